@@ -107,6 +107,22 @@ EOS
   end
 end
 
+# Test for compression libraries (used for dynamic response compression).
+unless ENV['NO_COMPRESSION']
+  if have_header('zlib.h') && have_library('z', 'deflate')
+    $defs << "-DHAVE_ZLIB"
+    puts "detected zlib, enabling gzip response compression."
+  end
+  if have_header('brotli/encode.h') && have_library('brotlienc', 'BrotliEncoderCompress')
+    $defs << "-DHAVE_BROTLI"
+    puts "detected brotli, enabling br response compression."
+  end
+  if have_header('zstd.h') && have_library('zstd', 'ZSTD_compressStream2')
+    $defs << "-DHAVE_ZSTD"
+    puts "detected zstd, enabling zstd response compression."
+  end
+end
+
 # Feature detection for blocking operation support (Ruby 4.0+)
 has_blocking_op_extract = have_func("rb_fiber_scheduler_blocking_operation_extract")
 
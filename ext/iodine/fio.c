@@ -3521,9 +3521,23 @@ static inline void fio_sock_packet_rotate_unsafe(uintptr_t fd) {
 }
 
 static int fio_sock_write_buffer(int fd, fio_packet_s *packet) {
-  int written = fd_data(fd).rw_hooks->write(
+  int written;
+#ifdef MSG_MORE
+  /* When more data is already queued (i.e., a file following an HTTP header
+   * packet), hint the kernel so the packets share TCP segments. */
+  if (packet->next && fd_data(fd).rw_hooks == &FIO_DEFAULT_RW_HOOKS) {
+    written = send(fd, ((uint8_t *)packet->data.buffer + packet->offset),
+                   packet->length, MSG_MORE);
+    if (written >= 0 || errno != ENOTSOCK)
+      goto after_write;
+  }
+#endif
+  written = fd_data(fd).rw_hooks->write(
       fd2uuid(fd), fd_data(fd).rw_udata,
       ((uint8_t *)packet->data.buffer + packet->offset), packet->length);
+#ifdef MSG_MORE
+after_write:
+#endif
   if (written > 0) {
     packet->length -= written;
     packet->offset += written;
@@ -3722,6 +3736,93 @@ retry_int:
   return -1;
 }
 
+#ifndef FIO_SPLICE_PIPE_SIZE
+/* the (requested) pipe capacity, limiting the data moved by `fio_read2fd` */
+#define FIO_SPLICE_PIPE_SIZE (1 << 20)
+#endif
+
+#if defined(__linux__) && defined(SPLICE_F_MOVE)
+/* each thread keeps a pipe for `splice`, it's always empty between calls */
+static __thread int fio_splice_pipe[2] = {-1, -1};
+
+static int fio_splice_pipe_open(void) {
+  if (fio_splice_pipe[0] != -1)
+    return 0;
+  if (pipe2(fio_splice_pipe, O_CLOEXEC | O_NONBLOCK))
+    return -1;
+#ifdef F_SETPIPE_SZ
+  fcntl(fio_splice_pipe[1], F_SETPIPE_SZ, FIO_SPLICE_PIPE_SIZE);
+#endif
+  return 0;
+}
+
+static void fio_splice_pipe_close(void) {
+  close(fio_splice_pipe[0]);
+  close(fio_splice_pipe[1]);
+  fio_splice_pipe[0] = fio_splice_pipe[1] = -1;
+}
+
+/**
+ * Reads up to `count` bytes from the socket directly into the file descriptor
+ * `fd` (at `offset`), without copying the data to user space.
+ */
+ssize_t fio_read2fd(intptr_t uuid, int fd, off_t offset, size_t count) {
+  if (!uuid_is_valid(uuid) || !uuid_data(uuid).open) {
+    errno = EBADF;
+    return -1;
+  }
+  if (count == 0)
+    return 0;
+  fio_lock(&uuid_data(uuid).sock_lock);
+  uint8_t raw = uuid_data(uuid).rw_hooks == &FIO_DEFAULT_RW_HOOKS;
+  fio_unlock(&uuid_data(uuid).sock_lock);
+  if (!raw || fio_splice_pipe_open()) {
+    errno = ENOTSUP;
+    return -1;
+  }
+  int old_errno = errno;
+  ssize_t ret;
+retry_int:
+  ret = splice(fio_uuid2fd(uuid), NULL, fio_splice_pipe[1], NULL, count,
+               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if (ret < 0 && errno == EINTR)
+    goto retry_int;
+  if (ret < 0 &&
+      (errno == EWOULDBLOCK || errno == EAGAIN || errno == ENOTCONN)) {
+    errno = old_errno;
+    return 0;
+  }
+  if (ret <= 0)
+    goto closed;
+  for (ssize_t left = ret; left;) {
+    ssize_t w = splice(fio_splice_pipe[0], NULL, fd, &offset, (size_t)left,
+                       SPLICE_F_MOVE);
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w <= 0) {
+      /* the data in the pipe is lost, replace the pipe */
+      fio_splice_pipe_close();
+      goto closed;
+    }
+    left -= w;
+  }
+  fio_touch(uuid);
+  return ret;
+closed:
+  fio_force_close(uuid);
+  return -1;
+}
+#else
+ssize_t fio_read2fd(intptr_t uuid, int fd, off_t offset, size_t count) {
+  errno = ENOTSUP;
+  return -1;
+  (void)uuid;
+  (void)fd;
+  (void)offset;
+  (void)count;
+}
+#endif
+
 /**
  * `fio_write2_fn` is the actual function behind the macro `fio_write2`.
  */
@@ -3801,6 +3902,22 @@ size_t fio_pending(intptr_t uuid) {
   return uuid_data(uuid).packet_count;
 }
 
+/**
+ * Returns the number of bytes that are waiting in the socket's queue and
+ * haven't been sent yet.
+ */
+size_t fio_pending_bytes(intptr_t uuid) {
+  if (!uuid_is_valid(uuid))
+    return 0;
+  size_t bytes = 0;
+  fio_lock(&uuid_data(uuid).sock_lock);
+  for (fio_packet_s *packet = uuid_data(uuid).packet; packet;
+       packet = packet->next)
+    bytes += packet->length;
+  fio_unlock(&uuid_data(uuid).sock_lock);
+  return bytes;
+}
+
 /**
  * `fio_close` marks the connection for disconnection once all the data was
  * sent. The actual disconnection will be managed by the `fio_flush` function.
@@ -6347,6 +6464,198 @@ static struct {
     .meta.lock = FIO_LOCK_INIT,
 };
 
+/* *****************************************************************************
+Pattern Index (a trie of the patterns' literal prefixes)
+***************************************************************************** */
+
+/*
+ * Glob patterns are indexed by their literal prefix (the bytes before the first
+ * `*`, `?`, `[` or `\`), so a publication only evaluates the patterns whose
+ * prefix matches the channel's name.
+ *
+ * The index is protected by the `fio_postoffice.patterns` lock. It doesn't own
+ * the channels, which are removed from the index when they leave the
+ * collection.
+ */
+
+static int fio_glob_match(fio_str_info_s pat, fio_str_info_s ch);
+
+#define FIO_FORCE_MALLOC_TMP 1
+#define FIO_ARY_NAME fio_ch_ary
+#define FIO_ARY_TYPE channel_s *
+#include <fio.h>
+
+typedef struct fio_pattern_node_s fio_pattern_node_s;
+struct fio_pattern_node_s {
+  /* child nodes, sorted by their key */
+  fio_pattern_node_s **children;
+  size_t count;
+  size_t capa;
+  /* `prefix*` patterns, matching any longer channel name */
+  fio_ch_ary_s prefix;
+  /* patterns that require the glob matcher for the rest of the name */
+  fio_ch_ary_s glob;
+  uint8_t key;
+};
+
+static struct {
+  fio_pattern_node_s root;
+  /* patterns using a custom `match` function (tested for every message) */
+  fio_ch_ary_s custom;
+} fio_pattern_index;
+
+/** Returns the length of the pattern's literal prefix. */
+static inline size_t fio_pattern_prefix_len(channel_s *ch) {
+  size_t i = 0;
+  while (i < ch->name_len && ch->name[i] != '*' && ch->name[i] != '?' &&
+         ch->name[i] != '[' && ch->name[i] != '\\')
+    ++i;
+  return i;
+}
+
+/** Returns true if the node holds any patterns. */
+static inline int fio_pattern_node_any(fio_pattern_node_s *node) {
+  return fio_ch_ary_count(&node->prefix) || fio_ch_ary_count(&node->glob);
+}
+
+/** Finds the child's position (or the position it should be inserted at). */
+static inline size_t fio_pattern_child_pos(fio_pattern_node_s *node,
+                                           uint8_t key) {
+  size_t lo = 0, hi = node->count;
+  while (lo < hi) {
+    size_t mid = (lo + hi) >> 1;
+    if (node->children[mid]->key < key)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/** Finds a child node (or NULL). */
+static inline fio_pattern_node_s *fio_pattern_child(fio_pattern_node_s *node,
+                                                    uint8_t key) {
+  size_t pos = fio_pattern_child_pos(node, key);
+  if (pos < node->count && node->children[pos]->key == key)
+    return node->children[pos];
+  return NULL;
+}
+
+/** Finds or creates a child node. */
+static fio_pattern_node_s *fio_pattern_child_add(fio_pattern_node_s *node,
+                                                 uint8_t key) {
+  size_t pos = fio_pattern_child_pos(node, key);
+  if (pos < node->count && node->children[pos]->key == key)
+    return node->children[pos];
+  if (node->count == node->capa) {
+    node->capa = node->capa ? (node->capa << 1) : 2;
+    node->children =
+        realloc(node->children, node->capa * sizeof(*node->children));
+    FIO_ASSERT_ALLOC(node->children);
+  }
+  fio_pattern_node_s *child = malloc(sizeof(*child));
+  FIO_ASSERT_ALLOC(child);
+  *child = (fio_pattern_node_s){.key = key};
+  memmove(node->children + pos + 1, node->children + pos,
+          (node->count - pos) * sizeof(*node->children));
+  node->children[pos] = child;
+  ++node->count;
+  return child;
+}
+
+/** Frees a node and its children. */
+static void fio_pattern_node_free(fio_pattern_node_s *node) {
+  for (size_t i = 0; i < node->count; ++i)
+    fio_pattern_node_free(node->children[i]);
+  free(node->children);
+  fio_ch_ary_free(&node->prefix);
+  fio_ch_ary_free(&node->glob);
+  if (node != &fio_pattern_index.root)
+    free(node);
+  else
+    *node = (fio_pattern_node_s){.key = 0};
+}
+
+/** Adds a pattern channel to the index. Call within the collection's lock. */
+static void fio_pattern_index_add(channel_s *ch) {
+  if (ch->match != fio_glob_match) {
+    fio_ch_ary_push(&fio_pattern_index.custom, ch);
+    return;
+  }
+  size_t len = fio_pattern_prefix_len(ch);
+  fio_pattern_node_s *node = &fio_pattern_index.root;
+  for (size_t i = 0; i < len; ++i)
+    node = fio_pattern_child_add(node, (uint8_t)ch->name[i]);
+  if (len + 1 == ch->name_len && ch->name[len] == '*')
+    fio_ch_ary_push(&node->prefix, ch);
+  else
+    fio_ch_ary_push(&node->glob, ch);
+}
+
+/** Removes a pattern channel from the index. Call within the collection's lock. */
+static void fio_pattern_index_remove(channel_s *ch) {
+  if (ch->match != fio_glob_match) {
+    fio_ch_ary_remove2(&fio_pattern_index.custom, ch, NULL);
+    return;
+  }
+  size_t len = fio_pattern_prefix_len(ch);
+  fio_pattern_node_s *node = &fio_pattern_index.root;
+  /* the branch that becomes empty once the pattern is removed (if any) */
+  fio_pattern_node_s *cut = NULL, *cut_parent = NULL;
+  for (size_t i = 0; i < len; ++i) {
+    fio_pattern_node_s *child = fio_pattern_child(node, (uint8_t)ch->name[i]);
+    if (!child)
+      return;
+    if (!cut || node->count > 1 || fio_pattern_node_any(node)) {
+      cut_parent = node;
+      cut = child;
+    }
+    node = child;
+  }
+  if (fio_ch_ary_remove2(&node->prefix, ch, NULL) &&
+      fio_ch_ary_remove2(&node->glob, ch, NULL))
+    return;
+  if (!cut || node->count || fio_pattern_node_any(node))
+    return;
+  size_t pos = fio_pattern_child_pos(cut_parent, cut->key);
+  memmove(cut_parent->children + pos, cut_parent->children + pos + 1,
+          (cut_parent->count - pos - 1) * sizeof(*cut_parent->children));
+  --cut_parent->count;
+  fio_pattern_node_free(cut);
+}
+
+/**
+ * Calls `task` for every pattern matching the channel's name. Call within the
+ * collection's lock.
+ */
+static void fio_pattern_index_each(fio_str_info_s name,
+                                   void (*task)(channel_s *, void *),
+                                   void *arg) {
+  FIO_ARY_FOR(&fio_pattern_index.custom, pos) {
+    if ((*pos)->match(
+            (fio_str_info_s){.data = (*pos)->name, .len = (*pos)->name_len},
+            name))
+      task(*pos, arg);
+  }
+  fio_pattern_node_s *node = &fio_pattern_index.root;
+  for (size_t i = 0;; ++i) {
+    /* `prefix*` never matches the prefix itself */
+    if (i < name.len) {
+      FIO_ARY_FOR(&node->prefix, pos) { task(*pos, arg); }
+    }
+    /* the prefix was matched, test the rest of the pattern */
+    FIO_ARY_FOR(&node->glob, pos) {
+      if (fio_glob_match((fio_str_info_s){.data = (*pos)->name + i,
+                                          .len = (*pos)->name_len - i},
+                         (fio_str_info_s){.data = name.data + i,
+                                          .len = name.len - i}))
+        task(*pos, arg);
+    }
+    if (i == name.len || !(node = fio_pattern_child(node, (uint8_t)name.data[i])))
+      return;
+  }
+}
+
 /** used to contain the message before it's passed to the handler */
 typedef struct {
   fio_msg_s msg;
@@ -6574,6 +6883,9 @@ static channel_s *fio_channel_match_dup_lock(fio_str_info_s name,
   channel_s *ch_p =
       fio_filter_dup_lock_internal(&ch, hashed_name, &fio_postoffice.patterns);
   if (fio_ls_embd_is_empty(&ch_p->subscriptions)) {
+    fio_lock(&fio_postoffice.patterns.lock);
+    fio_pattern_index_add(ch_p);
+    fio_unlock(&fio_postoffice.patterns.lock);
     fio_pubsub_on_channel_create(ch_p);
   }
   return ch_p;
@@ -6648,6 +6960,8 @@ void fio_unsubscribe(subscription_s *s) {
     if (fio_ls_embd_is_empty(&ch->subscriptions)) {
       fio_ch_set_remove(&c->channels, hashed, ch, NULL);
       removed = (c != &fio_postoffice.filters);
+      if (c == &fio_postoffice.patterns)
+        fio_pattern_index_remove(ch);
     }
     fio_unlock(&c->lock);
   }
@@ -6857,14 +7171,16 @@ void fio_message_defer(fio_msg_s *msg_) {
   cl->marker = 1;
 }
 
-/* performs the actual callback */
-static void fio_perform_subscription_callback(void *s_, void *msg_) {
-  subscription_s *s = s_;
-  if (fio_trylock(&s->lock)) {
-    fio_defer_push_task(fio_perform_subscription_callback, s_, msg_);
-    return;
-  }
-  fio_msg_internal_s *msg = (fio_msg_internal_s *)msg_;
+/**
+ * Performs the actual callback.
+ *
+ * Returns -1 if the callback should be performed again later (the subscription
+ * was busy or the message was deferred).
+ */
+static int fio_subscription_perform(subscription_s *s,
+                                    fio_msg_internal_s *msg) {
+  if (fio_trylock(&s->lock))
+    return -1;
   fio_msg_client_s m = {
       .msg =
           {
@@ -6883,7 +7199,14 @@ static void fio_perform_subscription_callback(void *s_, void *msg_) {
     s->on_message(&m.msg);
   }
   fio_unlock(&s->lock);
-  if (m.marker) {
+  return (m.marker ? -1 : 0);
+}
+
+/* performs the callback for a single subscription (retried until done) */
+static void fio_perform_subscription_callback(void *s_, void *msg_) {
+  subscription_s *s = s_;
+  fio_msg_internal_s *msg = (fio_msg_internal_s *)msg_;
+  if (fio_subscription_perform(s, msg)) {
     fio_defer_push_task(fio_perform_subscription_callback, s_, msg_);
     return;
   }
@@ -6891,17 +7214,61 @@ static void fio_perform_subscription_callback(void *s_, void *msg_) {
   fio_subscription_free(s);
 }
 
+#ifndef FIO_PUBSUB_BATCH
+/* the number of subscriptions handled by each fan-out task */
+#define FIO_PUBSUB_BATCH 64
+#endif
+
+/* a fan-out task's subscriptions (each holding a reference) */
+typedef struct {
+  fio_msg_internal_s *msg;
+  size_t count;
+  subscription_s *subs[FIO_PUBSUB_BATCH];
+} fio_subscription_batch_s;
+
+/* performs the callbacks for a batch of subscriptions */
+static void fio_perform_subscription_batch(void *batch_, void *ignr_) {
+  fio_subscription_batch_s *b = batch_;
+  for (size_t i = 0; i < b->count; ++i) {
+    if (fio_subscription_perform(b->subs[i], b->msg)) {
+      /* retry on its own, the task takes over the subscription's reference */
+      fio_atomic_add(&b->msg->ref, 1);
+      fio_defer_push_task(fio_perform_subscription_callback, b->subs[i],
+                          b->msg);
+      continue;
+    }
+    fio_subscription_free(b->subs[i]);
+  }
+  fio_msg_internal_free(b->msg);
+  fio_free(b);
+  (void)ignr_;
+}
+
 /** UNSAFE! publishes a message to a channel, managing the reference counts */
 static void fio_publish2channel(channel_s *ch, fio_msg_internal_s *msg) {
+  /* subscriptions are handled in batches, limiting the number of tasks */
+  fio_subscription_batch_s *b = NULL;
   FIO_LS_EMBD_FOR(&ch->subscriptions, pos) {
     subscription_s *s = FIO_LS_EMBD_OBJ(subscription_s, node, pos);
     if (!s || s->on_message == fio_mock_on_message) {
       continue;
     }
+    if (!b) {
+      b = fio_malloc(sizeof(*b));
+      FIO_ASSERT_ALLOC(b);
+      b->msg = msg;
+      b->count = 0;
+      fio_atomic_add(&msg->ref, 1);
+    }
     fio_atomic_add(&s->ref, 1);
-    fio_atomic_add(&msg->ref, 1);
-    fio_defer_push_task(fio_perform_subscription_callback, s, msg);
+    b->subs[b->count++] = s;
+    if (b->count == FIO_PUBSUB_BATCH) {
+      fio_defer_push_task(fio_perform_subscription_batch, b, NULL);
+      b = NULL;
+    }
   }
+  if (b)
+    fio_defer_push_task(fio_perform_subscription_batch, b, NULL);
   fio_msg_internal_free(msg);
 }
 static void fio_publish2channel_task(void *ch_, void *msg) {
@@ -6920,6 +7287,13 @@ finish:
   fio_channel_free(ch);
 }
 
+/** Schedules the message for a matching pattern channel. */
+static void fio_publish2pattern(channel_s *ch, void *m) {
+  fio_channel_dup(ch);
+  fio_defer_push_urgent(fio_publish2channel_task, ch,
+                        fio_msg_internal_dup((fio_msg_internal_s *)m));
+}
+
 /** Publishes the message to the current process and frees the strings. */
 static void fio_publish2process(fio_msg_internal_s *m) {
   fio_msg_internal_finalize(m);
@@ -6938,21 +7312,9 @@ static void fio_publish2process(fio_msg_internal_s *m) {
                           fio_msg_internal_dup(m));
   }
   if (m->filter == 0) {
-    /* pattern matching match */
+    /* pattern matching match (only candidate patterns are tested) */
     fio_lock(&fio_postoffice.patterns.lock);
-    FIO_SET_FOR_LOOP(&fio_postoffice.patterns.channels, p) {
-      if (!p->hash) {
-        continue;
-      }
-
-      if (p->obj->match(
-              (fio_str_info_s){.data = p->obj->name, .len = p->obj->name_len},
-              m->channel)) {
-        fio_channel_dup(p->obj);
-        fio_defer_push_urgent(fio_publish2channel_task, p->obj,
-                              fio_msg_internal_dup(m));
-      }
-    }
+    fio_pattern_index_each(m->channel, fio_publish2pattern, m);
     fio_unlock(&fio_postoffice.patterns.lock);
   }
 finish:
@@ -7591,6 +7953,8 @@ static void fio_cluster_at_exit(void *ignore) {
   }
   fio_ch_set_free(&fio_postoffice.filters.channels);
   fio_ch_set_free(&fio_postoffice.patterns.channels);
+  fio_pattern_node_free(&fio_pattern_index.root);
+  fio_ch_ary_free(&fio_pattern_index.custom);
   fio_ch_set_free(&fio_postoffice.pubsub.channels);
 
   /* clear engines */
@@ -1192,6 +1192,20 @@ ssize_t fio_read(intptr_t uuid, void *buffer, size_t count);
  */
 ssize_t fio_read_unsafe(intptr_t uuid, void *buffer, size_t count);
 
+/**
+ * Reads up to `count` bytes from the socket directly into the file descriptor
+ * `fd`, writing at `offset`, without copying the data to user space (on Linux,
+ * using `splice` through a pipe).
+ *
+ * Returns the same values as `fio_read` (the connection is closed on errors,
+ * including file errors).
+ *
+ * If the connection uses read/write hooks (i.e., TLS) or the platform doesn't
+ * support this, -1 is returned with `errno` set to `ENOTSUP` and the connection
+ * is left untouched (use `fio_read` instead).
+ */
+ssize_t fio_read2fd(intptr_t uuid, int fd, off_t offset, size_t count);
+
 /** The following structure is used for `fio_write2_fn` function arguments. */
 typedef struct {
   union {
@@ -1315,6 +1329,15 @@ inline FIO_FUNC ssize_t fio_sendfile(intptr_t uuid, intptr_t source_fd,
  */
 size_t fio_pending(intptr_t uuid);
 
+/**
+ * Returns the number of bytes that are waiting in the socket's queue and
+ * haven't been sent yet.
+ *
+ * Unlike `fio_pending`, this reflects the actual amount of buffered data and
+ * can be used for byte based backpressure.
+ */
+size_t fio_pending_bytes(intptr_t uuid);
+
 /**
  * `fio_flush` attempts to write any remaining data in the internal buffer to
  * the underlying file descriptor and closes the underlying file descriptor once
@@ -8,7 +8,11 @@ Feel free to copy, use and enjoy according to the license provided.
 #include <fio.h>
 
 #include <http1.h>
+#include <http_compress.h>
+#include <http_file_cache.h>
 #include <http_internal.h>
+#include <http_log.h>
+#include <http_multipart.h>
 
 #include <ctype.h>
 #include <fcntl.h>
@@ -21,6 +25,8 @@ Feel free to copy, use and enjoy according to the license provided.
 #include <pthread.h>
 #include <ruby/io.h>
 
+#include "iodine_caller.h"
+
 #ifndef HAVE_TM_TM_ZONE
 #if defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__) ||     \
     defined(__DragonFly__) || defined(__bsdi__) || defined(__ultrix) ||        \
@@ -62,11 +68,7 @@ fio_tls_alpn_add(void *tls, const char *protocol_name,
 #pragma weak fio_tls_alpn_add
 #endif
 
-static VALUE cTempfile;
-static VALUE tempfile_args;
 static VALUE cUploadedFile;
-static ID create_id;
-static ID path_id;
 static rb_encoding *IodineBinaryEncoding;
 
 /* *****************************************************************************
@@ -351,6 +353,19 @@ int http_set_cookie(http_s *h, http_cookie_args_s cookie) {
  *
  * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
  */
+static FIOBJ http_compress_response(http_s *r, void *data, uintptr_t length);
+static http_compress_e http_compress_negotiate(http_s *r, uintptr_t length);
+static void http_compress_set_headers(http_s *r, http_compress_e coding);
+
+/* sends the body as is (never compressed), see `http_send_body` */
+static int http_send_body_identity(http_s *r, void *data, uintptr_t length) {
+  add_content_length(r, length);
+  // add_content_type(r);
+  add_date(r);
+  return ((http_vtable_s *)r->private_data.vtbl)
+      ->http_send_body(r, data, length);
+}
+
 int http_send_body(http_s *r, void *data, uintptr_t length) {
   if (HTTP_INVALID_HANDLE(r))
     return -1;
@@ -358,11 +373,87 @@ int http_send_body(http_s *r, void *data, uintptr_t length) {
     http_finish(r);
     return 0;
   }
+  FIOBJ compressed = http_compress_response(r, data, length);
+  if (compressed) {
+    fio_str_info_s c = fiobj_obj2cstr(compressed);
+    add_content_length(r, c.len);
+    add_date(r);
+    int ret = ((http_vtable_s *)r->private_data.vtbl)
+                  ->http_send_body(r, c.data, c.len);
+    fiobj_free(compressed);
+    return ret;
+  }
+  return http_send_body_identity(r, data, length);
+}
+/**
+ * Sends the response headers and body without copying the body.
+ *
+ * `data` must remain valid until `dealloc(owner)` is called (once the body was
+ * sent, or on error). The body is copied when it's compressed.
+ *
+ * Returns -1 on error and 0 on success.
+ *
+ * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
+ */
+int http_send_body_nocopy(http_s *r, void *owner, void *data, uintptr_t length,
+                          void (*dealloc)(void *)) {
+  int ret = -1;
+  if (HTTP_INVALID_HANDLE(r))
+    goto finish;
+  http_vtable_s *vtbl = (http_vtable_s *)r->private_data.vtbl;
+  if (!length || !data || !vtbl->http_send_body_nocopy)
+    goto copy;
+  FIOBJ compressed = http_compress_response(r, data, length);
+  if (compressed) {
+    fio_str_info_s c = fiobj_obj2cstr(compressed);
+    add_content_length(r, c.len);
+    add_date(r);
+    ret = vtbl->http_send_body(r, c.data, c.len);
+    fiobj_free(compressed);
+    goto finish;
+  }
   add_content_length(r, length);
-  // add_content_type(r);
   add_date(r);
-  return ((http_vtable_s *)r->private_data.vtbl)
-      ->http_send_body(r, data, length);
+  return vtbl->http_send_body_nocopy(r, owner, data, length, dealloc);
+copy:
+  ret = http_send_body(r, data, length);
+finish:
+  dealloc(owner);
+  return ret;
+}
+
+/**
+ * Sends the response headers (on the first call) and a part of the response's
+ * body.
+ *
+ * Returns -1 on error and 0 on success.
+ *
+ * `http_finish` MUST be called to complete the response.
+ */
+int http_stream(http_s *r, void *data, uintptr_t length) {
+  if (HTTP_INVALID_HANDLE(r))
+    return -1;
+  http_vtable_s *vtbl = (http_vtable_s *)r->private_data.vtbl;
+  if (!r->private_data.streaming) {
+    /* the first chunk decides whether the stream is compressed */
+    r->private_data.streaming = 1;
+    http_compress_e coding = http_compress_negotiate(r, length);
+    if (coding != HTTP_COMPRESS_NONE &&
+        (r->private_data.compressor = http_compress_stream_new(coding)))
+      http_compress_set_headers(r, coding);
+  }
+  add_date(r);
+  if (!r->private_data.compressor)
+    return vtbl->http_stream(r, data, length);
+  FIOBJ out = fiobj_str_buf((length >> 1) + 64);
+  int ret = -1;
+  if (!http_compress_stream_write(r->private_data.compressor, out, data,
+                                  length, 0)) {
+    fio_str_info_s o = fiobj_obj2cstr(out);
+    ret = vtbl->http_stream(r, o.data, o.len);
+  }
+  fiobj_free(out);
+  return ret;
 }
 /**
  * Sends the response headers and the specified file (the response's body).
@@ -397,6 +488,223 @@ static inline int http_test_encoded_path(const char *mem, size_t len) {
   return 0;
 }
 
+/* pre-compressed static file variants (see `static_encodings`) */
+static const struct {
+  const char *name;
+  size_t name_len;
+  const char *ext;
+  size_t ext_len;
+  FIOBJ *value;
+} http_static_encodings[] = {
+    {.name = "br", .name_len = 2, .ext = ".br", .ext_len = 3,
+     .value = &HTTP_HVALUE_BROTLI},
+    {.name = "zstd", .name_len = 4, .ext = ".zst", .ext_len = 4,
+     .value = &HTTP_HVALUE_ZSTD},
+    {.name = "gzip", .name_len = 4, .ext = ".gz", .ext_len = 3,
+     .value = &HTTP_HVALUE_GZIP},
+};
+#define HTTP_STATIC_ENCODINGS_COUNT                                           \
+  (sizeof(http_static_encodings) / sizeof(http_static_encodings[0]))
+
+/** Returns the index of the named encoding, or -1. */
+static inline int http_static_encoding_find(const char *name, size_t len) {
+  for (size_t i = 0; i < HTTP_STATIC_ENCODINGS_COUNT; ++i) {
+    if (http_static_encodings[i].name_len == len &&
+        !strncasecmp(http_static_encodings[i].name, name, len))
+      return (int)i;
+  }
+  return -1;
+}
+
+/** Returns the index of the encoding matching the path's extension, or -1. */
+static inline int http_static_encoding_find_ext(fio_str_info_s path) {
+  for (size_t i = 0; i < HTTP_STATIC_ENCODINGS_COUNT; ++i) {
+    const size_t len = http_static_encodings[i].ext_len;
+    if (path.len > len &&
+        !memcmp(path.data + path.len - len, http_static_encodings[i].ext, len))
+      return (int)i;
+  }
+  return -1;
+}
+
+/**
+ * Returns the q-value (in thousandths) the `Accept-Encoding` header assigns to
+ * the content coding, falling back to the wildcard (`*`) value if `wildcard`
+ * is set.
+ *
+ * Returns -1 if the coding isn't mentioned.
+ */
+static int http_accept_encoding_q(fio_str_info_s accept, const char *coding,
+                                  size_t len, uint8_t wildcard) {
+  int found = -1, any = -1;
+  char *pos = accept.data;
+  char *end = accept.data + accept.len;
+  while (pos < end) {
+    while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == ','))
+      ++pos;
+    char *name = pos;
+    while (pos < end && *pos != ',' && *pos != ';' && *pos != ' ' &&
+           *pos != '\t')
+      ++pos;
+    size_t name_len = pos - name;
+    int q = 1000;
+    /* parameters (we only care about `q`) */
+    while (pos < end && *pos != ',') {
+      if (*pos != ';') {
+        ++pos;
+        continue;
+      }
+      ++pos;
+      while (pos < end && (*pos == ' ' || *pos == '\t'))
+        ++pos;
+      if (end - pos < 3 || (pos[0] | 32) != 'q' || pos[1] != '=')
+        continue;
+      pos += 2;
+      q = (*pos == '1') ? 1000 : 0;
+      ++pos;
+      if (!q && pos < end && *pos == '.') {
+        ++pos;
+        for (int mul = 100; mul && pos < end && *pos >= '0' && *pos <= '9';
+             mul /= 10)
+          q += (*(pos++) - '0') * mul;
+      }
+    }
+    if (name_len == len && !strncasecmp(name, coding, len))
+      found = q;
+    else if (wildcard && name_len == 1 && *name == '*')
+      any = q;
+  }
+  return (found >= 0) ? found : any;
+}
+
+/* *****************************************************************************
+Dynamic response compression
+***************************************************************************** */
+
+/** Adds `accept-encoding` to the response's Vary header. */
+static void http_add_vary_accept_encoding(http_s *r) {
+  FIOBJ vary = fiobj_hash_get2(r->private_data.out_headers,
+                               fiobj_obj2hash(HTTP_HEADER_VARY));
+  if (!vary) {
+    fiobj_hash_set(r->private_data.out_headers, HTTP_HEADER_VARY,
+                   fiobj_dup(HTTP_HVALUE_ACCEPT_ENCODING));
+    return;
+  }
+  if (!FIOBJ_TYPE_IS(vary, FIOBJ_T_STRING))
+    return;
+  fio_str_info_s v = fiobj_obj2cstr(vary);
+  if (memchr(v.data, '*', v.len) || strcasestr(v.data, "accept-encoding"))
+    return;
+  FIOBJ tmp = fiobj_str_buf(v.len + 17);
+  fiobj_str_write(tmp, v.data, v.len);
+  fiobj_str_write(tmp, ", accept-encoding", 17);
+  fiobj_hash_set(r->private_data.out_headers, HTTP_HEADER_VARY, tmp);
+}
+
+/** Returns a response header's String value (or an empty string). */
+static inline fio_str_info_s http_response_header_str(http_s *r, FIOBJ name) {
+  FIOBJ tmp =
+      fiobj_hash_get2(r->private_data.out_headers, fiobj_obj2hash(name));
+  if (!tmp || !FIOBJ_TYPE_IS(tmp, FIOBJ_T_STRING))
+    return (fio_str_info_s){.data = NULL};
+  return fiobj_obj2cstr(tmp);
+}
+
+/**
+ * Picks the content coding for a response body (or the first streamed chunk)
+ * when the settings (`compress_min_size`, `compress_types`), the response
+ * headers and the request's `Accept-Encoding` allow it.
+ *
+ * Adds the Vary header once the response depends on `Accept-Encoding`.
+ */
+static http_compress_e http_compress_negotiate(http_s *r, uintptr_t length) {
+  static uint64_t accept_enc_hash = 0;
+  if (!accept_enc_hash)
+    accept_enc_hash = fiobj_hash_string("accept-encoding", 15);
+  static const http_compress_e codings[] = {
+      HTTP_COMPRESS_ZSTD, HTTP_COMPRESS_BROTLI, HTTP_COMPRESS_GZIP};
+  http_settings_s *settings = http2protocol(r)->settings;
+  if (!settings->compress_min_size || length < settings->compress_min_size ||
+      r->status < 200 || r->status >= 300 || r->status == 204 ||
+      r->status == 206)
+    return HTTP_COMPRESS_NONE;
+  if (fiobj_hash_get2(r->private_data.out_headers,
+                      fiobj_obj2hash(HTTP_HEADER_CONTENT_ENCODING)) ||
+      fiobj_hash_get2(r->private_data.out_headers,
+                      fiobj_obj2hash(HTTP_HEADER_CONTENT_RANGE)) ||
+      !http_compress_is_compressible(
+          settings->compress_types,
+          http_response_header_str(r, HTTP_HEADER_CONTENT_TYPE)))
+    return HTTP_COMPRESS_NONE;
+  {
+    fio_str_info_s cc = http_response_header_str(r, HTTP_HEADER_CACHE_CONTROL);
+    if (cc.data && strcasestr(cc.data, "no-transform"))
+      return HTTP_COMPRESS_NONE;
+  }
+  /* from here on, the response depends on the request's Accept-Encoding */
+  http_add_vary_accept_encoding(r);
+
+  FIOBJ tmp = fiobj_hash_get2(r->headers, accept_enc_hash);
+  if (!tmp)
+    return HTTP_COMPRESS_NONE;
+  if (FIOBJ_TYPE_IS(tmp, FIOBJ_T_ARRAY))
+    tmp = fiobj_ary_index(tmp, 0);
+  fio_str_info_s ac_str = fiobj_obj2cstr(tmp);
+  if (!ac_str.data)
+    return HTTP_COMPRESS_NONE;
+  http_compress_e coding = HTTP_COMPRESS_NONE;
+  int best_q = http_accept_encoding_q(ac_str, "identity", 8, 0);
+  if (best_q < 0)
+    best_q = 0;
+  for (size_t i = 0; i < sizeof(codings) / sizeof(codings[0]); ++i) {
+    if (!http_compress_is_available(codings[i]))
+      continue;
+    fio_str_info_s name = http_compress_name(codings[i]);
+    int q = http_accept_encoding_q(ac_str, name.data, name.len, 1);
+    if (q <= best_q)
+      continue;
+    best_q = q;
+    coding = codings[i];
+  }
+  return coding;
+}
+
+/** Updates the response headers for the (compressed) content coding. */
+static void http_compress_set_headers(http_s *r, http_compress_e coding) {
+  {
+    fio_str_info_s name = http_compress_name(coding);
+    fiobj_hash_set(r->private_data.out_headers, HTTP_HEADER_CONTENT_ENCODING,
+                   fiobj_str_new(name.data, name.len));
+  }
+  fiobj_hash_delete2(r->private_data.out_headers,
+                     fiobj_obj2hash(HTTP_HEADER_CONTENT_LENGTH));
+  {
+    /* a strong ETag doesn't describe the encoded representation */
+    fio_str_info_s etag = http_response_header_str(r, HTTP_HEADER_ETAG);
+    if (etag.data && etag.data[0] == '"') {
+      FIOBJ weak = fiobj_str_buf(etag.len + 2);
+      fiobj_str_write(weak, "W/", 2);
+      fiobj_str_write(weak, etag.data, etag.len);
+      fiobj_hash_set(r->private_data.out_headers, HTTP_HEADER_ETAG, weak);
+    }
+  }
+}
+
+/**
+ * Compresses a response body when `http_compress_negotiate` allows it.
+ *
+ * Returns the compressed body (after updating the headers) or FIOBJ_INVALID.
+ */
+static FIOBJ http_compress_response(http_s *r, void *data, uintptr_t length) {
+  http_compress_e coding = http_compress_negotiate(r, length);
+  if (coding == HTTP_COMPRESS_NONE)
+    return FIOBJ_INVALID;
+  FIOBJ body = http_compress(coding, data, length);
+  if (body)
+    http_compress_set_headers(r, coding);
+  return body;
+}
+
 /**
  * Sends the response headers and the specified file (the response's body).
  *
@@ -408,7 +716,6 @@ int http_sendfile2(http_s *h, const char *prefix, size_t prefix_len,
                    const char *encoded, size_t encoded_len) {
   if (HTTP_INVALID_HANDLE(h))
     return -1;
-  struct stat file_data = {.st_size = 0};
   static uint64_t accept_enc_hash = 0;
   if (!accept_enc_hash)
     accept_enc_hash = fiobj_hash_string("accept-encoding", 15);
@@ -450,55 +757,84 @@ int http_sendfile2(http_s *h, const char *prefix, size_t prefix_len,
     if (tmp.data[tmp.len - 1] == '/')
       fiobj_str_write(filename, "index.html", 10);
   }
-  /* test for file existance  */
+  /* test for file existance (cached, see http_file_cache.h) */
 
-  int file = -1;
-  uint8_t is_gz = 0;
+  http_file_s *file = NULL;
+  int fd = -1;
+  FIOBJ encoding = FIOBJ_INVALID;
+  uint8_t vary = 0;
 
   fio_str_info_s s = fiobj_obj2cstr(filename);
   {
+    const char *pref = http2protocol(h)->settings->static_encodings;
+    if (!pref || !*pref || http_static_encoding_find_ext(s) >= 0)
+      goto no_variant;
+    /* caches must key on Accept-Encoding even when the request has none */
+    vary = 1;
     FIOBJ tmp = fiobj_hash_get2(h->headers, accept_enc_hash);
     if (!tmp)
-      goto no_gzip_support;
+      goto no_variant;
+    if (FIOBJ_TYPE_IS(tmp, FIOBJ_T_ARRAY))
+      tmp = fiobj_ary_index(tmp, 0);
     fio_str_info_s ac_str = fiobj_obj2cstr(tmp);
-    if (!ac_str.data || !strstr(ac_str.data, "gzip"))
-      goto no_gzip_support;
-    if (s.data[s.len - 3] != '.' || s.data[s.len - 2] != 'g' ||
-        s.data[s.len - 1] != 'z') {
-      fiobj_str_write(filename, ".gz", 3);
-      s = fiobj_obj2cstr(filename);
-      if (!stat(s.data, &file_data) &&
-          (S_ISREG(file_data.st_mode) || S_ISLNK(file_data.st_mode))) {
-        is_gz = 1;
-        goto found_file;
-      }
-      fiobj_str_resize(filename, s.len - 3);
+    if (!ac_str.data)
+      goto no_variant;
+    /* the identity is used unless a variant is preferred by the client */
+    int best_q = http_accept_encoding_q(ac_str, "identity", 8, 0);
+    if (best_q < 0)
+      best_q = 0;
+    const size_t base_len = s.len;
+    while (*pref) {
+      const char *name = pref;
+      while (*pref && *pref != ',')
+        ++pref;
+      int i = http_static_encoding_find(name, pref - name);
+      while (*pref == ',' || *pref == ' ')
+        ++pref;
+      if (i < 0)
+        continue;
+      int q = http_accept_encoding_q(ac_str, http_static_encodings[i].name,
+                                     http_static_encodings[i].name_len, 1);
+      if (q <= best_q)
+        continue;
+      fiobj_str_resize(filename, base_len);
+      fiobj_str_write(filename, http_static_encodings[i].ext,
+                      http_static_encodings[i].ext_len);
+      http_file_s *variant = http_file_cache_get(filename);
+      if (!variant)
+        continue;
+      if (file)
+        http_file_cache_release(file);
+      file = variant;
+      best_q = q;
+      encoding = *http_static_encodings[i].value;
     }
+    fiobj_str_resize(filename, base_len);
+    s = fiobj_obj2cstr(filename);
   }
-no_gzip_support:
-  if (stat(s.data, &file_data) ||
-      !(S_ISREG(file_data.st_mode) || S_ISLNK(file_data.st_mode)))
+no_variant:
+  if (!file && !(file = http_file_cache_get(filename)))
     return -1;
-found_file:
+  if (vary)
+    http_set_header_if_none(h, HTTP_HEADER_VARY,
+                            fiobj_dup(HTTP_HVALUE_ACCEPT_ENCODING));
+  /* a pre-compressed variant's ETag has the encoding folded in */
+  FIOBJ etag = encoding ? file->encoded_etag : file->etag;
   /* set cache-control */
   http_set_header_if_none(h, HTTP_HEADER_CACHE_CONTROL, fiobj_dup(HTTP_HVALUE_MAX_AGE));
   /* set last-modified */
-  FIOBJ last_modified_str = fiobj_str_buf(32);
-  fiobj_str_resize(
-      last_modified_str, http_time2str(fiobj_obj2cstr(last_modified_str).data, file_data.st_mtime));
-  http_set_header_if_none(h, HTTP_HEADER_LAST_MODIFIED, last_modified_str);
+  http_set_header_if_none(h, HTTP_HEADER_LAST_MODIFIED,
+                          fiobj_dup(file->last_modified));
   /* set & test etag */
-  FIOBJ etag_str = fiobj_str_buf(1);
-  fiobj_str_printf(etag_str, "%lx-%llx", file_data.st_mtime, file_data.st_size);
-  /* set */
-  http_set_header(h, HTTP_HEADER_ETAG, etag_str);
+  http_set_header(h, HTTP_HEADER_ETAG, fiobj_dup(etag));
   /* test */
   {
     static uint64_t none_match_hash = 0;
     if (!none_match_hash)
       none_match_hash = fiobj_hash_string("if-none-match", 13);
     FIOBJ tmp2 = fiobj_hash_get2(h->headers, none_match_hash);
-    if (tmp2 && fiobj_iseq(tmp2, etag_str)) {
+    if (tmp2 && fiobj_iseq(tmp2, etag)) {
+      http_file_cache_release(file);
       h->status = 304;
       http_finish(h);
       return 0;
@@ -506,13 +842,14 @@ found_file:
   }
   /* handle range requests */
   int64_t offset = 0;
-  int64_t length = file_data.st_size;
+  int64_t length = file->size;
   {
     static uint64_t ifrange_hash = 0;
     if (!ifrange_hash)
       ifrange_hash = fiobj_hash_string("if-range", 8);
     FIOBJ tmp = fiobj_hash_get2(h->headers, ifrange_hash);
-    if (tmp && !(fiobj_iseq(tmp, etag_str) || fiobj_iseq(tmp, last_modified_str))) {
+    if (tmp && !(fiobj_iseq(tmp, etag) ||
+                 fiobj_iseq(tmp, file->last_modified))) {
       fiobj_hash_delete2(h->headers, range_hash);
     } else {
       tmp = fiobj_hash_get2(h->headers, range_hash);
@@ -543,7 +880,7 @@ found_file:
           if (0 - start_at >= length)
             goto invalid_range;
 
-          offset = file_data.st_size + start_at;
+          offset = file->size + start_at;
           length = 0 - start_at;
         } else {
           /* "Range bytes=100-": all bytes starting at `start_at` are requested */
@@ -560,7 +897,7 @@ found_file:
           fiobj_str_printf(cranges, "bytes %lu-%lu/%lu",
                            (unsigned long)start_at,
                            (unsigned long)(start_at + length - 1),
-                           (unsigned long)file_data.st_size);
+                           (unsigned long)file->size);
           http_set_header(h, HTTP_HEADER_CONTENT_RANGE, cranges);
         }
         http_set_header(h, HTTP_HEADER_ACCEPT_RANGES,
@@ -575,6 +912,7 @@ found_file:
     if (!strncasecmp("options", s.data, 7)) {
       http_set_header2(h, (fio_str_info_s){.data = (char *)"allow", .len = 5},
                        (fio_str_info_s){.data = (char *)"GET, HEAD", .len = 9});
+      http_file_cache_release(file);
       h->status = 200;
       http_finish(h);
       return 0;
@@ -586,6 +924,7 @@ found_file:
     break;
   case 4:
     if (!strncasecmp("head", s.data, 4)) {
+      http_file_cache_release(file);
       http_set_header(h, HTTP_HEADER_CONTENT_LENGTH, fiobj_num_new(length));
       http_finish(h);
       return 0;
@@ -593,46 +932,45 @@ found_file:
     goto open_file;
     break;
   }
+  http_file_cache_release(file);
   http_send_error(h, 403);
   return 0;
 open_file:
-  s = fiobj_obj2cstr(filename);
-  file = open(s.data, O_RDONLY);
-  if (file == -1) {
-    FIO_LOG_ERROR("(HTTP) couldn't open file %s!\n", s.data);
-    perror("     ");
-    http_send_error(h, 500);
-    return 0;
+  if (!file->data) {
+    /* the cached descriptor is shared, `http_sendfile` closes its own copy */
+    fd = dup(file->fd);
+    if (fd == -1) {
+      FIO_LOG_ERROR("(HTTP) couldn't open file %s!\n",
+                    fiobj_obj2cstr(filename).data);
+      perror("     ");
+      http_file_cache_release(file);
+      http_send_error(h, 500);
+      return 0;
+    }
   }
+  if (encoding)
+    http_set_header(h, HTTP_HEADER_CONTENT_ENCODING, fiobj_dup(encoding));
   {
-    FIOBJ tmp = 0;
-    uintptr_t pos = 0;
-    if (is_gz) {
-      http_set_header(h, HTTP_HEADER_CONTENT_ENCODING,
-                      fiobj_dup(HTTP_HVALUE_GZIP));
-
-      pos = s.len - 4;
-      while (pos && s.data[pos] != '.')
-        pos--;
-      pos++; /* assuming, but that's fine. */
-      tmp = http_mimetype_find(s.data + pos, s.len - pos - 3);
-
-    } else {
-      pos = s.len - 1;
-      while (pos && s.data[pos] != '.')
-        pos--;
-      pos++; /* assuming, but that's fine. */
-      tmp = http_mimetype_find(s.data + pos, s.len - pos);
-    }
-    if (tmp)
-      http_set_header_if_none(h, HTTP_HEADER_CONTENT_TYPE, tmp);
+    FIOBJ type = encoding ? file->encoded_type : file->content_type;
+    if (type)
+      http_set_header_if_none(h, HTTP_HEADER_CONTENT_TYPE, fiobj_dup(type));
+  }
+  if (file->data) {
+    /* small (hot) files are sent from memory, along with the headers. They
+     * aren't compressed on the fly, since the ETag, HEAD and Range responses
+     * describe the file (pre-compressed variants are served instead). */
+    http_send_body_identity(h, (void *)(file->data + offset), length);
+    http_file_cache_release(file);
+    return 0;
   }
-  http_sendfile(h, file, length, offset);
+  http_file_cache_release(file);
+  http_sendfile(h, fd, length, offset);
   return 0;
 invalid_range:
   {
     FIOBJ crange = fiobj_str_buf(1);
-    fiobj_str_printf(crange, "bytes */%lu", (unsigned long)file_data.st_size);
+    fiobj_str_printf(crange, "bytes */%lu", (unsigned long)file->size);
+    http_file_cache_release(file);
     http_set_header(h, HTTP_HEADER_CONTENT_RANGE, crange);
     http_send_error(h, 416);
     return 0;
@@ -685,6 +1023,19 @@ void http_finish(http_s *r) {
   if (!r || !r->private_data.vtbl) {
     return;
   }
+  if (r->private_data.compressor &&
+      !fio_is_closed(((http_fio_protocol_s *)r->private_data.flag)->uuid)) {
+    /* complete the compressed stream */
+    FIOBJ out = fiobj_str_buf(64);
+    if (!http_compress_stream_write(r->private_data.compressor, out, NULL, 0,
+                                    1)) {
+      fio_str_info_s o = fiobj_obj2cstr(out);
+      ((http_vtable_s *)r->private_data.vtbl)->http_stream(r, o.data, o.len);
+    }
+    fiobj_free(out);
+    http_compress_stream_free(r->private_data.compressor);
+    r->private_data.compressor = NULL;
+  }
   add_content_length(r, 0);
   add_date(r);
   ((http_vtable_s *)r->private_data.vtbl)->http_finish(r);
@@ -763,7 +1114,7 @@ static void http_resume_wrapper(intptr_t uuid, fio_protocol_s *p_, void *arg) {
   http_s *h = http->h;
   h->udata = http->udata;
   h->fiber = http->fiber;
-  h->subscription = http->subscription;
+  h->resume_entry = http->resume_entry;
   http_vtable_s *vtbl = (http_vtable_s *)h->private_data.vtbl;
   if (http->task)
     http->task(h);
@@ -797,7 +1148,7 @@ void http_pause(http_s *h, void (*task)(http_pause_handle_s *http)) {
       .h = h,
       .udata = h->udata,
       .fiber = h->fiber,
-      .subscription = h->subscription,
+      .resume_entry = h->resume_entry,
   };
   vtbl->http_on_pause(h, p);
   fio_defer(http_pause_wrapper, http, (void *)((uintptr_t)task));
@@ -849,6 +1200,8 @@ static http_settings_s *http_settings_new(http_settings_s arg_settings) {
 
   if (!arg_settings.max_body_size)
     arg_settings.max_body_size = HTTP_DEFAULT_BODY_LIMIT;
+  if (!arg_settings.stream_flush_size)
+    arg_settings.stream_flush_size = HTTP_DEFAULT_STREAM_FLUSH_SIZE;
   if (!arg_settings.timeout)
     arg_settings.timeout = 40;
   if (!arg_settings.ws_max_msg_size)
@@ -865,9 +1218,34 @@ static http_settings_s *http_settings_new(http_settings_s arg_settings) {
       arg_settings.max_clients -= HTTP_BUSY_UNLESS_HAS_FDS;
   }
 
+  if (!arg_settings.static_encodings)
+    arg_settings.static_encodings = HTTP_DEFAULT_STATIC_ENCODINGS;
+  if (!arg_settings.compress_types)
+    arg_settings.compress_types = HTTP_DEFAULT_COMPRESS_TYPES;
+
   http_settings_s *settings = malloc(sizeof(*settings) + sizeof(void *));
   *settings = arg_settings;
 
+  {
+    size_t len = strlen(arg_settings.static_encodings);
+    settings->static_encodings = malloc(len + 1);
+    FIO_ASSERT_ALLOC(settings->static_encodings);
+    memcpy((void *)settings->static_encodings, arg_settings.static_encodings,
+           len + 1);
+  }
+  {
+    size_t len = strlen(arg_settings.compress_types);
+    settings->compress_types = malloc(len + 1);
+    FIO_ASSERT_ALLOC(settings->compress_types);
+    memcpy((void *)settings->compress_types, arg_settings.compress_types,
+           len + 1);
+  }
+
+  settings->rate_limit_header = NULL;
+  settings->limiter = http_limiter_new(
+      arg_settings.max_clients_per_ip, arg_settings.rate_limit,
+      arg_settings.rate_burst, arg_settings.rate_limit_header);
+
   if (settings->public_folder) {
     settings->public_folder_length = strlen(settings->public_folder);
     if (settings->public_folder[0] == '~' &&
@@ -895,7 +1273,10 @@ static http_settings_s *http_settings_new(http_settings_s arg_settings) {
 }
 
 static void http_settings_free(http_settings_s *s) {
+  http_limiter_free(s->limiter);
   free((void *)s->public_folder);
+  free((void *)s->static_encodings);
+  free((void *)s->compress_types);
   free(s);
 }
 /* *****************************************************************************
@@ -918,6 +1299,12 @@ static void http_on_server_protocol_http1(intptr_t uuid, void *set,
     return;
   }
   fio_http_at_capa = 0;
+  if (http_limiter_connect(((http_settings_s *)set)->limiter, uuid)) {
+    FIO_LOG_DEBUG("HTTP client at capacity (%s)", fio_peer_addr(uuid).data);
+    http_send_error2(429, uuid, set);
+    fio_close(uuid);
+    return;
+  }
   fio_protocol_s *pr = http1_new(uuid, set, NULL, 0);
   if (!pr)
     fio_close(uuid);
@@ -966,9 +1353,15 @@ intptr_t http_listen(const char *port, const char *binding,
   }
 #endif
 
-  return fio_listen(.port = port, .address = binding, .tls = arg_settings.tls,
-                    .on_finish = http_on_finish, .on_open = http_on_open,
-                    .udata = settings);
+  intptr_t uuid =
+      fio_listen(.port = port, .address = binding, .tls = arg_settings.tls,
+                 .on_finish = http_on_finish, .on_open = http_on_open,
+                 .udata = settings);
+  /* the master fills the static file cache, shared by forked workers */
+  if (uuid != -1 && settings->public_folder)
+    http_file_cache_preload(settings->public_folder,
+                            settings->public_folder_length);
+  return uuid;
 }
 /** Listens to HTTP connections at the specified `port` and `binding`. */
 #define http_listen(port, binding, ...)                                        \
@@ -990,6 +1383,28 @@ fio_str_info_s http_peer_addr(http_s *h) {
   return fio_peer_addr(((http_fio_protocol_s *)h->private_data.flag)->uuid);
 }
 
+/**
+ * Returns the connection's `uuid` or -1 on error.
+ */
+intptr_t http_uuid(http_s *h) {
+  if (!h || !h->private_data.flag)
+    return -1;
+  return ((http_fio_protocol_s *)h->private_data.flag)->uuid;
+}
+
+/**
+ * Reads request body data that wasn't received when the request was dispatched
+ * (see the `early_dispatch` setting).
+ */
+ssize_t http_read_body(http_s *h, void *buffer, size_t length) {
+  if (HTTP_INVALID_HANDLE(h) || !length)
+    return 0;
+  http_vtable_s *vtbl = (http_vtable_s *)h->private_data.vtbl;
+  if (!vtbl->http_read_body)
+    return 0;
+  return vtbl->http_read_body(h, buffer, length);
+}
+
 /* *****************************************************************************
 HTTP client connections
 ***************************************************************************** */
@@ -1825,23 +2240,6 @@ int http_add2hash(FIOBJ dest, char *name, size_t name_len, char *value,
 /* *****************************************************************************
 HTTP Body Parsing
 ***************************************************************************** */
-#include <http_mime_parser.h>
-
-typedef struct {
-  http_mime_parser_s p;
-  http_s *h;
-  fio_str_info_s buffer;
-  size_t pos;
-  size_t partial_offset;
-  size_t partial_length;
-  VALUE partial_name;
-  int partial_fd;
-  VALUE partial_tempfile;
-  VALUE params;
-} http_fio_mime_s;
-
-#define http_mime_parser2fio(parser) ((http_fio_mime_s *)(parser))
-
 /** Parse a parameter key and add it to the `params` hash. Check `parse_nested_query_internal` for reference. */
 static void add_to_params(VALUE params, char *key, size_t key_len, VALUE value) {
   char *pos = NULL;
@@ -1981,132 +2379,97 @@ static inline void cleanup_temp_file(void *path) {
   unlink(c_path);
 }
 
-static VALUE create_temp_file(http_mime_parser_s *parser, char **path) {
-  VALUE tempfile = rb_funcallv_kw(cTempfile, create_id, 1, &tempfile_args, RB_PASS_KEYWORDS);
-
-  VALUE r_path = rb_funcall2(tempfile, path_id, 0, NULL);
-  IodineStore.add(r_path);
-  *path = StringValueCStr(r_path);
-
-  http_s *h = http_mime_parser2fio(parser)->h;
-  http_fio_protocol_s *p = (http_fio_protocol_s *)h->private_data.flag;
-  fio_uuid_link(p->uuid, (void *)r_path, cleanup_temp_file); // schedule file deletion
-  
-  return tempfile;
-}
-
-static VALUE build_file_value(VALUE file, char *filename, size_t filename_len, char *mimetype, size_t mimetype_len) {
-  VALUE args[3] = { file, rb_enc_str_new(filename, filename_len, IodineBinaryEncoding), rb_enc_str_new(mimetype, mimetype_len, IodineBinaryEncoding) };
+static VALUE build_file_value(VALUE file, FIOBJ filename, FIOBJ mimetype) {
+  fio_str_info_s f = fiobj_obj2cstr(filename);
+  fio_str_info_s m = fiobj_obj2cstr(mimetype);
+  VALUE args[3] = { file, rb_enc_str_new(f.data, f.len, IodineBinaryEncoding), rb_enc_str_new(m.data, m.len, IodineBinaryEncoding) };
   VALUE uploaded_file = rb_class_new_instance(3, args, cUploadedFile);
 
   return uploaded_file;
 }
 
-/** Called when all the data is available at once. */
-static void http_mime_parser_on_data(http_mime_parser_s *parser, void *name,
-                                     size_t name_len, void *filename,
-                                     size_t filename_len, void *mimetype,
-                                     size_t mimetype_len, void *value,
-                                     size_t value_len) {
-  // for regular values - just add them to params
-  if (!filename_len) {
-    VALUE r_value = rb_enc_str_new(value, value_len, IodineBinaryEncoding);
-    add_to_params(http_mime_parser2fio(parser)->params, name, name_len, r_value);
-    return;
-  }
+/**
+ * Wraps a part's temporary file with a (rewound) `File` object, taking
+ * ownership of the file (it's deleted once the connection is closed).
+ */
+static VALUE build_file(http_s *h, http_multipart_part_s *part) {
+  int fd = dup(part->fd); // the parser keeps its descriptor, see `http_multipart_body`
+  if (fd == -1)
+    rb_sys_fail("couldn't open a multipart file");
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  lseek(fd, 0, SEEK_SET);
 
-  // write file data into a temporary file
-  char* path;
-  VALUE r_tempfile = create_temp_file(parser, &path);
+  fio_str_info_s path = fiobj_obj2cstr(part->path);
+  VALUE r_path = rb_str_new(path.data, path.len);
+  VALUE file = rb_io_fdopen(fd, O_RDWR, path.data);
+  rb_io_binmode(file);
 
-  int file = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0777);
-  write(file, value, value_len);
-  close(file);
+  if (!part->handed_over) {
+    part->handed_over = 1;
+    IodineStore.add(r_path);
+    http_fio_protocol_s *p = (http_fio_protocol_s *)h->private_data.flag;
+    fio_uuid_link(p->uuid, (void *)r_path, cleanup_temp_file); // schedule file deletion
+  }
 
-  VALUE r_value = build_file_value(r_tempfile, filename, filename_len, mimetype, mimetype_len);
-  add_to_params(http_mime_parser2fio(parser)->params, name, name_len, r_value);
+  return file;
 }
 
-/** Called when the data didn't fit in the buffer. Data will be streamed. */
-static void http_mime_parser_on_partial_start(
-    http_mime_parser_s *parser, void *name, size_t name_len, void *filename,
-    size_t filename_len, void *mimetype, size_t mimetype_len) {
-
-  // store the parameter name
-  http_mime_parser2fio(parser)->partial_name = rb_str_new(name, name_len);
-
-  if (!filename)
-    return;
-
-  // create and store the temporary file for the file data
-  char* path;
-  VALUE r_tempfile = create_temp_file(parser, &path);
-
-  http_mime_parser2fio(parser)->partial_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0777);
-  
-  VALUE r_value = build_file_value(r_tempfile, filename, filename_len, mimetype, mimetype_len);
-  http_mime_parser2fio(parser)->partial_tempfile = r_value;
-}
+typedef struct {
+  http_s *h;
+  http_multipart_s *m;
+} http_multipart_args_s;
 
-/** Called when partial data is available. */
-static void http_mime_parser_on_partial_data(http_mime_parser_s *parser,
-                                             void *value, size_t value_len) {
+/** Builds the `params` hash from the natively parsed parts. */
+static VALUE build_multipart_params(VALUE args_) {
+  http_multipart_args_s *args = (http_multipart_args_s *)args_;
+  if (http_multipart_is_failed(args->m))
+    rb_raise(rb_eIOError, "Couldn't store a multipart file");
 
-  http_fio_mime_s *fio_parser = http_mime_parser2fio(parser);
+  size_t count;
+  http_multipart_part_s *parts = http_multipart_parts(args->m, &count);
+  VALUE params = rb_hash_new();
 
-  // if this is a file - write into it rightaway
-  if (fio_parser->partial_fd) {
-    write(fio_parser->partial_fd, value, value_len);
-    return;
+  for (size_t i = 0; i < count; ++i) {
+    fio_str_info_s name = fiobj_obj2cstr(parts[i].name);
+    VALUE r_value;
+    if (parts[i].fd == -1) {
+      fio_str_info_s value = fiobj_obj2cstr(parts[i].value);
+      r_value = rb_enc_str_new(value.data, value.len, IodineBinaryEncoding);
+    } else {
+      r_value = build_file_value(build_file(args->h, parts + i), parts[i].filename, parts[i].mimetype);
+    }
+    add_to_params(params, name.data, name.len, r_value);
   }
 
-  // if that's just a large piece of data - store the offset and length values
-  if (!fio_parser->partial_offset) {
-    fio_parser->partial_offset = fio_parser->pos + ((uintptr_t)value - (uintptr_t)fio_parser->buffer.data);
-  }
-  fio_parser->partial_length += value_len;
+  return params;
 }
 
-/** Called when the partial data is complete. */
-static void http_mime_parser_on_partial_end(http_mime_parser_s *parser) {
-  http_fio_mime_s *fio_parser = http_mime_parser2fio(parser);
-
-  // for a file - add to params and close the fd
-  if (fio_parser->partial_fd) {
-    add_to_params(fio_parser->params, RSTRING_PTR(fio_parser->partial_name), RSTRING_LEN(fio_parser->partial_name), fio_parser->partial_tempfile);
-    close(fio_parser->partial_fd);
+static VALUE free_multipart(VALUE m) {
+  http_multipart_free((http_multipart_s *)m);
+  return Qnil;
+}
 
-    fio_parser->partial_name = Qnil;
-    fio_parser->partial_tempfile = Qnil;
-    fio_parser->partial_fd = 0;
+/** Parses a buffered body (called outside the GVL). */
+static void *parse_multipart_body(void *args_) {
+  http_multipart_args_s *args = args_;
+  size_t pos = 0;
+  fio_str_info_s buffer;
 
-    return;
+  while ((buffer = fiobj_data_pread(args->h->body, pos, 262144)).data && buffer.len) {
+    http_multipart_write(args->m, FIOBJ_INVALID, buffer.data, buffer.len);
+    pos += buffer.len;
   }
+  http_multipart_finish(args->m, FIOBJ_INVALID);
 
-  FIOBJ slice = fiobj_data_slice(fio_parser->h->body, fio_parser->partial_offset, fio_parser->partial_length);
-  fio_str_info_s s_slice = fiobj_obj2cstr(slice);
-  VALUE r_value = rb_enc_str_new(s_slice.data, s_slice.len, IodineBinaryEncoding);
-  add_to_params(fio_parser->params, RSTRING_PTR(fio_parser->partial_name), RSTRING_LEN(fio_parser->partial_name), r_value);
-
-  fio_parser->partial_name = Qnil;
-  fio_parser->partial_length = 0;
-  fio_parser->partial_offset = 0;
-}
-
-/**
- * Called when URL decoding is required.
- *
- * Should support inplace decoding (`dest == encoded`).
- *
- * Should return the length of the decoded string.
- */
-static inline size_t http_mime_decode_url(char *dest, const char *encoded,
-                                          size_t length) {
-  return http_decode_url(dest, encoded, length);
+  return NULL;
 }
 
 /**
  * Attempts to decode a multipart/form-data encoded body.
+ *
+ * The body is usually parsed as it arrives (see `http_multipart_write`), in
+ * which case only the `params` hash is built here. Otherwise (i.e., early
+ * dispatch) the buffered body is parsed without holding the GVL.
  */
 VALUE http_parse_multipart(http_s *h, char *content_type, size_t content_type_len) {
   static uint8_t http_initialized;
@@ -2115,20 +2478,38 @@ VALUE http_parse_multipart(http_s *h, char *content_type, size_t content_type_le
     http_init();
   }
 
-  VALUE params = rb_hash_new();
-  http_fio_mime_s p = {.h = h, .params = params};
-  if (http_mime_parser_init(&p.p, content_type, content_type_len))
+  http_multipart_args_s args = {.h = h, .m = h->multipart};
+  if (http_multipart_is_finished(args.m))
+    return build_multipart_params((VALUE)&args);
+
+  args.m = http_multipart_new(content_type, content_type_len);
+  if (!args.m)
     rb_raise(rb_eRuntimeError, "Malformed multipart request");
+  if (h->body)
+    IodineCaller.leaveGVL(parse_multipart_body, &args);
 
-  do {
-    size_t cons = http_mime_parse(&p.p, p.buffer.data, p.buffer.len);
-    p.pos += cons;
-    p.buffer = fiobj_data_pread(h->body, p.pos, 262144);
-  } while (p.buffer.data && !p.p.done && !p.p.error);
-  
-  p.params = Qnil;
+  return rb_ensure(build_multipart_params, (VALUE)&args, free_multipart, (VALUE)args.m);
+}
 
-  return params;
+/** Restores the body (called outside the GVL). */
+static void *restore_multipart_body(void *h_) {
+  http_s *h = h_;
+  FIOBJ body = http_multipart_body(h->multipart, h->body);
+  if (!body)
+    return NULL;
+  fiobj_free(h->body);
+  h->body = body;
+  return NULL;
+}
+
+/**
+ * Restores a multipart/form-data body whose file parts were written straight
+ * to their temporary files, leaving them out of `h->body`.
+ */
+void http_restore_body(http_s *h) {
+  if (!http_multipart_is_finished(h->multipart) || !http_multipart_is_sparse(h->multipart))
+    return;
+  IodineCaller.leaveGVL(restore_multipart_body, h);
 }
 
 /* *****************************************************************************
@@ -2184,6 +2565,110 @@ FIOBJ http_req2str(http_s *h) {
   return w.dest;
 }
 
+/** Returns a monotonic timestamp in nanoseconds, see `http_timings_s`. */
+uint64_t http_timings_now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return ((uint64_t)t.tv_sec * 1000000000) + t.tv_nsec;
+}
+
+/* a per-thread copy of the log's date, so lines don't contend for a lock */
+static __thread struct {
+  time_t at;
+  size_t len;
+  char str[48];
+} http_log_date;
+
+/** Writes the date (refreshed once a second) to the log line. */
+static void http_write_log_date(FIOBJ l) {
+  time_t now = fio_last_tick().tv_sec;
+  if (http_log_date.at != now) {
+    http_log_date.len = http_time2str(http_log_date.str, now);
+    http_log_date.at = now;
+  }
+  fiobj_str_write(l, http_log_date.str, http_log_date.len);
+}
+
+/** Writes a duration (in nanoseconds) as milliseconds (i.e., "1.234"). */
+static void http_write_log_ms(FIOBJ l, uint64_t ns) {
+  /* microsecond resolution, printed as milliseconds */
+  uint64_t us = ns / 1000;
+  char buf[32];
+  size_t len = fio_ltoa(buf, us / 1000, 10);
+  buf[len++] = '.';
+  buf[len++] = '0' + ((us / 100) % 10);
+  buf[len++] = '0' + ((us / 10) % 10);
+  buf[len++] = '0' + (us % 10);
+  fiobj_str_write(l, buf, len);
+}
+
+/**
+ * Writes the phases as milliseconds since the request's first byte, either
+ * as ` (headers=1.234 ...)` or as a JSON object.
+ */
+static void http_write_log_timings(FIOBJ l, http_timings_s *t, uint8_t json) {
+  const struct {
+    const char *name;
+    uint64_t at;
+  } phases[] = {
+      {"headers", t->headers}, {"body", t->body},       {"gvl", t->gvl},
+      {"app", t->app},         {"written", t->written}, {"flushed", t->flushed},
+  };
+  fiobj_str_write(l, (json ? "{" : " ("), (json ? 1 : 2));
+  for (size_t i = 0; i < sizeof(phases) / sizeof(phases[0]); ++i) {
+    if (i)
+      fiobj_str_write(l, (json ? "," : " "), 1);
+    if (json)
+      fiobj_str_write(l, "\"", 1);
+    fiobj_str_write(l, phases[i].name, strlen(phases[i].name));
+    fiobj_str_write(l, (json ? "\":" : "="), (json ? 2 : 1));
+    if (!phases[i].at || !t->read || phases[i].at < t->read) {
+      fiobj_str_write(l, (json ? "null" : "-"), (json ? 4 : 1));
+      continue;
+    }
+    http_write_log_ms(l, phases[i].at - t->read);
+  }
+  fiobj_str_write(l, (json ? "}" : ")"), 1);
+}
+
+/** Writes a JSON log line (see `http_log_setup`). */
+static void http_write_log_json(FIOBJ l, http_s *h, fio_str_info_s peer,
+                                intptr_t bytes_sent, size_t ms) {
+  fiobj_str_write(l, "{\"peer\":", 8);
+  {
+    FIOBJ tmp = fiobj_str_new(peer.data, peer.len);
+    fiobj_obj2json2(l, tmp, 0);
+    fiobj_free(tmp);
+  }
+  fiobj_str_write(l, ",\"time\":\"", 9);
+  http_write_log_date(l);
+  fiobj_str_write(l, "\",\"method\":", 11);
+  fiobj_obj2json2(l, h->method, 0);
+  fiobj_str_write(l, ",\"path\":", 8);
+  fiobj_obj2json2(l, h->path, 0);
+  fiobj_str_write(l, ",\"version\":", 11);
+  fiobj_obj2json2(l, h->version, 0);
+  fiobj_str_write(l, ",\"status\":", 10);
+  fiobj_str_write_i(l, h->status);
+  fiobj_str_write(l, ",\"bytes\":", 9);
+  if (bytes_sent > 0)
+    fiobj_str_write_i(l, bytes_sent);
+  else
+    fiobj_str_write(l, "null", 4);
+  fiobj_str_write(l, ",\"ms\":", 6);
+  fiobj_str_write_i(l, ms);
+  if (http2protocol(h)->settings->timings) {
+    fiobj_str_write(l, ",\"timings\":", 11);
+    http_write_log_timings(l, &h->timings, 1);
+  }
+  fiobj_str_write(l, "}\n", 2);
+}
+
+/**
+ * Writes the request's log line to the access log (see `http_log_setup`).
+ *
+ * Lines are buffered and written by a background thread.
+ */
 void http_write_log(http_s *h) {
   FIOBJ l = fiobj_str_buf(128);
 
@@ -2193,29 +2678,22 @@ void http_write_log(http_s *h) {
   struct timespec start, end;
   clock_gettime(CLOCK_REALTIME, &end);
   start = h->received_at;
+  size_t ms = ((end.tv_sec - start.tv_sec) * 1000) +
+              ((end.tv_nsec - start.tv_nsec) / 1000000);
 
-  {
-    // TODO Guess IP address from headers (forwarded) where possible
-    fio_str_info_s peer = fio_peer_addr(http2protocol(h)->uuid);
-    fiobj_str_write(l, peer.data, peer.len);
-  }
-  fio_str_info_s buff = fiobj_obj2cstr(l);
+  // TODO Guess IP address from headers (forwarded) where possible
+  fio_str_info_s peer = fio_peer_addr(http2protocol(h)->uuid);
+  if (!peer.len)
+    peer = (fio_str_info_s){.data = (char *)"[unknown]", .len = 9};
 
-  if (buff.len == 0) {
-    memcpy(buff.data, "[unknown]", 9);
-    buff.len = 9;
-  }
-  memcpy(buff.data + buff.len, " - - [", 6);
-  buff.len += 6;
-  fiobj_str_resize(l, buff.len);
-  {
-    FIOBJ date;
-    fio_lock(&date_lock);
-    date = fiobj_dup(current_date);
-    fio_unlock(&date_lock);
-    fiobj_str_join(l, current_date);
-    fiobj_free(date);
+  if (http_log_is_json()) {
+    http_write_log_json(l, h, peer, bytes_sent, ms);
+    goto write;
   }
+
+  fiobj_str_write(l, peer.data, peer.len);
+  fiobj_str_write(l, " - - [", 6);
+  http_write_log_date(l);
   fiobj_str_write(l, "] \"", 3);
   fiobj_str_join(l, h->method);
   fiobj_str_write(l, " ", 1);
@@ -2232,14 +2710,17 @@ void http_write_log(http_s *h) {
     fiobj_str_join(l, fiobj_num_tmp(h->status));
     fiobj_str_write(l, " -- ", 4);
   }
+  fiobj_str_write_i(l, ms);
+  fiobj_str_write(l, "ms", 2);
+  if (http2protocol(h)->settings->timings)
+    http_write_log_timings(l, &h->timings, 0);
+  fiobj_str_write(l, "\r\n", 2);
 
-  bytes_sent = ((end.tv_sec - start.tv_sec) * 1000) +
-               ((end.tv_nsec - start.tv_nsec) / 1000000);
-  fiobj_str_write_i(l, bytes_sent);
-  fiobj_str_write(l, "ms\r\n", 4);
-
-  buff = fiobj_obj2cstr(l);
-  fwrite(buff.data, 1, buff.len, stderr);
+write:
+  {
+    fio_str_info_s buff = fiobj_obj2cstr(l);
+    http_log_write(buff.data, buff.len);
+  }
   fiobj_free(l);
 }
 
@@ -2688,18 +3169,9 @@ ssize_t http_decode_path_unsafe(char *dest, const char *url_data) {
 // init the http module to enable multipart/form-data parsing;
 // should be called lazily as it references `Rage`
 void http_init(void) {
-  cTempfile = rb_const_get(rb_cObject, rb_intern("Tempfile"));
-
   VALUE cRage = rb_const_get(rb_cObject, rb_intern("Rage"));
   cUploadedFile = rb_const_get(cRage, rb_intern("UploadedFile"));
   
-  tempfile_args = rb_hash_new();
-  rb_hash_aset(tempfile_args, ID2SYM(rb_intern("binmode")), Qtrue);
-  rb_global_variable(&tempfile_args);
-
-  create_id = rb_intern("create");
-  path_id = rb_intern("path");
-
   IodineBinaryEncoding = rb_enc_find("binary");
 }
 
@@ -35,6 +35,28 @@ Compile Time Settings
 #define HTTP_DEFAULT_BODY_LIMIT (1024 * 1024 * 50)
 #endif
 
+#ifndef HTTP_DEFAULT_STREAM_FLUSH_SIZE
+/** the default number of bytes collected before a streamed body is written */
+#define HTTP_DEFAULT_STREAM_FLUSH_SIZE (1024 * 16)
+#endif
+
+#ifndef HTTP_DEFAULT_COMPRESS_MIN_SIZE
+/** the default minimal response size for dynamic compression (when enabled) */
+#define HTTP_DEFAULT_COMPRESS_MIN_SIZE 1024
+#endif
+
+#ifndef HTTP_DEFAULT_COMPRESS_TYPES
+/** the default Content-Types of dynamically compressed responses */
+#define HTTP_DEFAULT_COMPRESS_TYPES                                            \
+  "text/*,application/json,application/javascript,application/x-javascript,"  \
+  "application/xml,image/svg+xml,*+json,*+xml"
+#endif
+
+#ifndef HTTP_DEFAULT_STATIC_ENCODINGS
+/** the default pre-compressed static file variants, in order of preference */
+#define HTTP_DEFAULT_STATIC_ENCODINGS "br,zstd,gzip"
+#endif
+
 #ifndef HTTP_MAX_HEADER_COUNT
 #define HTTP_MAX_HEADER_COUNT 128
 #endif
@@ -71,6 +93,31 @@ typedef struct http_settings_s http_settings_s;
 The Request / Response type and functions
 ***************************************************************************** */
 
+/**
+ * High resolution timestamps of a request's phases (see `http_timings_now`).
+ *
+ * A zero value means the phase wasn't reached (or wasn't recorded).
+ */
+typedef struct {
+  /** the request's first byte was read (or found in the buffer). */
+  uint64_t read;
+  /** the request's headers were parsed. */
+  uint64_t headers;
+  /** the request's body was received (the request is complete). */
+  uint64_t body;
+  /** the application layer was entered (i.e., Ruby's GVL was acquired). */
+  uint64_t gvl;
+  /** the application returned a response. */
+  uint64_t app;
+  /** the response headers were written. */
+  uint64_t written;
+  /** the response's last byte was flushed to the socket (if it was immediate). */
+  uint64_t flushed;
+} http_timings_s;
+
+/** Returns a monotonic timestamp in nanoseconds, see `http_timings_s`. */
+uint64_t http_timings_now(void);
+
 /**
  * A generic HTTP handle used for HTTP request/response data.
  *
@@ -86,9 +133,20 @@ typedef struct {
     uintptr_t flag;
     /** The response headers, if they weren't sent. Don't access directly. */
     FIOBJ out_headers;
+    /** A streamed response's compressor (if any). Don't access directly. */
+    struct http_compress_stream_s *compressor;
+    /** Set once the response started streaming. Don't access directly. */
+    uint8_t streaming;
   } private_data;
   /** a time merker indicating when the request was received. */
   struct timespec received_at;
+  /**
+   * When the request was completely read (a monotonic timestamp in nanoseconds,
+   * see `http_timings_now`), or zero if unknown.
+   */
+  uint64_t completed_at;
+  /** the timestamps of the request's phases. */
+  http_timings_s timings;
   /** a String containing the method data (supports non-standard methods. */
   FIOBJ method;
   /** The status string, for response objects (client mode response). */
@@ -122,14 +180,19 @@ typedef struct {
    * see fiobj_data.h for details.
    */
   FIOBJ body;
+  /**
+   * the multipart/form-data body, parsed as it arrives (might be NULL).
+   * see `http_parse_multipart` for details.
+   */
+  struct http_multipart_s *multipart;
   /** an opaque user data pointer, to be used BEFORE calling `http_defer`. */
   void *udata;
 
   /** in case the request was paused, this will hold a Ruby fiber, that was scheduled during the request. */
   void *fiber;
 
-  /** in case the request needs to be paused, Iodine will subscribe to a channel identified by this object. */
-  void *subscription;
+  /** in case the request was paused, this will hold Iodine's resume table entry (see `Iodine.resume`). */
+  void *resume_entry;
 } http_s;
 
 /**
@@ -208,6 +271,37 @@ int http_set_cookie(http_s *h, http_cookie_args_s);
  */
 int http_send_body(http_s *h, void *data, uintptr_t length);
 
+/**
+ * Sends the response headers and body without copying the body.
+ *
+ * `data` must remain valid until `dealloc(owner)` is called (once the body was
+ * sent, or on error). The body is copied when it's compressed.
+ *
+ * Returns -1 on error and 0 on success.
+ *
+ * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
+ */
+int http_send_body_nocopy(http_s *h, void *owner, void *data, uintptr_t length,
+                          void (*dealloc)(void *));
+
+/**
+ * Sends the response headers (on the first call) and a part of the response's
+ * body, allowing the body to be streamed in parts.
+ *
+ * If the `content-length` header wasn't set, the body will be sent using the
+ * `chunked` transfer encoding (or the connection will be closed once the
+ * response is complete, for HTTP/1.0 clients).
+ *
+ * **Note**: The data is *copied* to the HTTP stream and it's memory should be
+ * freed by the calling function.
+ *
+ * Once the body was streamed, `http_finish` MUST be called to complete the
+ * response.
+ *
+ * Returns -1 on error and 0 on success.
+ */
+int http_stream(http_s *h, void *data, uintptr_t length);
+
 /**
  * Sends the response headers and the specified file (the response's body).
  *
@@ -281,7 +375,7 @@ struct http_pause_handle_s {
   http_s *h;
   void *udata;
   void *fiber;
-  void *subscription;
+  void *resume_entry;
   void (*task)(http_s *);
   void (*fallback)(void *);
 };
@@ -356,7 +450,8 @@ struct http_settings_s {
    * A public folder for file transfers - allows to circumvent any application
    * layer logic and simply serve static files.
    *
-   * Supports automatic `gz` pre-compressed alternatives.
+   * Supports automatic pre-compressed alternatives (`br`, `zst` and `gz`), see
+   * `static_encodings`.
    */
   const char *public_folder;
   /**
@@ -394,12 +489,99 @@ struct http_settings_s {
   intptr_t max_clients;
   /** SSL/TLS support. */
   void *tls;
-  /** reserved for future use. */
-  intptr_t reserved1;
-  /** reserved for future use. */
-  intptr_t reserved2;
-  /** reserved for future use. */
-  intptr_t reserved3;
+  /**
+   * The number of bytes a streamed response body (see `http_stream`) should
+   * collect before it's written to the socket.
+   *
+   * Defaults to 16Kib.
+   */
+  size_t stream_flush_size;
+  /**
+   * A comma separated list of the pre-compressed variants the static file
+   * service should look for, in order of preference (used to break ties
+   * between equal `Accept-Encoding` q-values).
+   *
+   * Supported values are `br` (`.br`), `zstd` (`.zst`) and `gzip` (`.gz`). An
+   * empty string disables pre-compressed variants.
+   *
+   * Defaults to HTTP_DEFAULT_STATIC_ENCODINGS ("br,zstd,gzip").
+   */
+  const char *static_encodings;
+  /**
+   * Dynamic responses (`http_send_body`) of at least this many bytes are
+   * compressed (`zstd`, `br` or `gzip`, according to `Accept-Encoding`) when
+   * their Content-Type is listed in `compress_types`.
+   *
+   * Streamed responses (`http_stream`) are compressed incrementally when their
+   * first chunk is large enough. Static files (`http_sendfile2`) aren't
+   * compressed, their pre-compressed variants are (see `static_encodings`).
+   *
+   * Defaults to 0 (disabled).
+   */
+  size_t compress_min_size;
+  /**
+   * A comma separated list of the Content-Types that should be compressed
+   * (see `compress_min_size`). Entries ending with a slash followed by `*`
+   * match any subtype (i.e., `text/` followed by `*`) and entries starting with
+   * `*` match a suffix (i.e., `*+json`).
+   *
+   * Defaults to HTTP_DEFAULT_COMPRESS_TYPES (text, JSON, XML, JavaScript and
+   * SVG). Already compressed formats (and `application/wasm`) aren't listed.
+   */
+  const char *compress_types;
+  /**
+   * The maximum number of concurrent connections per client (peer address).
+   *
+   * Connections over the limit receive a 429 (Too Many Requests) error and are
+   * closed before any data is read.
+   *
+   * The limit is per process (each worker keeps its own count).
+   *
+   * Defaults to 0 (no limit).
+   */
+  size_t max_clients_per_ip;
+  /**
+   * The number of requests per second allowed per client (a token bucket).
+   *
+   * Requests over the limit receive a 429 (Too Many Requests) error with a
+   * `Retry-After` header, without reaching the `on_request` callback.
+   *
+   * The limit is per process (each worker keeps its own buckets).
+   *
+   * Defaults to 0 (no limit).
+   */
+  size_t rate_limit;
+  /**
+   * The number of requests a client may burst (the token bucket's size).
+   *
+   * Defaults to `rate_limit`.
+   */
+  size_t rate_burst;
+  /**
+   * The header identifying the client for the `rate_limit` (i.e.,
+   * `"x-forwarded-for"`, where the last address is used). Only set this when
+   * the header is set by a trusted proxy.
+   *
+   * Defaults to NULL (the peer address).
+   */
+  const char *rate_limit_header;
+  /**
+   * Admission control: the number of requests allowed to wait for the
+   * application (i.e., for Ruby's GVL). Once crossed, new requests receive a
+   * 503 (Service Unavailable) error with a `Retry-After` header.
+   *
+   * Enforced by the `on_request` callback. Defaults to 0 (no limit).
+   */
+  size_t max_queue;
+  /**
+   * Admission control: the number of milliseconds a request may wait for the
+   * application, measured from when it was completely read. Requests that
+   * waited longer (and new requests, while the average wait is longer) receive
+   * a 503 error.
+   *
+   * Enforced by the `on_request` callback. Defaults to 0 (no limit).
+   */
+  size_t max_queue_time;
   /**
    * The maximum websocket message size/buffer (in bytes) for Websocket
    * connections. Defaults to ~250KB.
@@ -421,10 +603,33 @@ struct http_settings_s {
    * fails). Pongs are ignored.
    */
   uint8_t ws_timeout;
+  /**
+   * Enables `permessage-deflate` (RFC 7692) for WebSocket connections.
+   *
+   * The value is zlib's memory level (1..9) for outgoing messages, trading
+   * memory for speed and compression. Defaults to 0 (disabled).
+   */
+  uint8_t ws_deflate;
   /** Logging flag - set to TRUE to log HTTP requests. */
   uint8_t log;
+  /**
+   * Timings flag - set to TRUE to add the request's phases (see
+   * `http_timings_s`) to the log and to let the `on_request` callback report
+   * them (i.e., using a `Server-Timing` header).
+   */
+  uint8_t timings;
+  /**
+   * Early dispatch flag - set to TRUE to call `on_request` as soon as the
+   * headers of a request with a large (non chunked) body were received.
+   *
+   * The body is then read by the `on_request` callback using `http_read_body`
+   * rather than collected (possibly to a temporary file) beforehand.
+   */
+  uint8_t early_dispatch;
   /** a read only flag set automatically to indicate the protocol's mode. */
   uint8_t is_client;
+  /** a read only field set automatically when client limits are set. */
+  struct http_limiter_s *limiter;
 };
 
 /**
@@ -484,6 +689,27 @@ struct http_settings_s *http_settings(http_s *h);
  */
 fio_str_info_s http_peer_addr(http_s *h);
 
+/**
+ * Returns the connection's `uuid` or -1 on error.
+ */
+intptr_t http_uuid(http_s *h);
+
+/**
+ * Reads request body data that wasn't received when the request was dispatched
+ * (see the `early_dispatch` setting). Any body data received beforehand is
+ * found in `h->body`.
+ *
+ * Returns the number of bytes copied to `buffer`, 0 once the whole body was
+ * read (or if the body was never streamed) and -1 on error.
+ *
+ * When no data is available yet, -1 is returned and `errno` is set to `EAGAIN`
+ * - wait for the connection (`http_uuid`) to become readable and try again.
+ *
+ * Unread body data will cause the connection to close once the response was
+ * sent.
+ */
+ssize_t http_read_body(http_s *h, void *buffer, size_t length);
+
 /**
  * Hijacks the socket away from the HTTP protocol and away from facil.io.
  *
@@ -563,6 +789,20 @@ typedef struct {
    * `websocket_udata_set` function.
    */
   void (*on_close)(intptr_t uuid, void *udata);
+  /**
+   * The (optional) on_message_chunk callback replaces `on_message`, passing
+   * messages in pieces as they arrive (the `first` and `last` flags mark the
+   * message's boundaries).
+   *
+   * Frames that don't fit the connection's read buffer are passed as their
+   * data is read, so memory remains bounded by the read buffer and `max_msg`
+   * isn't enforced. Compressed (permessage-deflate) messages are inflated and
+   * passed as a single piece.
+   *
+   * Text messages might be split in the middle of a UTF-8 character.
+   */
+  void (*on_message_chunk)(ws_s *ws, fio_str_info_s data, uint8_t is_text,
+                           uint8_t first, uint8_t last);
   /** Opaque user data. */
   void *udata;
 } websocket_settings_s;
@@ -778,9 +1018,20 @@ HTTP GET and POST parsing helpers
 
 /**
  * Attempts to decode a multipart/form-data encoded body.
+ *
+ * The body is usually parsed as it arrives, with file parts written straight to
+ * temporary files (wrapped by `File` objects).
  */
 VALUE http_parse_multipart(http_s *h, char *content_type, size_t content_type_len);
 
+/**
+ * Restores a multipart/form-data body whose file parts were written straight
+ * to their temporary files, leaving them out of `h->body`.
+ *
+ * Call before reading `h->body` (the body is only restored once).
+ */
+void http_restore_body(http_s *h);
+
 /**
  * Parses the query part of an HTTP request/response. Uses `http_add2hash`.
  *
@@ -880,7 +1131,9 @@ extern FIOBJ HTTP_HEADER_HOST;
 extern FIOBJ HTTP_HEADER_LAST_MODIFIED;
 extern FIOBJ HTTP_HEADER_ORIGIN;
 extern FIOBJ HTTP_HEADER_SET_COOKIE;
+extern FIOBJ HTTP_HEADER_TRANSFER_ENCODING;
 extern FIOBJ HTTP_HEADER_UPGRADE;
+extern FIOBJ HTTP_HEADER_VARY;
 
 /* *****************************************************************************
 HTTP General Helper functions that could be used globally
@@ -893,7 +1146,10 @@ HTTP General Helper functions that could be used globally
 FIOBJ http_req2str(http_s *h);
 
 /**
- * Writes a log line to `stderr` about the request / response object.
+ * Writes a log line to the access log about the request / response object.
+ *
+ * The line is written by a background thread, to `stderr` unless another
+ * target was set using `http_log_setup` (see `http_log.h`).
  *
  * This function is called automatically if the `.log` setting is enabled.
  */
@@ -9,10 +9,14 @@ License: MIT
 #include <http_internal.h>
 #include <websockets.h>
 
+#include <fio_tmpfile.h>
+
 #include <fiobj.h>
 
 #include <assert.h>
+#include <errno.h>
 #include <stddef.h>
+#include <strings.h>
 
 /* *****************************************************************************
 The HTTP/1.1 Protocol Object
@@ -25,9 +29,15 @@ typedef struct http1pr_s {
   uintptr_t buf_len;
   uintptr_t max_header_size;
   uintptr_t header_size;
+  uintptr_t streamed;
+  uint64_t read_at;
+  int spool_fd;
   uint8_t close;
   uint8_t is_client;
   uint8_t stop;
+  uint8_t streaming;
+  uint8_t early;
+  uint8_t spool;
   uint8_t buf[];
 } http1pr_s;
 
@@ -45,10 +55,25 @@ inline static void h1_reset(http1pr_s *p) { p->header_size = 0; }
 #define http1_pr2handle(pr) (((http1pr_s *)(pr))->request)
 #define handle2pr(h) ((http1pr_s *)h->private_data.flag)
 
+/* records a request phase (see `http_timings_s`) when timings are enabled */
+#define http1_timing(pr, h, phase)                                             \
+  do {                                                                         \
+    if ((pr)->p.settings->timings)                                             \
+      (h)->timings.phase = http_timings_now();                                 \
+  } while (0)
+
 /* cleanup an HTTP/1.1 handler object */
 static inline void http1_after_finish(http_s *h) {
   http1pr_s *p = handle2pr(h);
+  if (!fio_pending(p->p.uuid))
+    http1_timing(p, h, flushed);
   p->stop = p->stop & (~1UL);
+  p->streaming = 0;
+  p->streamed = 0;
+  if (p->early) {
+    /* the (early dispatched) request body wasn't read, don't wait for it */
+    p->close = 1;
+  }
   if (h != &p->request) {
     http_s_destroy(h, 0);
     fio_free(h);
@@ -101,6 +126,8 @@ static FIOBJ headers2str(http_s *h, uintptr_t padding) {
   if (!connection_hash)
     connection_hash = fiobj_hash_string("connection", 10);
 
+  http1_timing(handle2pr(h), h, written);
+
   struct header_writer_s w;
   {
     const uintptr_t header_length_guess =
@@ -186,6 +213,23 @@ static int http1_send_body(http_s *h, void *data, uintptr_t length) {
   http1_after_finish(h);
   return 0;
 }
+/** Should send existing headers and data (without copying the data) */
+static int http1_send_body_nocopy(http_s *h, void *owner, void *data,
+                                  uintptr_t length, void (*dealloc)(void *)) {
+  FIOBJ packet = headers2str(h, 0);
+  if (!packet) {
+    dealloc(owner);
+    http1_after_finish(h);
+    return -1;
+  }
+  intptr_t uuid = handle2pr(h)->p.uuid;
+  fiobj_send_free(uuid, packet);
+  fio_write2(uuid, .data.buffer = owner,
+             .offset = (uintptr_t)data - (uintptr_t)owner, .length = length,
+             .after.dealloc = dealloc);
+  http1_after_finish(h);
+  return 0;
+}
 /** Should send existing headers and file */
 static int http1_sendfile(http_s *h, int fd, uintptr_t length,
                           uintptr_t offset) {
@@ -219,8 +263,79 @@ static int http1_sendfile(http_s *h, int fd, uintptr_t length,
   return 0;
 }
 
+/** Should send existing headers and data and prepare for streaming */
+static int http1_stream(http_s *h, void *data, uintptr_t length) {
+  http1pr_s *p = handle2pr(h);
+  FIOBJ packet;
+  if (!p->streaming) {
+    /* streaming type: 1 == raw (length / framing is known), 2 == chunked */
+    p->streaming = 1;
+    if (!p->is_client &&
+        !fiobj_hash_get2(h->private_data.out_headers,
+                         fiobj_obj2hash(HTTP_HEADER_CONTENT_LENGTH)) &&
+        !fiobj_hash_get2(h->private_data.out_headers,
+                         fiobj_obj2hash(HTTP_HEADER_TRANSFER_ENCODING))) {
+      fio_str_info_s t = fiobj_obj2cstr(h->version);
+      if (t.len > 7 && t.data && t.data[5] == '1' && t.data[6] == '.' &&
+          t.data[7] == '1') {
+        fiobj_hash_set(h->private_data.out_headers,
+                       HTTP_HEADER_TRANSFER_ENCODING,
+                       fiobj_dup(HTTP_HVALUE_CHUNKED));
+        p->streaming = 2;
+      } else {
+        /* HTTP/1.0 - the end of the body is marked by closing the socket */
+        fiobj_hash_set(h->private_data.out_headers, HTTP_HEADER_CONNECTION,
+                       fiobj_dup(HTTP_HVALUE_CLOSE));
+      }
+    }
+    packet = headers2str(h, length + 16);
+    if (!packet) {
+      p->streaming = 0;
+      return -1;
+    }
+  } else {
+    if (!length)
+      return 0;
+    packet = fiobj_str_buf(length + 16);
+  }
+  if (length) {
+    if (p->streaming == 2) {
+      /* chunk header: length in hex followed by CRLF */
+      char tmp[24];
+      size_t pos = sizeof(tmp);
+      uintptr_t n = length;
+      tmp[--pos] = '\n';
+      tmp[--pos] = '\r';
+      do {
+        tmp[--pos] = "0123456789ABCDEF"[n & 15];
+        n >>= 4;
+      } while (n);
+      fiobj_str_write(packet, tmp + pos, sizeof(tmp) - pos);
+      fiobj_str_write(packet, data, length);
+      fiobj_str_write(packet, "\r\n", 2);
+    } else {
+      fiobj_str_write(packet, data, length);
+    }
+    p->streamed += length;
+  }
+  fiobj_send_free(p->p.uuid, packet);
+  return 0;
+}
+
 /** Should send existing headers or complete streaming */
 static void htt1p_finish(http_s *h) {
+  http1pr_s *p = handle2pr(h);
+  if (p->streaming) {
+    /* a closing connection marks an incomplete body, leave it unterminated */
+    if (p->streaming == 2 && !fio_is_closed(p->p.uuid))
+      fio_write2(p->p.uuid, .data.buffer = "0\r\n\r\n", .length = 5,
+                 .after.dealloc = FIO_DEALLOC_NOOP);
+    /* headers were already sent, record the body's length for the log */
+    fiobj_hash_set(h->private_data.out_headers, HTTP_HEADER_CONTENT_LENGTH,
+                   fiobj_num_new(p->streamed));
+    http1_after_finish(h);
+    return;
+  }
   FIOBJ packet = headers2str(h, 0);
   if (packet)
     fiobj_send_free((handle2pr(h)->p.uuid), packet);
@@ -298,7 +413,8 @@ static void http1_websocket_client_on_upgrade(http_s *h, char *proto,
   http_finish(h);
   p->stop = 1;
   websocket_attach(uuid, set, args, p->parser.state.next,
-                   p->buf_len - (intptr_t)(p->parser.state.next - p->buf));
+                   p->buf_len - (intptr_t)(p->parser.state.next - p->buf),
+                   (websocket_deflate_s){0});
   fio_free(args);
   (void)proto;
   (void)len;
@@ -356,10 +472,12 @@ static int http1_http2websocket_server(http_s *h, websocket_settings_s *args) {
   http1pr_s *pr = handle2pr(h);
   const intptr_t uuid = handle2pr(h)->p.uuid;
   http_settings_s *set = handle2pr(h)->p.settings;
+  websocket_deflate_s deflate = websocket_deflate_negotiate(h, set);
   http_finish(h);
   pr->stop = 1;
   websocket_attach(uuid, set, args, pr->parser.state.next,
-                   pr->buf_len - (intptr_t)(pr->parser.state.next - pr->buf));
+                   pr->buf_len - (intptr_t)(pr->parser.state.next - pr->buf),
+                   deflate);
   return 0;
 bad_request:
   http_send_error(h, 400);
@@ -527,6 +645,43 @@ static int http1_sse_close(http_sse_s *sse) {
   fio_close(((http_sse_internal_s *)sse)->uuid);
   return 0;
 }
+
+/** Reads the remaining request body, after an early dispatch. */
+static ssize_t http1_read_body(http_s *h, void *buffer, size_t length) {
+  http1pr_s *p = handle2pr(h);
+  if (!p->early || h != &p->request)
+    return 0;
+  if (p->early == 1) {
+    /* the client might be waiting for permission to send the body */
+    static uint64_t expect_hash = 0;
+    if (!expect_hash)
+      expect_hash = fiobj_hash_string("expect", 6);
+    fio_str_info_s expect =
+        fiobj_obj2cstr(fiobj_hash_get2(h->headers, expect_hash));
+    if (expect.len == 12 && !strncasecmp(expect.data, "100-continue", 12))
+      fio_write(p->p.uuid, "HTTP/1.1 100 Continue\r\n\r\n", 25);
+    p->early = 2;
+  }
+  size_t remaining =
+      (size_t)(p->parser.state.content_length - p->parser.state.read);
+  if (length > remaining)
+    length = remaining;
+  ssize_t r = fio_read(p->p.uuid, buffer, length);
+  if (r > 0) {
+    p->parser.state.read += r;
+    if ((size_t)r == remaining) {
+      /* the whole body was read, the parser can move on */
+      p->parser.state = (struct http1_parser_protected_read_only_state_s){0};
+      p->early = 0;
+    }
+    return r;
+  }
+  if (r == 0)
+    errno = EAGAIN;
+  else if (errno == EAGAIN || errno == EWOULDBLOCK)
+    errno = ECONNRESET;
+  return -1;
+}
 /* *****************************************************************************
 Virtual Table Decleration
 ***************************************************************************** */
@@ -534,12 +689,15 @@ Virtual Table Decleration
 struct http_vtable_s HTTP1_VTABLE = {
     .http_send_body = http1_send_body,
     .http_sendfile = http1_sendfile,
+    .http_stream = http1_stream,
     .http_finish = htt1p_finish,
     .http_push_data = http1_push_data,
     .http_push_file = http1_push_file,
     .http_on_pause = http1_on_pause,
     .http_on_resume = http1_on_resume,
     .http_hijack = http1_hijack,
+    .http_read_body = http1_read_body,
+    .http_send_body_nocopy = http1_send_body_nocopy,
     .http2websocket = http1_http2websocket,
     .http_upgrade2sse = http1_upgrade2sse,
     .http_sse_write = http1_sse_write,
@@ -548,6 +706,116 @@ struct http_vtable_s HTTP1_VTABLE = {
 
 void *http1_vtable(void) { return (void *)&HTTP1_VTABLE; }
 
+/* *****************************************************************************
+Early Dispatch
+***************************************************************************** */
+
+/** Tests if the request being parsed should be handled before its body. */
+static inline int http1_is_early_dispatch(http1pr_s *p) {
+  return p->p.settings->early_dispatch && !p->is_client && !p->early &&
+         (p->parser.state.reserved & HTTP1_P_FLAG_HEADER_COMPLETE) &&
+         !(p->parser.state.reserved &
+           (HTTP1_P_FLAG_CHUNKED | HTTP1_P_FLAG_COMPLETE)) &&
+         p->parser.state.content_length > HTTP_MAX_HEADER_LENGTH &&
+         p->parser.state.content_length <=
+             (ssize_t)p->p.settings->max_body_size;
+}
+
+/**
+ * Handles a request before its body was received. The body is read by the
+ * handler (`http_read_body`), so the connection is suspended meanwhile.
+ */
+static void http1_dispatch_early(http1pr_s *p) {
+  p->early = 1;
+  if (!p->request.body)
+    p->request.body = fiobj_data_newstr();
+  fio_suspend(p->p.uuid);
+  p->request.completed_at = p->read_at; /* the headers are complete */
+  http_on_request_handler______internal(&p->request, p->p.settings);
+  if (p->request.method && !p->stop)
+    http_finish(&p->request);
+  h1_reset(p);
+  if (!p->stop)
+    fio_force_event(p->p.uuid, FIO_EVENT_ON_DATA);
+}
+
+/* *****************************************************************************
+Multipart Bodies
+***************************************************************************** */
+
+/**
+ * Starts parsing a multipart/form-data request body as it arrives, so file
+ * parts are stored without holding the GVL (see `http_parse_multipart`).
+ */
+static void http1_multipart_init(http1pr_s *p) {
+  static uint64_t content_type_hash = 0;
+  if (p->is_client)
+    return;
+  if (!content_type_hash)
+    content_type_hash = fiobj_obj2hash(HTTP_HEADER_CONTENT_TYPE);
+  FIOBJ tmp = fiobj_hash_get2(p->request.headers, content_type_hash);
+  if (!tmp || !FIOBJ_TYPE_IS(tmp, FIOBJ_T_STRING))
+    return;
+  fio_str_info_s t = fiobj_obj2cstr(tmp);
+  if (t.len < 19 || strncasecmp(t.data, "multipart/form-data", 19))
+    return;
+  p->request.multipart = http_multipart_new(t.data, t.len);
+}
+
+/* *****************************************************************************
+Upload Spooling
+***************************************************************************** */
+
+/**
+ * Creates the temporary file for a large request body.
+ *
+ * If the body is large enough, the rest of it will be moved from the socket
+ * straight into the (preallocated) file, see `http1_spool`.
+ */
+static FIOBJ http1_body_tmpfile(http1pr_s *p) {
+  int fd = fio_tmpfile();
+  if (fd == -1)
+    return FIOBJ_INVALID;
+  if (!p->is_client && !p->request.multipart &&
+      !(p->parser.state.reserved & HTTP1_P_FLAG_CHUNKED) &&
+      p->parser.state.content_length >= HTTP1_SPLICE_LIMIT) {
+    p->spool = 1;
+    p->spool_fd = fd;
+#ifdef FALLOC_FL_KEEP_SIZE
+    /* reserve the space, but keep the size (it marks the data's end) */
+    fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, p->parser.state.content_length);
+#endif
+  }
+  return fiobj_data_newfd(fd);
+}
+
+/**
+ * Moves the request body from the socket to its temporary file, completing
+ * the request (as the parser would) once the whole body was received.
+ *
+ * Returns -1 if the data should be read using `fio_read` instead.
+ */
+static int http1_spool(intptr_t uuid, http1pr_s *p) {
+  ssize_t i = fio_read2fd(
+      uuid, p->spool_fd, (off_t)p->parser.state.read,
+      (size_t)(p->parser.state.content_length - p->parser.state.read));
+  if (i < 0) {
+    if (errno != ENOTSUP)
+      return 0; /* the connection was closed */
+    p->spool = 0;
+    return -1;
+  }
+  p->read_at = http_timings_now();
+  p->parser.state.read += i;
+  if (p->parser.state.read < p->parser.state.content_length)
+    return 0;
+  p->spool = 0;
+  p->parser.state.reserved |= HTTP1_P_FLAG_COMPLETE;
+  http1_on_request(&p->parser);
+  p->parser.state = (struct http1_parser_protected_read_only_state_s){0};
+  return 0;
+}
+
 /* *****************************************************************************
 Parser Callbacks
 ***************************************************************************** */
@@ -555,6 +823,19 @@ Parser Callbacks
 /** called when a request was received. */
 static int http1_on_request(http1_parser_s *parser) {
   http1pr_s *p = parser2http(parser);
+  if (p->early) {
+    /* already handled (early dispatch), the unread body was discarded */
+    p->early = 0;
+    h1_reset(p);
+    return fio_is_closed(p->p.uuid);
+  }
+  http_multipart_finish(p->request.multipart, p->request.body);
+  if (!p->request.timings.headers)
+    http1_timing(p, &p->request, headers);
+  http1_timing(p, &p->request, body);
+  /* the last read completed the request (pipelined requests read together
+   * share the stamp, accounting for the time spent behind each other) */
+  p->request.completed_at = p->read_at;
   http_on_request_handler______internal(&http1_pr2handle(p), p->p.settings);
   if (p->request.method && !p->stop)
     http_finish(&p->request);
@@ -576,6 +857,9 @@ static int http1_on_method(http1_parser_s *parser, char *method,
   http1_pr2handle(parser2http(parser)).method =
       fiobj_str_new(method, method_len);
   parser2http(parser)->header_size += method_len;
+  if (!http1_pr2handle(parser2http(parser)).timings.read)
+    http1_timing(parser2http(parser), &http1_pr2handle(parser2http(parser)),
+                 read); /* pipelined requests */
   return 0;
 }
 
@@ -649,6 +933,8 @@ static int http1_on_header(http1_parser_s *parser, char *name, size_t name_len,
 /** called when a body chunk is parsed. */
 static int http1_on_body_chunk(http1_parser_s *parser, char *data,
                                size_t data_len) {
+  if (parser2http(parser)->early)
+    return 0; /* unread body of an early dispatched request, discard */
   if (parser->state.content_length >
           (ssize_t)parser2http(parser)->p.settings->max_body_size ||
       parser->state.read >
@@ -657,14 +943,27 @@ static int http1_on_body_chunk(http1_parser_s *parser, char *data,
     return -1; /* test every time, in case of chunked data */
   }
   if (!parser->state.read) {
-    if (parser->state.content_length > 0 &&
-        parser->state.content_length <= HTTP_MAX_HEADER_LENGTH) {
+    http1_timing(parser2http(parser), &http1_pr2handle(parser2http(parser)),
+                 headers);
+    uint8_t early = http1_is_early_dispatch(parser2http(parser));
+    if (!early)
+      http1_multipart_init(parser2http(parser));
+    if ((parser->state.content_length > 0 &&
+         parser->state.content_length <= HTTP_MAX_HEADER_LENGTH) ||
+        early) {
       http1_pr2handle(parser2http(parser)).body = fiobj_data_newstr();
     } else {
-      http1_pr2handle(parser2http(parser)).body = fiobj_data_newtmpfile();
+      http1_pr2handle(parser2http(parser)).body =
+          http1_body_tmpfile(parser2http(parser));
     }
   }
-  fiobj_data_write(http1_pr2handle(parser2http(parser)).body, data, data_len);
+  if (http1_pr2handle(parser2http(parser)).multipart)
+    http_multipart_write(http1_pr2handle(parser2http(parser)).multipart,
+                         http1_pr2handle(parser2http(parser)).body, data,
+                         data_len);
+  else
+    fiobj_data_write(http1_pr2handle(parser2http(parser)).body, data,
+                     data_len);
   return 0;
 }
 
@@ -690,10 +989,14 @@ static inline void http1_consume_data(intptr_t uuid, http1pr_s *p) {
   int pipeline_limit = 8;
   if (!p->buf_len)
     return;
+  if (!p->request.timings.read)
+    http1_timing(p, &p->request, read);
   do {
     i = http1_parse(&p->parser, p->buf + (org_len - p->buf_len), p->buf_len);
     p->buf_len -= i;
     --pipeline_limit;
+    if (http1_is_early_dispatch(p))
+      http1_dispatch_early(p);
   } while (i && p->buf_len && pipeline_limit && !p->stop);
 
   if (p->buf_len && org_len != p->buf_len) {
@@ -730,11 +1033,14 @@ static void http1_on_data(intptr_t uuid, fio_protocol_s *protocol) {
     fio_suspend(uuid);
     return;
   }
+  if (p->spool && !p->buf_len && !http1_spool(uuid, p))
+    return;
   ssize_t i = 0;
   if (HTTP_MAX_HEADER_LENGTH - p->buf_len)
     i = fio_read(uuid, p->buf + p->buf_len,
                  HTTP_MAX_HEADER_LENGTH - p->buf_len);
   if (i > 0) {
+    p->read_at = http_timings_now();
     p->buf_len += i;
   }
   http1_consume_data(uuid, p);
@@ -766,6 +1072,7 @@ static void http1_on_data_first_time(intptr_t uuid, fio_protocol_s *protocol) {
 
   if (i <= 0)
     return;
+  p->read_at = http_timings_now();
   p->buf_len += i;
 
   /* ensure future reads skip this first time HTTP/2.0 test */
@@ -15,6 +15,14 @@ License: MIT
 #define HTTP1_READ_BUFFER (8 * 1024) /* ~8kb */
 #endif
 
+#ifndef HTTP1_SPLICE_LIMIT
+/**
+ * Request bodies larger than this are moved from the socket to their temporary
+ * file without passing through user space (`splice`, for plain TCP on Linux).
+ */
+#define HTTP1_SPLICE_LIMIT (1024 * 1024) /* 1Mb */
+#endif
+
 /** Creates an HTTP1 protocol object and handles any unread data in the buffer
  * (if any). */
 fio_protocol_s *http1_new(uintptr_t uuid, http_settings_s *settings,
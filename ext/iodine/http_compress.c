@@ -0,0 +1,359 @@
+/*
+Copyright: Boaz Segev, 2016-2019
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+#include <http_compress.h>
+
+#include <string.h>
+#include <strings.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/* *****************************************************************************
+Content codings
+***************************************************************************** */
+
+/** Returns true if the coding was compiled in (the library was detected). */
+int http_compress_is_available(http_compress_e coding) {
+  switch (coding) {
+#ifdef HAVE_ZLIB
+  case HTTP_COMPRESS_GZIP:
+    return 1;
+#endif
+#ifdef HAVE_BROTLI
+  case HTTP_COMPRESS_BROTLI:
+    return 1;
+#endif
+#ifdef HAVE_ZSTD
+  case HTTP_COMPRESS_ZSTD:
+    return 1;
+#endif
+  default:
+    return 0;
+  }
+}
+
+/** Returns the content coding's name (i.e., "gzip"). */
+fio_str_info_s http_compress_name(http_compress_e coding) {
+  switch (coding) {
+  case HTTP_COMPRESS_GZIP:
+    return (fio_str_info_s){.data = (char *)"gzip", .len = 4};
+  case HTTP_COMPRESS_BROTLI:
+    return (fio_str_info_s){.data = (char *)"br", .len = 2};
+  case HTTP_COMPRESS_ZSTD:
+    return (fio_str_info_s){.data = (char *)"zstd", .len = 4};
+  default:
+    return (fio_str_info_s){.data = NULL, .len = 0};
+  }
+}
+
+/**
+ * Returns true if responses of the Content-Type should be compressed (the
+ * Content-Type matches an entry in the comma separated `types` list).
+ */
+int http_compress_is_compressible(const char *types, fio_str_info_s t) {
+  if (!types || !t.data || !t.len)
+    return 0;
+  /* ignore parameters (i.e., "; charset=utf-8") */
+  size_t len = 0;
+  while (len < t.len && t.data[len] != ';' && t.data[len] != ' ')
+    ++len;
+  while (*types) {
+    while (*types == ',' || *types == ' ')
+      ++types;
+    const char *name = types;
+    while (*types && *types != ',' && *types != ' ')
+      ++types;
+    size_t n = types - name;
+    if (!n)
+      continue;
+    if (n > 1 && name[n - 1] == '*' && name[n - 2] == '/') {
+      /* a type prefix (a slash followed by `*`), i.e., any "text/" type */
+      if (len > n - 1 && !strncasecmp(t.data, name, n - 1))
+        return 1;
+    } else if (name[0] == '*') {
+      /* a suffix, i.e., "*+json" */
+      if (len > n - 1 &&
+          !strncasecmp(t.data + len - (n - 1), name + 1, n - 1))
+        return 1;
+    } else if (len == n && !strncasecmp(t.data, name, n)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* *****************************************************************************
+Compression
+***************************************************************************** */
+
+#ifdef HAVE_ZLIB
+static FIOBJ http_compress_gzip(const void *data, size_t len) {
+  z_stream z = {.zalloc = Z_NULL};
+  /* 15 window bits + 16 for a gzip header */
+  if (deflateInit2(&z, HTTP_COMPRESS_GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK)
+    return FIOBJ_INVALID;
+  size_t capa = deflateBound(&z, len);
+  if (capa > len)
+    capa = len; /* a larger result is useless */
+  FIOBJ out = fiobj_str_buf(capa);
+  fio_str_info_s o = fiobj_obj2cstr(out);
+  z.next_in = (Bytef *)data;
+  z.avail_in = len;
+  z.next_out = (Bytef *)o.data;
+  z.avail_out = o.capa;
+  int r = deflate(&z, Z_FINISH);
+  size_t written = o.capa - z.avail_out;
+  deflateEnd(&z);
+  if (r != Z_STREAM_END || written >= len) {
+    fiobj_free(out);
+    return FIOBJ_INVALID;
+  }
+  fiobj_str_resize(out, written);
+  return out;
+}
+#endif
+
+#ifdef HAVE_BROTLI
+static FIOBJ http_compress_brotli(const void *data, size_t len) {
+  size_t written = BrotliEncoderMaxCompressedSize(len);
+  if (!written || written > len)
+    written = len;
+  FIOBJ out = fiobj_str_buf(written);
+  fio_str_info_s o = fiobj_obj2cstr(out);
+  written = o.capa;
+  if (!BrotliEncoderCompress(HTTP_COMPRESS_BROTLI_QUALITY, BROTLI_DEFAULT_WINDOW,
+                             BROTLI_MODE_TEXT, len, (const uint8_t *)data,
+                             &written, (uint8_t *)o.data) ||
+      written >= len) {
+    fiobj_free(out);
+    return FIOBJ_INVALID;
+  }
+  fiobj_str_resize(out, written);
+  return out;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static FIOBJ http_compress_zstd(const void *data, size_t len) {
+  FIOBJ out = fiobj_str_buf(ZSTD_compressBound(len));
+  fio_str_info_s o = fiobj_obj2cstr(out);
+  size_t written =
+      ZSTD_compress(o.data, o.capa, data, len, HTTP_COMPRESS_ZSTD_LEVEL);
+  if (ZSTD_isError(written) || written >= len) {
+    fiobj_free(out);
+    return FIOBJ_INVALID;
+  }
+  fiobj_str_resize(out, written);
+  return out;
+}
+#endif
+
+/**
+ * Compresses `data` using the requested content coding.
+ *
+ * Returns a new String object or FIOBJ_INVALID if the data couldn't be
+ * compressed (or if the result isn't smaller than the original).
+ */
+FIOBJ http_compress(http_compress_e coding, const void *data, size_t len) {
+  if (!data || !len)
+    return FIOBJ_INVALID;
+  switch (coding) {
+#ifdef HAVE_ZLIB
+  case HTTP_COMPRESS_GZIP:
+    return http_compress_gzip(data, len);
+#endif
+#ifdef HAVE_BROTLI
+  case HTTP_COMPRESS_BROTLI:
+    return http_compress_brotli(data, len);
+#endif
+#ifdef HAVE_ZSTD
+  case HTTP_COMPRESS_ZSTD:
+    return http_compress_zstd(data, len);
+#endif
+  default:
+    return FIOBJ_INVALID;
+  }
+}
+
+/* *****************************************************************************
+Incremental compression (streamed responses)
+***************************************************************************** */
+
+struct http_compress_stream_s {
+  http_compress_e coding;
+  union {
+#ifdef HAVE_ZLIB
+    z_stream z;
+#endif
+#ifdef HAVE_BROTLI
+    BrotliEncoderState *br;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx *zstd;
+#endif
+    void *ignr_;
+  } state;
+};
+
+/* makes room for (at least) `more` bytes, returning the writable buffer */
+static inline fio_str_info_s http_compress_stream_room(FIOBJ dest,
+                                                       size_t more) {
+  fio_str_info_s o = fiobj_obj2cstr(dest);
+  o.capa = fiobj_str_capa_assert(dest, o.len + more);
+  o.data = fiobj_obj2cstr(dest).data;
+  return o;
+}
+
+/** Returns a new incremental compressor, or NULL on error. */
+http_compress_stream_s *http_compress_stream_new(http_compress_e coding) {
+  http_compress_stream_s *s = fio_malloc(sizeof(*s));
+  FIO_ASSERT_ALLOC(s);
+  *s = (http_compress_stream_s){.coding = coding};
+  switch (coding) {
+#ifdef HAVE_ZLIB
+  case HTTP_COMPRESS_GZIP:
+    /* 15 window bits + 16 for a gzip header */
+    if (deflateInit2(&s->state.z, HTTP_COMPRESS_GZIP_LEVEL, Z_DEFLATED,
+                     15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+      goto error;
+    return s;
+#endif
+#ifdef HAVE_BROTLI
+  case HTTP_COMPRESS_BROTLI:
+    s->state.br = BrotliEncoderCreateInstance(NULL, NULL, NULL);
+    if (!s->state.br)
+      goto error;
+    BrotliEncoderSetParameter(s->state.br, BROTLI_PARAM_QUALITY,
+                              HTTP_COMPRESS_BROTLI_QUALITY);
+    BrotliEncoderSetParameter(s->state.br, BROTLI_PARAM_MODE,
+                              BROTLI_MODE_TEXT);
+    return s;
+#endif
+#ifdef HAVE_ZSTD
+  case HTTP_COMPRESS_ZSTD:
+    s->state.zstd = ZSTD_createCCtx();
+    if (!s->state.zstd)
+      goto error;
+    ZSTD_CCtx_setParameter(s->state.zstd, ZSTD_c_compressionLevel,
+                           HTTP_COMPRESS_ZSTD_LEVEL);
+    return s;
+#endif
+  default:
+    goto error;
+  }
+error:
+  fio_free(s);
+  return NULL;
+}
+
+/**
+ * Compresses `data`, appending the (flushed) output to `dest`, completing the
+ * compressed stream when `finish` is set.
+ */
+int http_compress_stream_write(http_compress_stream_s *s, FIOBJ dest,
+                               const void *data, size_t len, int finish) {
+  switch (s->coding) {
+#ifdef HAVE_ZLIB
+  case HTTP_COMPRESS_GZIP: {
+    z_stream *z = &s->state.z;
+    z->next_in = (Bytef *)data;
+    z->avail_in = len;
+    for (;;) {
+      fio_str_info_s o = http_compress_stream_room(dest, (len >> 1) + 64);
+      z->next_out = (Bytef *)o.data + o.len;
+      z->avail_out = o.capa - o.len - 1;
+      int r = deflate(z, finish ? Z_FINISH : Z_SYNC_FLUSH);
+      fiobj_str_resize(dest, o.capa - 1 - z->avail_out);
+      if (r == Z_STREAM_END)
+        return 0;
+      if (r != Z_OK && r != Z_BUF_ERROR)
+        return -1;
+      /* all output was flushed once room was left in the buffer */
+      if (!finish && z->avail_out)
+        return 0;
+    }
+  }
+#endif
+#ifdef HAVE_BROTLI
+  case HTTP_COMPRESS_BROTLI: {
+    const uint8_t *next_in = data;
+    size_t avail_in = len;
+    for (;;) {
+      fio_str_info_s o = http_compress_stream_room(dest, (len >> 1) + 64);
+      uint8_t *next_out = (uint8_t *)o.data + o.len;
+      size_t avail_out = o.capa - o.len - 1;
+      if (!BrotliEncoderCompressStream(
+              s->state.br,
+              finish ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_FLUSH,
+              &avail_in, &next_in, &avail_out, &next_out, NULL))
+        return -1;
+      fiobj_str_resize(dest, o.capa - 1 - avail_out);
+      if (finish ? BrotliEncoderIsFinished(s->state.br)
+                 : (!avail_in && !BrotliEncoderHasMoreOutput(s->state.br)))
+        return 0;
+    }
+  }
+#endif
+#ifdef HAVE_ZSTD
+  case HTTP_COMPRESS_ZSTD: {
+    ZSTD_inBuffer in = {.src = data, .size = len};
+    for (;;) {
+      fio_str_info_s o = http_compress_stream_room(dest, ZSTD_CStreamOutSize());
+      ZSTD_outBuffer out = {.dst = o.data + o.len,
+                            .size = o.capa - o.len - 1};
+      size_t remaining = ZSTD_compressStream2(
+          s->state.zstd, &out, &in, finish ? ZSTD_e_end : ZSTD_e_flush);
+      if (ZSTD_isError(remaining))
+        return -1;
+      fiobj_str_resize(dest, o.len + out.pos);
+      if (!remaining)
+        return 0;
+    }
+  }
+#endif
+  default:
+    return -1;
+  }
+  (void)dest;
+  (void)data;
+  (void)len;
+  (void)finish;
+}
+
+/** Frees the compressor (NULL is ignored). */
+void http_compress_stream_free(http_compress_stream_s *s) {
+  if (!s)
+    return;
+  switch (s->coding) {
+#ifdef HAVE_ZLIB
+  case HTTP_COMPRESS_GZIP:
+    deflateEnd(&s->state.z);
+    break;
+#endif
+#ifdef HAVE_BROTLI
+  case HTTP_COMPRESS_BROTLI:
+    BrotliEncoderDestroyInstance(s->state.br);
+    break;
+#endif
+#ifdef HAVE_ZSTD
+  case HTTP_COMPRESS_ZSTD:
+    ZSTD_freeCCtx(s->state.zstd);
+    break;
+#endif
+  default:
+    break;
+  }
+  fio_free(s);
+}
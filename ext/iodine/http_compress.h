@@ -0,0 +1,84 @@
+/*
+Copyright: Boaz Segev, 2016-2019
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+#ifndef H_HTTP_COMPRESS_H
+#define H_HTTP_COMPRESS_H
+
+#include <fio.h>
+#include <fiobj.h>
+
+#ifndef HTTP_COMPRESS_GZIP_LEVEL
+/** zlib compression level (1..9) for dynamic `gzip` responses. */
+#define HTTP_COMPRESS_GZIP_LEVEL 6
+#endif
+
+#ifndef HTTP_COMPRESS_BROTLI_QUALITY
+/** brotli quality (0..11) for dynamic `br` responses (favors speed). */
+#define HTTP_COMPRESS_BROTLI_QUALITY 4
+#endif
+
+#ifndef HTTP_COMPRESS_ZSTD_LEVEL
+/** zstd compression level for dynamic `zstd` responses. */
+#define HTTP_COMPRESS_ZSTD_LEVEL 3
+#endif
+
+/** Content codings supported by `http_compress`. */
+typedef enum {
+  HTTP_COMPRESS_NONE = 0,
+  HTTP_COMPRESS_ZSTD,
+  HTTP_COMPRESS_BROTLI,
+  HTTP_COMPRESS_GZIP,
+} http_compress_e;
+
+/** Returns true if the coding was compiled in (the library was detected). */
+int http_compress_is_available(http_compress_e coding);
+
+/** Returns the content coding's name (i.e., "gzip"). */
+fio_str_info_s http_compress_name(http_compress_e coding);
+
+/**
+ * Returns true if responses of the Content-Type should be compressed.
+ *
+ * `types` is a comma separated list of Content-Types. Entries ending with a
+ * slash followed by `*` match any subtype (i.e., `text/` followed by `*`) and
+ * entries starting with `*` match a suffix (i.e., `*+json`). Parameters (i.e., "; charset=utf-8") are ignored.
+ */
+int http_compress_is_compressible(const char *types,
+                                  fio_str_info_s content_type);
+
+/**
+ * Compresses `data` using the requested content coding.
+ *
+ * Returns a new String object or FIOBJ_INVALID if the data couldn't be
+ * compressed (or if the result isn't smaller than the original).
+ *
+ * This is CPU bound and shouldn't be called while holding a language lock
+ * (i.e., Ruby's GVL).
+ */
+FIOBJ http_compress(http_compress_e coding, const void *data, size_t len);
+
+/** An incremental compressor, used for streamed responses. */
+typedef struct http_compress_stream_s http_compress_stream_s;
+
+/** Returns a new incremental compressor, or NULL on error. */
+http_compress_stream_s *http_compress_stream_new(http_compress_e coding);
+
+/**
+ * Compresses `data`, appending the output to the `dest` String object.
+ *
+ * The output is flushed, so the client can decompress everything written so
+ * far. When `finish` is set, the compressed stream is completed (no further
+ * data can be written).
+ *
+ * Returns -1 on error and 0 on success.
+ */
+int http_compress_stream_write(http_compress_stream_s *s, FIOBJ dest,
+                               const void *data, size_t len, int finish);
+
+/** Frees the compressor (NULL is ignored). */
+void http_compress_stream_free(http_compress_stream_s *s);
+
+#endif
@@ -0,0 +1,568 @@
+/*
+Copyright: Boaz Segev, 2016-2019
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+#include <fio.h>
+
+#include <http.h>
+#include <http_file_cache.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#define HTTP_FILE_CACHE_INOTIFY 1
+#else
+#define HTTP_FILE_CACHE_INOTIFY 0
+#endif
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+/* *****************************************************************************
+Cache entries
+***************************************************************************** */
+
+typedef struct {
+  http_file_s file; /* must be first */
+  volatile size_t ref;
+  time_t expires;
+  time_t ctime;
+  dev_t dev;
+  ino_t ino;
+  uint8_t short_ttl;
+} http_file_cache_entry_s;
+
+#define http_file2entry(f) ((http_file_cache_entry_s *)(f))
+
+static void http_file_cache_entry_free(http_file_cache_entry_s *e) {
+  if (!e || fio_atomic_sub(&e->ref, 1))
+    return;
+  if (e->file.fd != -1)
+    close(e->file.fd);
+  fio_free((void *)e->file.data);
+  fiobj_free(e->file.etag);
+  fiobj_free(e->file.last_modified);
+  fiobj_free(e->file.content_type);
+  fiobj_free(e->file.encoded_etag);
+  fiobj_free(e->file.encoded_type);
+  fio_free(e);
+}
+
+/** Compares two String keys without relying on (possibly stale) hashes. */
+static inline int http_file_cache_key_eq(FIOBJ k1, FIOBJ k2) {
+  fio_str_info_s s1 = fiobj_obj2cstr(k1);
+  fio_str_info_s s2 = fiobj_obj2cstr(k2);
+  return s1.len == s2.len && !memcmp(s1.data, s2.data, s1.len);
+}
+
+#define FIO_SET_NAME http_file_cache_map
+#define FIO_SET_KEY_TYPE FIOBJ
+#define FIO_SET_KEY_COMPARE(k1, k2) http_file_cache_key_eq((k1), (k2))
+#define FIO_SET_KEY_COPY(dest, k) ((dest) = (k)) /* ownership moves in */
+#define FIO_SET_KEY_DESTROY(k) fiobj_free((k))
+#define FIO_SET_OBJ_TYPE http_file_cache_entry_s *
+#define FIO_SET_OBJ_DESTROY(o) http_file_cache_entry_free((o))
+#include <fio.h>
+
+/* maps inotify watch descriptors to their (watched) directory */
+#define FIO_SET_NAME http_file_cache_watch_map
+#define FIO_SET_KEY_TYPE uintptr_t
+#define FIO_SET_OBJ_TYPE FIOBJ
+#define FIO_SET_OBJ_DESTROY(o) fiobj_free((o))
+#include <fio.h>
+
+/* maps watched directories to their watch descriptor */
+#define FIO_SET_NAME http_file_cache_dir_map
+#define FIO_SET_KEY_TYPE FIOBJ
+#define FIO_SET_KEY_COMPARE(k1, k2) http_file_cache_key_eq((k1), (k2))
+#define FIO_SET_KEY_COPY(dest, k) ((dest) = (k)) /* ownership moves in */
+#define FIO_SET_KEY_DESTROY(k) fiobj_free((k))
+#define FIO_SET_OBJ_TYPE uintptr_t
+#include <fio.h>
+
+static fio_lock_i http_file_cache_lock = FIO_LOCK_INIT;
+static http_file_cache_map_s http_file_cache = FIO_SET_INIT;
+static http_file_cache_watch_map_s http_file_cache_watches = FIO_SET_INIT;
+static http_file_cache_dir_map_s http_file_cache_dirs = FIO_SET_INIT;
+/* incremented whenever entries are invalidated, prevents racing inserts */
+static volatile size_t http_file_cache_generation = 0;
+
+#define HTTP_FILE_CACHE_HASH(s) FIO_HASH_FN((s).data, (s).len, 0, 0)
+
+/** Removes a path from the cache. Call within the lock. */
+static void http_file_cache_forget_unsafe(fio_str_info_s path) {
+  FIOBJ key = fiobj_str_new(path.data, path.len);
+  http_file_cache_map_remove(&http_file_cache, HTTP_FILE_CACHE_HASH(path), key,
+                             NULL);
+  fiobj_free(key);
+}
+
+/** Removes all the entries from the cache. Call within the lock. */
+static void http_file_cache_clear_unsafe(void) {
+  http_file_cache_map_free(&http_file_cache);
+  ++http_file_cache_generation;
+}
+
+/* *****************************************************************************
+inotify invalidation
+***************************************************************************** */
+
+#if HTTP_FILE_CACHE_INOTIFY
+
+#define HTTP_FILE_CACHE_WATCH_MASK                                             \
+  (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |            \
+   IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+static intptr_t http_file_cache_inotify = -1;
+static uint8_t http_file_cache_inotify_failed = 0;
+/* the process owning the inotify connection (workers inherit a closed copy) */
+static pid_t http_file_cache_inotify_pid = 0;
+
+static void http_file_cache_on_event(struct inotify_event *e) {
+  if ((e->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF)) ||
+      ((e->mask & IN_ISDIR) && (e->mask & (IN_MOVED_FROM | IN_MOVED_TO)))) {
+    /* the tree changed shape (or events were lost), start fresh */
+    http_file_cache_clear_unsafe();
+    return;
+  }
+  if ((e->mask & IN_IGNORED)) {
+    /* the watch is gone (the kernel removed it) */
+    FIOBJ dir = http_file_cache_watch_map_find(
+        &http_file_cache_watches, (uintptr_t)e->wd + 1, (uintptr_t)e->wd);
+    if (dir)
+      http_file_cache_dir_map_remove(
+          &http_file_cache_dirs, HTTP_FILE_CACHE_HASH(fiobj_obj2cstr(dir)),
+          dir, NULL);
+    http_file_cache_watch_map_remove(&http_file_cache_watches,
+                                     (uintptr_t)e->wd + 1, (uintptr_t)e->wd,
+                                     NULL);
+    http_file_cache_clear_unsafe();
+    return;
+  }
+  if (!e->len)
+    return;
+  FIOBJ dir = http_file_cache_watch_map_find(
+      &http_file_cache_watches, (uintptr_t)e->wd + 1, (uintptr_t)e->wd);
+  if (!dir)
+    return;
+  fio_str_info_s d = fiobj_obj2cstr(dir);
+  char buf[PATH_MAX];
+  size_t name_len = strlen(e->name);
+  if (d.len + name_len + 2 > sizeof(buf)) {
+    http_file_cache_clear_unsafe();
+    return;
+  }
+  memcpy(buf, d.data, d.len);
+  buf[d.len] = '/';
+  memcpy(buf + d.len + 1, e->name, name_len);
+  http_file_cache_forget_unsafe(
+      (fio_str_info_s){.data = buf, .len = d.len + 1 + name_len});
+  ++http_file_cache_generation;
+}
+
+static void http_file_cache_on_data(intptr_t uuid, fio_protocol_s *pr) {
+  char buf[4096]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+  while ((len = read(fio_uuid2fd(uuid), buf, sizeof(buf))) > 0) {
+    fio_lock(&http_file_cache_lock);
+    for (char *pos = buf; pos < buf + len;) {
+      struct inotify_event *e = (struct inotify_event *)pos;
+      http_file_cache_on_event(e);
+      pos += sizeof(*e) + e->len;
+    }
+    fio_unlock(&http_file_cache_lock);
+  }
+  (void)pr;
+}
+
+static void http_file_cache_on_close(intptr_t uuid, fio_protocol_s *pr) {
+  if (getpid() != http_file_cache_inotify_pid)
+    return; /* closed by a forked worker, the inherited entries are kept */
+  fio_lock(&http_file_cache_lock);
+  if (uuid == http_file_cache_inotify) {
+    http_file_cache_inotify = -1;
+    http_file_cache_watch_map_free(&http_file_cache_watches);
+    http_file_cache_dir_map_free(&http_file_cache_dirs);
+    http_file_cache_clear_unsafe();
+  }
+  fio_unlock(&http_file_cache_lock);
+  (void)pr;
+}
+
+static void http_file_cache_ping(intptr_t uuid, fio_protocol_s *pr) {
+  fio_touch(uuid);
+  (void)pr;
+}
+
+static fio_protocol_s http_file_cache_protocol = {
+    .on_data = http_file_cache_on_data,
+    .on_close = http_file_cache_on_close,
+    .ping = http_file_cache_ping,
+};
+
+/**
+ * Watches the directory containing `path`.
+ *
+ * Returns -1 if the path can't be watched (the entry will use a short TTL).
+ */
+static int http_file_cache_watch(fio_str_info_s path) {
+  size_t dir_len = path.len;
+  while (dir_len && path.data[dir_len - 1] != '/')
+    --dir_len;
+  if (dir_len > 1)
+    --dir_len; /* remove trailing '/' */
+  char dir[PATH_MAX];
+  if (!dir_len || dir_len >= sizeof(dir))
+    return -1;
+  memcpy(dir, path.data, dir_len);
+  dir[dir_len] = 0;
+  FIOBJ key = fiobj_str_new(dir, dir_len);
+  const uint64_t hash = HTTP_FILE_CACHE_HASH(((fio_str_info_s){
+      .data = dir, .len = dir_len}));
+
+  fio_lock(&http_file_cache_lock);
+  if (http_file_cache_inotify != -1 &&
+      http_file_cache_dir_map_find(&http_file_cache_dirs, hash, key)) {
+    /* already watched */
+    fio_unlock(&http_file_cache_lock);
+    fiobj_free(key);
+    return 0;
+  }
+  if (http_file_cache_inotify == -1 && !http_file_cache_inotify_failed) {
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == -1) {
+      http_file_cache_inotify_failed = 1;
+      FIO_LOG_WARNING("(HTTP) static file cache couldn't initialize inotify, "
+                      "using a %d second TTL.",
+                      HTTP_FILE_CACHE_SHORT_TTL);
+    } else {
+      fio_attach_fd(fd, &http_file_cache_protocol);
+      http_file_cache_inotify = fio_fd2uuid(fd);
+      http_file_cache_inotify_pid = getpid();
+    }
+  }
+  intptr_t uuid = http_file_cache_inotify;
+  fio_unlock(&http_file_cache_lock);
+  if (uuid == -1)
+    goto error;
+
+  int wd =
+      inotify_add_watch(fio_uuid2fd(uuid), dir, HTTP_FILE_CACHE_WATCH_MASK);
+  if (wd == -1)
+    goto error;
+  fio_lock(&http_file_cache_lock);
+  if (uuid == http_file_cache_inotify &&
+      !http_file_cache_dir_map_find(&http_file_cache_dirs, hash, key)) {
+    if (!http_file_cache_watch_map_find(&http_file_cache_watches,
+                                        (uintptr_t)wd + 1, (uintptr_t)wd))
+      http_file_cache_watch_map_insert(&http_file_cache_watches,
+                                       (uintptr_t)wd + 1, (uintptr_t)wd,
+                                       fiobj_dup(key), NULL);
+    http_file_cache_dir_map_insert(&http_file_cache_dirs, hash, key,
+                                   (uintptr_t)wd, NULL);
+    key = FIOBJ_INVALID; /* owned by the map */
+  }
+  fio_unlock(&http_file_cache_lock);
+  fiobj_free(key);
+  return 0;
+error:
+  fiobj_free(key);
+  return -1;
+}
+
+static void http_file_cache_inotify_reset(void) {
+  /* the reactor closes the inherited inotify connection after a fork */
+  http_file_cache_inotify = -1;
+  http_file_cache_inotify_failed = 0;
+  http_file_cache_watch_map_free(&http_file_cache_watches);
+  http_file_cache_dir_map_free(&http_file_cache_dirs);
+}
+
+#else /* HTTP_FILE_CACHE_INOTIFY */
+
+static int http_file_cache_watch(fio_str_info_s path) {
+  return -1;
+  (void)path;
+}
+
+static void http_file_cache_inotify_reset(void) {}
+
+#endif /* HTTP_FILE_CACHE_INOTIFY */
+
+/* *****************************************************************************
+Cache API
+***************************************************************************** */
+
+/** Tests if the file at `path` is still the one held by the entry. */
+static int http_file_cache_entry_is_fresh(http_file_cache_entry_s *e,
+                                          const char *path) {
+  struct stat st;
+  return !stat(path, &st) && S_ISREG(st.st_mode) && st.st_dev == e->dev &&
+         st.st_ino == e->ino && st.st_size == e->file.size &&
+         st.st_mtime == e->file.mtime && st.st_ctime == e->ctime;
+}
+
+/**
+ * Collects the file's data (a cached "miss" if it isn't a regular file).
+ *
+ * Unless `watch` is set, the directory isn't watched and the entry is created
+ * expired, so it's revalidated (and watched) when first used.
+ */
+static http_file_cache_entry_s *
+http_file_cache_entry_new(fio_str_info_s path, uint8_t watch) {
+  http_file_cache_entry_s *e = fio_malloc(sizeof(*e));
+  FIO_ASSERT_ALLOC(e);
+  *e = (http_file_cache_entry_s){.file = {.fd = -1}, .ref = 1};
+  e->short_ttl = (watch && http_file_cache_watch(path) != 0);
+
+  struct stat st;
+  int fd = open(path.data, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    goto finish;
+  if (fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+    close(fd);
+    goto finish;
+  }
+  e->file.fd = fd;
+  e->file.size = st.st_size;
+  e->file.mtime = st.st_mtime;
+  e->ctime = st.st_ctime;
+  e->dev = st.st_dev;
+  e->ino = st.st_ino;
+  /* symlink targets might live outside the watched directory */
+  if (!e->short_ttl && !lstat(path.data, &st) && S_ISLNK(st.st_mode))
+    e->short_ttl = 1;
+
+  if (e->file.size && e->file.size <= HTTP_FILE_CACHE_BODY_LIMIT) {
+    char *data = fio_malloc(e->file.size);
+    FIO_ASSERT_ALLOC(data);
+    if (pread(fd, data, e->file.size, 0) == e->file.size)
+      e->file.data = data;
+    else
+      fio_free(data); /* the file is changing, don't keep a partial copy */
+  }
+
+  e->file.etag = fiobj_str_buf(32);
+  fiobj_str_printf(e->file.etag, "%lx-%llx", (unsigned long)e->file.mtime,
+                   (unsigned long long)e->file.size);
+  fiobj_str_freeze(e->file.etag);
+  e->file.last_modified = fiobj_str_buf(32);
+  fiobj_str_resize(
+      e->file.last_modified,
+      http_time2str(fiobj_obj2cstr(e->file.last_modified).data, e->file.mtime));
+  fiobj_str_freeze(e->file.last_modified);
+
+  /* find the last two extensions: `name.type.encoding` */
+  size_t ext[2] = {0, 0};
+  for (size_t pos = path.len, i = 0; pos && i < 2 && path.data[pos - 1] != '/';
+       --pos) {
+    if (path.data[pos - 1] == '.')
+      ext[i++] = pos;
+  }
+  if (ext[0]) {
+    e->file.content_type =
+        http_mimetype_find(path.data + ext[0], path.len - ext[0]);
+    e->file.encoded_etag = fiobj_str_copy(e->file.etag);
+    fiobj_str_write(e->file.encoded_etag, "-", 1);
+    fiobj_str_write(e->file.encoded_etag, path.data + ext[0],
+                    path.len - ext[0]);
+    fiobj_str_freeze(e->file.encoded_etag);
+  } else {
+    e->file.encoded_etag = fiobj_dup(e->file.etag);
+  }
+  if (ext[1])
+    e->file.encoded_type =
+        http_mimetype_find(path.data + ext[1], ext[0] - 1 - ext[1]);
+finish:
+  if (watch)
+    e->expires = fio_last_tick().tv_sec + (e->short_ttl
+                                               ? HTTP_FILE_CACHE_SHORT_TTL
+                                               : HTTP_FILE_CACHE_TTL);
+  return e;
+}
+
+/**
+ * Adds (or replaces) the entry, evicting the oldest entry when the cache is
+ * full. The cache takes a reference. Call within the lock.
+ */
+static void http_file_cache_insert_unsafe(fio_str_info_s path, uint64_t hash,
+                                          http_file_cache_entry_s *e) {
+  FIOBJ key = fiobj_str_new(path.data, path.len);
+  uint8_t exists = (http_file_cache_map_find(&http_file_cache, hash, key) !=
+                    NULL);
+  if (!exists &&
+      http_file_cache_map_count(&http_file_cache) >= HTTP_FILE_CACHE_LIMIT) {
+    /* evict the oldest entry */
+    FIO_SET_FOR_LOOP(&http_file_cache, pos) {
+      if (!pos->hash)
+        continue;
+      http_file_cache_map_remove(&http_file_cache, pos->hash, pos->obj.key,
+                                 NULL);
+      break;
+    }
+  }
+  fio_atomic_add(&e->ref, 1);
+  http_file_cache_map_insert(&http_file_cache, hash, key, e, NULL);
+  if (exists)
+    fiobj_free(key); /* the existing key is kept, only the entry is replaced */
+}
+
+/**
+ * Returns a cached file for the (NUL terminated) path or NULL if the path
+ * isn't a regular file.
+ */
+http_file_s *http_file_cache_get(FIOBJ path) {
+  fio_str_info_s s = fiobj_obj2cstr(path);
+  const uint64_t hash = HTTP_FILE_CACHE_HASH(s);
+  const time_t now = fio_last_tick().tv_sec;
+  http_file_cache_entry_s *e;
+  size_t generation;
+
+  fio_lock(&http_file_cache_lock);
+  e = http_file_cache_map_find(&http_file_cache, hash, path);
+  if (e && (e->expires > now || e->file.fd != -1))
+    fio_atomic_add(&e->ref, 1);
+  else
+    e = NULL;
+  generation = http_file_cache_generation;
+  fio_unlock(&http_file_cache_lock);
+
+  if (e) {
+    if (e->expires > now)
+      goto found;
+    /* expired: revalidate using a single `stat`, keeping the descriptor and
+     * in-memory data if unchanged */
+    uint8_t short_ttl = e->short_ttl || http_file_cache_watch(s);
+    if (http_file_cache_entry_is_fresh(e, s.data)) {
+      fio_lock(&http_file_cache_lock);
+      if (generation == http_file_cache_generation)
+        e->expires = now + (short_ttl ? HTTP_FILE_CACHE_SHORT_TTL
+                                      : HTTP_FILE_CACHE_TTL);
+      fio_unlock(&http_file_cache_lock);
+      goto found;
+    }
+    http_file_cache_entry_free(e);
+  }
+
+  /* collect file data outside the lock */
+  e = http_file_cache_entry_new(s, 1);
+
+  fio_lock(&http_file_cache_lock);
+  if (generation == http_file_cache_generation)
+    http_file_cache_insert_unsafe(s, hash, e);
+  fio_unlock(&http_file_cache_lock);
+
+found:
+  if (e->file.fd == -1) {
+    http_file_cache_entry_free(e);
+    return NULL;
+  }
+  return &e->file;
+}
+
+/** Releases a file returned by `http_file_cache_get`. */
+void http_file_cache_release(http_file_s *file) {
+  http_file_cache_entry_free(http_file2entry(file));
+}
+
+/** Clears the cache, closing any file descriptors it holds. */
+void http_file_cache_clear(void) {
+  fio_lock(&http_file_cache_lock);
+  http_file_cache_clear_unsafe();
+  fio_unlock(&http_file_cache_lock);
+}
+
+/* adds the small files in the (NUL terminated) folder, see `preload` */
+static void http_file_cache_preload_folder(char *path, size_t len,
+                                           size_t *count) {
+  DIR *dir = opendir(path);
+  if (!dir)
+    return;
+  struct dirent *d;
+  while (*count < (HTTP_FILE_CACHE_LIMIT >> 1) && (d = readdir(dir))) {
+    /* skip hidden files and folders (including "." and "..") */
+    if (d->d_name[0] == '.')
+      continue;
+    size_t name_len = strlen(d->d_name);
+    if (len + name_len + 2 > PATH_MAX)
+      continue;
+    path[len] = '/';
+    memcpy(path + len + 1, d->d_name, name_len + 1);
+    struct stat st;
+    if (lstat(path, &st))
+      continue;
+    if (S_ISDIR(st.st_mode)) {
+      /* symlinked folders aren't followed (lstat), so there are no loops */
+      http_file_cache_preload_folder(path, len + 1 + name_len, count);
+      continue;
+    }
+    if (stat(path, &st) || !S_ISREG(st.st_mode) || !st.st_size ||
+        st.st_size > HTTP_FILE_CACHE_BODY_LIMIT)
+      continue;
+    fio_str_info_s s = {.data = path, .len = len + 1 + name_len};
+    http_file_cache_entry_s *e = http_file_cache_entry_new(s, 0);
+    if (e->file.fd != -1) {
+      fio_lock(&http_file_cache_lock);
+      http_file_cache_insert_unsafe(s, HTTP_FILE_CACHE_HASH(s), e);
+      fio_unlock(&http_file_cache_lock);
+      ++*count;
+    }
+    http_file_cache_entry_free(e);
+  }
+  closedir(dir);
+  path[len] = 0;
+}
+
+/** Adds the folder's small files to the cache, see `http_file_cache.h`. */
+size_t http_file_cache_preload(const char *folder, size_t len) {
+  char path[PATH_MAX];
+  size_t count = 0;
+  while (len > 1 && folder[len - 1] == '/')
+    --len; /* request paths start with a '/' */
+  if (!len || len >= sizeof(path))
+    return 0;
+  memcpy(path, folder, len);
+  path[len] = 0;
+  http_file_cache_preload_folder(path, len, &count);
+  FIO_LOG_DEBUG("(HTTP) preloaded %zu static files from %s", count, path);
+  return count;
+}
+
+/* *****************************************************************************
+Lifetime
+***************************************************************************** */
+
+static void http_file_cache_on_fork(void *ignr_) {
+  http_file_cache_lock = FIO_LOCK_INIT;
+  http_file_cache_inotify_reset();
+  /* keep the inherited (copy-on-write) entries, but the parent's watches don't
+   * apply to this process, so each entry is revalidated (and watched) once */
+  FIO_SET_FOR_LOOP(&http_file_cache, pos) {
+    if (pos->hash)
+      pos->obj.obj->expires = 0;
+  }
+  (void)ignr_;
+}
+
+static void http_file_cache_cleanup(void *ignr_) {
+  http_file_cache_clear_unsafe();
+  http_file_cache_inotify_reset();
+  (void)ignr_;
+}
+
+static __attribute__((constructor)) void http_file_cache_constructor(void) {
+  fio_state_callback_add(FIO_CALL_IN_CHILD, http_file_cache_on_fork, NULL);
+  fio_state_callback_add(FIO_CALL_AT_EXIT, http_file_cache_cleanup, NULL);
+}
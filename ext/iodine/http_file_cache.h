@@ -0,0 +1,101 @@
+/*
+Copyright: Boaz Segev, 2016-2019
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+#ifndef H_HTTP_FILE_CACHE_H
+#define H_HTTP_FILE_CACHE_H
+
+#include <fiobj.h>
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#ifndef HTTP_FILE_CACHE_LIMIT
+/** The maximum number of paths (including missing ones) held by the cache. */
+#define HTTP_FILE_CACHE_LIMIT 1024
+#endif
+
+#ifndef HTTP_FILE_CACHE_TTL
+/** Seconds an entry is trusted while inotify watches its directory. */
+#define HTTP_FILE_CACHE_TTL 60
+#endif
+
+#ifndef HTTP_FILE_CACHE_BODY_LIMIT
+/** Files up to this size are kept in memory (`http_file_s.data`). */
+#define HTTP_FILE_CACHE_BODY_LIMIT (64 * 1024)
+#endif
+
+#ifndef HTTP_FILE_CACHE_SHORT_TTL
+/** Seconds an entry is trusted when it can't be watched (or is a symlink). */
+#define HTTP_FILE_CACHE_SHORT_TTL 2
+#endif
+
+/**
+ * A cached static file.
+ *
+ * The `fd` is shared by all concurrent responses and is only ever read using
+ * explicit offsets (`pread` / `sendfile`), so it MUST be `dup`ed before being
+ * handed to anything that closes it.
+ *
+ * The header values are shared as well and should be `fiobj_dup`ed.
+ *
+ * Small files (see `HTTP_FILE_CACHE_BODY_LIMIT`) are also held in memory, so
+ * they can be sent without touching the file system.
+ */
+typedef struct {
+  /** the file's size. */
+  off_t size;
+  /** the file's modification time. */
+  time_t mtime;
+  /** the file's content, if it's small enough to be kept in memory. */
+  const char *data;
+  /** a shared read-only file descriptor. */
+  int fd;
+  /** the preformatted ETag header value. */
+  FIOBJ etag;
+  /** the preformatted Last-Modified header value. */
+  FIOBJ last_modified;
+  /** the Content-Type header value (may be FIOBJ_INVALID). */
+  FIOBJ content_type;
+  /**
+   * The ETag header value for a pre-compressed variant (i.e., `style.css.br`),
+   * with the encoding (the last extension) folded in.
+   */
+  FIOBJ encoded_etag;
+  /**
+   * The Content-Type header value for a pre-compressed variant, ignoring the
+   * last extension (may be FIOBJ_INVALID).
+   */
+  FIOBJ encoded_type;
+} http_file_s;
+
+/**
+ * Returns a cached file for the (NUL terminated) path or NULL if the path
+ * isn't a regular file.
+ *
+ * A non-NULL result MUST be released using `http_file_cache_release`.
+ */
+http_file_s *http_file_cache_get(FIOBJ path);
+
+/** Releases a file returned by `http_file_cache_get`. */
+void http_file_cache_release(http_file_s *file);
+
+/** Clears the cache, closing any file descriptors it holds. */
+void http_file_cache_clear(void);
+
+/**
+ * Adds the small files (see `HTTP_FILE_CACHE_BODY_LIMIT`) found in the folder
+ * and its (non hidden) sub-folders to the cache, up to half the cache's limit.
+ *
+ * When called before forking, workers share the entries (including the files'
+ * in-memory data) using copy-on-write. Each worker revalidates an entry (a
+ * single `stat`) and watches its directory when the entry is first used.
+ *
+ * Returns the number of files added.
+ */
+size_t http_file_cache_preload(const char *folder, size_t len);
+
+#endif
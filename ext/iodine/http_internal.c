@@ -34,6 +34,20 @@ void http_on_request_handler______internal(http_s *h,
     }
   }
 
+  /* Per-client rate limits */
+  if (settings->limiter) {
+    size_t wait = http_limiter_request(settings->limiter, h);
+    if (wait) {
+      char buf[32];
+      size_t len = fio_ltoa(buf, wait, 10);
+      http_set_header2(
+          h, (fio_str_info_s){.data = (char *)"retry-after", .len = 11},
+          (fio_str_info_s){.data = buf, .len = len});
+      http_send_error(h, 429);
+      return;
+    }
+  }
+
   /* Static file handling */
   if (settings->public_folder &&
       (fiobj_obj2cstr(h->method).len != 4 || strncasecmp("post", fiobj_obj2cstr(h->method).data, 4))) {
@@ -82,6 +96,8 @@ int http_send_error2(size_t error, intptr_t uuid, http_settings_s *settings) {
   FIO_ASSERT_ALLOC(r);
   FIO_ASSERT(pr, "Couldn't allocate response object for error report.")
   http_s_new(r, (http_fio_protocol_s *)pr, http1_vtable());
+  /* no request was parsed, a method marks the handle as a server response */
+  r->method = fiobj_str_new("GET", 3);
   int ret = http_send_error(r, error);
   fio_close(uuid);
   return ret;
@@ -106,10 +122,15 @@ FIOBJ HTTP_HEADER_HOST;
 FIOBJ HTTP_HEADER_LAST_MODIFIED;
 FIOBJ HTTP_HEADER_ORIGIN;
 FIOBJ HTTP_HEADER_SET_COOKIE;
+FIOBJ HTTP_HEADER_TRANSFER_ENCODING;
 FIOBJ HTTP_HEADER_UPGRADE;
+FIOBJ HTTP_HEADER_VARY;
 FIOBJ HTTP_HEADER_WS_SEC_CLIENT_KEY;
 FIOBJ HTTP_HEADER_WS_SEC_KEY;
+FIOBJ HTTP_HVALUE_ACCEPT_ENCODING;
 FIOBJ HTTP_HVALUE_BYTES;
+FIOBJ HTTP_HVALUE_BROTLI;
+FIOBJ HTTP_HVALUE_CHUNKED;
 FIOBJ HTTP_HVALUE_CLOSE;
 FIOBJ HTTP_HVALUE_CONTENT_TYPE_DEFAULT;
 FIOBJ HTTP_HVALUE_GZIP;
@@ -121,6 +142,7 @@ FIOBJ HTTP_HVALUE_WEBSOCKET;
 FIOBJ HTTP_HVALUE_WS_SEC_VERSION;
 FIOBJ HTTP_HVALUE_WS_UPGRADE;
 FIOBJ HTTP_HVALUE_WS_VERSION;
+FIOBJ HTTP_HVALUE_ZSTD;
 
 static void http_lib_init(void *ignr_);
 static void http_lib_cleanup(void *ignr_);
@@ -152,10 +174,15 @@ static void http_lib_cleanup(void *ignr_) {
   HTTPLIB_RESET(HTTP_HEADER_LAST_MODIFIED);
   HTTPLIB_RESET(HTTP_HEADER_ORIGIN);
   HTTPLIB_RESET(HTTP_HEADER_SET_COOKIE);
+  HTTPLIB_RESET(HTTP_HEADER_TRANSFER_ENCODING);
   HTTPLIB_RESET(HTTP_HEADER_UPGRADE);
+  HTTPLIB_RESET(HTTP_HEADER_VARY);
   HTTPLIB_RESET(HTTP_HEADER_WS_SEC_CLIENT_KEY);
   HTTPLIB_RESET(HTTP_HEADER_WS_SEC_KEY);
+  HTTPLIB_RESET(HTTP_HVALUE_ACCEPT_ENCODING);
   HTTPLIB_RESET(HTTP_HVALUE_BYTES);
+  HTTPLIB_RESET(HTTP_HVALUE_BROTLI);
+  HTTPLIB_RESET(HTTP_HVALUE_CHUNKED);
   HTTPLIB_RESET(HTTP_HVALUE_CLOSE);
   HTTPLIB_RESET(HTTP_HVALUE_CONTENT_TYPE_DEFAULT);
   HTTPLIB_RESET(HTTP_HVALUE_GZIP);
@@ -167,6 +194,7 @@ static void http_lib_cleanup(void *ignr_) {
   HTTPLIB_RESET(HTTP_HVALUE_WS_SEC_VERSION);
   HTTPLIB_RESET(HTTP_HVALUE_WS_UPGRADE);
   HTTPLIB_RESET(HTTP_HVALUE_WS_VERSION);
+  HTTPLIB_RESET(HTTP_HVALUE_ZSTD);
 
 #undef HTTPLIB_RESET
   http_mimetype_stats();
@@ -193,10 +221,15 @@ static void http_lib_init(void *ignr_) {
   HTTP_HEADER_LAST_MODIFIED = fiobj_str_new("last-modified", 13);
   HTTP_HEADER_ORIGIN = fiobj_str_new("origin", 6);
   HTTP_HEADER_SET_COOKIE = fiobj_str_new("set-cookie", 10);
+  HTTP_HEADER_TRANSFER_ENCODING = fiobj_str_new("transfer-encoding", 17);
   HTTP_HEADER_UPGRADE = fiobj_str_new("upgrade", 7);
+  HTTP_HEADER_VARY = fiobj_str_new("vary", 4);
   HTTP_HEADER_WS_SEC_CLIENT_KEY = fiobj_str_new("sec-websocket-key", 17);
   HTTP_HEADER_WS_SEC_KEY = fiobj_str_new("sec-websocket-accept", 20);
+  HTTP_HVALUE_ACCEPT_ENCODING = fiobj_str_new("accept-encoding", 15);
   HTTP_HVALUE_BYTES = fiobj_str_new("bytes", 5);
+  HTTP_HVALUE_BROTLI = fiobj_str_new("br", 2);
+  HTTP_HVALUE_CHUNKED = fiobj_str_new("chunked", 7);
   HTTP_HVALUE_CLOSE = fiobj_str_new("close", 5);
   HTTP_HVALUE_CONTENT_TYPE_DEFAULT =
       fiobj_str_new("application/octet-stream", 24);
@@ -209,6 +242,7 @@ static void http_lib_init(void *ignr_) {
   HTTP_HVALUE_WS_SEC_VERSION = fiobj_str_new("sec-websocket-version", 21);
   HTTP_HVALUE_WS_UPGRADE = fiobj_str_new("Upgrade", 7);
   HTTP_HVALUE_WS_VERSION = fiobj_str_new("13", 2);
+  HTTP_HVALUE_ZSTD = fiobj_str_new("zstd", 4);
 
   fiobj_obj2hash(HTTP_HEADER_ACCEPT_RANGES);
   fiobj_obj2hash(HTTP_HEADER_CACHE_CONTROL);
@@ -224,10 +258,15 @@ static void http_lib_init(void *ignr_) {
   fiobj_obj2hash(HTTP_HEADER_LAST_MODIFIED);
   fiobj_obj2hash(HTTP_HEADER_ORIGIN);
   fiobj_obj2hash(HTTP_HEADER_SET_COOKIE);
+  fiobj_obj2hash(HTTP_HEADER_TRANSFER_ENCODING);
   fiobj_obj2hash(HTTP_HEADER_UPGRADE);
+  fiobj_obj2hash(HTTP_HEADER_VARY);
   fiobj_obj2hash(HTTP_HEADER_WS_SEC_CLIENT_KEY);
   fiobj_obj2hash(HTTP_HEADER_WS_SEC_KEY);
+  fiobj_obj2hash(HTTP_HVALUE_ACCEPT_ENCODING);
   fiobj_obj2hash(HTTP_HVALUE_BYTES);
+  fiobj_obj2hash(HTTP_HVALUE_BROTLI);
+  fiobj_obj2hash(HTTP_HVALUE_CHUNKED);
   fiobj_obj2hash(HTTP_HVALUE_CLOSE);
   fiobj_obj2hash(HTTP_HVALUE_CONTENT_TYPE_DEFAULT);
   fiobj_obj2hash(HTTP_HVALUE_GZIP);
@@ -239,6 +278,7 @@ static void http_lib_init(void *ignr_) {
   fiobj_obj2hash(HTTP_HVALUE_WS_SEC_VERSION);
   fiobj_obj2hash(HTTP_HVALUE_WS_UPGRADE);
   fiobj_obj2hash(HTTP_HVALUE_WS_VERSION);
+  fiobj_obj2hash(HTTP_HVALUE_ZSTD);
 
 #define REGISTER_MIME(ext, type)                                               \
   http_mimetype_register((char *)ext, sizeof(ext) - 1,                         \
@@ -17,6 +17,9 @@ Feel free to copy, use and enjoy according to the license provided.
 #include <fio.h>
 
 #include <http.h>
+#include <http_compress.h>
+#include <http_limiter.h>
+#include <http_multipart.h>
 
 #ifndef __MINGW32__
 #include <arpa/inet.h>
@@ -54,6 +57,11 @@ struct http_vtable_s {
   void (*http_on_resume)(http_s *, http_fio_protocol_s *);
   /** hijacks the socket aaway from the protocol. */
   intptr_t (*http_hijack)(http_s *h, fio_str_info_s *leftover);
+  /** Reads the remaining request body (early dispatch). */
+  ssize_t (*http_read_body)(http_s *h, void *buffer, size_t length);
+  /** Should send existing headers and data (without copying the data). */
+  int (*http_send_body_nocopy)(http_s *h, void *owner, void *data,
+                               uintptr_t length, void (*dealloc)(void *));
 
   /** Upgrades an HTTP connection to an EventSource (SSE) connection. */
   int (*http_upgrade2sse)(http_s *h, http_sse_s *sse);
@@ -78,7 +86,10 @@ Constants that shouldn't be accessed by the users (`fiobj_dup` required).
 extern FIOBJ HTTP_HEADER_ACCEPT_RANGES;
 extern FIOBJ HTTP_HEADER_WS_SEC_CLIENT_KEY;
 extern FIOBJ HTTP_HEADER_WS_SEC_KEY;
+extern FIOBJ HTTP_HVALUE_ACCEPT_ENCODING;
 extern FIOBJ HTTP_HVALUE_BYTES;
+extern FIOBJ HTTP_HVALUE_BROTLI;
+extern FIOBJ HTTP_HVALUE_CHUNKED;
 extern FIOBJ HTTP_HVALUE_CLOSE;
 extern FIOBJ HTTP_HVALUE_CONTENT_TYPE_DEFAULT;
 extern FIOBJ HTTP_HVALUE_GZIP;
@@ -90,6 +101,7 @@ extern FIOBJ HTTP_HVALUE_WEBSOCKET;
 extern FIOBJ HTTP_HVALUE_WS_SEC_VERSION;
 extern FIOBJ HTTP_HVALUE_WS_UPGRADE;
 extern FIOBJ HTTP_HVALUE_WS_VERSION;
+extern FIOBJ HTTP_HVALUE_ZSTD;
 
 /* *****************************************************************************
 HTTP request/response object management
@@ -124,9 +136,12 @@ static inline void http_s_destroy(http_s *h, uint8_t log) {
   fiobj_free(h->cookies);
   fiobj_free(h->body);
   fiobj_free(h->params);
+  http_multipart_free(h->multipart);
+  /* a streamed response that was never finished (i.e., the client left) */
+  http_compress_stream_free(h->private_data.compressor);
 
   h->fiber = NULL;
-  h->subscription = NULL;
+  h->resume_entry = NULL;
 
   *h = (http_s){
     .private_data.vtbl = h->private_data.vtbl,
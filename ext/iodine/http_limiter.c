@@ -0,0 +1,284 @@
+/*
+Copyright: Boaz Segev, 2016-2019
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+#include <fio.h>
+
+#include <http.h>
+#include <http_limiter.h>
+
+#include <string.h>
+
+/* *****************************************************************************
+Client entries
+***************************************************************************** */
+
+/* bucket tokens are counted in thousandths, so they refill every millisecond */
+#define HTTP_LIMITER_TOKEN 1000
+
+typedef struct {
+  size_t connections;
+  size_t tokens;
+  uint64_t stamp;
+} http_limiter_entry_s;
+
+/** Compares two String keys without relying on (possibly stale) hashes. */
+static inline int http_limiter_key_eq(FIOBJ k1, FIOBJ k2) {
+  fio_str_info_s s1 = fiobj_obj2cstr(k1);
+  fio_str_info_s s2 = fiobj_obj2cstr(k2);
+  return s1.len == s2.len && !memcmp(s1.data, s2.data, s1.len);
+}
+
+#define FIO_SET_NAME http_limiter_map
+#define FIO_SET_KEY_TYPE FIOBJ
+#define FIO_SET_KEY_COMPARE(k1, k2) http_limiter_key_eq((k1), (k2))
+#define FIO_SET_KEY_COPY(dest, k) ((dest) = fiobj_dup((k)))
+#define FIO_SET_KEY_DESTROY(k) fiobj_free((k))
+#define FIO_SET_OBJ_TYPE http_limiter_entry_s *
+#define FIO_SET_OBJ_DESTROY(o) fio_free((o))
+#include <fio.h>
+
+struct http_limiter_s {
+  http_limiter_map_s clients;
+  fio_lock_i lock;
+  volatile size_t ref;
+  size_t max_connections;
+  /* tokens per millisecond (in thousandths == requests per second) */
+  size_t rate;
+  /* the bucket's capacity (in thousandths) */
+  size_t capacity;
+  /* the number of entries that triggers the next sweep */
+  size_t sweep_at;
+  /* the header identifying the client (or 0 for the peer address) */
+  uint64_t header_hash;
+  FIOBJ header;
+};
+
+#define HTTP_LIMITER_HASH(s) FIO_HASH_FN((s).data, (s).len, 0, 0)
+
+static inline uint64_t http_limiter_now(void) {
+  struct timespec t = fio_last_tick();
+  return ((uint64_t)t.tv_sec * 1000) + (t.tv_nsec / 1000000);
+}
+
+/** Refills the client's bucket. Call within the lock. */
+static inline void http_limiter_refill(http_limiter_s *l,
+                                       http_limiter_entry_s *e, uint64_t now) {
+  if (now > e->stamp) {
+    uint64_t elapsed = now - e->stamp;
+    if (elapsed > l->capacity)
+      elapsed = l->capacity; /* avoids overflows, rate is at least 1 */
+    e->tokens += elapsed * l->rate;
+    if (e->tokens > l->capacity)
+      e->tokens = l->capacity;
+  }
+  e->stamp = now;
+}
+
+/** Forgets clients without connections whose bucket is full. */
+static void http_limiter_sweep_unsafe(http_limiter_s *l, uint64_t now) {
+  FIO_SET_FOR_LOOP(&l->clients, pos) {
+    if (!pos->hash)
+      continue;
+    http_limiter_entry_s *e = pos->obj.obj;
+    if (e->connections)
+      continue;
+    if (l->rate) {
+      http_limiter_refill(l, e, now);
+      if (e->tokens < l->capacity)
+        continue;
+    }
+    http_limiter_map_remove(&l->clients, pos->hash, pos->obj.key, NULL);
+  }
+  http_limiter_map_compact(&l->clients);
+  l->sweep_at = http_limiter_map_count(&l->clients) * 2;
+  if (l->sweep_at < HTTP_LIMITER_ENTRIES)
+    l->sweep_at = HTTP_LIMITER_ENTRIES;
+}
+
+/** Finds (or creates) the client's entry. Call within the lock. */
+static http_limiter_entry_s *http_limiter_get_unsafe(http_limiter_s *l,
+                                                     fio_str_info_s client,
+                                                     uint64_t now) {
+  uint64_t hash = HTTP_LIMITER_HASH(client);
+  FIOBJ key = fiobj_str_new(client.data, client.len);
+  http_limiter_entry_s *e = http_limiter_map_find(&l->clients, hash, key);
+  if (!e) {
+    if (http_limiter_map_count(&l->clients) >= l->sweep_at)
+      http_limiter_sweep_unsafe(l, now);
+    e = fio_malloc(sizeof(*e));
+    FIO_ASSERT_ALLOC(e);
+    *e = (http_limiter_entry_s){.tokens = l->capacity, .stamp = now};
+    http_limiter_map_insert(&l->clients, hash, key, e, NULL);
+  }
+  fiobj_free(key);
+  return e;
+}
+
+/* *****************************************************************************
+Connections
+***************************************************************************** */
+
+typedef struct {
+  http_limiter_s *limiter;
+  FIOBJ client;
+} http_limiter_link_s;
+
+/** Called when a counted connection closes. */
+static void http_limiter_on_close(void *link_) {
+  http_limiter_link_s *link = link_;
+  http_limiter_s *l = link->limiter;
+  fio_str_info_s client = fiobj_obj2cstr(link->client);
+  fio_lock(&l->lock);
+  http_limiter_entry_s *e =
+      http_limiter_map_find(&l->clients, HTTP_LIMITER_HASH(client),
+                            link->client);
+  if (e && e->connections && !--e->connections && !l->rate)
+    http_limiter_map_remove(&l->clients, HTTP_LIMITER_HASH(client),
+                            link->client, NULL);
+  fio_unlock(&l->lock);
+  fiobj_free(link->client);
+  fio_free(link);
+  http_limiter_free(l);
+}
+
+/**
+ * Counts a new connection for its peer address.
+ *
+ * Returns -1 (without counting the connection) if the peer is at capacity.
+ * Otherwise the connection is counted until it's closed.
+ */
+int http_limiter_connect(http_limiter_s *l, intptr_t uuid) {
+  if (!l || !l->max_connections)
+    return 0;
+  fio_str_info_s client = fio_peer_addr(uuid);
+  if (!client.len)
+    return 0; /* Unix sockets */
+  fio_lock(&l->lock);
+  http_limiter_entry_s *e =
+      http_limiter_get_unsafe(l, client, http_limiter_now());
+  if (e->connections >= l->max_connections) {
+    fio_unlock(&l->lock);
+    return -1;
+  }
+  ++e->connections;
+  fio_unlock(&l->lock);
+
+  http_limiter_link_s *link = fio_malloc(sizeof(*link));
+  FIO_ASSERT_ALLOC(link);
+  fio_atomic_add(&l->ref, 1);
+  *link = (http_limiter_link_s){
+      .limiter = l,
+      .client = fiobj_str_new(client.data, client.len),
+  };
+  fio_uuid_link(uuid, link, http_limiter_on_close);
+  return 0;
+}
+
+/* *****************************************************************************
+Requests
+***************************************************************************** */
+
+/** Returns the client's identity (the last proxy entry or peer address). */
+static fio_str_info_s http_limiter_client(http_limiter_s *l, http_s *h) {
+  if (l->header_hash) {
+    FIOBJ value = fiobj_hash_get2(h->headers, l->header_hash);
+    if (FIOBJ_TYPE_IS(value, FIOBJ_T_ARRAY))
+      value = fiobj_ary_index(value, -1);
+    fio_str_info_s s = fiobj_obj2cstr(value);
+    if (s.len) {
+      /* the last address was set by the (trusted) closest proxy */
+      while (s.len && (s.data[s.len - 1] == ' ' || s.data[s.len - 1] == ','))
+        --s.len;
+      size_t start = s.len;
+      while (start && s.data[start - 1] != ',')
+        --start;
+      while (start < s.len && s.data[start] == ' ')
+        ++start;
+      s.data += start;
+      s.len -= start;
+      if (s.len)
+        return s;
+    }
+  }
+  return http_peer_addr(h);
+}
+
+/**
+ * Takes a token from the client's bucket.
+ *
+ * Returns 0 if the request is allowed, otherwise the number of seconds until
+ * the client may retry (for the `Retry-After` header).
+ */
+size_t http_limiter_request(http_limiter_s *l, http_s *h) {
+  if (!l || !l->rate)
+    return 0;
+  fio_str_info_s client = http_limiter_client(l, h);
+  if (!client.len)
+    return 0;
+  size_t wait = 0;
+  uint64_t now = http_limiter_now();
+  fio_lock(&l->lock);
+  http_limiter_entry_s *e = http_limiter_get_unsafe(l, client, now);
+  http_limiter_refill(l, e, now);
+  if (e->tokens >= HTTP_LIMITER_TOKEN) {
+    e->tokens -= HTTP_LIMITER_TOKEN;
+  } else {
+    /* milliseconds until a token is available, rounded up to seconds */
+    wait = (HTTP_LIMITER_TOKEN - e->tokens + l->rate - 1) / l->rate;
+    wait = (wait + 999) / 1000;
+    if (!wait)
+      wait = 1;
+  }
+  fio_unlock(&l->lock);
+  return wait;
+}
+
+/* *****************************************************************************
+Lifetime
+***************************************************************************** */
+
+/**
+ * Creates a limiter, returning NULL if all the limits are disabled (0).
+ *
+ * `rate` is the number of requests per second and `burst` the bucket's size
+ * (defaults to `rate`). The `header` (if any) must be a lower case header name.
+ */
+http_limiter_s *http_limiter_new(size_t max_connections, size_t rate,
+                                 size_t burst, const char *header) {
+  if (!max_connections && !rate)
+    return NULL;
+  if (burst < 1)
+    burst = rate ? rate : 1;
+  http_limiter_s *l = fio_malloc(sizeof(*l));
+  FIO_ASSERT_ALLOC(l);
+  *l = (http_limiter_s){
+      .clients = FIO_SET_INIT,
+      .lock = FIO_LOCK_INIT,
+      .ref = 1,
+      .max_connections = max_connections,
+      .rate = rate,
+      .capacity = burst * HTTP_LIMITER_TOKEN,
+      .sweep_at = HTTP_LIMITER_ENTRIES,
+  };
+  if (rate && header && header[0]) {
+    l->header = fiobj_str_new(header, strlen(header));
+    fio_str_info_s s = fiobj_obj2cstr(l->header);
+    for (size_t i = 0; i < s.len; ++i)
+      if (s.data[i] >= 'A' && s.data[i] <= 'Z')
+        s.data[i] |= 32;
+    l->header_hash = fiobj_hash_string(s.data, s.len);
+  }
+  return l;
+}
+
+/** Releases the limiter (counters are freed once all connections close). */
+void http_limiter_free(http_limiter_s *l) {
+  if (!l || fio_atomic_sub(&l->ref, 1))
+    return;
+  http_limiter_map_free(&l->clients);
+  fiobj_free(l->header);
+  fio_free(l);
+}
@@ -0,0 +1,59 @@
+/*
+Copyright: Boaz Segev, 2016-2019
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+#ifndef H_HTTP_LIMITER_H
+#define H_HTTP_LIMITER_H
+
+#include <fio.h>
+#include <http.h>
+
+#include <stdint.h>
+
+#ifndef HTTP_LIMITER_ENTRIES
+/** The number of clients tracked before idle clients are forgotten. */
+#define HTTP_LIMITER_ENTRIES 65536
+#endif
+
+/**
+ * Per-client connection caps and request rate limits (a token bucket per
+ * client), enforced before a request reaches the `on_request` callback.
+ *
+ * Clients are identified by their peer address or, for request rates, by a
+ * header set by a trusted proxy (i.e., `x-forwarded-for`).
+ *
+ * Each process keeps its own counters.
+ */
+typedef struct http_limiter_s http_limiter_s;
+
+/**
+ * Creates a limiter, returning NULL if all the limits are disabled (0).
+ *
+ * `rate` is the number of requests per second and `burst` the bucket's size
+ * (defaults to `rate`). The `header` (if any) must be a lower case header name.
+ */
+http_limiter_s *http_limiter_new(size_t max_connections, size_t rate,
+                                 size_t burst, const char *header);
+
+/** Releases the limiter (counters are freed once all connections close). */
+void http_limiter_free(http_limiter_s *l);
+
+/**
+ * Counts a new connection for its peer address.
+ *
+ * Returns -1 (without counting the connection) if the peer is at capacity.
+ * Otherwise the connection is counted until it's closed.
+ */
+int http_limiter_connect(http_limiter_s *l, intptr_t uuid);
+
+/**
+ * Takes a token from the client's bucket.
+ *
+ * Returns 0 if the request is allowed, otherwise the number of seconds until
+ * the client may retry (for the `Retry-After` header).
+ */
+size_t http_limiter_request(http_limiter_s *l, http_s *h);
+
+#endif
@@ -0,0 +1,268 @@
+/*
+Copyright: Boaz Segev, 2016-2019
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+#include <fio.h>
+
+#include <http_log.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* *****************************************************************************
+State
+***************************************************************************** */
+
+static struct {
+  /* protects `pending` and `len` (held only while copying a line) */
+  fio_lock_i lock;
+  /* protects the target and the `writing` buffer */
+  fio_lock_i output_lock;
+  /* protects the writer thread's lifetime */
+  fio_lock_i thread_lock;
+  char *pending;
+  size_t len;
+  char *writing;
+  volatile size_t dropped;
+  size_t reported;
+  /* the target (-1 for stderr) */
+  int fd;
+  uint8_t dgram;
+  uint8_t json;
+  uint8_t block;
+  /* the writer thread was started (or skipped) in this process */
+  volatile uint8_t started;
+  /* the writer thread is running */
+  volatile uint8_t running;
+  pthread_t thread;
+  struct sockaddr_un addr;
+} http_log = {.fd = -1};
+
+/* *****************************************************************************
+Output (performed by the writer thread)
+***************************************************************************** */
+
+/** Sends each line as a datagram (without the line's EOL marker). */
+static void http_log_output_dgram(const char *data, size_t len) {
+  while (len) {
+    const char *eol = memchr(data, '\n', len);
+    size_t line = eol ? (size_t)(eol - data) + 1 : len;
+    size_t payload = line;
+    while (payload && (data[payload - 1] == '\n' || data[payload - 1] == '\r'))
+      --payload;
+    if (payload &&
+        sendto(http_log.fd, data, payload, 0, (struct sockaddr *)&http_log.addr,
+               sizeof(http_log.addr)) < 0)
+      fio_atomic_add(&http_log.dropped, 1); /* i.e., no one is listening */
+    data += line;
+    len -= line;
+  }
+}
+
+/** Writes the data to the log's target. Call within the `output_lock`. */
+static void http_log_output_unsafe(const char *data, size_t len) {
+  if (http_log.dgram) {
+    http_log_output_dgram(data, len);
+    return;
+  }
+  int fd = http_log.fd == -1 ? STDERR_FILENO : http_log.fd;
+  while (len) {
+    ssize_t w = write(fd, data, len);
+    if (w < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    data += w;
+    len -= w;
+  }
+}
+
+/** Writes the pending lines, returning the number of bytes written. */
+static size_t http_log_drain(void) {
+  fio_lock(&http_log.output_lock);
+  fio_lock(&http_log.lock);
+  char *data = http_log.pending;
+  size_t len = http_log.len;
+  http_log.pending = http_log.writing;
+  http_log.writing = data;
+  http_log.len = 0;
+  fio_unlock(&http_log.lock);
+  if (len)
+    http_log_output_unsafe(data, len);
+  size_t dropped = http_log.dropped;
+  if (dropped != http_log.reported) {
+    FIO_LOG_WARNING("(%d) the access log dropped %zu lines.", (int)getpid(),
+                    dropped - http_log.reported);
+    http_log.reported = dropped;
+  }
+  fio_unlock(&http_log.output_lock);
+  return len;
+}
+
+static void *http_log_thread(void *ignr_) {
+  while (http_log.running) {
+    /* large batches are written immediately, small batches are collected */
+    if (http_log_drain() < (HTTP_LOG_BUFFER >> 1))
+      fio_throttle_thread(HTTP_LOG_INTERVAL * 1000000UL);
+  }
+  http_log_drain();
+  return ignr_;
+}
+
+/* *****************************************************************************
+Writer thread lifetime
+***************************************************************************** */
+
+/** Starts the process's writer thread (buffers are allocated on demand). */
+static void http_log_start(void) {
+  fio_lock(&http_log.thread_lock);
+  if (http_log.started)
+    goto finish;
+  http_log.started = 1;
+  if (!http_log.pending) {
+    http_log.pending = fio_malloc(HTTP_LOG_BUFFER);
+    http_log.writing = fio_malloc(HTTP_LOG_BUFFER);
+    FIO_ASSERT_ALLOC(http_log.pending && http_log.writing);
+  }
+  http_log.running = 1;
+  if (pthread_create(&http_log.thread, NULL, http_log_thread, NULL)) {
+    /* lines will be written synchronously */
+    http_log.running = 0;
+    FIO_LOG_ERROR("couldn't spawn the access log thread.");
+  }
+finish:
+  fio_unlock(&http_log.thread_lock);
+}
+
+/** Stops the writer thread (later lines are written synchronously). */
+static void http_log_stop(void *ignr_) {
+  fio_lock(&http_log.thread_lock);
+  http_log.started = 1;
+  if (http_log.running) {
+    http_log.running = 0;
+    pthread_join(http_log.thread, NULL);
+  }
+  fio_unlock(&http_log.thread_lock);
+  http_log_flush();
+  (void)ignr_;
+}
+
+/** Worker processes start their own writer thread (on demand). */
+static void http_log_on_fork(void *ignr_) {
+  http_log.lock = FIO_LOCK_INIT;
+  http_log.output_lock = FIO_LOCK_INIT;
+  http_log.thread_lock = FIO_LOCK_INIT;
+  /* the parent writes the lines it buffered */
+  http_log.len = 0;
+  http_log.dropped = 0;
+  http_log.reported = 0;
+  http_log.started = 0;
+  http_log.running = 0;
+  (void)ignr_;
+}
+
+static __attribute__((constructor)) void http_log_constructor(void) {
+  fio_state_callback_add(FIO_CALL_IN_CHILD, http_log_on_fork, NULL);
+  fio_state_callback_add(FIO_CALL_ON_FINISH, http_log_stop, NULL);
+  fio_state_callback_add(FIO_CALL_AT_EXIT, http_log_stop, NULL);
+}
+
+/* *****************************************************************************
+API
+***************************************************************************** */
+
+/**
+ * Sets the access log's target, format and overflow policy.
+ *
+ * Returns -1 if the target couldn't be opened (the previous target is kept).
+ */
+#undef http_log_setup
+int http_log_setup(http_log_settings_s settings) {
+  int fd = -1;
+  uint8_t dgram = 0;
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (settings.target && settings.target[0]) {
+    if (!strncmp(settings.target, "unix:", 5)) {
+      size_t len = strlen(settings.target + 5);
+      if (!len || len >= sizeof(addr.sun_path)) {
+        FIO_LOG_ERROR("invalid access log socket: %s", settings.target);
+        return -1;
+      }
+      memcpy(addr.sun_path, settings.target + 5, len + 1);
+      fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+      dgram = 1;
+    } else {
+      fd = open(settings.target, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    }
+    if (fd == -1) {
+      FIO_LOG_ERROR("couldn't open the access log (%s): %s", settings.target,
+                    strerror(errno));
+      return -1;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+  }
+  fio_lock(&http_log.output_lock);
+  if (http_log.fd != -1)
+    close(http_log.fd);
+  http_log.fd = fd;
+  http_log.dgram = dgram;
+  http_log.addr = addr;
+  http_log.json = settings.json;
+  http_log.block = settings.block;
+  fio_unlock(&http_log.output_lock);
+  return 0;
+}
+
+/** Returns true if log lines should be formatted as JSON. */
+uint8_t http_log_is_json(void) { return http_log.json; }
+
+/**
+ * Buffers a (complete) log line for the writer thread.
+ *
+ * When the buffer is full the line is dropped (and counted), unless the
+ * `block` policy was requested.
+ */
+void http_log_write(const char *line, size_t len) {
+  if (!len)
+    return;
+  if (!http_log.started)
+    http_log_start();
+  if (!http_log.running || len > HTTP_LOG_BUFFER) {
+    fio_lock(&http_log.output_lock);
+    http_log_output_unsafe(line, len);
+    fio_unlock(&http_log.output_lock);
+    return;
+  }
+  for (;;) {
+    fio_lock(&http_log.lock);
+    if (http_log.len + len <= HTTP_LOG_BUFFER) {
+      memcpy(http_log.pending + http_log.len, line, len);
+      http_log.len += len;
+      fio_unlock(&http_log.lock);
+      return;
+    }
+    fio_unlock(&http_log.lock);
+    if (!http_log.block || !http_log.running) {
+      fio_atomic_add(&http_log.dropped, 1);
+      return;
+    }
+    fio_throttle_thread(100000UL); /* wait for the writer thread */
+  }
+}
+
+/** Writes any buffered lines (blocking the calling thread). */
+void http_log_flush(void) {
+  if (http_log.pending)
+    http_log_drain();
+}
+
+/** Returns the number of lines this process dropped since it started. */
+size_t http_log_dropped(void) { return http_log.dropped; }
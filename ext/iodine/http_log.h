@@ -0,0 +1,67 @@
+/*
+Copyright: Boaz Segev, 2016-2019
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+#ifndef H_HTTP_LOG_H
+#define H_HTTP_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef HTTP_LOG_BUFFER
+/** The number of bytes buffered (per process) before lines are dropped. */
+#define HTTP_LOG_BUFFER (1UL << 20)
+#endif
+
+#ifndef HTTP_LOG_INTERVAL
+/** The writer thread's maximal delay (in milliseconds) between batches. */
+#define HTTP_LOG_INTERVAL 20
+#endif
+
+/**
+ * The access log (see `http_write_log`) is buffered in memory and written by a
+ * background thread (one per process), so slow targets never block the
+ * reactor.
+ *
+ * The log settings are process-wide.
+ */
+typedef struct {
+  /**
+   * The log's target: a file path (lines are appended), `unix:<path>` for a
+   * Unix datagram socket (one line per datagram), or NULL for `stderr`.
+   */
+  const char *target;
+  /** Set to true to write JSON lines (rather than the common log format). */
+  uint8_t json;
+  /** Set to true to block (rather than drop lines) when the buffer is full. */
+  uint8_t block;
+} http_log_settings_s;
+
+/**
+ * Sets the access log's target, format and overflow policy.
+ *
+ * Returns -1 if the target couldn't be opened (the previous target is kept).
+ */
+int http_log_setup(http_log_settings_s settings);
+#define http_log_setup(...) http_log_setup((http_log_settings_s){__VA_ARGS__})
+
+/** Returns true if log lines should be formatted as JSON. */
+uint8_t http_log_is_json(void);
+
+/**
+ * Buffers a (complete) log line for the writer thread.
+ *
+ * When the buffer is full the line is dropped (and counted), unless the
+ * `block` policy was requested.
+ */
+void http_log_write(const char *line, size_t len);
+
+/** Writes any buffered lines (blocking the calling thread). */
+void http_log_flush(void);
+
+/** Returns the number of lines this process dropped since it started. */
+size_t http_log_dropped(void);
+
+#endif
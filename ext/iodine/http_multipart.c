@@ -0,0 +1,442 @@
+/*
+Copyright: Boaz Segev, 2016-2019
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+#include <http_multipart.h>
+
+#include <http.h>
+#include <http_mime_parser.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+struct http_multipart_s {
+  http_mime_parser_s parser;
+  /** the Content-Type header (the parser's boundary points into it). */
+  FIOBJ content_type;
+  /** data waiting for more data (i.e., a part's incomplete headers). */
+  FIOBJ pending;
+  /** the spool for the data being parsed (valid while parsing). */
+  FIOBJ spool;
+  /** the data being parsed (valid while parsing). */
+  const char *buffer;
+  /** the amount of the data being parsed that was either spooled or saved. */
+  size_t handled;
+  /** the amount of data written to the spool. */
+  size_t spooled;
+  http_multipart_part_s *parts;
+  size_t count;
+  size_t capa;
+  uint8_t finished;
+  uint8_t failed;
+  uint8_t restored;
+};
+
+#define http_mime_parser2multipart(parser) ((http_multipart_s *)(parser))
+
+/* set when a part's file name is URL encoded (see `http_mime_decode_url`) */
+static __thread uint8_t http_multipart_encoded_filename;
+
+/* *****************************************************************************
+Temporary files
+***************************************************************************** */
+
+/** Opens a temporary file, setting its path. */
+static int http_multipart_tmpfile(FIOBJ *path) {
+  const char *dir = getenv("TMPDIR");
+  if (!dir || !dir[0])
+    dir = "/tmp";
+  char buf[PATH_MAX];
+  if ((size_t)snprintf(buf, PATH_MAX, "%s/iodine-multipart-XXXXXX", dir) >=
+      PATH_MAX) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  int fd = mkstemp(buf);
+  if (fd == -1)
+    return -1;
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  *path = fiobj_str_new(buf, strlen(buf));
+  return fd;
+}
+
+/** Writes the whole buffer, returning -1 on error. */
+static int http_multipart_write2fd(int fd, const char *data, size_t len) {
+  while (len) {
+    ssize_t w = write(fd, data, len);
+    if (w < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    data += w;
+    len -= w;
+  }
+  return 0;
+}
+
+/** Writes data that isn't a file's data to the spool. */
+static void http_multipart_spool(http_multipart_s *m, const char *data,
+                                 size_t len) {
+  if (!len || !m->spool)
+    return;
+  fiobj_data_write(m->spool, (void *)data, len);
+  m->spooled += len;
+}
+
+/* *****************************************************************************
+Parser callbacks
+***************************************************************************** */
+
+static http_multipart_part_s *
+http_multipart_add(http_multipart_s *m, void *name, size_t name_len,
+                   void *filename, size_t filename_len, void *mimetype,
+                   size_t mimetype_len) {
+  uint8_t encoded = http_multipart_encoded_filename;
+  http_multipart_encoded_filename = 0;
+  if (m->failed)
+    return NULL;
+  if (m->count == m->capa) {
+    m->capa = m->capa ? m->capa << 1 : 8;
+    m->parts = fio_realloc2(m->parts, m->capa * sizeof(*m->parts),
+                            m->count * sizeof(*m->parts));
+    FIO_ASSERT_ALLOC(m->parts);
+  }
+  http_multipart_part_s *part = m->parts + m->count;
+  *part = (http_multipart_part_s){
+      .name = fiobj_str_new(name, name_len),
+      .mimetype = mimetype_len ? fiobj_str_new(mimetype, mimetype_len)
+                               : FIOBJ_INVALID,
+      .fd = -1,
+  };
+  if (filename_len) {
+    part->fd = http_multipart_tmpfile(&part->path);
+    if (part->fd == -1) {
+      FIO_LOG_ERROR("couldn't create a multipart/form-data temporary file: %s",
+                    strerror(errno));
+      fiobj_free(part->name);
+      fiobj_free(part->mimetype);
+      m->failed = 1;
+      m->parser.error = 1;
+      return NULL;
+    }
+    part->filename = fiobj_str_new(filename, filename_len);
+    if (encoded) {
+      fio_str_info_s f = fiobj_obj2cstr(part->filename);
+      ssize_t len = http_decode_url(f.data, f.data, f.len);
+      if (len > 0)
+        fiobj_str_resize(part->filename, len);
+    }
+  } else {
+    part->value = fiobj_str_buf(0);
+  }
+  ++m->count;
+  return part;
+}
+
+static void http_multipart_append(http_multipart_s *m, void *value,
+                                  size_t value_len) {
+  if (m->failed || !m->count)
+    return;
+  http_multipart_part_s *part = m->parts + (m->count - 1);
+  if (part->fd == -1) {
+    fiobj_str_write(part->value, value, value_len);
+    return;
+  }
+  if (http_multipart_write2fd(part->fd, value, value_len)) {
+    /* the data is left in the spool */
+    FIO_LOG_ERROR("couldn't write a multipart/form-data temporary file: %s",
+                  strerror(errno));
+    m->failed = 1;
+    m->parser.error = 1;
+    return;
+  }
+  /* spool the data preceding the file's data, leaving the file's data out */
+  size_t at = (uintptr_t)value - (uintptr_t)m->buffer;
+  http_multipart_spool(m, m->buffer + m->handled, at - m->handled);
+  m->handled = at + value_len;
+  if (!part->length)
+    part->spool_offset = m->spooled;
+  part->length += value_len;
+}
+
+/** Called when all the data is available at once. */
+static void http_mime_parser_on_data(http_mime_parser_s *parser, void *name,
+                                     size_t name_len, void *filename,
+                                     size_t filename_len, void *mimetype,
+                                     size_t mimetype_len, void *value,
+                                     size_t value_len) {
+  http_multipart_s *m = http_mime_parser2multipart(parser);
+  if (!http_multipart_add(m, name, name_len, filename, filename_len, mimetype,
+                          mimetype_len))
+    return;
+  http_multipart_append(m, value, value_len);
+}
+
+/** Called when the data didn't fit in the buffer. Data will be streamed. */
+static void http_mime_parser_on_partial_start(
+    http_mime_parser_s *parser, void *name, size_t name_len, void *filename,
+    size_t filename_len, void *mimetype, size_t mimetype_len) {
+  http_multipart_add(http_mime_parser2multipart(parser), name, name_len,
+                     filename, filename_len, mimetype, mimetype_len);
+}
+
+/** Called when partial data is available. */
+static void http_mime_parser_on_partial_data(http_mime_parser_s *parser,
+                                             void *value, size_t value_len) {
+  http_multipart_append(http_mime_parser2multipart(parser), value, value_len);
+}
+
+/** Called when the partial data is complete. */
+static void http_mime_parser_on_partial_end(http_mime_parser_s *parser) {
+  (void)parser;
+}
+
+/**
+ * Called when URL decoding is required.
+ *
+ * The body's data is spooled, so it's left intact. The file name is decoded
+ * once it's copied (see `http_multipart_add`).
+ */
+static inline size_t http_mime_decode_url(char *dest, const char *encoded,
+                                          size_t length) {
+  http_multipart_encoded_filename = 1;
+  return 0;
+  (void)dest;
+  (void)encoded;
+  (void)length;
+}
+
+/* *****************************************************************************
+API
+***************************************************************************** */
+
+/**
+ * Takes the HTTP Content-Type header and returns a new parser, or NULL if the
+ * body isn't multipart/form-data (or if the boundary is missing).
+ */
+http_multipart_s *http_multipart_new(const char *content_type, size_t len) {
+  http_multipart_s *m = fio_malloc(sizeof(*m));
+  FIO_ASSERT_ALLOC(m);
+  *m = (http_multipart_s){
+      .content_type = fiobj_str_new(content_type, len),
+      .pending = fiobj_str_buf(0),
+  };
+  fio_str_info_s t = fiobj_obj2cstr(m->content_type);
+  if (http_mime_parser_init(&m->parser, t.data, t.len)) {
+    http_multipart_free(m);
+    return NULL;
+  }
+  return m;
+}
+
+/**
+ * Frees the parser, closing the temporary files and deleting the ones it still
+ * owns.
+ */
+void http_multipart_free(http_multipart_s *m) {
+  if (!m)
+    return;
+  for (size_t i = 0; i < m->count; ++i) {
+    fiobj_free(m->parts[i].name);
+    fiobj_free(m->parts[i].filename);
+    fiobj_free(m->parts[i].mimetype);
+    fiobj_free(m->parts[i].value);
+    if (m->parts[i].fd != -1)
+      close(m->parts[i].fd);
+    if (m->parts[i].path && !m->parts[i].handed_over)
+      unlink(fiobj_obj2cstr(m->parts[i].path).data);
+    fiobj_free(m->parts[i].path);
+  }
+  fio_free(m->parts);
+  fiobj_free(m->content_type);
+  fiobj_free(m->pending);
+  fio_free(m);
+}
+
+/**
+ * Parses the pending data.
+ *
+ * Unless this is the last of the data, parsing stops when a part's headers
+ * might be incomplete (less than a buffer's worth of data is left).
+ *
+ * Whatever isn't a file's data is written to the spool once it was parsed (or
+ * if it can't be parsed).
+ */
+static void http_multipart_consume(http_multipart_s *m, FIOBJ spool,
+                                   uint8_t last) {
+  fio_str_info_s s = fiobj_obj2cstr(m->pending);
+  size_t pos = 0;
+  m->spool = spool;
+  m->buffer = s.data;
+  m->handled = 0;
+  while (pos < s.len && !m->parser.done && !m->parser.error &&
+         (last || m->parser.in_obj || s.len - pos >= HTTP_MULTIPART_BUFFER)) {
+    http_multipart_encoded_filename = 0;
+    size_t consumed = http_mime_parse(&m->parser, s.data + pos, s.len - pos);
+    if (!consumed)
+      break;
+    pos += consumed;
+  }
+  if (last || m->parser.done || m->parser.error)
+    pos = s.len; /* the rest of the body is spooled as is */
+  http_multipart_spool(m, s.data + m->handled, pos - m->handled);
+  m->spool = FIOBJ_INVALID;
+  m->buffer = NULL;
+  if (!pos)
+    return;
+  memmove(s.data, s.data + pos, s.len - pos);
+  fiobj_str_resize(m->pending, s.len - pos);
+}
+
+/**
+ * Consumes a chunk of the body, writing any data that isn't a file's data to
+ * the `spool` (a FIOBJ Data object).
+ *
+ * File parts are written to temporary files as they arrive.
+ */
+void http_multipart_write(http_multipart_s *m, FIOBJ spool, const void *data,
+                          size_t len) {
+  if (m->finished || !len)
+    return;
+  if (m->parser.done || m->parser.error) {
+    /* nothing is pending, the rest of the body is spooled as is */
+    if (spool)
+      fiobj_data_write(spool, (void *)data, len);
+    m->spooled += len;
+    return;
+  }
+  fiobj_str_write(m->pending, data, len);
+  if (!m->parser.in_obj &&
+      fiobj_obj2cstr(m->pending).len < HTTP_MULTIPART_BUFFER)
+    return;
+  http_multipart_consume(m, spool, 0);
+}
+
+/** Marks the end of the body, consuming any buffered data. */
+void http_multipart_finish(http_multipart_s *m, FIOBJ spool) {
+  if (!m || m->finished)
+    return;
+  m->finished = 1;
+  http_multipart_consume(m, spool, 1);
+  fiobj_free(m->pending);
+  m->pending = FIOBJ_INVALID;
+}
+
+/** Returns true once `http_multipart_finish` was called. */
+int http_multipart_is_finished(http_multipart_s *m) { return m && m->finished; }
+
+/** Returns true if a temporary file couldn't be created or written. */
+int http_multipart_is_failed(http_multipart_s *m) { return m && m->failed; }
+
+/** Returns true if file parts were left out of the spool (and not restored). */
+int http_multipart_is_sparse(http_multipart_s *m) {
+  if (!m || m->restored)
+    return 0;
+  for (size_t i = 0; i < m->count; ++i) {
+    if (m->parts[i].fd != -1 && m->parts[i].length)
+      return 1;
+  }
+  return 0;
+}
+
+/** Returns the parsed parts (in order of appearance) and their count. */
+http_multipart_part_s *http_multipart_parts(http_multipart_s *m,
+                                            size_t *count) {
+  *count = m->count;
+  return m->parts;
+}
+
+/** Copies `length` bytes of the spool (or the rest of it), from `offset`. */
+static int http_multipart_copy_spool(FIOBJ dest, FIOBJ spool, size_t offset,
+                                     size_t length) {
+  while (length) {
+    fio_str_info_s s = fiobj_data_pread(
+        spool, offset,
+        length > HTTP_MULTIPART_BUFFER ? HTTP_MULTIPART_BUFFER : length);
+    if (!s.data || !s.len)
+      return length == (size_t)-1 ? 0 : -1;
+    if (fiobj_data_write(dest, s.data, s.len) < 0)
+      return -1;
+    offset += s.len;
+    if (length != (size_t)-1)
+      length -= s.len;
+  }
+  return 0;
+}
+
+/** Copies a file's data. */
+static int http_multipart_copy_file(FIOBJ dest, http_multipart_part_s *part,
+                                    char *buffer) {
+  size_t offset = 0;
+  while (offset < part->length) {
+    size_t len = part->length - offset;
+    if (len > HTTP_MULTIPART_BUFFER)
+      len = HTTP_MULTIPART_BUFFER;
+    ssize_t r = pread(part->fd, buffer, len, offset);
+    if (r <= 0) {
+      if (r < 0 && errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (fiobj_data_write(dest, buffer, r) < 0)
+      return -1;
+    offset += r;
+  }
+  return 0;
+}
+
+/**
+ * Returns a new FIOBJ Data object with the complete body, restoring the file
+ * parts left out of the `spool`.
+ *
+ * Returns FIOBJ_INVALID if the spool is the complete body (or on error). The
+ * body is only restored once.
+ */
+FIOBJ http_multipart_body(http_multipart_s *m, FIOBJ spool) {
+  FIOBJ body = FIOBJ_INVALID;
+  char *buffer = NULL;
+  size_t pos = 0;
+  if (m->restored)
+    return FIOBJ_INVALID;
+  m->restored = 1;
+  for (size_t i = 0; i < m->count; ++i) {
+    http_multipart_part_s *part = m->parts + i;
+    if (part->fd == -1 || !part->length)
+      continue;
+    if (!body) {
+      body = fiobj_data_newtmpfile();
+      buffer = fio_malloc(HTTP_MULTIPART_BUFFER);
+      if (!body || !buffer)
+        goto error;
+    }
+    if (http_multipart_copy_spool(body, spool, pos, part->spool_offset - pos) ||
+        http_multipart_copy_file(body, part, buffer))
+      goto error;
+    pos = part->spool_offset;
+  }
+  if (!body)
+    return FIOBJ_INVALID;
+  if (http_multipart_copy_spool(body, spool, pos, (size_t)-1))
+    goto error;
+  fio_free(buffer);
+  fiobj_data_seek(body, 0);
+  return body;
+error:
+  FIO_LOG_ERROR("couldn't restore a multipart/form-data body: %s",
+                strerror(errno));
+  fio_free(buffer);
+  fiobj_free(body);
+  return FIOBJ_INVALID;
+}
@@ -0,0 +1,113 @@
+/*
+Copyright: Boaz Segev, 2016-2019
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+#ifndef H_HTTP_MULTIPART_H
+#define H_HTTP_MULTIPART_H
+
+#include <fio.h>
+#include <fiobj.h>
+
+#include <stdint.h>
+
+#ifndef HTTP_MULTIPART_BUFFER
+/**
+ * The amount of data buffered before a part's headers are parsed (a part's
+ * headers must fit in the buffer).
+ */
+#define HTTP_MULTIPART_BUFFER (64 * 1024)
+#endif
+
+/**
+ * A natively parsed multipart/form-data body.
+ *
+ * The parser doesn't require a language lock, so it consumes the body as it
+ * arrives (see `http_multipart_write`), leaving only the params construction
+ * to the request handler.
+ *
+ * File parts are written straight to their temporary files, so they are left
+ * out of the request's body (the spool). `http_multipart_body` restores the
+ * complete body when it's required.
+ */
+typedef struct http_multipart_s http_multipart_s;
+
+/** A form field (part). */
+typedef struct {
+  /** the field's name (i.e., `user[avatar]`). */
+  FIOBJ name;
+  /** the file's name or FIOBJ_INVALID for regular values. */
+  FIOBJ filename;
+  /** the part's Content-Type or FIOBJ_INVALID. */
+  FIOBJ mimetype;
+  /** the value of a regular field (FIOBJ_INVALID for files). */
+  FIOBJ value;
+  /**
+   * The temporary file holding a file's data (FIOBJ_INVALID for regular
+   * values).
+   */
+  FIOBJ path;
+  /** the temporary file's descriptor (-1 for regular values). */
+  int fd;
+  /**
+   * Set when taking ownership of the temporary file, otherwise it will be
+   * deleted by `http_multipart_free`.
+   *
+   * The descriptor is still owned by the parser (see `http_multipart_body`).
+   */
+  uint8_t handed_over;
+  /** the length of a file's data. */
+  size_t length;
+  /** the position within the spool where the file's data was left out. */
+  size_t spool_offset;
+} http_multipart_part_s;
+
+/**
+ * Takes the HTTP Content-Type header and returns a new parser, or NULL if the
+ * body isn't multipart/form-data (or if the boundary is missing).
+ */
+http_multipart_s *http_multipart_new(const char *content_type, size_t len);
+
+/**
+ * Frees the parser, closing the temporary files and deleting the ones it still
+ * owns.
+ */
+void http_multipart_free(http_multipart_s *m);
+
+/**
+ * Consumes a chunk of the body, writing any data that isn't a file's data to
+ * the `spool` (a FIOBJ Data object, or FIOBJ_INVALID if the body is stored
+ * elsewhere).
+ *
+ * File parts are written to temporary files as they arrive.
+ */
+void http_multipart_write(http_multipart_s *m, FIOBJ spool, const void *data,
+                          size_t len);
+
+/** Marks the end of the body, consuming any buffered data. */
+void http_multipart_finish(http_multipart_s *m, FIOBJ spool);
+
+/** Returns true once `http_multipart_finish` was called. */
+int http_multipart_is_finished(http_multipart_s *m);
+
+/** Returns true if a temporary file couldn't be created or written. */
+int http_multipart_is_failed(http_multipart_s *m);
+
+/** Returns true if file parts were left out of the spool (and not restored). */
+int http_multipart_is_sparse(http_multipart_s *m);
+
+/** Returns the parsed parts (in order of appearance) and their count. */
+http_multipart_part_s *http_multipart_parts(http_multipart_s *m,
+                                            size_t *count);
+
+/**
+ * Returns a new FIOBJ Data object with the complete body, restoring the file
+ * parts left out of the `spool`.
+ *
+ * Returns FIOBJ_INVALID if the spool is the complete body (or on error). The
+ * body is only restored once.
+ */
+FIOBJ http_multipart_body(http_multipart_s *m, FIOBJ spool);
+
+#endif
@@ -39,22 +39,38 @@ static VALUE address_sym;
 static VALUE app_sym;
 static VALUE body_sym;
 static VALUE cookies_sym;
+static VALUE early_dispatch_sym;
 static VALUE handler_sym;
 static VALUE headers_sym;
 static VALUE log_sym;
+static VALUE log_format_sym;
+static VALUE log_policy_sym;
+static VALUE log_target_sym;
 static VALUE max_body_sym;
 static VALUE max_clients_sym;
+static VALUE max_clients_per_ip_sym;
 static VALUE max_headers_sym;
 static VALUE max_msg_sym;
+static VALUE max_queue_sym;
+static VALUE max_queue_time_sym;
 static VALUE method_sym;
 static VALUE path_sym;
 static VALUE ping_sym;
 static VALUE port_sym;
 static VALUE public_sym;
+static VALUE rate_burst_sym;
+static VALUE rate_limit_sym;
+static VALUE rate_limit_header_sym;
 static VALUE service_sym;
+static VALUE compress_sym;
+static VALUE compress_types_sym;
+static VALUE static_encodings_sym;
+static VALUE stream_flush_sym;
 static VALUE timeout_sym;
+static VALUE timings_sym;
 static VALUE tls_sym;
 static VALUE url_sym;
+static VALUE ws_deflate_sym;
 
 /* *****************************************************************************
 Idling
@@ -403,17 +419,48 @@ static VALUE iodine_cli_parse(VALUE self) {
                     "map to fractions of available CPU cores."),
       FIO_CLI_PRINT_HEADER("HTTP Settings:"),
       FIO_CLI_STRING("-public -www public folder, for static file service."),
+      FIO_CLI_STRING("-static-encodings -senc pre-compressed static file "
+                     "variants, in order of preference. Default: br,zstd,gzip"),
       FIO_CLI_INT("-keep-alive -k -tout HTTP keep-alive timeout in seconds "
                   "(0..255). Default: 40s"),
       FIO_CLI_BOOL("-log -v HTTP request logging."),
+      FIO_CLI_STRING("-log-target -logt access log file (or unix:<path> for a "
+                     "datagram socket). Default: stderr."),
+      FIO_CLI_BOOL("-log-json -logj JSON access log lines."),
+      FIO_CLI_BOOL("-log-block -logb block (rather than drop lines) when the "
+                   "access log falls behind."),
+      FIO_CLI_BOOL("-timings -tm report each request's phases (log, env and "
+                   "Server-Timing header)."),
+      FIO_CLI_BOOL("-early-dispatch -edisp handle large uploads before their "
+                   "body arrives (streaming rack.input)."),
       FIO_CLI_INT(
           "-max-body -maxbd HTTP upload limit in Mega-Bytes. Default: 50Mb"),
       FIO_CLI_INT("-max-header -maxhd header limit per HTTP request in Kb. "
                   "Default: 32Kb."),
+      FIO_CLI_INT("-stream-flush -sflush streamed response bodies are sent "
+                  "in Kb sized chunks. Default: 16Kb."),
+      FIO_CLI_INT("-compress compresses dynamic (textual) responses of at "
+                  "least this many bytes (zstd / br / gzip). Default: off."),
+      FIO_CLI_STRING("-compress-types -ctypes comma separated Content-Types "
+                     "to compress (i.e. text/*,*+json,application/wasm)."),
+      FIO_CLI_INT("-max-queue -maxq requests allowed to wait for Ruby before "
+                  "new requests receive a 503. Default: unlimited."),
+      FIO_CLI_INT("-max-queue-time -maxqt wait (in ms, since a request was read) "
+                  "before requests receive a 503. Default: unlimited."),
+      FIO_CLI_INT("-max-clients-per-ip -maxip concurrent connections allowed "
+                  "per client IP (per worker). Default: unlimited."),
+      FIO_CLI_INT("-rate-limit -rate requests per second allowed per client "
+                  "(per worker). Default: unlimited."),
+      FIO_CLI_INT("-rate-burst -burst requests a client may burst. Default: "
+                  "the rate limit."),
+      FIO_CLI_STRING("-rate-limit-header -rhead a (trusted) header identifying "
+                     "the client, i.e. x-forwarded-for. Default: peer address."),
       FIO_CLI_PRINT_HEADER("WebSocket Settings:"),
       FIO_CLI_INT("-max-msg -maxms incoming WebSocket message limit in Kb. "
                   "Default: 250Kb"),
       FIO_CLI_INT("-ping websocket ping interval (1..255). Default: 40s"),
+      FIO_CLI_INT("-ws-deflate -wsd permessage-deflate memory level (1..9, "
+                  "0 disables). Default: disabled"),
       FIO_CLI_PRINT_HEADER("SSL/TLS:"),
       FIO_CLI_BOOL("-tls enable SSL/TLS using a self-signed certificate."),
       FIO_CLI_STRING(
@@ -460,6 +507,22 @@ static VALUE iodine_cli_parse(VALUE self) {
   if (fio_cli_get_bool("-v")) {
     rb_hash_aset(defaults, log_sym, Qtrue);
   }
+  if (fio_cli_get("-logt")) {
+    rb_hash_aset(defaults, log_target_sym,
+                 rb_str_new_cstr(fio_cli_get("-logt")));
+  }
+  if (fio_cli_get_bool("-logj")) {
+    rb_hash_aset(defaults, log_format_sym, ID2SYM(rb_intern("json")));
+  }
+  if (fio_cli_get_bool("-logb")) {
+    rb_hash_aset(defaults, log_policy_sym, ID2SYM(rb_intern("block")));
+  }
+  if (fio_cli_get_bool("-tm")) {
+    rb_hash_aset(defaults, timings_sym, Qtrue);
+  }
+  if (fio_cli_get_bool("-edisp")) {
+    rb_hash_aset(defaults, early_dispatch_sym, Qtrue);
+  }
   if (fio_cli_get_bool("-warmup")) {
     rb_hash_aset(defaults, ID2SYM(rb_intern("warmup_")), Qtrue);
   }
@@ -490,6 +553,38 @@ static VALUE iodine_cli_parse(VALUE self) {
   if (fio_cli_get("-www")) {
     rb_hash_aset(defaults, public_sym, rb_str_new_cstr(fio_cli_get("-www")));
   }
+  if (fio_cli_get("-compress")) {
+    rb_hash_aset(defaults, compress_sym, INT2NUM(fio_cli_get_i("-compress")));
+  }
+  if (fio_cli_get("-maxq")) {
+    rb_hash_aset(defaults, max_queue_sym, INT2NUM(fio_cli_get_i("-maxq")));
+  }
+  if (fio_cli_get("-maxqt")) {
+    rb_hash_aset(defaults, max_queue_time_sym,
+                 INT2NUM(fio_cli_get_i("-maxqt")));
+  }
+  if (fio_cli_get("-maxip")) {
+    rb_hash_aset(defaults, max_clients_per_ip_sym,
+                 INT2NUM(fio_cli_get_i("-maxip")));
+  }
+  if (fio_cli_get("-rate")) {
+    rb_hash_aset(defaults, rate_limit_sym, INT2NUM(fio_cli_get_i("-rate")));
+  }
+  if (fio_cli_get("-burst")) {
+    rb_hash_aset(defaults, rate_burst_sym, INT2NUM(fio_cli_get_i("-burst")));
+  }
+  if (fio_cli_get("-rhead")) {
+    rb_hash_aset(defaults, rate_limit_header_sym,
+                 rb_str_new_cstr(fio_cli_get("-rhead")));
+  }
+  if (fio_cli_get("-ctypes")) {
+    rb_hash_aset(defaults, compress_types_sym,
+                 rb_str_new_cstr(fio_cli_get("-ctypes")));
+  }
+  if (fio_cli_get("-senc")) {
+    rb_hash_aset(defaults, static_encodings_sym,
+                 rb_str_new_cstr(fio_cli_get("-senc")));
+  }
   if (!fio_cli_get("-redis") && getenv("IODINE_REDIS_URL")) {
     fio_cli_set("-redis", getenv("IODINE_REDIS_URL"));
   }
@@ -503,6 +598,9 @@ static VALUE iodine_cli_parse(VALUE self) {
   if (fio_cli_get("-ping")) {
     rb_hash_aset(defaults, ping_sym, INT2NUM(fio_cli_get_i("-ping")));
   }
+  if (fio_cli_get("-wsd")) {
+    rb_hash_aset(defaults, ws_deflate_sym, INT2NUM(fio_cli_get_i("-wsd")));
+  }
   if (fio_cli_get("-redis-ping")) {
     rb_hash_aset(defaults, ID2SYM(rb_intern("redis_ping_")),
                  INT2NUM(fio_cli_get_i("-redis-ping")));
@@ -519,6 +617,10 @@ static VALUE iodine_cli_parse(VALUE self) {
     rb_hash_aset(defaults, max_headers_sym,
                  INT2NUM((fio_cli_get_i("-maxhd") /* * 1024 */)));
   }
+  if (fio_cli_get("-sflush")) {
+    rb_hash_aset(defaults, stream_flush_sym,
+                 INT2NUM((fio_cli_get_i("-sflush") /* * 1024 */)));
+  }
 #ifndef __MINGW32__
   if (fio_cli_get_bool("-tls") || fio_cli_get("-key") || fio_cli_get("-cert")) {
     VALUE rbtls = IodineCaller.call(IodineTLSClass, rb_intern2("new", 3));
@@ -660,12 +762,22 @@ Supported Settigs:
 - `:body` (HTTP client)
 - `:tls`
 - `:log` (HTTP only)
+- `:log_target`, `:log_format` and `:log_policy` (HTTP server only)
 - `:public` (public folder, HTTP server only)
 - `:timeout` (HTTP only)
 - `:ping` (`:raw` clients and WebSockets only)
 - `:max_headers` (HTTP only)
 - `:max_body` (HTTP only)
 - `:max_msg` (WebSockets only)
+- `:static_encodings` (HTTP server only)
+- `:compress` and `:compress_types` (HTTP server only)
+- `:early_dispatch` (HTTP server only)
+- `:max_clients_per_ip` (HTTP server only)
+- `:max_queue` and `:max_queue_time` (HTTP server only)
+- `:rate_limit`, `:rate_burst` and `:rate_limit_header` (HTTP server only)
+- `:stream_flush` (HTTP server only)
+- `:timings` (HTTP server only)
+- `:ws_deflate` (WebSocket servers only)
 
 */
 FIO_FUNC iodine_connection_args_s iodine_connect_args(VALUE s, uint8_t is_srv) {
@@ -675,25 +787,41 @@ FIO_FUNC iodine_connection_args_s iodine_connect_args(VALUE s, uint8_t is_srv) {
   VALUE address = rb_hash_aref(s, address_sym);
   VALUE app = rb_hash_aref(s, app_sym);
   VALUE body = rb_hash_aref(s, body_sym);
+  VALUE compress = rb_hash_aref(s, compress_sym);
+  VALUE compress_types = rb_hash_aref(s, compress_types_sym);
   VALUE cookies = rb_hash_aref(s, cookies_sym);
+  VALUE early_dispatch = rb_hash_aref(s, early_dispatch_sym);
   VALUE handler = rb_hash_aref(s, handler_sym);
   VALUE headers = rb_hash_aref(s, headers_sym);
   VALUE log = rb_hash_aref(s, log_sym);
+  VALUE log_format = rb_hash_aref(s, log_format_sym);
+  VALUE log_policy = rb_hash_aref(s, log_policy_sym);
+  VALUE log_target = rb_hash_aref(s, log_target_sym);
   VALUE max_body = rb_hash_aref(s, max_body_sym);
   VALUE max_clients = rb_hash_aref(s, max_clients_sym);
+  VALUE max_clients_per_ip = rb_hash_aref(s, max_clients_per_ip_sym);
   VALUE max_headers = rb_hash_aref(s, max_headers_sym);
   VALUE max_msg = rb_hash_aref(s, max_msg_sym);
+  VALUE max_queue = rb_hash_aref(s, max_queue_sym);
+  VALUE max_queue_time = rb_hash_aref(s, max_queue_time_sym);
   VALUE method = rb_hash_aref(s, method_sym);
   VALUE path = rb_hash_aref(s, path_sym);
   VALUE ping = rb_hash_aref(s, ping_sym);
   VALUE port = rb_hash_aref(s, port_sym);
   VALUE r_public = rb_hash_aref(s, public_sym);
+  VALUE rate_burst = rb_hash_aref(s, rate_burst_sym);
+  VALUE rate_limit = rb_hash_aref(s, rate_limit_sym);
+  VALUE rate_limit_header = rb_hash_aref(s, rate_limit_header_sym);
   VALUE service = rb_hash_aref(s, service_sym);
+  VALUE static_encodings = rb_hash_aref(s, static_encodings_sym);
+  VALUE stream_flush = rb_hash_aref(s, stream_flush_sym);
   VALUE timeout = rb_hash_aref(s, timeout_sym);
+  VALUE timings = rb_hash_aref(s, timings_sym);
 #ifndef __MINGW32__
   VALUE tls = rb_hash_aref(s, tls_sym);
 #endif
   VALUE r_url = rb_hash_aref(s, url_sym);
+  VALUE ws_deflate = rb_hash_aref(s, ws_deflate_sym);
   fio_str_info_s service_str = {.data = NULL};
 
   /* Complete using default values */
@@ -701,22 +829,41 @@ FIO_FUNC iodine_connection_args_s iodine_connect_args(VALUE s, uint8_t is_srv) {
     address = rb_hash_aref(iodine_default_args, address_sym);
   if (app == Qnil)
     app = rb_hash_aref(iodine_default_args, app_sym);
+  if (compress == Qnil)
+    compress = rb_hash_aref(iodine_default_args, compress_sym);
+  if (compress_types == Qnil)
+    compress_types = rb_hash_aref(iodine_default_args, compress_types_sym);
   if (cookies == Qnil)
     cookies = rb_hash_aref(iodine_default_args, cookies_sym);
+  if (early_dispatch == Qnil)
+    early_dispatch = rb_hash_aref(iodine_default_args, early_dispatch_sym);
   if (handler == Qnil)
     handler = rb_hash_aref(iodine_default_args, handler_sym);
   if (headers == Qnil)
     headers = rb_hash_aref(iodine_default_args, headers_sym);
   if (log == Qnil)
     log = rb_hash_aref(iodine_default_args, log_sym);
+  if (log_format == Qnil)
+    log_format = rb_hash_aref(iodine_default_args, log_format_sym);
+  if (log_policy == Qnil)
+    log_policy = rb_hash_aref(iodine_default_args, log_policy_sym);
+  if (log_target == Qnil)
+    log_target = rb_hash_aref(iodine_default_args, log_target_sym);
   if (max_body == Qnil)
     max_body = rb_hash_aref(iodine_default_args, max_body_sym);
   if (max_clients == Qnil)
     max_clients = rb_hash_aref(iodine_default_args, max_clients_sym);
+  if (max_clients_per_ip == Qnil)
+    max_clients_per_ip =
+        rb_hash_aref(iodine_default_args, max_clients_per_ip_sym);
   if (max_headers == Qnil)
     max_headers = rb_hash_aref(iodine_default_args, max_headers_sym);
   if (max_msg == Qnil)
     max_msg = rb_hash_aref(iodine_default_args, max_msg_sym);
+  if (max_queue == Qnil)
+    max_queue = rb_hash_aref(iodine_default_args, max_queue_sym);
+  if (max_queue_time == Qnil)
+    max_queue_time = rb_hash_aref(iodine_default_args, max_queue_time_sym);
   if (method == Qnil)
     method = rb_hash_aref(iodine_default_args, method_sym);
   if (path == Qnil)
@@ -728,10 +875,26 @@ FIO_FUNC iodine_connection_args_s iodine_connect_args(VALUE s, uint8_t is_srv) {
   if (r_public == Qnil) {
     r_public = rb_hash_aref(iodine_default_args, public_sym);
   }
+  if (rate_burst == Qnil)
+    rate_burst = rb_hash_aref(iodine_default_args, rate_burst_sym);
+  if (rate_limit == Qnil)
+    rate_limit = rb_hash_aref(iodine_default_args, rate_limit_sym);
+  if (rate_limit_header == Qnil)
+    rate_limit_header =
+        rb_hash_aref(iodine_default_args, rate_limit_header_sym);
+  if (static_encodings == Qnil)
+    static_encodings =
+        rb_hash_aref(iodine_default_args, static_encodings_sym);
+  if (stream_flush == Qnil)
+    stream_flush = rb_hash_aref(iodine_default_args, stream_flush_sym);
   // if (service == Qnil) // not supported by default settings...
   //   service = rb_hash_aref(iodine_default_args, service_sym);
   if (timeout == Qnil)
     timeout = rb_hash_aref(iodine_default_args, timeout_sym);
+  if (timings == Qnil)
+    timings = rb_hash_aref(iodine_default_args, timings_sym);
+  if (ws_deflate == Qnil)
+    ws_deflate = rb_hash_aref(iodine_default_args, ws_deflate_sym);
 #ifndef __MINGW32__
   if (tls == Qnil)
     tls = rb_hash_aref(iodine_default_args, tls_sym);
@@ -776,18 +939,51 @@ FIO_FUNC iodine_connection_args_s iodine_connect_args(VALUE s, uint8_t is_srv) {
   if (log != Qnil && log != Qfalse) {
     r.log = 1;
   }
+  if (log_format != Qnil && RB_TYPE_P(log_format, T_SYMBOL))
+    log_format = rb_sym2str(log_format);
+  if (log_format != Qnil && RB_TYPE_P(log_format, T_STRING) &&
+      RSTRING_LEN(log_format) == 4 && !memcmp(RSTRING_PTR(log_format), "json", 4)) {
+    r.log_json = 1;
+  }
+  if (log_policy != Qnil && RB_TYPE_P(log_policy, T_SYMBOL))
+    log_policy = rb_sym2str(log_policy);
+  if (log_policy != Qnil && RB_TYPE_P(log_policy, T_STRING) &&
+      RSTRING_LEN(log_policy) == 5 && !memcmp(RSTRING_PTR(log_policy), "block", 5)) {
+    r.log_block = 1;
+  }
+  if (log_target != Qnil && RB_TYPE_P(log_target, T_STRING)) {
+    r.log_target = IODINE_RSTRINFO(log_target);
+  }
+  if (early_dispatch != Qnil && early_dispatch != Qfalse) {
+    r.early_dispatch = 1;
+  }
+  if (timings != Qnil && timings != Qfalse) {
+    r.timings = 1;
+  }
   if (max_body != Qnil && RB_TYPE_P(max_body, T_FIXNUM)) {
     r.max_body = FIX2ULONG(max_body) * 1024 * 1024;
   }
   if (max_clients != Qnil && RB_TYPE_P(max_clients, T_FIXNUM)) {
     r.max_clients = FIX2ULONG(max_clients);
   }
+  if (max_clients_per_ip != Qnil && RB_TYPE_P(max_clients_per_ip, T_FIXNUM) &&
+      FIX2LONG(max_clients_per_ip) > 0) {
+    r.max_clients_per_ip = FIX2ULONG(max_clients_per_ip);
+  }
   if (max_headers != Qnil && RB_TYPE_P(max_headers, T_FIXNUM)) {
     r.max_headers = FIX2ULONG(max_headers) * 1024;
   }
   if (max_msg != Qnil && RB_TYPE_P(max_msg, T_FIXNUM)) {
     r.max_msg = FIX2ULONG(max_msg) * 1024;
   }
+  if (max_queue != Qnil && RB_TYPE_P(max_queue, T_FIXNUM) &&
+      FIX2LONG(max_queue) > 0) {
+    r.max_queue = FIX2ULONG(max_queue);
+  }
+  if (max_queue_time != Qnil && RB_TYPE_P(max_queue_time, T_FIXNUM) &&
+      FIX2LONG(max_queue_time) > 0) {
+    r.max_queue_time = FIX2ULONG(max_queue_time);
+  }
   if (method != Qnil && RB_TYPE_P(method, T_STRING)) {
     r.method = IODINE_RSTRINFO(method);
   }
@@ -826,6 +1022,40 @@ FIO_FUNC iodine_connection_args_s iodine_connect_args(VALUE s, uint8_t is_srv) {
     service = rb_sym2str(service);
     service_str = IODINE_RSTRINFO(service);
   }
+  if (ws_deflate == Qtrue) {
+    r.ws_deflate = WEBSOCKET_DEFLATE_MEM_LEVEL;
+  } else if (ws_deflate != Qnil && RB_TYPE_P(ws_deflate, T_FIXNUM) &&
+             FIX2LONG(ws_deflate) > 0) {
+    if (FIX2LONG(ws_deflate) > 9)
+      FIO_LOG_WARNING(":ws_deflate memory level over 9 will be reduced to 9.");
+    r.ws_deflate = FIX2LONG(ws_deflate) > 9 ? 9 : FIX2ULONG(ws_deflate);
+  }
+  if (compress == Qtrue) {
+    r.compress = HTTP_DEFAULT_COMPRESS_MIN_SIZE;
+  } else if (compress != Qnil && RB_TYPE_P(compress, T_FIXNUM) &&
+             FIX2LONG(compress) > 0) {
+    r.compress = FIX2ULONG(compress);
+  }
+  if (rate_burst != Qnil && RB_TYPE_P(rate_burst, T_FIXNUM) &&
+      FIX2LONG(rate_burst) > 0) {
+    r.rate_burst = FIX2ULONG(rate_burst);
+  }
+  if (rate_limit != Qnil && RB_TYPE_P(rate_limit, T_FIXNUM) &&
+      FIX2LONG(rate_limit) > 0) {
+    r.rate_limit = FIX2ULONG(rate_limit);
+  }
+  if (rate_limit_header != Qnil && RB_TYPE_P(rate_limit_header, T_STRING)) {
+    r.rate_limit_header = IODINE_RSTRINFO(rate_limit_header);
+  }
+  if (compress_types != Qnil && RB_TYPE_P(compress_types, T_STRING)) {
+    r.compress_types = IODINE_RSTRINFO(compress_types);
+  }
+  if (static_encodings != Qnil && RB_TYPE_P(static_encodings, T_STRING)) {
+    r.static_encodings = IODINE_RSTRINFO(static_encodings);
+  }
+  if (stream_flush != Qnil && RB_TYPE_P(stream_flush, T_FIXNUM)) {
+    r.stream_flush = FIX2ULONG(stream_flush) * 1024;
+  }
   if (timeout != Qnil && RB_TYPE_P(timeout, T_FIXNUM)) {
     if (FIX2ULONG(timeout) > 255)
       FIO_LOG_WARNING(":timeout value over 255 will be silently ignored.");
@@ -1019,18 +1249,34 @@ Supported Settigs:
 |  |  |
 |---|---|
 | `:url` | URL indicating service type, host name and port. Path will be parsed as a Unix socket. |
+| `:compress` | (HTTP server only) compress dynamic (textual) responses of at least this many bytes using `zstd`, `br` or `gzip` (according to `Accept-Encoding`). `true` uses a 1Kb minimum. Streamed bodies are compressed as they are sent. Default: off. |
+| `:compress_types` | (HTTP server only) a comma separated list of the Content-Types to compress. A type followed by a slash and `*` (i.e., `text/` followed by `*`) matches any subtype and `"*+json"` matches a suffix. Default: any `text/` type, `application/json`, `application/javascript`, `application/x-javascript`, `application/xml`, `image/svg+xml`, `*+json` and `*+xml` (add `application/wasm` to compress WebAssembly). |
+| `:early_dispatch` | (HTTP server only) handle requests with large (non chunked) bodies as soon as their headers arrive. `rack.input` then streams the body as it's received (it can't be rewound). Default: `false`. |
 | `:handler` | (deprecated: `:app`) see details below. |
 | `:address` | an IP address or a unix socket address. Only relevant if `:url` is missing. |
 | `:log` |  (HTTP only) request logging. For global verbosity see {Iodine.verbosity} |
+| `:log_target` | (HTTP server only) the access log's file, or `"unix:<path>"` for a Unix datagram socket (a line per datagram). The access log is written by a background thread and its settings are process-wide. Default: `stderr`. |
+| `:log_format` | (HTTP server only) `:json` for JSON access log lines (including the `:timings`, if enabled). Default: the common log format. |
+| `:log_policy` | (HTTP server only) `:block` to wait (rather than drop lines) when the access log falls behind. Dropped lines are counted by {Iodine.dropped_log_lines}. Default: `:drop`. |
 | `:max_body` | (HTTP only) maximum upload size allowed per request before disconnection (in Mb). |
 | `:max_headers` |  (HTTP only) maximum total header length allowed per request (in Kb). |
+| `:max_clients_per_ip` | (HTTP server only) maximum concurrent connections per client (peer address). Connections over the limit receive a 429 response. The limit is enforced per worker process, so with multiple workers a client may open up to `workers * max_clients_per_ip` connections. Default: unlimited. |
 | `:max_msg` |  (WebSockets only) maximum message size pre message (in Kb). |
+| `:max_queue` | (HTTP server only) the number of requests allowed to wait for Ruby (the GVL). Once reached, new requests receive a 503 response with a `Retry-After` header. Default: unlimited. |
+| `:max_queue_time` | (HTTP server only) the time, in milliseconds, requests may wait for Ruby (measured from when they were completely read). Requests that waited longer, and new requests while the average wait is longer, receive a 503 response. The measured wait is available as `env["iodine.queue_time"]`. Default: unlimited. |
 | `:ping` |  (`:raw` clients and WebSockets only) ping interval (in seconds). Up to 255 seconds. |
 | `:port` | port number to listen to either a String or Number) |
 | `:public` | (HTTP server only) public folder for static file service. |
+| `:rate_limit` | (HTTP server only) requests per second allowed per client (token bucket). Requests over the limit receive a 429 response with a `Retry-After` header, without entering Ruby. The limit is enforced per worker process, so with multiple workers the effective rate may reach `workers * rate_limit`. Default: unlimited. |
+| `:rate_burst` | (HTTP server only) the number of requests a client may burst (the bucket's size). Default: the `:rate_limit`. |
+| `:rate_limit_header` | (HTTP server only) a header identifying the client for the `:rate_limit`, set by a trusted proxy (i.e., `"X-Forwarded-For"`, the last address is used). Default: the peer address. |
 | `:service` | (`:raw` / `:tls` / `:ws` / `:wss` / `:http` / `:https` ) a supported service this socket will listen to. |
+| `:static_encodings` | (HTTP server only) a comma separated list of pre-compressed static file variants (`br`, `zstd`, `gzip`), in order of preference. Default: `"br,zstd,gzip"`. |
+| `:stream_flush` | (HTTP server only) streamed response bodies are buffered and sent in chunks of this size (in Kb). Default: 16Kb. |
 | `:timeout` |  (HTTP only) keep-alive timeout in seconds. Up to 255 seconds. |
+| `:timings` | (HTTP server only) records each request's phases, adding them to the log, to `env["iodine.timings"]` and to a `Server-Timing` response header. Default: `false`. |
 | `:tls` | an {Iodine::TLS} context object for encrypted connections. |
+| `:ws_deflate` | (WebSocket servers only) negotiates `permessage-deflate` compression using this zlib memory level (1..9), `true` uses 8. Messages are compressed without context takeover, broadcasts are compressed once for all subscribers. Default: off. |
 
 Some connection settings are only valid when listening to HTTP / WebSocket connections.
 
@@ -1336,22 +1582,38 @@ void Init_iodine_ext(void) {
   IODINE_MAKE_SYM(app);
   IODINE_MAKE_SYM(body);
   IODINE_MAKE_SYM(cookies);
+  IODINE_MAKE_SYM(early_dispatch);
   IODINE_MAKE_SYM(handler);
   IODINE_MAKE_SYM(headers);
   IODINE_MAKE_SYM(log);
+  IODINE_MAKE_SYM(log_format);
+  IODINE_MAKE_SYM(log_policy);
+  IODINE_MAKE_SYM(log_target);
   IODINE_MAKE_SYM(max_body);
   IODINE_MAKE_SYM(max_clients);
+  IODINE_MAKE_SYM(max_clients_per_ip);
   IODINE_MAKE_SYM(max_headers);
   IODINE_MAKE_SYM(max_msg);
+  IODINE_MAKE_SYM(max_queue);
+  IODINE_MAKE_SYM(max_queue_time);
   IODINE_MAKE_SYM(method);
   IODINE_MAKE_SYM(path);
   IODINE_MAKE_SYM(ping);
   IODINE_MAKE_SYM(port);
   IODINE_MAKE_SYM(public);
+  IODINE_MAKE_SYM(rate_burst);
+  IODINE_MAKE_SYM(rate_limit);
+  IODINE_MAKE_SYM(rate_limit_header);
   IODINE_MAKE_SYM(service);
+  IODINE_MAKE_SYM(compress);
+  IODINE_MAKE_SYM(compress_types);
+  IODINE_MAKE_SYM(static_encodings);
+  IODINE_MAKE_SYM(stream_flush);
   IODINE_MAKE_SYM(timeout);
+  IODINE_MAKE_SYM(timings);
   IODINE_MAKE_SYM(tls);
   IODINE_MAKE_SYM(url);
+  IODINE_MAKE_SYM(ws_deflate);
 
   // load any environment specific patches
   patch_env();
@@ -1410,6 +1672,9 @@ void Init_iodine_ext(void) {
   // initialize the HTTP module
   iodine_init_http();
 
+  // initialize the native router
+  iodine_router_init();
+
 #ifndef __MINGW32__
   // initialize SSL/TLS support module
   iodine_init_tls();
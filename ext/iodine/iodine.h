@@ -14,6 +14,10 @@ typedef struct {
   fio_str_info_s path;
   fio_str_info_s body;
   fio_str_info_s public;
+  fio_str_info_s static_encodings;
+  fio_str_info_s compress_types;
+  fio_str_info_s rate_limit_header;
+  fio_str_info_s log_target;
   fio_str_info_s url;
 #ifndef __MINGW32__
   fio_tls_s *tls;
@@ -25,9 +29,21 @@ typedef struct {
   size_t max_body;
   intptr_t max_clients;
   size_t max_msg;
+  size_t stream_flush;
+  size_t compress;
+  size_t max_clients_per_ip;
+  size_t max_queue;
+  size_t max_queue_time;
+  size_t rate_limit;
+  size_t rate_burst;
   uint8_t timeout;
   uint8_t ping;
   uint8_t log;
+  uint8_t log_json;
+  uint8_t log_block;
+  uint8_t timings;
+  uint8_t ws_deflate;
+  uint8_t early_dispatch;
   enum {
     IODINE_SERVICE_RAW,
     IODINE_SERVICE_HTTP,
@@ -44,6 +60,7 @@ typedef struct {
 #include "iodine_mustache.h"
 #include "iodine_pubsub.h"
 #include "iodine_rack_io.h"
+#include "iodine_router.h"
 #include "iodine_store.h"
 #include "iodine_tcp.h"
 #include "iodine_tls.h"
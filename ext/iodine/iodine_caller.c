@@ -87,12 +87,16 @@ static VALUE iodine_ruby_caller_perform(VALUE tsk_) {
   return rb_funcall2(task->obj, task->method, task->argc, task->argv);
 }
 
+/* set when the latest protected call (on this thread) raised an exception */
+static __thread uint8_t iodine_caller_raised;
+
 /* wrap the function call in exception handling block (uses longjmp) */
 static void *iodine_protect_ruby_call(void *task_) {
   int state = 0;
   VALUE ret = rb_protect(((iodine_rb_task_s *)task_)->protected_task,
                          (VALUE)(task_),
                          &state);
+  iodine_caller_raised = (state != 0);
   if (state) {
     iodine_handle_exception(NULL);
   }
@@ -198,6 +202,9 @@ static VALUE iodine_call_block(
   return (VALUE)rv;
 }
 
+/** Returns true if the latest protected call raised an exception. */
+static uint8_t iodine_raised(void) { return iodine_caller_raised; }
+
 /** Returns the GVL state flag. */
 static uint8_t iodine_in_GVL(void) {
   pthread_once(&iodine_GVL_state_once, init_iodine_GVL_state_key);
@@ -237,6 +244,8 @@ struct IodineCaller_s IodineCaller = {
     .call2 = iodine_call2,
     /** Calls a Ruby method on a given object, without protecting against exceptions. */
     .call_unprotected = iodine_call_unprotected,
+    /** Returns true if the latest protected call raised an exception. */
+    .raised = iodine_raised,
     /** Returns the GVL state flag. */
     .in_GVL = iodine_in_GVL,
     /** Forces the GVL state flag. */
@@ -20,6 +20,11 @@ extern struct IodineCaller_s {
   VALUE(*call_with_block)
   (VALUE obj, ID method, int argc, VALUE *argv, VALUE udata,
    VALUE (*block_func)(VALUE block_argv1, VALUE udata, int argc, const VALUE *argv, VALUE blockarg));
+  /**
+   * Returns true if the latest protected call (on the calling thread) raised an
+   * exception.
+   */
+  uint8_t (*raised)(void);
   /** Returns the GVL state flag. */
   uint8_t (*in_GVL)(void);
   /** Forces the GVL state flag. */
@@ -1,10 +1,12 @@
 #include "iodine_connection.h"
+#include "iodine_http.h"
 
 #define FIO_INCLUDE_LINKED_LIST
 #define FIO_INCLUDE_STR
 #include "fio.h"
 
 #include "fiobj4fio.h"
+#include "websocket_simd.h"
 #include "websockets.h"
 
 #include <ruby/io.h>
@@ -21,11 +23,14 @@ static ID as_id;
 static ID binary_id;
 static ID match_id;
 static ID redis_id;
+static ID slow_id;
+static ID max_pending_id;
 static ID handler_id;
 static ID engine_id;
 static ID message_id;
 static ID on_open_id;
 static ID on_message_id;
+static ID on_message_chunk_id;
 static ID on_drained_id;
 static ID ping_id;
 static ID on_shutdown_id;
@@ -82,7 +87,15 @@ typedef struct {
   size_t ref;
   fio_subhash_s subscriptions;
   fio_lock_i lock;
+  /* messages collected by `cork` (written once the block returns) */
+  FIOBJ cork;
+  size_t corked;
+  /* subscriptions with a slow consumer policy (see `iodine_slow_sub_s`) */
+  fio_ls_embd_s slow;
+  /* protects `slow` (`on_unsubscribe` might be called within `lock`) */
+  fio_lock_i slow_lock;
   uint8_t answers_on_message;
+  uint8_t answers_on_message_chunk;
   uint8_t answers_on_drained;
   uint8_t answers_ping;
   /* these are one-shot, but the CPU cache might have the data, so set it */
@@ -111,6 +124,7 @@ static void iodine_connection_data_free(void *c_) {
   iodine_connection_data_s *data = c_;
   if (fio_atomic_sub(&data->ref, 1))
     return;
+  fiobj_free(data->cork);
   free(data);
 }
 
@@ -140,6 +154,8 @@ static VALUE iodine_connection_data_alloc_c(VALUE self) {
       .ref = 1,
       .subscriptions = FIO_SET_INIT,
       .lock = FIO_LOCK_INIT,
+      .slow = FIO_LS_INIT(c->slow),
+      .slow_lock = FIO_LOCK_INIT,
   };
   return TypedData_Wrap_Struct(self, &iodine_connection_data_type, c);
 }
@@ -164,6 +180,36 @@ iodine_connection_validate_data(VALUE self) {
 Ruby Connection Methods - write, close open? pending
 ***************************************************************************** */
 
+/** Returns `data` as a String (warning about other objects). */
+static VALUE iodine_connection_str(VALUE data) {
+  if (!RB_TYPE_P(data, T_STRING)) {
+    VALUE tmp = data;
+    data = IodineCaller.call(data, iodine_to_s_id);
+    if (!RB_TYPE_P(data, T_STRING))
+      Check_Type(tmp, T_STRING);
+    rb_backtrace();
+    FIO_LOG_WARNING(
+        "`Iodine::Connection#write` was called with a non-String object.");
+  }
+  return data;
+}
+
+/** Appends the (framed) message to a buffer that's written later. */
+static void iodine_connection_append(iodine_connection_data_s *c, FIOBJ dest,
+                                     VALUE data) {
+  switch (c->info.type) {
+  case IODINE_CONNECTION_WEBSOCKET:
+    websocket_write2str(c->info.arg, dest, IODINE_RSTRINFO(data),
+                        rb_enc_get(data) == IodineUTF8Encoding);
+    break;
+  case IODINE_CONNECTION_SSE: /* SSE - raw bytes, framework handles formatting */
+  case IODINE_CONNECTION_RAW: /* fallthrough */
+  default:
+    fiobj_str_write(dest, RSTRING_PTR(data), RSTRING_LEN(data));
+    break;
+  }
+}
+
 /**
  * Writes data to the connection asynchronously. `data` MUST be a String.
  *
@@ -172,6 +218,9 @@ Ruby Connection Methods - write, close open? pending
  *
  * Use {pending} to test how many `write` operations are pending completion
  * (`on_drained(client)` will be called when they complete).
+ *
+ * Within a {cork} block the data is collected and written once the block
+ * returns.
  */
 static VALUE iodine_connection_write(VALUE self, VALUE data) {
   iodine_connection_data_s *c = iodine_connection_validate_data(self);
@@ -180,14 +229,11 @@ static VALUE iodine_connection_write(VALUE self, VALUE data) {
     return Qnil;
     // rb_raise(rb_eIOError, "Connection closed or invalid.");
   }
-  if (!RB_TYPE_P(data, T_STRING)) {
-    VALUE tmp = data;
-    data = IodineCaller.call(data, iodine_to_s_id);
-    if (!RB_TYPE_P(data, T_STRING))
-      Check_Type(tmp, T_STRING);
-    rb_backtrace();
-    FIO_LOG_WARNING(
-        "`Iodine::Connection#write` was called with a non-String object.");
+  data = iodine_connection_str(data);
+
+  if (c->corked) {
+    iodine_connection_append(c, c->cork, data);
+    return Qtrue;
   }
 
   switch (c->info.type) {
@@ -200,13 +246,92 @@ static VALUE iodine_connection_write(VALUE self, VALUE data) {
   case IODINE_CONNECTION_SSE: /* SSE - raw bytes, framework handles formatting */
   case IODINE_CONNECTION_RAW: /* fallthrough */
   default: {
-    fio_write(c->info.uuid, RSTRING_PTR(data), RSTRING_LEN(data));
+    if (IODINE_ZERO_COPY(data))
+      iodine_store_write_str(c->info.uuid, data, 0, RSTRING_LEN(data));
+    else
+      fio_write(c->info.uuid, RSTRING_PTR(data), RSTRING_LEN(data));
     return Qtrue;
   } break;
   }
   return Qnil;
 }
 
+/**
+ * Writes all the Strings in the Array using a single `write` operation (each
+ * String is a separate WebSocket message).
+ *
+ * This is faster than calling {write} for each of many small messages.
+ */
+static VALUE iodine_connection_write_many(VALUE self, VALUE ary) {
+  Check_Type(ary, T_ARRAY);
+  iodine_connection_data_s *c = iodine_connection_validate_data(self);
+  if (!c || fio_is_closed(c->info.uuid)) {
+    return Qnil;
+  }
+  const long count = RARRAY_LEN(ary);
+  if (!count)
+    return Qtrue;
+  /* convert the data before allocating (conversions might raise) */
+  VALUE strings = ary;
+  size_t total = 0;
+  for (long i = 0; i < count; ++i) {
+    VALUE data = rb_ary_entry(strings, i);
+    if (!RB_TYPE_P(data, T_STRING)) {
+      if (strings == ary)
+        strings = rb_ary_dup(ary);
+      data = iodine_connection_str(data);
+      rb_ary_store(strings, i, data);
+    }
+    total += RSTRING_LEN(data) + 14;
+  }
+  FIOBJ dest = c->corked ? c->cork : fiobj_str_buf(total);
+  for (long i = 0; i < count; ++i)
+    iodine_connection_append(c, dest, rb_ary_entry(strings, i));
+  if (!c->corked)
+    fiobj_send_free(c->info.uuid, dest);
+  return Qtrue;
+}
+
+static VALUE iodine_connection_cork_yield(VALUE ignr_) {
+  return rb_yield(Qnil);
+  (void)ignr_;
+}
+
+static VALUE iodine_connection_uncork(VALUE self) {
+  iodine_connection_data_s *c = iodine_connection_ruby2C(self);
+  if (!c || !c->corked || --c->corked)
+    return Qnil;
+  FIOBJ dest = c->cork;
+  c->cork = FIOBJ_INVALID;
+  if (fiobj_obj2cstr(dest).len && c->info.uuid != -1)
+    fiobj_send_free(c->info.uuid, dest);
+  else
+    fiobj_free(dest);
+  return Qnil;
+}
+
+/**
+ * Collects the data written within the block (using {write} or {write_many})
+ * and writes it using a single `write` operation once the block returns.
+ *
+ * Blocks may be nested (the data is written when the outermost block
+ * returns). Returns the block's value.
+ *
+ *      client.cork do
+ *        updates.each { |u| client.write u }
+ *      end
+ */
+static VALUE iodine_connection_cork(VALUE self) {
+  rb_need_block();
+  iodine_connection_data_s *c = iodine_connection_validate_data(self);
+  if (!c || fio_is_closed(c->info.uuid))
+    return rb_yield(Qnil);
+  if (!c->corked++)
+    c->cork = fiobj_str_buf(0);
+  return rb_ensure(iodine_connection_cork_yield, Qnil, iodine_connection_uncork,
+                   self);
+}
+
 /**
  * Schedules the connection to be closed.
  *
@@ -370,6 +495,8 @@ static VALUE iodine_connection_handler_set(VALUE self, VALUE handler) {
     data->info.handler = handler;
     data->answers_on_open = answers_on_open,
     data->answers_on_message = (rb_respond_to(handler, on_message_id) != 0),
+    data->answers_on_message_chunk =
+        (rb_respond_to(handler, on_message_chunk_id) != 0),
     data->answers_ping = (rb_respond_to(handler, ping_id) != 0),
     data->answers_on_drained = (rb_respond_to(handler, on_drained_id) != 0),
     data->answers_on_shutdown = (rb_respond_to(handler, on_shutdown_id) != 0),
@@ -383,6 +510,161 @@ static VALUE iodine_connection_handler_set(VALUE self, VALUE handler) {
   }
   return handler;
 }
+/* *****************************************************************************
+Pub/Sub slow consumers (policies for direct subscriptions)
+***************************************************************************** */
+
+#ifndef IODINE_SLOW_CONSUMER_LIMIT
+/** The default number of queued bytes that marks a client as slow. */
+#define IODINE_SLOW_CONSUMER_LIMIT (1UL << 20)
+#endif
+
+typedef enum {
+  IODINE_SLOW_NONE,
+  IODINE_SLOW_DROP_NEWEST,
+  IODINE_SLOW_DROP_OLDEST,
+  IODINE_SLOW_CONFLATE,
+  IODINE_SLOW_CLOSE,
+  IODINE_SLOW_POLICIES,
+} iodine_slow_policy_e;
+
+static const char *iodine_slow_names[IODINE_SLOW_POLICIES] = {
+    NULL, "drop_newest", "drop_oldest", "conflate", "close",
+};
+
+/* the number of times each policy was applied (in this process) */
+static volatile size_t iodine_slow_counters[IODINE_SLOW_POLICIES];
+
+typedef struct {
+  /* Qnil for (text / generic) messages, Qtrue for binary WebSocket messages */
+  VALUE block;
+  iodine_connection_data_s *c;
+  /* the number of queued bytes that marks the client as slow */
+  size_t limit;
+  iodine_slow_policy_e policy;
+  uint8_t closed;
+  fio_lock_i lock;
+  /* messages held while the client is slow (FIOBJ Strings) */
+  fio_ls_s held;
+  size_t held_bytes;
+  /* the connection's `slow` list node */
+  fio_ls_embd_s node;
+} iodine_slow_sub_s;
+
+/** Returns true if the client isn't backed up. */
+static inline uint8_t iodine_slow_is_ready(iodine_slow_sub_s *s) {
+  /* `fio_pending_bytes` walks the queue, so test the packet count first */
+  return !fio_pending(s->c->info.uuid) ||
+         fio_pending_bytes(s->c->info.uuid) <= s->limit;
+}
+
+/** Writes a held message. */
+static void iodine_slow_write_held(iodine_slow_sub_s *s, FIOBJ str) {
+  iodine_connection_data_s *c = s->c;
+  if (c->info.type == IODINE_CONNECTION_WEBSOCKET) {
+    fio_str_info_s m = fiobj_obj2cstr(str);
+    websocket_write(c->info.arg, m,
+                    s->block == Qnil && websocket_utf8_valid(m.data, m.len));
+    fiobj_free(str);
+    return;
+  }
+  fiobj_send_free(c->info.uuid, str);
+}
+
+/** Writes the held messages (oldest first). Call within the lock. */
+static void iodine_slow_flush_unsafe(iodine_slow_sub_s *s) {
+  while (fio_ls_any(&s->held))
+    iodine_slow_write_held(s, (FIOBJ)fio_ls_shift(&s->held));
+  s->held_bytes = 0;
+}
+
+/** Holds a message until the client is drained. Call within the lock. */
+static void iodine_slow_hold_unsafe(iodine_slow_sub_s *s, fio_msg_s *msg) {
+  if (s->policy == IODINE_SLOW_CONFLATE && fio_ls_any(&s->held)) {
+    fiobj_free((FIOBJ)fio_ls_shift(&s->held));
+    s->held_bytes = 0;
+    fio_atomic_add(&iodine_slow_counters[IODINE_SLOW_CONFLATE], 1);
+  }
+  fio_ls_push(&s->held, (void *)fiobj_str_new(msg->msg.data, msg->msg.len));
+  s->held_bytes += msg->msg.len;
+  /* the newest message is always held */
+  while (s->held_bytes > s->limit && s->held.next != s->held.prev) {
+    FIOBJ oldest = (FIOBJ)fio_ls_shift(&s->held);
+    s->held_bytes -= fiobj_obj2cstr(oldest).len;
+    fiobj_free(oldest);
+    fio_atomic_add(&iodine_slow_counters[IODINE_SLOW_DROP_OLDEST], 1);
+  }
+}
+
+/** Applies the subscription's policy to a message for a slow client. */
+static void iodine_slow_apply_unsafe(iodine_slow_sub_s *s, fio_msg_s *msg) {
+  switch (s->policy) {
+  case IODINE_SLOW_DROP_OLDEST: /* fallthrough */
+  case IODINE_SLOW_CONFLATE:
+    iodine_slow_hold_unsafe(s, msg);
+    return;
+  case IODINE_SLOW_CLOSE:
+    s->closed = 1;
+    fio_atomic_add(&iodine_slow_counters[IODINE_SLOW_CLOSE], 1);
+    FIO_LOG_DEBUG("(iodine) closing a slow pub/sub client (%p)",
+                  (void *)s->c->info.uuid);
+    if (s->c->info.type == IODINE_CONNECTION_WEBSOCKET)
+      websocket_close_code(s->c->info.arg, 1008); /* policy violation */
+    else
+      fio_close(s->c->info.uuid);
+    return;
+  case IODINE_SLOW_DROP_NEWEST: /* fallthrough */
+  default:
+    fio_atomic_add(&iodine_slow_counters[IODINE_SLOW_DROP_NEWEST], 1);
+    return;
+  }
+}
+
+/** Writes the held messages once the connection's queue was drained. */
+static void iodine_slow_on_drained(iodine_connection_data_s *c) {
+  fio_lock(&c->slow_lock);
+  FIO_LS_EMBD_FOR(&c->slow, node) {
+    iodine_slow_sub_s *s = FIO_LS_EMBD_OBJ(iodine_slow_sub_s, node, node);
+    fio_lock(&s->lock);
+    if (c->info.uuid != -1 && !s->closed)
+      iodine_slow_flush_unsafe(s);
+    fio_unlock(&s->lock);
+  }
+  fio_unlock(&c->slow_lock);
+}
+
+/** Parses the `slow` subscription option (raising on unknown policies). */
+static iodine_slow_policy_e iodine_slow_policy(VALUE name) {
+  if (name == Qnil || name == Qfalse)
+    return IODINE_SLOW_NONE;
+  if (TYPE(name) == T_SYMBOL) {
+    const char *s = rb_id2name(rb_sym2id(name));
+    for (size_t i = 1; s && i < IODINE_SLOW_POLICIES; ++i) {
+      if (!strcmp(s, iodine_slow_names[i]))
+        return (iodine_slow_policy_e)i;
+    }
+  }
+  rb_raise(rb_eArgError, ":slow must be one of :drop_newest, :drop_oldest, "
+                         ":conflate or :close.");
+  return IODINE_SLOW_NONE;
+}
+
+/**
+ * Returns a Hash with the number of times each slow consumer policy was
+ * applied by this process (see {Iodine::Connection#subscribe}).
+ *
+ * `:drop_newest` and `:drop_oldest` count dropped messages, `:conflate` counts
+ * replaced messages and `:close` counts disconnected clients.
+ */
+static VALUE iodine_slow_consumers(VALUE self) {
+  VALUE ret = rb_hash_new();
+  for (size_t i = 1; i < IODINE_SLOW_POLICIES; ++i)
+    rb_hash_aset(ret, ID2SYM(rb_intern(iodine_slow_names[i])),
+                 SIZET2NUM(iodine_slow_counters[i]));
+  (void)self;
+  return ret;
+}
+
 /* *****************************************************************************
 Pub/Sub Callbacks (internal implementation)
 ***************************************************************************** */
@@ -418,16 +700,10 @@ static void iodine_on_pubsub(fio_msg_s *msg) {
       return;
     switch (data->info.type) {
     case IODINE_CONNECTION_WEBSOCKET: {
-      FIOBJ s = (FIOBJ)fio_message_metadata(
-          msg, (block == Qnil ? WEBSOCKET_OPTIMIZE_PUBSUB
-                              : WEBSOCKET_OPTIMIZE_PUBSUB_BINARY));
-      if (s) {
-        // fwrite(".", 1, 1, stderr);
-        fiobj_send_free(data->info.uuid, fiobj_dup(s));
-      } else {
-        fwrite("-", 1, 1, stderr);
-        websocket_write(data->info.arg, msg->msg, (block == Qnil));
-      }
+      websocket_write_broadcast(data->info.arg, msg,
+                                (block == Qnil
+                                     ? WEBSOCKET_OPTIMIZE_PUBSUB
+                                     : WEBSOCKET_OPTIMIZE_PUBSUB_BINARY));
       return;
     }
     case IODINE_CONNECTION_SSE: /* SSE - raw bytes, framework handles formatting */
@@ -455,6 +731,50 @@ static void iodine_on_pubsub(fio_msg_s *msg) {
   }
 }
 
+/* callback for direct subscriptions with a slow consumer policy */
+static void iodine_on_pubsub_slow(fio_msg_s *msg) {
+  iodine_connection_data_s *data = msg->udata1;
+  iodine_slow_sub_s *s = msg->udata2;
+  if (data->info.handler == Qnil || data->info.uuid == -1 ||
+      fio_is_closed(data->info.uuid))
+    return;
+  fio_lock(&s->lock);
+  if (s->closed)
+    goto finish;
+  if (!iodine_slow_is_ready(s)) {
+    iodine_slow_apply_unsafe(s, msg);
+    goto finish;
+  }
+  iodine_slow_flush_unsafe(s);
+  if (data->info.type == IODINE_CONNECTION_WEBSOCKET)
+    websocket_write_broadcast(data->info.arg, msg,
+                              (s->block == Qnil
+                                   ? WEBSOCKET_OPTIMIZE_PUBSUB
+                                   : WEBSOCKET_OPTIMIZE_PUBSUB_BINARY));
+  else
+    fio_write(data->info.uuid, msg->msg.data, msg->msg.len);
+finish:
+  fio_unlock(&s->lock);
+}
+
+/* callback for the closure of subscriptions with a slow consumer policy */
+static void iodine_on_unsubscribe_slow(void *udata1, void *udata2) {
+  iodine_connection_data_s *data = udata1;
+  iodine_slow_sub_s *s = udata2;
+  fio_lock(&data->slow_lock);
+  fio_ls_embd_remove(&s->node);
+  fio_unlock(&data->slow_lock);
+  while (fio_ls_any(&s->held))
+    fiobj_free((FIOBJ)fio_ls_shift(&s->held));
+  if (data->info.type == IODINE_CONNECTION_WEBSOCKET)
+    websocket_optimize4broadcasts((s->block == Qnil
+                                       ? WEBSOCKET_OPTIMIZE_PUBSUB
+                                       : WEBSOCKET_OPTIMIZE_PUBSUB_BINARY),
+                                  0);
+  free(s);
+  iodine_connection_data_free(data);
+}
+
 /* callback for subscription closure */
 static void iodine_on_unsubscribe(void *udata1, void *udata2) {
   iodine_connection_data_s *data = udata1;
@@ -488,6 +808,8 @@ typedef struct {
   VALUE channel;
   VALUE block;
   fio_match_fn pattern;
+  size_t max_pending;
+  iodine_slow_policy_e slow;
   uint8_t binary;
 } iodine_sub_args_s;
 
@@ -543,6 +865,11 @@ static iodine_sub_args_s iodine_subscribe_args(int argc, VALUE *argv) {
         TYPE(tmp) == T_SYMBOL && rb_sym2id(tmp) == redis_id) {
       ret.pattern = FIO_MATCH_GLOB;
     }
+    ret.slow = iodine_slow_policy(rb_hash_aref(rb_opt, ID2SYM(slow_id)));
+    if ((tmp = rb_hash_aref(rb_opt, ID2SYM(max_pending_id))) != Qnil) {
+      Check_Type(tmp, T_FIXNUM);
+      ret.max_pending = FIX2ULONG(tmp);
+    }
     ret.block = rb_hash_aref(rb_opt, ID2SYM(handler_id));
     if (ret.block != Qnil) {
       IodineStore.add(ret.block);
@@ -582,6 +909,8 @@ The options Hash supports the following possible keys (other keys are ignored, a
 - `:to` - The channel / subject to subscribe to.
 - `:as` - (only for WebSocket connections) accepts the optional value `:binary`. default is `:text`. Note that binary transmissions are illegal for some connections (such as SSE) and an attempted binary subscription will fail for these connections.
 - `:handler` - Any object that answers `.call(source, msg)` where source is the stream / channel name.
+- `:slow` - (only for connection subscriptions without a block / handler) the policy used when the client is slow, i.e., when the connection's queued data exceeds `:max_pending` bytes. Valid values are: `:drop_newest` (new messages are dropped), `:drop_oldest` (messages are held until the client drains, dropping the oldest held messages when they exceed `:max_pending`), `:conflate` (only the latest message is held) and `:close` (the connection is closed, WebSocket clients receive the 1008 close code). See {Iodine::PubSub.slow_consumers} for the policy counters.
+- `:max_pending` - the number of queued bytes that marks a client as slow (defaults to 1Mb).
 
 Note: if an existing subscription with the same name exists, it will be replaced by this new subscription.
 
@@ -600,6 +929,10 @@ static VALUE iodine_pubsub_subscribe(int argc, VALUE *argv, VALUE self) {
       rb_raise(rb_eArgError,
                "block or :handler required for local subscriptions.");
     }
+    if (args.slow) {
+      IodineStore.remove(args.block);
+      rb_raise(rb_eArgError, ":slow requires a connection subscription.");
+    }
   } else {
     c = iodine_connection_validate_data(self);
     if (!c || (c->info.type == IODINE_CONNECTION_SSE && args.binary)) {
@@ -608,6 +941,10 @@ static VALUE iodine_pubsub_subscribe(int argc, VALUE *argv, VALUE self) {
       }
       return Qnil; /* cannot subscribe a closed / invalid connection. */
     }
+    if (args.slow && args.block != Qnil) {
+      IodineStore.remove(args.block);
+      rb_raise(rb_eArgError, ":slow can't be used with a block or :handler.");
+    }
     if (args.block == Qnil) {
       if (c->info.type == IODINE_CONNECTION_WEBSOCKET)
         websocket_optimize4broadcasts((args.binary
@@ -621,11 +958,32 @@ static VALUE iodine_pubsub_subscribe(int argc, VALUE *argv, VALUE self) {
     fio_atomic_add(&c->ref, 1);
   }
 
-  subscription_s *sub =
-      fio_subscribe(.channel = IODINE_RSTRINFO(args.channel),
-                    .on_message = iodine_on_pubsub,
-                    .on_unsubscribe = iodine_on_unsubscribe, .udata1 = c,
-                    .udata2 = (void *)args.block, .match = args.pattern);
+  subscription_s *sub;
+  if (args.slow) {
+    iodine_slow_sub_s *s = malloc(sizeof(*s));
+    FIO_ASSERT_ALLOC(s);
+    *s = (iodine_slow_sub_s){
+        .block = args.block,
+        .c = c,
+        .limit = (args.max_pending ? args.max_pending
+                                   : IODINE_SLOW_CONSUMER_LIMIT),
+        .policy = args.slow,
+        .lock = FIO_LOCK_INIT,
+        .held = FIO_LS_INIT(s->held),
+    };
+    fio_lock(&c->slow_lock);
+    fio_ls_embd_push(&c->slow, &s->node);
+    fio_unlock(&c->slow_lock);
+    sub = fio_subscribe(.channel = IODINE_RSTRINFO(args.channel),
+                        .on_message = iodine_on_pubsub_slow,
+                        .on_unsubscribe = iodine_on_unsubscribe_slow,
+                        .udata1 = c, .udata2 = s, .match = args.pattern);
+  } else {
+    sub = fio_subscribe(.channel = IODINE_RSTRINFO(args.channel),
+                        .on_message = iodine_on_pubsub,
+                        .on_unsubscribe = iodine_on_unsubscribe, .udata1 = c,
+                        .udata2 = (void *)args.block, .match = args.pattern);
+  }
   if (c) {
     fio_lock(&c->lock);
     if (c->info.uuid == -1) {
@@ -763,6 +1121,8 @@ static VALUE iodine_pubsub_publish(int argc, VALUE *argv, VALUE self) {
     }
   }
 
+  /* deprecated: deferred requests used to wait on their fiber's ID channel */
+  iodine_http_resume_channel(IODINE_RSTRINFO(rb_ch));
   fio_publish(.engine = engine, .channel = IODINE_RSTRINFO(rb_ch),
               .message = IODINE_RSTRINFO(rb_msg));
   return Qtrue;
@@ -791,11 +1151,15 @@ VALUE iodine_connection_new(iodine_connection_s args) {
       .ref = 1,
       .answers_on_open = (rb_respond_to(args.handler, on_open_id) != 0),
       .answers_on_message = (rb_respond_to(args.handler, on_message_id) != 0),
+      .answers_on_message_chunk =
+          (rb_respond_to(args.handler, on_message_chunk_id) != 0),
       .answers_ping = (rb_respond_to(args.handler, ping_id) != 0),
       .answers_on_drained = (rb_respond_to(args.handler, on_drained_id) != 0),
       .answers_on_shutdown = (rb_respond_to(args.handler, on_shutdown_id) != 0),
       .answers_on_close = (rb_respond_to(args.handler, on_close_id) != 0),
       .lock = FIO_LOCK_INIT,
+      .slow = FIO_LS_INIT(data->slow),
+      .slow_lock = FIO_LOCK_INIT,
   };
   return connection;
 }
@@ -834,6 +1198,8 @@ void iodine_connection_fire_event(VALUE connection,
     }
     break;
   case IODINE_CONNECTION_ON_DRAINED:
+    if (fio_ls_embd_any(&data->slow))
+      iodine_slow_on_drained(data);
     if (data->answers_on_drained) {
       IodineCaller.call2(data->info.handler, on_drained_id, 1, args);
     }
@@ -867,6 +1233,33 @@ void iodine_connection_fire_event(VALUE connection,
   }
 }
 
+/** Returns true if the connection's handler answers `on_message_chunk`. */
+uint8_t iodine_connection_answers_chunks(VALUE connection) {
+  iodine_connection_data_s *data = iodine_connection_validate_data(connection);
+  return data && data->answers_on_message_chunk;
+}
+
+/**
+ * Fires the `on_message_chunk(client, data, first, last)` event.
+ *
+ * If the handler was replaced by one that doesn't answer `on_message_chunk`,
+ * complete messages are passed to `on_message`.
+ */
+void iodine_connection_fire_chunk(VALUE connection, VALUE data, uint8_t first,
+                                  uint8_t last) {
+  iodine_connection_data_s *c = iodine_connection_validate_data(connection);
+  if (!c || !c->info.handler || c->info.handler == Qnil)
+    return;
+  if (c->answers_on_message_chunk) {
+    VALUE args[4] = {connection, data, (first ? Qtrue : Qfalse),
+                     (last ? Qtrue : Qfalse)};
+    IodineCaller.call2(c->info.handler, on_message_chunk_id, 4, args);
+  } else if (first && last) {
+    iodine_connection_fire_event(connection, IODINE_CONNECTION_ON_MESSAGE,
+                                 data);
+  }
+}
+
 void iodine_connection_init(void) {
   // set used constants
   IodineUTF8Encoding = rb_enc_find("UTF-8");
@@ -880,6 +1273,8 @@ void iodine_connection_init(void) {
   binary_id = rb_intern2("binary", 6);
   match_id = rb_intern2("match", 5);
   redis_id = rb_intern2("redis", 5);
+  slow_id = rb_intern2("slow", 4);
+  max_pending_id = rb_intern("max_pending");
   handler_id = rb_intern2("handler", 7);
   engine_id = rb_intern2("engine", 6);
   message_id = rb_intern2("message", 7);
@@ -887,6 +1282,7 @@ void iodine_connection_init(void) {
   on_message_id = rb_intern("on_message");
   on_drained_id = rb_intern("on_drained");
   on_shutdown_id = rb_intern("on_shutdown");
+  on_message_chunk_id = rb_intern("on_message_chunk");
   on_close_id = rb_intern("on_close");
   ping_id = rb_intern("ping");
 
@@ -898,11 +1294,14 @@ void iodine_connection_init(void) {
     IodineStore.add(ID2SYM(binary_id));
     IodineStore.add(ID2SYM(match_id));
     IodineStore.add(ID2SYM(redis_id));
+    IodineStore.add(ID2SYM(slow_id));
+    IodineStore.add(ID2SYM(max_pending_id));
     IodineStore.add(ID2SYM(handler_id));
     IodineStore.add(ID2SYM(engine_id));
     IodineStore.add(ID2SYM(message_id));
     IodineStore.add(ID2SYM(on_open_id));
     IodineStore.add(ID2SYM(on_message_id));
+    IodineStore.add(ID2SYM(on_message_chunk_id));
     IodineStore.add(ID2SYM(on_drained_id));
     IodineStore.add(ID2SYM(on_shutdown_id));
     IodineStore.add(ID2SYM(on_close_id));
@@ -922,6 +1321,9 @@ void iodine_connection_init(void) {
       rb_define_class_under(IodineModule, "Connection", rb_cObject);
   rb_define_alloc_func(ConnectionKlass, iodine_connection_data_alloc_c);
   rb_define_method(ConnectionKlass, "write", iodine_connection_write, 1);
+  rb_define_method(ConnectionKlass, "write_many", iodine_connection_write_many,
+                   1);
+  rb_define_method(ConnectionKlass, "cork", iodine_connection_cork, 0);
   rb_define_method(ConnectionKlass, "close", iodine_connection_close, 0);
   rb_define_method(ConnectionKlass, "open?", iodine_connection_is_open, 0);
   rb_define_method(ConnectionKlass, "pending", iodine_connection_pending, 0);
@@ -951,4 +1353,6 @@ void iodine_connection_init(void) {
   rb_define_module_function(IodineModule, "unsubscribe",
                             iodine_pubsub_unsubscribe, 1);
   rb_define_module_function(IodineModule, "publish", iodine_pubsub_publish, -1);
+  rb_define_module_function(rb_define_module_under(IodineModule, "PubSub"),
+                            "slow_consumers", iodine_slow_consumers, 0);
 }
@@ -40,6 +40,13 @@ void iodine_connection_fire_event(VALUE connection,
                                   iodine_connection_event_type_e ev,
                                   VALUE data);
 
+/** Returns true if the connection's handler answers `on_message_chunk`. */
+uint8_t iodine_connection_answers_chunks(VALUE connection);
+
+/** Fires the `on_message_chunk(client, data, first, last)` event. */
+void iodine_connection_fire_chunk(VALUE connection, VALUE data, uint8_t first,
+                                  uint8_t last);
+
 /** Initializes the Connection Ruby class. */
 void iodine_connection_init(void);
 
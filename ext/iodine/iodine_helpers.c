@@ -451,6 +451,7 @@ static VALUE parse_multipart(VALUE self, VALUE rack_io, VALUE content_type) {
   if (content_type == Qnil) {
     rb_raise(rb_eRuntimeError, "Incorrect content type for multipart request");
   }
+  IodineRackIO.buffer(rack_io);
 
   return http_parse_multipart(h, RSTRING_PTR(content_type), RSTRING_LEN(content_type));
   (void)self;
@@ -7,6 +7,7 @@ Feel free to copy, use and enjoy according to the license provided.
 #include "iodine.h"
 
 #include "http.h"
+#include "http_log.h"
 #include "iodine_caller.h"
 #include "iodine_store.h"
 
@@ -19,11 +20,15 @@ Feel free to copy, use and enjoy according to the license provided.
 #include <arpa/inet.h>
 #endif
 #include <ctype.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #ifndef __MINGW32__
+#include <poll.h>
 #include <sys/socket.h>
 #endif
+#include <time.h>
 
 /* *****************************************************************************
 Available Globals
@@ -57,6 +62,8 @@ static VALUE HTTP_HOST;
 static VALUE hijack_func_sym;
 static ID close_method_id;
 static ID each_method_id;
+static ID to_path_method_id;
+static ID ranges_method_id;
 static ID attach_method_id;
 static ID iodine_call_proc_id;
 static ID fiber_result_var_id;
@@ -66,6 +73,8 @@ static ID iodine_env_var_id;
 
 static VALUE env_template;
 
+static VALUE IodineResponseStreamClass;
+
 static rb_encoding *IodineUTF8Encoding;
 static rb_encoding *IodineBinaryEncoding;
 
@@ -108,15 +117,29 @@ rack_declare(XSENDFILE_TYPE_HEADER); // for X-Sendfile support
 rack_declare(CONTENT_LENGTH_HEADER); // for X-Sendfile support
 rack_declare(IODINE_REQUEST_ID);
 rack_declare(IODINE_HAS_BODY);
+rack_declare(IODINE_QUEUE_TIME); // iodine.queue_time
+rack_declare(IODINE_TIMINGS);    // iodine.timings
 
 /* used internally to handle requests */
 typedef struct {
   http_s *h;
   FIOBJ body;
   FIOBJ root;
+  /* a (frozen) String body sent without copying it */
+  VALUE pinned;
+  /* when the request was received (monotonic, microseconds) */
+  uint64_t queued_at;
+  /* used when sending a `to_path` body */
+  int fd;
+  uintptr_t offset;
+  uintptr_t length;
   enum iodine_http_response_type_enum {
     IODINE_HTTP_NONE,
     IODINE_HTTP_SENDBODY,
+    IODINE_HTTP_SENDPINNED,
+    IODINE_HTTP_STREAM,
+    IODINE_HTTP_STREAM_FAILED,
+    IODINE_HTTP_SENDFILE,
     IODINE_HTTP_XSENDFILE,
     IODINE_HTTP_EMPTY,
     IODINE_HTTP_ERROR,
@@ -133,6 +156,8 @@ typedef struct {
   char *data;
   size_t size;
   uint8_t is_text;
+  uint8_t first;
+  uint8_t last;
   VALUE io;
 } iodine_msg2ruby_s;
 
@@ -155,6 +180,33 @@ static void iodine_ws_on_message(ws_s *ws, fio_str_info_s data,
   };
   IodineCaller.enterGVL(iodine_ws_fire_message, &msg);
 }
+
+static void *iodine_ws_fire_message_chunk(void *msg_) {
+  iodine_msg2ruby_s *msg = msg_;
+  VALUE data = rb_enc_str_new(
+      msg->data, msg->size,
+      (msg->is_text ? rb_utf8_encoding() : rb_ascii8bit_encoding()));
+  iodine_connection_fire_chunk(msg->io, data, msg->first, msg->last);
+  return NULL;
+}
+
+/**
+ * Used (instead of `on_message`) when the handler answers `on_message_chunk`,
+ * passing messages to Ruby in pieces, as they arrive.
+ */
+static void iodine_ws_on_message_chunk(ws_s *ws, fio_str_info_s data,
+                                       uint8_t is_text, uint8_t first,
+                                       uint8_t last) {
+  iodine_msg2ruby_s msg = {
+      .data = data.data,
+      .size = data.len,
+      .is_text = is_text,
+      .first = first,
+      .last = last,
+      .io = (VALUE)websocket_udata_get(ws),
+  };
+  IodineCaller.enterGVL(iodine_ws_fire_message_chunk, &msg);
+}
 /**
  * The (optional) on_open callback will be called once the websocket
  * connection is established and before is is registered with `facil`, so no
@@ -210,6 +262,9 @@ static void iodine_ws_attach(http_s *h, VALUE handler, VALUE env) {
     return;
 
   http_upgrade2ws(h, .on_message = iodine_ws_on_message,
+                  .on_message_chunk = (iodine_connection_answers_chunks(io)
+                                           ? iodine_ws_on_message_chunk
+                                           : NULL),
                   .on_open = iodine_ws_on_open, .on_ready = iodine_ws_on_ready,
                   .on_shutdown = iodine_ws_on_shutdown,
                   .on_close = iodine_ws_on_close, .udata = (void *)io);
@@ -319,12 +374,36 @@ static int iodine_copy2env_task(FIOBJ o, void *env_) {
   return 0;
 }
 
-static inline VALUE copy2env(iodine_http_request_handle_s *handle) {
+/** Returns a phase's time since the request's first byte (or nil). */
+static inline VALUE iodine_http_timing2ruby(http_s *h, uint64_t at) {
+  if (!at || !h->timings.read || at < h->timings.read)
+    return Qnil;
+  return DBL2NUM((double)(at - h->timings.read) / 1000000.0);
+}
+
+/** Returns the request's phases so far (milliseconds since the first byte). */
+static VALUE iodine_http_timings2hash(http_s *h) {
+  VALUE timings = rb_hash_new();
+  rb_hash_aset(timings, rb_str_new_static("headers", 7),
+               iodine_http_timing2ruby(h, h->timings.headers));
+  rb_hash_aset(timings, rb_str_new_static("body", 4),
+               iodine_http_timing2ruby(h, h->timings.body));
+  rb_hash_aset(timings, rb_str_new_static("gvl", 3),
+               iodine_http_timing2ruby(h, h->timings.gvl));
+  return timings;
+}
+
+static inline VALUE copy2env(iodine_http_request_handle_s *handle,
+                             uint64_t queue_time) {
   VALUE env;
   http_s *h = handle->h;
   env = rb_hash_dup(env_template);
   IodineStore.add(env);
 
+  rb_hash_aset(env, IODINE_QUEUE_TIME, DBL2NUM((double)queue_time / 1000.0));
+  if (http_settings(h)->timings)
+    rb_hash_aset(env, IODINE_TIMINGS, iodine_http_timings2hash(h));
+
   fio_str_info_s tmp;
   char *pos = NULL;
   /* Copy basic data */
@@ -532,24 +611,247 @@ array_style_multi_value:
   return ST_CONTINUE;
 }
 
-// writes the body to the response object
-static VALUE for_each_body_string(VALUE str, VALUE body_, int argc,
-                                  const VALUE *argv, VALUE blockarg) {
-  // fprintf(stderr, "For_each - body\n");
-  // write body
+/* *****************************************************************************
+Streaming the response body
+***************************************************************************** */
+
+#ifndef IODINE_HTTP_STREAM_HIGH_WATERMARK
+/** streamed bodies wait for the socket once this many bytes are queued */
+#define IODINE_HTTP_STREAM_HIGH_WATERMARK (1024 * 256)
+#endif
+
+typedef struct {
+  http_s *h;
+  FIOBJ buf;
+  intptr_t uuid;
+  size_t flush_size;
+  /** set once the headers were sent */
+  uint8_t started;
+  /** set if the connection was lost (further data is discarded) */
+  uint8_t aborted;
+  /** set if the body raised an exception (the response is incomplete) */
+  uint8_t failed;
+} iodine_http_stream_s;
+
+/* waits (outside the GVL) until the socket's queue drains below the mark */
+static void *iodine_http_stream_drain(void *s_) {
+  iodine_http_stream_s *s = s_;
+  size_t pending = fio_pending_bytes(s->uuid);
+  size_t timeout = http_settings(s->h)->timeout;
+  time_t last_progress = time(NULL);
+  while (pending > (IODINE_HTTP_STREAM_HIGH_WATERMARK >> 1)) {
+    if (fio_flush(s->uuid) < 0 && errno != EWOULDBLOCK)
+      goto aborted;
+    size_t tmp = fio_pending_bytes(s->uuid);
+    if (tmp < pending)
+      last_progress = time(NULL);
+    else if ((size_t)(time(NULL) - last_progress) >= timeout)
+      goto timed_out;
+    pending = tmp;
+    if (!fio_is_valid(s->uuid))
+      goto aborted;
+#ifndef __MINGW32__
+    struct pollfd pfd = {.fd = fio_uuid2fd(s->uuid), .events = POLLOUT};
+    poll(&pfd, 1, 250);
+#else
+    fio_throttle_thread(2000000);
+#endif
+  }
+  return NULL;
+timed_out:
+  FIO_LOG_DEBUG("(%d) streamed response timed out waiting for the client.",
+                (int)getpid());
+  fio_close(s->uuid);
+aborted:
+  s->aborted = 1;
+  return NULL;
+}
+
+/* sends the buffered data (outside the GVL, since it might be compressed) */
+static void *iodine_http_stream_send(void *s_) {
+  iodine_http_stream_s *s = s_;
+  fio_str_info_s data = fiobj_obj2cstr(s->buf);
+  if (http_stream(s->h, data.data, data.len))
+    s->aborted = 1;
+  return NULL;
+}
+
+/* sends any buffered data, sending the headers if required */
+static void iodine_http_stream_flush(iodine_http_stream_s *s) {
+  if (s->aborted)
+    goto reset;
+  IodineCaller.leaveGVL(iodine_http_stream_send, s);
+  if (s->aborted)
+    goto reset;
+  s->started = 1;
+  if (fio_pending_bytes(s->uuid) > IODINE_HTTP_STREAM_HIGH_WATERMARK)
+    IodineCaller.leaveGVL(iodine_http_stream_drain, s);
+reset:
+  fiobj_str_resize(s->buf, 0);
+}
+
+/* buffers a String, flushing the buffer once it's large enough */
+static void iodine_http_stream_write(iodine_http_stream_s *s, VALUE str) {
   if (TYPE(str) != T_STRING) {
     FIO_LOG_ERROR("(Iodine) response body not a String\n");
-    return Qfalse;
-  }
-  if (RSTRING_LEN(str) && RSTRING_PTR(str)) {
-    fiobj_str_write((FIOBJ)body_, RSTRING_PTR(str), RSTRING_LEN(str));
+    return;
   }
+  if (!RSTRING_LEN(str) || s->aborted)
+    return;
+  fiobj_str_write(s->buf, RSTRING_PTR(str), RSTRING_LEN(str));
+  if (fiobj_obj2cstr(s->buf).len >= s->flush_size)
+    iodine_http_stream_flush(s);
+}
+
+// writes the body to the response object
+static VALUE for_each_body_string(VALUE str, VALUE s_, int argc,
+                                  const VALUE *argv, VALUE blockarg) {
+  // fprintf(stderr, "For_each - body\n");
+  iodine_http_stream_write((iodine_http_stream_s *)s_, str);
   return Qtrue;
   (void)argc;
   (void)argv;
   (void)blockarg;
 }
 
+/* *****************************************************************************
+Rack 3 streaming bodies - the `stream` object passed to `body.call(stream)`
+***************************************************************************** */
+
+static const rb_data_type_t iodine_response_stream_type = {
+    .wrap_struct_name = "IodineResponseStream",
+    .function =
+        {
+            .dmark = NULL,
+            .dfree = NULL, /* the stream data lives on the C stack */
+            .dsize = NULL,
+        },
+    .data = NULL,
+    .flags = RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
+static inline iodine_http_stream_s *iodine_response_stream_get(VALUE self) {
+  iodine_http_stream_s *s =
+      rb_check_typeddata(self, &iodine_response_stream_type);
+  if (!s)
+    rb_raise(rb_eIOError, "closed stream");
+  return s;
+}
+
+/**
+Writes the data to the response. Data is buffered and sent to the client once
+enough data was collected (or when {flush} is called).
+
+Returns the number of bytes written.
+*/
+static VALUE iodine_response_stream_write(int argc, VALUE *argv, VALUE self) {
+  iodine_http_stream_s *s = iodine_response_stream_get(self);
+  size_t len = 0;
+  for (int i = 0; i < argc; ++i) {
+    VALUE str = argv[i];
+    if (TYPE(str) != T_STRING)
+      str = IodineCaller.call(str, iodine_to_s_id);
+    iodine_http_stream_write(s, str);
+    if (TYPE(str) == T_STRING)
+      len += RSTRING_LEN(str);
+  }
+  return SIZET2NUM(len);
+}
+
+/** Writes the data to the response, returning the stream object. */
+static VALUE iodine_response_stream_push(VALUE self, VALUE str) {
+  iodine_response_stream_write(1, &str, self);
+  return self;
+}
+
+/** Sends any buffered data (and the response headers) to the client. */
+static VALUE iodine_response_stream_flush(VALUE self) {
+  iodine_http_stream_flush(iodine_response_stream_get(self));
+  return self;
+}
+
+/**
+Reading from the response stream isn't supported, use `rack.input` instead.
+
+Always returns `nil`.
+*/
+static VALUE iodine_response_stream_read(int argc, VALUE *argv, VALUE self) {
+  return Qnil;
+  (void)argc;
+  (void)argv;
+  (void)self;
+}
+
+/** Closes the stream. The response is completed once `call` returns. */
+static VALUE iodine_response_stream_close(VALUE self) {
+  DATA_PTR(self) = NULL;
+  return Qnil;
+}
+
+/** Returns `true` if the stream was closed. */
+static VALUE iodine_response_stream_is_closed(VALUE self) {
+  return DATA_PTR(self) ? Qfalse : Qtrue;
+}
+
+/* *****************************************************************************
+Sending `to_path` bodies (`File`, `Rack::Files::Iterator`) using `sendfile`
+***************************************************************************** */
+
+/*
+ * Opens the file a `to_path` body points to and finds the range to be sent.
+ *
+ * Returns -1 if the body should be sent using `each` (i.e., multiple ranges,
+ * or the file couldn't be opened).
+ */
+static int ruby2c_review_to_path(iodine_http_request_handle_s *handle,
+                                 VALUE body) {
+  VALUE path = IodineCaller.call(body, to_path_method_id);
+  if (TYPE(path) != T_STRING || !RSTRING_LEN(path) ||
+      memchr(RSTRING_PTR(path), 0, RSTRING_LEN(path)))
+    return -1;
+  long long first = 0;
+  long long last = -1;
+  if (rb_respond_to(body, ranges_method_id)) {
+    /* Rack::Files::Iterator - a single range can be sent directly */
+    VALUE ranges = IodineCaller.call(body, ranges_method_id);
+    if (TYPE(ranges) == T_ARRAY) {
+      if (RARRAY_LEN(ranges) > 1)
+        return -1; /* multipart/byteranges, requires the body's framing */
+      if (RARRAY_LEN(ranges) == 1) {
+        VALUE r_first, r_last;
+        int exclusive;
+        if (rb_range_values(RARRAY_AREF(ranges, 0), &r_first, &r_last,
+                            &exclusive) != Qtrue ||
+            !RB_INTEGER_TYPE_P(r_first) || !RB_INTEGER_TYPE_P(r_last))
+          return -1;
+        first = NUM2LL(r_first);
+        last = NUM2LL(r_last) - (exclusive ? 1 : 0);
+        if (first < 0 || last < first)
+          return -1;
+      }
+    }
+  }
+  int fd = open(RSTRING_PTR(path), O_RDONLY);
+  if (fd == -1)
+    return -1;
+  struct stat st;
+  if (fstat(fd, &st) || !S_ISREG(st.st_mode) || first >= st.st_size) {
+    close(fd);
+    return -1;
+  }
+  if (last < 0 || last >= st.st_size)
+    last = st.st_size - 1;
+  handle->fd = fd;
+  handle->offset = (uintptr_t)first;
+  handle->length = (uintptr_t)(last - first + 1);
+  handle->type = IODINE_HTTP_SENDFILE;
+  return 0;
+}
+
+/* *****************************************************************************
+Sending the response body
+***************************************************************************** */
+
 static inline int ruby2c_response_send(iodine_http_request_handle_s *handle,
                                        VALUE rbresponse, VALUE env) {
   (void)(env);
@@ -574,25 +876,65 @@ static inline int ruby2c_response_send(iodine_http_request_handle_s *handle,
 
   if (TYPE(body) == T_STRING) {
     // fprintf(stderr, "Review body as String\n");
-    if (RSTRING_LEN(body)) {
+    if (IODINE_ZERO_COPY(body)) {
+      /* released once written (see `iodine_store_str_release`) */
+      handle->pinned = IodineStore.add(body);
+      handle->type = IODINE_HTTP_SENDPINNED;
+    } else if (RSTRING_LEN(body)) {
       handle->body = fiobj_str_new(RSTRING_PTR(body), RSTRING_LEN(body));
       handle->type = IODINE_HTTP_SENDBODY;
     } else {
       handle->type = IODINE_HTTP_EMPTY;
     }
     return 0;
-  } else if (rb_respond_to(body, each_method_id)) {
+  }
+
+  if (rb_respond_to(body, to_path_method_id) &&
+      !ruby2c_review_to_path(handle, body)) {
+    // the file is sent by the kernel, the body object is no longer required
+    if (rb_respond_to(body, close_method_id))
+      IodineCaller.call(body, close_method_id);
+    return 0;
+  }
+
+  iodine_http_stream_s s = {
+      .h = handle->h,
+      .uuid = http_uuid(handle->h),
+      .flush_size = http_settings(handle->h)->stream_flush_size,
+  };
+  if (rb_respond_to(body, each_method_id)) {
     // fprintf(stderr, "Review body as for-each ...\n");
-    handle->body = fiobj_str_buf(1);
-    handle->type = IODINE_HTTP_SENDBODY;
-    IodineCaller.call_with_block(body, each_method_id, 0, NULL,
-                                 (VALUE)handle->body, for_each_body_string);
+    s.buf = fiobj_str_buf(1);
+    IodineCaller.call_with_block(body, each_method_id, 0, NULL, (VALUE)&s,
+                                 for_each_body_string);
+    s.failed = IodineCaller.raised();
     // we need to call `close` in case the object is an IO / BodyProxy
     if (rb_respond_to(body, close_method_id))
       IodineCaller.call(body, close_method_id);
-    return 0;
+  } else if (rb_respond_to(body, iodine_call_proc_id)) {
+    // Rack 3 streaming body
+    s.buf = fiobj_str_buf(1);
+    VALUE stream = TypedData_Wrap_Struct(IodineResponseStreamClass,
+                                         &iodine_response_stream_type, &s);
+    IodineStore.add(stream);
+    IodineCaller.call2(body, iodine_call_proc_id, 1, &stream);
+    s.failed = IodineCaller.raised();
+    DATA_PTR(stream) = NULL; /* the stream can't outlive the response */
+    IodineStore.remove(stream);
+  } else {
+    return -1;
   }
-  return -1;
+  if (s.failed && !s.started) {
+    /* nothing was sent yet, respond with an error instead */
+    fiobj_free(s.buf);
+    return -1;
+  }
+  handle->body = s.buf;
+  /* small bodies are sent as a whole, with a known content-length */
+  handle->type = s.started ? IODINE_HTTP_STREAM : IODINE_HTTP_SENDBODY;
+  if (s.failed)
+    handle->type = IODINE_HTTP_STREAM_FAILED;
+  return 0;
 }
 
 /* *****************************************************************************
@@ -652,6 +994,264 @@ upgraded:
   return 1;
 }
 
+/* *****************************************************************************
+Paused (deferred) requests - the resume table
+***************************************************************************** */
+
+/*
+ * Requests returning `[:__http_defer__, fiber]` are paused and stored here
+ * (by the fiber's ID) until `Iodine.resume(fiber)` is called.
+ *
+ * An entry is added while the request is handled (within the GVL), so
+ * `Iodine.resume` can't miss it, even if it's called before `http_pause`
+ * performed its task (in which case the request is resumed right away).
+ */
+typedef struct {
+  /** the paused request (NULL until `http_pause` performs its task). */
+  http_pause_handle_s *handle;
+  /** set when `Iodine.resume` was called before `handle` was set. */
+  uint8_t resumed;
+  /** the fiber's ID (the table's key). */
+  fio_str_info_s id;
+} iodine_paused_s;
+
+#define FIO_SET_NAME iodine_paused_map
+#define FIO_SET_OBJ_TYPE iodine_paused_s *
+#define FIO_SET_OBJ_COMPARE(o1, o2)                                            \
+  ((o1)->id.len == (o2)->id.len &&                                             \
+   ((o1) == (o2) || !memcmp((o1)->id.data, (o2)->id.data, (o1)->id.len)))
+#include <fio.h>
+
+static fio_lock_i iodine_paused_lock = FIO_LOCK_INIT;
+static iodine_paused_map_s iodine_paused = FIO_SET_INIT;
+
+/** Returns the fiber's ID (`fiber.__get_id`, if defined, or its object_id). */
+static VALUE iodine_fiber_id(VALUE fiber) {
+  if (TYPE(fiber) == T_STRING)
+    return fiber;
+  VALUE id = Qnil;
+  if (rb_respond_to(fiber, fiber_id_method_id))
+    id = IodineCaller.call(fiber, fiber_id_method_id);
+  if (id == Qnil)
+    id = rb_obj_id(fiber);
+  if (TYPE(id) != T_STRING)
+    id = rb_obj_as_string(id);
+  return id;
+}
+
+/** Adds an entry for the ID (must hold the GVL), NULL if it already exists. */
+static iodine_paused_s *iodine_paused_add(VALUE id) {
+  iodine_paused_s *entry = fio_malloc(sizeof(*entry) + RSTRING_LEN(id) + 1);
+  FIO_ASSERT_ALLOC(entry);
+  *entry = (iodine_paused_s){
+      .id = {.data = (char *)(entry + 1), .len = (size_t)RSTRING_LEN(id)},
+  };
+  memcpy(entry->id.data, RSTRING_PTR(id), entry->id.len);
+  entry->id.data[entry->id.len] = 0;
+  iodine_paused_s *existing;
+  fio_lock(&iodine_paused_lock);
+  existing = iodine_paused_map_insert(
+      &iodine_paused, fiobj_hash_string(entry->id.data, entry->id.len), entry);
+  fio_unlock(&iodine_paused_lock);
+  if (existing != entry) {
+    fio_free(entry);
+    return NULL;
+  }
+  return entry;
+}
+
+/** Removes an entry from the table (must hold the lock). */
+static inline void iodine_paused_remove(iodine_paused_s *entry) {
+  iodine_paused_map_remove(
+      &iodine_paused, fiobj_hash_string(entry->id.data, entry->id.len), entry,
+      NULL);
+}
+
+static inline void http_resume_deferred_request_handler(http_s *h);
+
+/** Resumes the request paused by the fiber ID, returns -1 if none was found. */
+static int iodine_resume_id(fio_str_info_s id) {
+  iodine_paused_s key = {.id = id};
+  http_pause_handle_s *handle = NULL;
+  fio_lock(&iodine_paused_lock);
+  iodine_paused_s *entry = iodine_paused_map_find(
+      &iodine_paused, fiobj_hash_string(key.id.data, key.id.len), &key);
+  if (entry && !entry->resumed) {
+    handle = entry->handle;
+    if (handle)
+      iodine_paused_remove(entry);
+    else
+      entry->resumed = 1; /* `http_pause` didn't perform its task yet */
+  } else {
+    entry = NULL;
+  }
+  fio_unlock(&iodine_paused_lock);
+  if (!entry)
+    return -1;
+  if (handle) {
+    fio_free(entry);
+    http_resume(handle, http_resume_deferred_request_handler, NULL);
+  }
+  return 0;
+}
+
+/**
+ * Resumes a request paused by a fiber with the channel's name as its ID.
+ *
+ * Deprecated: keeps `Iodine.publish(fiber.__get_id, ...)` working (only
+ * within the worker that handles the request), use `Iodine.resume` instead.
+ */
+int iodine_http_resume_channel(fio_str_info_s channel) {
+  static uint8_t warned = 0;
+  /* entries are added within the GVL, which `Iodine.publish` holds */
+  if (!iodine_paused_map_count(&iodine_paused) || iodine_resume_id(channel))
+    return -1;
+  if (!warned) {
+    warned = 1;
+    FIO_LOG_WARNING("resuming deferred requests using Iodine.publish is "
+                    "deprecated, use Iodine.resume(fiber) instead.");
+  }
+  return 0;
+}
+
+// clang-format off
+/**
+Resumes a request that was paused by returning `[:__http_defer__, fiber]` from
+the Rack application.
+
+The request's response is collected from the fiber's `@__result` instance
+variable once the request is resumed (on one of the server's threads).
+
+Accepts either the fiber or its ID (`fiber.__get_id`, when defined, or else
+`fiber.object_id`).
+
+Returns `true` if the request was found and `false` otherwise (i.e., if the
+request was already resumed).
+
+This doesn't use the pub/sub layer and should only be called within the worker
+process that handles the request.
+*/
+static VALUE iodine_resume(VALUE self, VALUE fiber) {
+  // clang-format on
+  VALUE id = iodine_fiber_id(fiber);
+  if (iodine_resume_id(IODINE_RSTRINFO(id)))
+    return Qfalse;
+  return Qtrue;
+  (void)self;
+}
+
+/**
+Returns the number of access log lines this process dropped because the log
+fell behind (see the `:log_policy` option).
+*/
+static VALUE iodine_dropped_log_lines(VALUE self) {
+  return SIZET2NUM(http_log_dropped());
+  (void)self;
+}
+
+/* *****************************************************************************
+Admission Control
+***************************************************************************** */
+
+/* the number of parsed requests not yet admitted (in this process) */
+static volatile size_t iodine_http_waiting = 0;
+/* a moving average of the time requests wait for the GVL (microseconds) */
+static uint64_t iodine_http_queue_time = 0;
+
+static inline uint64_t iodine_http_now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return ((uint64_t)t.tv_sec * 1000000) + (t.tv_nsec / 1000);
+}
+
+/**
+ * Returns the time since the request was completely read (microseconds).
+ *
+ * The client's upload time isn't included, only the time the complete request
+ * spent waiting for the application (see `http_s.completed_at`).
+ */
+static inline uint64_t iodine_http_received_ago(http_s *h) {
+  if (!h->completed_at)
+    return 0;
+  uint64_t now = http_timings_now();
+  return now > h->completed_at ? (now - h->completed_at) / 1000 : 0;
+}
+
+/**
+ * Counts the request as waiting and sheds it (503 with `Retry-After`) when the
+ * listener's `max_queue` or `max_queue_time` thresholds were crossed.
+ *
+ * A request that already waited longer than `max_queue_time` is always shed.
+ * The queue time estimate is only trusted while other requests are waiting,
+ * so an idle server always admits requests (and refreshes the estimate).
+ */
+static int iodine_http_shed(http_s *h, uint64_t waited) {
+  http_settings_s *settings = http_settings(h);
+  /* requests waiting ahead of this one */
+  size_t ahead = fio_atomic_add(&iodine_http_waiting, 1) - 1;
+  if (!((settings->max_queue && ahead >= settings->max_queue) ||
+        (settings->max_queue_time &&
+         (waited >= settings->max_queue_time * 1000 ||
+          (ahead &&
+           iodine_http_queue_time >= settings->max_queue_time * 1000)))))
+    return 0;
+  fio_atomic_sub(&iodine_http_waiting, 1);
+  http_set_header2(h, (fio_str_info_s){.data = (char *)"retry-after", .len = 11},
+                   (fio_str_info_s){.data = (char *)"1", .len = 1});
+  http_send_error(h, 503);
+  return 1;
+}
+
+/** Called once a request enters the GVL, returns its queue time. */
+static inline uint64_t
+iodine_http_admitted(iodine_http_request_handle_s *handle) {
+  uint64_t now = iodine_http_now();
+  uint64_t queue_time =
+      now > handle->queued_at ? now - handle->queued_at : 0;
+  fio_atomic_sub(&iodine_http_waiting, 1);
+  /* the GVL serializes updates */
+  iodine_http_queue_time =
+      ((iodine_http_queue_time * 7) + queue_time) >> 3;
+  if (http_settings(handle->h)->timings)
+    handle->h->timings.gvl = http_timings_now();
+  return queue_time;
+}
+
+/**
+ * Records the application's return and reports the request's phases using a
+ * `Server-Timing` header (`network`, `queue` and `app` durations).
+ */
+static void iodine_http_server_timing(http_s *h) {
+  if (!http_settings(h)->timings)
+    return;
+  http_timings_s *t = &h->timings;
+  t->app = http_timings_now();
+  uint64_t received = t->body ? t->body : t->headers;
+  const struct {
+    const char *name;
+    uint64_t start;
+    uint64_t end;
+  } metrics[] = {
+      {"network", t->read, received},
+      {"queue", received, t->gvl},
+      {"app", t->gvl, t->app},
+  };
+  char buf[128];
+  size_t len = 0;
+  for (size_t i = 0; i < sizeof(metrics) / sizeof(metrics[0]); ++i) {
+    if (!metrics[i].start || metrics[i].end < metrics[i].start)
+      continue;
+    len += snprintf(buf + len, sizeof(buf) - len, "%s%s;dur=%.3f",
+                    (len ? ", " : ""), metrics[i].name,
+                    (double)(metrics[i].end - metrics[i].start) / 1000000.0);
+  }
+  if (!len)
+    return;
+  http_set_header2(h,
+                   (fio_str_info_s){.data = (char *)"server-timing", .len = 13},
+                   (fio_str_info_s){.data = buf, .len = len});
+}
+
 /* *****************************************************************************
 Handling HTTP requests
 ***************************************************************************** */
@@ -661,6 +1261,9 @@ static inline void *iodine_handle_request_in_GVL(void *handle_) {
   VALUE rbresponse = Qnil;
   VALUE env = Qnil, tmp;
   http_s *h = handle->h;
+  uint64_t queue_time = 0;
+  if (handle->type != IODINE_HTTP_DEFERRED)
+    queue_time = iodine_http_admitted(handle);
   if (!h->udata)
     goto err_not_found;
 
@@ -669,7 +1272,7 @@ static inline void *iodine_handle_request_in_GVL(void *handle_) {
     env = rb_ivar_get((VALUE)h->fiber, iodine_env_var_id);
   } else {
     // create / register env variable
-    env = copy2env(handle);
+    env = copy2env(handle, queue_time);
     // create rack.io
     tmp = IodineRackIO.create(h, env);
     // pass env variable to handler
@@ -685,12 +1288,18 @@ static inline void *iodine_handle_request_in_GVL(void *handle_) {
   // rack will return `[:__http_defer__, fiber_to_wait_on]` in case the request needs to be paused
   if (TYPE(tmp) == T_SYMBOL && tmp == http_wait_directive) {
     VALUE fiber = rb_ary_entry(rbresponse, 1);
+    h->resume_entry = iodine_paused_add(iodine_fiber_id(fiber));
+    if (!h->resume_entry) {
+      FIO_LOG_ERROR("request deferred to a fiber that is already paused.");
+      goto internal_error;
+    }
     rb_ivar_set(fiber, iodine_env_var_id, env);
     h->fiber = (void *)IodineStore.add(fiber);
     goto defer;
   }
 
   IodineStore.add(rbresponse);
+  iodine_http_server_timing(h);
   // set response status
   if (TYPE(tmp) == T_STRING) {
     char *data = RSTRING_PTR(tmp);
@@ -784,6 +1393,32 @@ iodine_perform_handle_action(iodine_http_request_handle_s handle) {
     fiobj_free(handle.body);
     break;
   }
+  case IODINE_HTTP_SENDPINNED:
+    http_send_body_nocopy(handle.h, (void *)handle.pinned,
+                          RSTRING_PTR(handle.pinned),
+                          RSTRING_LEN(handle.pinned), iodine_store_str_release);
+    break;
+  case IODINE_HTTP_STREAM: {
+    /* send whatever remains in the buffer and complete the response */
+    fio_str_info_s data = fiobj_obj2cstr(handle.body);
+    if (data.len)
+      http_stream(handle.h, data.data, data.len);
+    http_finish(handle.h);
+    fiobj_free(handle.body);
+    break;
+  }
+  case IODINE_HTTP_STREAM_FAILED:
+    /* the body raised an exception midway, don't let it look complete */
+    fio_close(http_uuid(handle.h));
+    http_finish(handle.h);
+    fiobj_free(handle.body);
+    break;
+  case IODINE_HTTP_SENDFILE:
+    /* remove chunked transfer-encoding header, if any (Rack issue #1266) */
+    fiobj_hash_delete2(handle.h->private_data.out_headers,
+                       fiobj_obj2hash(HTTP_HEADER_TRANSFER_ENCODING));
+    http_sendfile(handle.h, handle.fd, handle.length, handle.offset);
+    break;
   case IODINE_HTTP_XSENDFILE: {
     /* remove chunked content-encoding header, if any (Rack issue #1266) */
     if (fiobj_obj2cstr(
@@ -834,10 +1469,9 @@ iodine_perform_handle_action(iodine_http_request_handle_s handle) {
 
 // gets called by `http_resume`
 static inline void http_resume_deferred_request_handler(http_s *h) {
-  // Save these before `iodine_handle_request_in_GVL`, because
+  // Save this before `iodine_handle_request_in_GVL`, because
   // SSE/WebSocket upgrades invalidate the `http_s` struct
   VALUE fiber = (VALUE)h->fiber;
-  subscription_s *subscription = (subscription_s *)h->subscription;
 
   iodine_http_request_handle_s handle = (iodine_http_request_handle_s){
     .h = h,
@@ -847,30 +1481,36 @@ static inline void http_resume_deferred_request_handler(http_s *h) {
   IodineCaller.enterGVL((void *(*)(void *))iodine_handle_request_in_GVL,
                         &handle);
 
-  fio_unsubscribe(subscription);
   IodineStore.remove(fiber);
 
   iodine_perform_handle_action(handle);
 }
 
-static inline void on_iodine_request_id_message(fio_msg_s *msg) {
-  http_resume((http_pause_handle_s *)msg->udata1, http_resume_deferred_request_handler, NULL);
-}
-
-// when Ruby sends a message into the `fiber_id` channel means the fiber attached to
-// to the `http_s h` var can be resumed
+// publishes the paused handle, unless `Iodine.resume` was already called
 static inline void http_pause_request_handler(http_pause_handle_s *s) {
-  VALUE fiber_id = rb_funcall((VALUE)s->fiber, fiber_id_method_id, 0);
-  subscription_s *sub = fio_subscribe(.channel = {0, RSTRING_LEN(fiber_id), RSTRING_PTR(fiber_id)},
-                                      .on_message = on_iodine_request_id_message,
-                                      .udata1 = (void *)s);
-
-  s->subscription = (void *)sub;
+  iodine_paused_s *entry = s->resume_entry;
+  uint8_t resumed;
+  fio_lock(&iodine_paused_lock);
+  resumed = entry->resumed;
+  if (resumed)
+    iodine_paused_remove(entry);
+  else
+    entry->handle = s;
+  fio_unlock(&iodine_paused_lock);
+  if (resumed) {
+    fio_free(entry);
+    http_resume(s, http_resume_deferred_request_handler, NULL);
+  }
 }
 
 static void on_rack_request(http_s *h) {
+  uint64_t waited = iodine_http_received_ago(h);
+  if (iodine_http_shed(h, waited))
+    return;
   iodine_http_request_handle_s handle = (iodine_http_request_handle_s){
       .h = h,
+      /* the wait starts when the request was read, not when it was parsed */
+      .queued_at = iodine_http_now() - waited,
   };
   IodineCaller.enterGVL((void *(*)(void *))iodine_handle_request_in_GVL,
                         &handle);
@@ -882,6 +1522,15 @@ static void on_rack_request(http_s *h) {
   }
 }
 
+/* routes the request before entering the GVL (see Iodine::Router) */
+static void on_router_request(http_s *h) {
+  VALUE app = iodine_router_route((VALUE)h->udata, h);
+  if (app == Qnil)
+    return;
+  h->udata = (void *)app;
+  on_rack_request(h);
+}
+
 /* *****************************************************************************
 Rack `env` Template Initialization
 ***************************************************************************** */
@@ -980,23 +1629,44 @@ app:: the Rack application that handles incoming requests. Default: `nil`.
 port:: the port to listen to. Default: 3000.
 address:: the address to bind to. Default: binds to all possible addresses.
 log:: enable response logging (Hijacked sockets aren't logged). Default: off.
+log_target:: The access log's file (or "unix:<path>" for a datagram socket), written by a background thread. Default: stderr.
+log_format:: `:json` for JSON access log lines. Default: the common log format.
+log_policy:: `:block` to wait (rather than drop lines) when the access log falls behind. Default: `:drop`.
+timings:: Record each request's phases (for the log, `env["iodine.timings"]` and a `Server-Timing` header). Default: off.
 public:: The root public folder for static file service. Default: none.
 timeout:: Timeout for inactive HTTP/1.x connections. Defaults: 40 seconds.
 max_body:: The maximum body size for incoming HTTP messages in bytes. Default: ~50Mib.
 max_headers:: The maximum total header length for incoming HTTP messages. Default: ~64Kib.
 max_msg:: The maximum Websocket message size allowed. Default: ~250Kib.
+ws_deflate:: Negotiate WebSocket `permessage-deflate` using this zlib memory level (1..9, `true` for 8). Default: off.
+stream_flush:: Streamed response bodies are sent in chunks of this size (in Kb). Default: 16Kib.
+compress:: Compress dynamic (textual) responses of at least this many bytes (`true` for 1Kib), streamed bodies are compressed as they're sent. Default: off.
+compress_types:: A comma separated list of the Content-Types to compress (i.e., "text/html,*+json,application/wasm", where `text/` followed by `*` matches any text type). Default: textual types, JSON, XML, JavaScript and SVG.
+static_encodings:: Pre-compressed static file variants, in order of preference. Default: "br,zstd,gzip".
+early_dispatch:: Handle large (non chunked) uploads as soon as their headers arrive, streaming `rack.input`. Default: off.
+max_queue:: Parsed requests allowed to wait for Ruby (the GVL) before new requests receive a 503 response. Default: unlimited.
+max_queue_time:: The wait (in milliseconds, measured from when a request was completely read) after which requests receive a 503 response. Default: unlimited.
+max_clients_per_ip:: Maximum concurrent connections per client (peer address), enforced per worker process. Default: unlimited.
+rate_limit:: Requests per second allowed per client, excess requests receive a 429 response without entering Ruby. Enforced per worker process (the effective limit is multiplied by the number of workers). Default: unlimited.
+rate_burst:: The number of requests a client may burst. Default: the `rate_limit`.
+rate_limit_header:: A (trusted) header identifying the client for the `rate_limit` (i.e., "X-Forwarded-For"). Default: the peer address.
 ping:: The Websocket `ping` interval. Default: 40 seconds.
 
 Either the `app` or the `public` properties are required. If niether exists,
 the function will fail. If both exist, Iodine will serve static files as well
 as dynamic requests.
 
-When using the static file server, it's possible to serve `gzip` versions of
-the static files by saving a compressed version with the `gz` extension (i.e.
-`styles.css.gz`).
+When using the static file server, it's possible to serve pre-compressed
+versions of the static files by saving a compressed version with the `br`,
+`zst` or `gz` extension (i.e. `styles.css.br`).
+
+A variant will only be served to clients that accept its content coding
+(`Accept-Encoding` q-values are honored, ties are broken using the
+`static_encodings` order).
 
-`gzip` will only be served to clients tat support the `gzip` transfer
-encoding.
+When the `app` is an {Iodine::Router}, requests are routed before entering the
+GVL. Static files, fixed responses, redirects and 404 errors are answered
+without ever locking the GVL.
 
 Once HTTP/2 is supported (planned, but probably very far away), HTTP/2
 timeouts will be dynamically managed by Iodine. The `timeout` option is only
@@ -1009,23 +1679,52 @@ intptr_t iodine_http_listen(iodine_connection_args_s args){
     rb_hash_aset(env_template, XSENDFILE_TYPE_HEADER, XSENDFILE);
     support_xsendfile = 1;
   }
+  if (args.log && http_log_setup(.target = args.log_target.data,
+                                 .json = args.log_json,
+                                 .block = args.log_block))
+    return -1;
   IodineStore.add(args.handler);
+  void (*on_request)(http_s *) = on_rack_request;
+  if (iodine_router_is(args.handler)) {
+    iodine_router_attach(args.handler);
+    on_request = on_router_request;
+  }
 #ifdef __MINGW32__
   intptr_t uuid = http_listen(
-      args.port.data, args.address.data, .on_request = on_rack_request,
+      args.port.data, args.address.data, .on_request = on_request,
       .udata = (void *)args.handler,
       .timeout = args.timeout, .ws_timeout = args.ping,
+      .ws_deflate = args.ws_deflate,
       .ws_max_msg_size = args.max_msg, .max_header_size = args.max_headers,
       .on_finish = free_iodine_http, .log = args.log, .max_clients = args.max_clients,
-      .max_body_size = args.max_body, .public_folder = args.public.data);
+      .max_body_size = args.max_body, .public_folder = args.public.data,
+      .stream_flush_size = args.stream_flush,
+      .static_encodings = args.static_encodings.data,
+      .compress_min_size = args.compress,
+      .compress_types = args.compress_types.data,
+      .early_dispatch = args.early_dispatch, .timings = args.timings,
+      .max_clients_per_ip = args.max_clients_per_ip,
+      .max_queue = args.max_queue, .max_queue_time = args.max_queue_time,
+      .rate_limit = args.rate_limit, .rate_burst = args.rate_burst,
+      .rate_limit_header = args.rate_limit_header.data);
 #else
   intptr_t uuid = http_listen(
-      args.port.data, args.address.data, .on_request = on_rack_request,
+      args.port.data, args.address.data, .on_request = on_request,
       .udata = (void *)args.handler,
       .tls = args.tls, .timeout = args.timeout, .ws_timeout = args.ping,
+      .ws_deflate = args.ws_deflate,
       .ws_max_msg_size = args.max_msg, .max_header_size = args.max_headers,
       .on_finish = free_iodine_http, .log = args.log, .max_clients = args.max_clients,
-      .max_body_size = args.max_body, .public_folder = args.public.data);
+      .max_body_size = args.max_body, .public_folder = args.public.data,
+      .stream_flush_size = args.stream_flush,
+      .static_encodings = args.static_encodings.data,
+      .compress_min_size = args.compress,
+      .compress_types = args.compress_types.data,
+      .early_dispatch = args.early_dispatch, .timings = args.timings,
+      .max_clients_per_ip = args.max_clients_per_ip,
+      .max_queue = args.max_queue, .max_queue_time = args.max_queue_time,
+      .rate_limit = args.rate_limit, .rate_burst = args.rate_burst,
+      .rate_limit_header = args.rate_limit_header.data);
 #endif
   if (uuid == -1)
     return uuid;
@@ -1109,9 +1808,13 @@ static void ws_client_http_connected(http_s *h) {
   fiobj_each1(s->headers, 0, each_cookie_ws_client_task, h);
   if (s->io && s->io != Qnil)
     http_upgrade2ws(
-        h, .on_message = iodine_ws_on_message, .on_open = iodine_ws_on_open,
-        .on_ready = iodine_ws_on_ready, .on_shutdown = iodine_ws_on_shutdown,
-        .on_close = iodine_ws_on_close, .udata = (void *)s->io);
+        h, .on_message = iodine_ws_on_message,
+        .on_message_chunk = (iodine_connection_answers_chunks(s->io)
+                                 ? iodine_ws_on_message_chunk
+                                 : NULL),
+        .on_open = iodine_ws_on_open, .on_ready = iodine_ws_on_ready,
+        .on_shutdown = iodine_ws_on_shutdown, .on_close = iodine_ws_on_close,
+        .udata = (void *)s->io);
   request_data_destroy(s);
 }
 
@@ -1199,6 +1902,8 @@ void iodine_init_http(void) {
 
   rack_autoset(IODINE_REQUEST_ID);
   rack_autoset(IODINE_HAS_BODY);
+  rack_set(IODINE_QUEUE_TIME, "iodine.queue_time");
+  rack_set(IODINE_TIMINGS, "iodine.timings");
 
   rack_set(HTTP_SCHEME, "http");
   rack_set(HTTPS_SCHEME, "https");
@@ -1226,6 +1931,8 @@ void iodine_init_http(void) {
   hijack_func_sym = ID2SYM(rb_intern("_hijack"));
   close_method_id = rb_intern("close");
   each_method_id = rb_intern("each");
+  to_path_method_id = rb_intern("to_path");
+  ranges_method_id = rb_intern("ranges");
   attach_method_id = rb_intern("attach_fd");
   iodine_call_proc_id = rb_intern("call");
   fiber_result_var_id = rb_intern("@__result");
@@ -1233,6 +1940,10 @@ void iodine_init_http(void) {
   fiber_id_method_id = rb_intern("__get_id");
   iodine_env_var_id = rb_intern("@__iodine_env");
 
+  rb_define_module_function(IodineModule, "resume", iodine_resume, 1);
+  rb_define_module_function(IodineModule, "dropped_log_lines",
+                            iodine_dropped_log_lines, 0);
+
   IodineUTF8Encoding = rb_enc_find("UTF-8");
   IodineBinaryEncoding = rb_enc_find("binary");
 
@@ -1244,4 +1955,25 @@ void iodine_init_http(void) {
     rb_global_variable(&IODINE_R_INPUT_DEFAULT);
   }
   initialize_env_template();
+
+  /* the `stream` object used for Rack 3 streaming bodies */
+  IodineResponseStreamClass =
+      rb_define_class_under(IodineBaseModule, "ResponseStream", rb_cObject);
+  rb_undef_alloc_func(IodineResponseStreamClass);
+  rb_define_method(IodineResponseStreamClass, "write",
+                   iodine_response_stream_write, -1);
+  rb_define_method(IodineResponseStreamClass, "<<", iodine_response_stream_push,
+                   1);
+  rb_define_method(IodineResponseStreamClass, "flush",
+                   iodine_response_stream_flush, 0);
+  rb_define_method(IodineResponseStreamClass, "read",
+                   iodine_response_stream_read, -1);
+  rb_define_method(IodineResponseStreamClass, "close",
+                   iodine_response_stream_close, 0);
+  rb_define_method(IodineResponseStreamClass, "close_write",
+                   iodine_response_stream_close, 0);
+  rb_define_method(IodineResponseStreamClass, "close_read",
+                   iodine_response_stream_read, -1);
+  rb_define_method(IodineResponseStreamClass, "closed?",
+                   iodine_response_stream_is_closed, 0);
 }
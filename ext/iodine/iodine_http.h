@@ -20,4 +20,7 @@ intptr_t iodine_http_listen(iodine_connection_args_s args);
 // intptr_t iodine_http_connect(iodine_connection_args_s args); // not yet...
 intptr_t iodine_ws_connect(iodine_connection_args_s args);
 
+/* resumes a request deferred to a fiber with the channel's name as its ID */
+int iodine_http_resume_channel(fio_str_info_s channel);
+
 #endif
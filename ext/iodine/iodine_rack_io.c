@@ -9,6 +9,7 @@ Feel free to copy, use and enjoy according to the license provided.
 #include "iodine.h"
 
 #include <ruby/encoding.h>
+#include <errno.h>
 #include <ruby/io.h>
 #include <unistd.h>
 
@@ -54,6 +55,7 @@ static VALUE rRackIO;
 
 static ID env_id;
 static ID io_id;
+static ID streamed_id;
 
 static VALUE R_INPUT; /* rack.input */
 static VALUE hijack_func_sym;
@@ -81,13 +83,71 @@ IO API
 
 static inline FIOBJ get_data(VALUE self) {
   VALUE i = rb_ivar_get(self, io_id);
-  return (FIOBJ)NUM2ULL(i);
+  FIOBJ io = (FIOBJ)NUM2ULL(i);
+  http_s *h;
+  /* multipart file parts are stored apart until the raw body is read */
+  if (io && (h = get_handle(self)) && h->multipart && h->body == io) {
+    http_restore_body(h);
+    if (h->body != io) {
+      io = h->body;
+      rb_ivar_set(self, io_id, ULL2NUM(io));
+    }
+  }
+  return io;
+}
+
+#ifndef IODINE_RACK_IO_STREAM_CHUNK
+/* the amount of body data read at a time from an early dispatched request */
+#define IODINE_RACK_IO_STREAM_CHUNK 16384
+#endif
+
+/*
+Replaces the (consumed) body buffer with the next part of a request body that's
+still being received (see the `early_dispatch` option), waiting (the fiber) for
+the data to arrive.
+
+Returns 0 once the whole body was read (or if the body isn't streamed).
+*/
+static int rio_fill(VALUE self) {
+  http_s *h = get_handle(self);
+  if (!h)
+    return 0;
+  char buffer[IODINE_RACK_IO_STREAM_CHUNK];
+  for (;;) {
+    ssize_t len = http_read_body(h, buffer, IODINE_RACK_IO_STREAM_CHUNK);
+    if (len > 0) {
+      FIOBJ io = fiobj_data_newstr();
+      fiobj_data_write(io, buffer, len);
+      fiobj_free(h->body);
+      h->body = io;
+      rb_ivar_set(self, io_id, ULL2NUM(io));
+      rb_ivar_set(self, streamed_id, Qtrue);
+      return 1;
+    }
+    if (!len)
+      return 0;
+    if (errno != EAGAIN)
+      rb_raise(rb_eEOFError, "client disconnected before sending the body.");
+    struct http_settings_s *settings = http_settings(h);
+    struct timeval tv = {.tv_sec = (settings && settings->timeout)
+                                       ? settings->timeout
+                                       : 40};
+    int ready =
+        rb_wait_for_single_fd(fio_uuid2fd(http_uuid(h)), RB_WAITFD_IN, &tv);
+    if (ready == 0)
+      rb_raise(rb_eIOError, "timeout while waiting for the request body.");
+    if (ready < 0)
+      rb_sys_fail("waiting for the request body");
+  }
 }
 
 static VALUE rio_rewind(VALUE self) {
   FIOBJ io = get_data(self);
   if (!FIOBJ_TYPE_IS(io, FIOBJ_T_DATA))
     return Qnil;
+  /* streamed data (early dispatch) isn't kept, so it can't be rewound */
+  if (rb_ivar_get(self, streamed_id) == Qtrue)
+    return Qnil;
   fiobj_data_seek(io, 0);
   return INT2NUM(0);
 }
@@ -102,8 +162,17 @@ static VALUE rio_gets(VALUE self) {
   if (!FIOBJ_TYPE_IS(io, FIOBJ_T_DATA))
     return Qnil;
   fio_str_info_s line = fiobj_data_gets(io);
+  if (!line.len && rio_fill(self))
+    line = fiobj_data_gets(get_data(self));
   if (line.len) {
     VALUE buffer = rb_str_new(line.data, line.len);
+    // a streamed line might continue in the next part of the body.
+    while (line.data[line.len - 1] != '\n' && rio_fill(self)) {
+      line = fiobj_data_gets(get_data(self));
+      if (!line.len)
+        break;
+      rb_str_cat(buffer, line.data, line.len);
+    }
     // make sure the buffer is binary encoded.
     rb_enc_associate(buffer, IodineBinaryEncoding);
     return buffer;
@@ -138,6 +207,8 @@ static VALUE rio_read(int argc, VALUE *argv, VALUE self) {
   }
   // return if we're at the EOF.
   fio_str_info_s buf = fiobj_data_read(io, len);
+  if (!buf.len && rio_fill(self))
+    buf = fiobj_data_read(get_data(self), len);
   if (buf.len) {
     // create the buffer if we don't have one.
     if (buffer == Qnil) {
@@ -151,6 +222,11 @@ static VALUE rio_read(int argc, VALUE *argv, VALUE self) {
       memcpy(RSTRING_PTR(buffer), buf.data, buf.len);
       rb_str_set_len(buffer, buf.len);
     }
+    // reading everything, collect any data that's still being received.
+    while (!ret_nil && rio_fill(self)) {
+      buf = fiobj_data_read(get_data(self), 0);
+      rb_str_cat(buffer, buf.data, buf.len);
+    }
     return buffer;
   }
   return ret_nil ? Qnil : rb_str_buf_new(0);
@@ -231,6 +307,33 @@ static VALUE new_rack_io(http_s *h, VALUE env) {
   return rack_io;
 }
 
+// collects the rest of a streamed body (early dispatch) into the request's body
+static void buffer_rack_io(VALUE rack_io) {
+  http_s *h = get_handle(rack_io);
+  if (!h || !FIOBJ_TYPE_IS(get_data(rack_io), FIOBJ_T_DATA))
+    return;
+  FIOBJ io = fiobj_dup(get_data(rack_io)); /* keep the unread part */
+  FIOBJ all = FIOBJ_INVALID;
+  fio_str_info_s buf;
+  while (rio_fill(rack_io)) {
+    if (!all) {
+      all = fiobj_data_newtmpfile();
+      buf = fiobj_data_read(io, 0);
+      fiobj_data_write(all, buf.data, buf.len);
+    }
+    buf = fiobj_data_read(get_data(rack_io), 0);
+    fiobj_data_write(all, buf.data, buf.len);
+  }
+  fiobj_free(io);
+  if (!all)
+    return;
+  fiobj_data_seek(all, 0);
+  fiobj_free(h->body);
+  h->body = all;
+  rb_ivar_set(rack_io, io_id, ULL2NUM(all));
+  rb_ivar_set(rack_io, streamed_id, Qfalse);
+}
+
 static void close_rack_io(VALUE rack_io) {
   // rio_close(rack_io);
   rb_ivar_set(rack_io, io_id, INT2NUM(0));
@@ -244,6 +347,7 @@ static void init_rack_io(void) {
   rRackIO = rb_define_class_under(IodineBaseModule, "RackIO", rb_cObject);
 
   io_id = rb_intern("rack_io");
+  streamed_id = rb_intern("streamed");
   env_id = rb_intern("env");
   for_fd_id = rb_intern("for_fd");
   iodine_fd_var_id = rb_intern("fd");
@@ -269,6 +373,7 @@ static void init_rack_io(void) {
 struct IodineRackIO IodineRackIO = {
     .create = new_rack_io,
     .close = close_rack_io,
+    .buffer = buffer_rack_io,
     .init = init_rack_io,
     .get_handle = get_handle,
 };
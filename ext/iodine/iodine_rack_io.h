@@ -14,6 +14,8 @@ Feel free to copy, use and enjoy according to the license provided.
 extern struct IodineRackIO {
   VALUE (*create)(http_s *h, VALUE env);
   void (*close)(VALUE rack_io);
+  /** collects any body data that's still being received (early dispatch). */
+  void (*buffer)(VALUE rack_io);
   void (*init)(void);
   http_s * (*get_handle)(VALUE obj);
 
@@ -0,0 +1,759 @@
+/*
+Copyright: Boaz segev, 2016-2018
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+#include "iodine_router.h"
+
+#include "fiobj.h"
+#include "http.h"
+
+#include <ruby/encoding.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+/*
+The Iodine::Router class routes requests using a radix tree of path patterns,
+matched before entering the GVL.
+
+Patterns are made of static text, `:name` segments (matching a single,
+non-empty path segment) and a trailing `*` (matching the rest of the path).
+
+Routes are matched by specificity: static text is preferred over `:name`
+segments, which are preferred over `*` wildcards.
+*/
+
+static VALUE RouterClass;
+static ID method_sym_id;
+static ID status_sym_id;
+static VALUE request_method_str;
+static VALUE path_info_str;
+static VALUE content_type_str;
+static VALUE location_str;
+static VALUE file_class;
+static rb_encoding *IodineBinaryEncoding;
+
+/* *****************************************************************************
+Routes and the radix tree
+***************************************************************************** */
+
+typedef enum {
+  IODINE_ROUTE_APP,
+  IODINE_ROUTE_STATIC,
+  IODINE_ROUTE_RESPONSE,
+  IODINE_ROUTE_REDIRECT,
+  IODINE_ROUTE_NOT_FOUND,
+} iodine_route_type_e;
+
+typedef struct iodine_route_s iodine_route_s;
+struct iodine_route_s {
+  /* the next route ending at the same node (for other methods) */
+  iodine_route_s *next;
+  /* the next route in the router (for marking / freeing) */
+  iodine_route_s *all;
+  iodine_route_type_e type;
+  /* the Rack application (IODINE_ROUTE_APP) */
+  VALUE app;
+  /* static folder / response body / redirect location */
+  FIOBJ data;
+  /* fixed response headers (a Hash) */
+  FIOBJ headers;
+  uintptr_t status;
+  /* the method (upper case) or an empty string for any method */
+  size_t method_len;
+  char method[16];
+};
+
+typedef struct iodine_route_node_s iodine_route_node_s;
+struct iodine_route_node_s {
+  /* the static text leading to this node (compressed edge) */
+  char *label;
+  size_t len;
+  /* static children, each with a different first byte */
+  iodine_route_node_s **children;
+  size_t count;
+  /* the `:name` child */
+  iodine_route_node_s *param;
+  /* routes ending at this node */
+  iodine_route_s *routes;
+  /* routes ending at this node with a `*` */
+  iodine_route_s *wildcard;
+};
+
+typedef struct {
+  iodine_route_node_s root;
+  iodine_route_s *all;
+  VALUE app;
+  uint8_t attached;
+} iodine_router_s;
+
+static iodine_route_node_s *iodine_route_node_new(const char *label,
+                                                  size_t len) {
+  iodine_route_node_s *n = fio_malloc(sizeof(*n));
+  FIO_ASSERT_ALLOC(n);
+  *n = (iodine_route_node_s){.len = len};
+  if (len) {
+    n->label = fio_malloc(len);
+    FIO_ASSERT_ALLOC(n->label);
+    memcpy(n->label, label, len);
+  }
+  return n;
+}
+
+static void iodine_route_node_free(iodine_route_node_s *n, uint8_t is_root) {
+  for (size_t i = 0; i < n->count; ++i)
+    iodine_route_node_free(n->children[i], 0);
+  if (n->param)
+    iodine_route_node_free(n->param, 0);
+  fio_free(n->children);
+  fio_free(n->label);
+  if (!is_root)
+    fio_free(n);
+}
+
+static void iodine_route_node_add_child(iodine_route_node_s *n,
+                                        iodine_route_node_s *child) {
+  n->children =
+      fio_realloc2(n->children, (n->count + 1) * sizeof(*n->children),
+                   n->count * sizeof(*n->children));
+  FIO_ASSERT_ALLOC(n->children);
+  n->children[n->count++] = child;
+}
+
+static inline iodine_route_node_s *
+iodine_route_node_child(iodine_route_node_s *n, char c) {
+  for (size_t i = 0; i < n->count; ++i)
+    if (n->children[i]->label[0] == c)
+      return n->children[i];
+  return NULL;
+}
+
+/** Inserts static text below the node, splitting edges as required. */
+static iodine_route_node_s *iodine_route_node_insert(iodine_route_node_s *n,
+                                                     const char *s,
+                                                     size_t len) {
+  while (len) {
+    iodine_route_node_s *child = iodine_route_node_child(n, s[0]);
+    if (!child) {
+      child = iodine_route_node_new(s, len);
+      iodine_route_node_add_child(n, child);
+      return child;
+    }
+    size_t common = 1;
+    while (common < child->len && common < len &&
+           child->label[common] == s[common])
+      ++common;
+    if (common < child->len) {
+      /* split the edge: the child keeps the tail of its label */
+      iodine_route_node_s *split = iodine_route_node_new(child->label, common);
+      child->len -= common;
+      memmove(child->label, child->label + common, child->len);
+      iodine_route_node_add_child(split, child);
+      for (size_t i = 0; i < n->count; ++i)
+        if (n->children[i] == child)
+          n->children[i] = split;
+      child = split;
+    }
+    n = child;
+    s += common;
+    len -= common;
+  }
+  return n;
+}
+
+/** Returns the first route in the list that accepts the method. */
+static inline iodine_route_s *iodine_route_find(iodine_route_s *r,
+                                                fio_str_info_s method) {
+  for (; r; r = r->next) {
+    if (!r->method_len)
+      return r;
+    if (r->method_len == method.len &&
+        !memcmp(r->method, method.data, method.len))
+      return r;
+    /* HEAD requests are answered by GET routes */
+    if (method.len == 4 && r->method_len == 3 &&
+        !memcmp(method.data, "HEAD", 4) && !memcmp(r->method, "GET", 3))
+      return r;
+  }
+  return NULL;
+}
+
+/**
+ * Finds the most specific route for the path (backtracking when a static
+ * branch has no matching route). `rest` is set to the text matched by `*`.
+ */
+static iodine_route_s *iodine_route_match(iodine_route_node_s *n,
+                                          const char *path, size_t len,
+                                          fio_str_info_s method,
+                                          fio_str_info_s *rest) {
+  iodine_route_s *r;
+  if (!len) {
+    if ((r = iodine_route_find(n->routes, method)))
+      return r;
+  } else {
+    iodine_route_node_s *child = iodine_route_node_child(n, path[0]);
+    if (child && child->len <= len &&
+        !memcmp(child->label, path, child->len) &&
+        (r = iodine_route_match(child, path + child->len, len - child->len,
+                                method, rest)))
+      return r;
+    if (n->param && path[0] != '/') {
+      const char *end = memchr(path, '/', len);
+      size_t seg = end ? (size_t)(end - path) : len;
+      if ((r = iodine_route_match(n->param, path + seg, len - seg, method,
+                                  rest)))
+        return r;
+    }
+  }
+  if ((r = iodine_route_find(n->wildcard, method))) {
+    *rest = (fio_str_info_s){.data = (char *)path, .len = len};
+    return r;
+  }
+  return NULL;
+}
+
+/* *****************************************************************************
+Ruby object
+***************************************************************************** */
+
+static void iodine_router_mark(void *ptr) {
+  iodine_router_s *r = ptr;
+  rb_gc_mark(r->app);
+  for (iodine_route_s *route = r->all; route; route = route->all)
+    rb_gc_mark(route->app);
+}
+
+static void iodine_router_free(void *ptr) {
+  iodine_router_s *r = ptr;
+  iodine_route_s *route = r->all;
+  while (route) {
+    iodine_route_s *tmp = route;
+    route = route->all;
+    fiobj_free(tmp->data);
+    fiobj_free(tmp->headers);
+    fio_free(tmp);
+  }
+  iodine_route_node_free(&r->root, 1);
+  fio_free(r);
+}
+
+static size_t iodine_router_size(const void *ptr) {
+  return sizeof(iodine_router_s);
+  (void)ptr;
+}
+
+static const rb_data_type_t iodine_router_type = {
+    .wrap_struct_name = "Iodine::Router",
+    .function =
+        {
+            .dmark = iodine_router_mark,
+            .dfree = iodine_router_free,
+            .dsize = iodine_router_size,
+        },
+    .flags = RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
+static VALUE iodine_router_alloc(VALUE klass) {
+  iodine_router_s *r = fio_malloc(sizeof(*r));
+  FIO_ASSERT_ALLOC(r);
+  *r = (iodine_router_s){.app = Qnil};
+  return TypedData_Wrap_Struct(klass, &iodine_router_type, r);
+}
+
+static iodine_router_s *iodine_router_get(VALUE self) {
+  iodine_router_s *r;
+  TypedData_Get_Struct(self, iodine_router_s, &iodine_router_type, r);
+  return r;
+}
+
+/** Validates the pattern and adds the route to the tree. */
+static iodine_route_s *iodine_router_add(VALUE self, VALUE pattern,
+                                         VALUE method,
+                                         iodine_route_type_e type) {
+  iodine_router_s *r = iodine_router_get(self);
+  if (r->attached)
+    rb_raise(rb_eFrozenError,
+             "can't add routes once the router is attached to a server");
+  Check_Type(pattern, T_STRING);
+  const char *s = RSTRING_PTR(pattern);
+  size_t len = RSTRING_LEN(pattern);
+  if (!len || s[0] != '/')
+    rb_raise(rb_eArgError, "route patterns must start with a '/'");
+
+  iodine_route_s *route = fio_malloc(sizeof(*route));
+  FIO_ASSERT_ALLOC(route);
+  *route = (iodine_route_s){.type = type, .app = Qnil};
+
+  if (method != Qnil) {
+    if (RB_TYPE_P(method, T_SYMBOL))
+      method = rb_sym2str(method);
+    Check_Type(method, T_STRING);
+    if (!RSTRING_LEN(method) || (size_t)RSTRING_LEN(method) >= 16) {
+      fio_free(route);
+      rb_raise(rb_eArgError, "invalid HTTP method");
+    }
+    route->method_len = RSTRING_LEN(method);
+    for (size_t i = 0; i < route->method_len; ++i) {
+      char c = RSTRING_PTR(method)[i];
+      route->method[i] = (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+    }
+  }
+
+  /* walk the pattern, inserting static text and `:name` segments */
+  iodine_route_node_s *n = &r->root;
+  uint8_t wildcard = 0;
+  size_t start = 0;
+  for (size_t i = 0; i < len; ++i) {
+    if (s[i] == '*') {
+      if (i + 1 != len || s[i - 1] != '/')
+        goto bad_pattern;
+      n = iodine_route_node_insert(n, s + start, i - start);
+      wildcard = 1;
+      start = len;
+      break;
+    }
+    if (s[i] == ':' && s[i - 1] == '/') {
+      n = iodine_route_node_insert(n, s + start, i - start);
+      while (i < len && s[i] != '/')
+        ++i;
+      if (!n->param)
+        n->param = iodine_route_node_new(NULL, 0);
+      n = n->param;
+      start = i;
+      --i;
+    }
+  }
+  if (start < len)
+    n = iodine_route_node_insert(n, s + start, len - start);
+
+  /* append, so earlier routes take precedence */
+  iodine_route_s **pos = wildcard ? &n->wildcard : &n->routes;
+  while (*pos)
+    pos = &(*pos)->next;
+  *pos = route;
+  route->all = r->all;
+  r->all = route;
+  return route;
+
+bad_pattern:
+  fio_free(route);
+  rb_raise(rb_eArgError,
+           "'*' is only allowed at the end of a route pattern, after a '/'");
+  return NULL;
+}
+
+/** Reads the `method:` keyword argument. */
+static VALUE iodine_router_opt(VALUE opts, ID name, VALUE fallback) {
+  if (opts == Qnil)
+    return fallback;
+  VALUE tmp = rb_hash_aref(opts, ID2SYM(name));
+  return tmp == Qnil ? fallback : tmp;
+}
+
+/**
+Creates a new router.
+
+The (optional) `app` handles any request that doesn't match a route. Without
+it, such requests receive a 404 (Not Found) response.
+
+    router = Iodine::Router.new(app)
+    router.respond "/health", 200, { "content-type" => "text/plain" }, "OK"
+    router.static "/assets", "public/assets"
+    router.redirect "/home", "/"
+    router.not_found "/wp-login.php"
+    router.route "/users/:id", users_app, method: :get
+    run router
+
+When the router is the application handed to {Iodine.listen} (i.e., using
+`run router` in a `config.ru` file), requests are routed before entering the
+GVL, so only requests that reach a Rack application compete for the GVL.
+*/
+static VALUE iodine_router_initialize(int argc, VALUE *argv, VALUE self) {
+  VALUE app = Qnil;
+  rb_scan_args(argc, argv, "01", &app);
+  iodine_router_get(self)->app = app;
+  return self;
+}
+
+/** Returns the application handling unrouted requests (or `nil`). */
+static VALUE iodine_router_app_get(VALUE self) {
+  return iodine_router_get(self)->app;
+}
+
+/** Sets the application handling unrouted requests (or `nil` for 404). */
+static VALUE iodine_router_app_set(VALUE self, VALUE app) {
+  iodine_router_s *r = iodine_router_get(self);
+  if (r->attached)
+    rb_raise(rb_eFrozenError,
+             "can't change the router once it's attached to a server");
+  r->app = app;
+  return app;
+}
+
+/**
+Routes requests matching the pattern to a Rack application.
+
+    router.route "/users/:id", users_app, method: :get
+
+Patterns ending with `*` (after a `/`) match any path with the same prefix.
+
+Accepts an optional `method:` (i.e., `:get`), any method matches by default.
+*/
+static VALUE iodine_router_route_app(int argc, VALUE *argv, VALUE self) {
+  VALUE pattern, app, opts;
+  rb_scan_args(argc, argv, "2:", &pattern, &app, &opts);
+  if (!rb_respond_to(app, iodine_call_id))
+    rb_raise(rb_eArgError, "the application must respond to `call`");
+  iodine_route_s *route =
+      iodine_router_add(self, pattern, iodine_router_opt(opts, method_sym_id, Qnil),
+                        IODINE_ROUTE_APP);
+  route->app = app;
+  return self;
+}
+
+/**
+Serves static files from the folder for `GET` and `HEAD` requests starting with
+the prefix. Missing files receive a 404 (Not Found) response.
+
+    router.static "/assets", "public/assets"
+*/
+static VALUE iodine_router_static(VALUE self, VALUE prefix, VALUE folder) {
+  Check_Type(prefix, T_STRING);
+  Check_Type(folder, T_STRING);
+  VALUE pattern = rb_str_dup(prefix);
+  if (!RSTRING_LEN(pattern) ||
+      RSTRING_PTR(pattern)[RSTRING_LEN(pattern) - 1] != '/')
+    rb_str_cat(pattern, "/", 1);
+  rb_str_cat(pattern, "*", 1);
+  iodine_route_s *route =
+      iodine_router_add(self, pattern, rb_str_new("GET", 3), IODINE_ROUTE_STATIC);
+  route->data = fiobj_str_new(RSTRING_PTR(folder), RSTRING_LEN(folder));
+  if (!RSTRING_LEN(folder) ||
+      RSTRING_PTR(folder)[RSTRING_LEN(folder) - 1] != '/')
+    fiobj_str_write(route->data, "/", 1);
+  return self;
+}
+
+static int iodine_router_headers_check_task(VALUE key, VALUE value,
+                                            VALUE ignr_) {
+  Check_Type(key, T_STRING);
+  Check_Type(value, T_STRING);
+  return ST_CONTINUE;
+  (void)ignr_;
+}
+
+/* expects headers already validated by `iodine_router_headers_check_task` */
+static int iodine_router_headers_task(VALUE key, VALUE value, VALUE dest) {
+  FIOBJ name = fiobj_str_new(RSTRING_PTR(key), RSTRING_LEN(key));
+  fio_str_info_s n = fiobj_obj2cstr(name);
+  for (size_t i = 0; i < n.len; ++i)
+    if (n.data[i] >= 'A' && n.data[i] <= 'Z')
+      n.data[i] |= 32;
+  fiobj_hash_set((FIOBJ)dest, name,
+                 fiobj_str_new(RSTRING_PTR(value), RSTRING_LEN(value)));
+  fiobj_free(name);
+  return ST_CONTINUE;
+}
+
+/**
+Responds to requests matching the pattern with a fixed response.
+
+    router.respond "/health", 200, { "content-type" => "text/plain" }, "OK"
+
+The headers and body are optional. Accepts an optional `method:`.
+*/
+static VALUE iodine_router_respond(int argc, VALUE *argv, VALUE self) {
+  VALUE pattern, status, headers, body, opts;
+  rb_scan_args(argc, argv, "13:", &pattern, &status, &headers, &body, &opts);
+  if (status == Qnil)
+    status = INT2FIX(200);
+  if (headers != Qnil) {
+    Check_Type(headers, T_HASH);
+    rb_hash_foreach(headers, iodine_router_headers_check_task, Qnil);
+  }
+  if (body != Qnil)
+    Check_Type(body, T_STRING);
+  if (NUM2ULONG(status) < 100 || NUM2ULONG(status) > 999)
+    rb_raise(rb_eArgError, "invalid status code");
+  /* adding the route may raise, so the headers are converted afterwards */
+  iodine_route_s *route = iodine_router_add(
+      self, pattern, iodine_router_opt(opts, method_sym_id, Qnil),
+      IODINE_ROUTE_RESPONSE);
+  route->status = NUM2ULONG(status);
+  route->headers = fiobj_hash_new();
+  if (headers != Qnil)
+    rb_hash_foreach(headers, iodine_router_headers_task,
+                    (VALUE)route->headers);
+  if (body != Qnil)
+    route->data = fiobj_str_new(RSTRING_PTR(body), RSTRING_LEN(body));
+  return self;
+}
+
+/**
+Redirects requests matching the pattern.
+
+    router.redirect "/home", "/", status: 301
+
+The `status:` defaults to 302. Accepts an optional `method:`.
+*/
+static VALUE iodine_router_redirect(int argc, VALUE *argv, VALUE self) {
+  VALUE pattern, location, opts;
+  rb_scan_args(argc, argv, "2:", &pattern, &location, &opts);
+  Check_Type(location, T_STRING);
+  unsigned long status =
+      NUM2ULONG(iodine_router_opt(opts, status_sym_id, INT2FIX(302)));
+  if (status < 300 || status > 399)
+    rb_raise(rb_eArgError, "redirects require a 3xx status code");
+  iodine_route_s *route = iodine_router_add(
+      self, pattern, iodine_router_opt(opts, method_sym_id, Qnil),
+      IODINE_ROUTE_REDIRECT);
+  route->status = status;
+  route->data = fiobj_str_new(RSTRING_PTR(location), RSTRING_LEN(location));
+  return self;
+}
+
+/**
+Responds to requests matching the pattern with a 404 (Not Found) error.
+
+    router.not_found "/wp-login.php"
+
+Accepts an optional `method:`.
+*/
+static VALUE iodine_router_not_found(int argc, VALUE *argv, VALUE self) {
+  VALUE pattern, opts;
+  rb_scan_args(argc, argv, "1:", &pattern, &opts);
+  iodine_router_add(self, pattern, iodine_router_opt(opts, method_sym_id, Qnil),
+                    IODINE_ROUTE_NOT_FOUND);
+  return self;
+}
+
+/* *****************************************************************************
+Rack interface (when the router isn't the server's application)
+***************************************************************************** */
+
+static VALUE iodine_router_rack_response(uintptr_t status, VALUE headers,
+                                         VALUE body) {
+  VALUE response = rb_ary_new_capa(3);
+  rb_ary_push(response, ULONG2NUM(status));
+  rb_ary_push(response, headers);
+  rb_ary_push(response, body);
+  return response;
+}
+
+static VALUE iodine_router_rack_404(void) {
+  VALUE headers = rb_hash_new();
+  rb_hash_aset(headers, content_type_str, rb_str_new("text/plain", 10));
+  VALUE body = rb_ary_new();
+  rb_ary_push(body, rb_str_new("Not Found", 9));
+  return iodine_router_rack_response(404, headers, body);
+}
+
+static int iodine_router_headers2rb_task(FIOBJ value, void *dest) {
+  fio_str_info_s k = fiobj_obj2cstr(fiobj_hash_key_in_loop());
+  fio_str_info_s v = fiobj_obj2cstr(value);
+  rb_hash_aset((VALUE)dest, rb_str_new(k.data, k.len), rb_str_new(v.data, v.len));
+  return 0;
+}
+
+/** Returns a `File` for a static route, or Qnil if the file isn't available. */
+static VALUE iodine_router_rack_file(iodine_route_s *route,
+                                     fio_str_info_s rest) {
+  fio_str_info_s folder = fiobj_obj2cstr(route->data);
+  VALUE path = rb_str_buf_new(folder.len + rest.len + 10);
+  rb_str_cat(path, folder.data, folder.len);
+  char *pos = RSTRING_PTR(path) + folder.len;
+  ssize_t len = http_decode_url(pos, rest.data, rest.len);
+  if (len < 0)
+    return Qnil;
+  rb_str_set_len(path, folder.len + len);
+  /* refuse path manipulations */
+  for (ssize_t i = 0; i + 1 < len; ++i) {
+    if (pos[i] == '.' && pos[i + 1] == '.' && (!i || pos[i - 1] == '/') &&
+        (i + 2 == len || pos[i + 2] == '/'))
+      return Qnil;
+  }
+  if (!len || pos[len - 1] == '/')
+    rb_str_cat(path, "index.html", 10);
+  struct stat st;
+  if (stat(StringValueCStr(path), &st) || !S_ISREG(st.st_mode))
+    return Qnil;
+  return path;
+}
+
+/**
+Routes a request using a Rack `env`.
+
+This is only used when the router isn't the server's application (i.e., when
+it's wrapped by middleware), in which case the GVL is already held.
+*/
+static VALUE iodine_router_call(VALUE self, VALUE env) {
+  iodine_router_s *r = iodine_router_get(self);
+  VALUE method = rb_hash_aref(env, request_method_str);
+  VALUE path = rb_hash_aref(env, path_info_str);
+  iodine_route_s *route = NULL;
+  fio_str_info_s rest = {.data = NULL};
+  if (RB_TYPE_P(method, T_STRING) && RB_TYPE_P(path, T_STRING))
+    route = iodine_route_match(&r->root, RSTRING_PTR(path), RSTRING_LEN(path),
+                               IODINE_RSTRINFO(method), &rest);
+  if (!route) {
+    if (r->app != Qnil)
+      return rb_funcallv(r->app, iodine_call_id, 1, &env);
+    return iodine_router_rack_404();
+  }
+  switch (route->type) {
+  case IODINE_ROUTE_APP:
+    return rb_funcallv(route->app, iodine_call_id, 1, &env);
+  case IODINE_ROUTE_STATIC: {
+    VALUE filename = iodine_router_rack_file(route, rest);
+    if (filename == Qnil)
+      return iodine_router_rack_404();
+    VALUE headers = rb_hash_new();
+    FIOBJ name = fiobj_str_new(RSTRING_PTR(filename), RSTRING_LEN(filename));
+    FIOBJ mime = http_mimetype_find2(name);
+    fiobj_free(name);
+    if (mime) {
+      fio_str_info_s m = fiobj_obj2cstr(mime);
+      rb_hash_aset(headers, content_type_str, rb_str_new(m.data, m.len));
+    }
+    VALUE args[2] = {filename, rb_str_new("rb", 2)};
+    return iodine_router_rack_response(
+        200, headers, rb_class_new_instance(2, args, file_class));
+  }
+  case IODINE_ROUTE_RESPONSE: {
+    VALUE headers = rb_hash_new();
+    fiobj_each1(route->headers, 0, iodine_router_headers2rb_task,
+                (void *)headers);
+    VALUE body = rb_ary_new();
+    if (route->data) {
+      fio_str_info_s b = fiobj_obj2cstr(route->data);
+      rb_ary_push(body, rb_enc_str_new(b.data, b.len, IodineBinaryEncoding));
+    }
+    return iodine_router_rack_response(route->status, headers, body);
+  }
+  case IODINE_ROUTE_REDIRECT: {
+    VALUE headers = rb_hash_new();
+    fio_str_info_s l = fiobj_obj2cstr(route->data);
+    rb_hash_aset(headers, location_str, rb_str_new(l.data, l.len));
+    return iodine_router_rack_response(route->status, headers, rb_ary_new());
+  }
+  case IODINE_ROUTE_NOT_FOUND:
+    break;
+  }
+  return iodine_router_rack_404();
+}
+
+/* *****************************************************************************
+Native routing (without the GVL)
+***************************************************************************** */
+
+static int iodine_router_set_header_task(FIOBJ value, void *h) {
+  http_set_header(h, fiobj_hash_key_in_loop(), fiobj_dup(value));
+  return 0;
+}
+
+/**
+ * Routes a request - performed WITHOUT holding the GVL.
+ *
+ * Static files, fixed responses, redirects and 404 errors are handled
+ * natively, in which case Qnil is returned. Otherwise the Rack application
+ * that should handle the request is returned.
+ */
+VALUE iodine_router_route(VALUE router, http_s *h) {
+  /* attached routers are immutable and kept alive by the server */
+  iodine_router_s *r = RTYPEDDATA_DATA(router);
+  fio_str_info_s path = fiobj_obj2cstr(h->path);
+  fio_str_info_s rest = {.data = NULL};
+  iodine_route_s *route = iodine_route_match(
+      &r->root, path.data, path.len, fiobj_obj2cstr(h->method), &rest);
+  if (!route) {
+    if (r->app != Qnil)
+      return r->app;
+    http_send_error(h, 404);
+    return Qnil;
+  }
+  switch (route->type) {
+  case IODINE_ROUTE_APP:
+    return route->app;
+  case IODINE_ROUTE_STATIC: {
+    /* include the '/' preceding the `*`, so path manipulations are detected */
+    fio_str_info_s folder = fiobj_obj2cstr(route->data);
+    if (http_sendfile2(h, folder.data, folder.len, rest.data - 1, rest.len + 1))
+      http_send_error(h, 404);
+    return Qnil;
+  }
+  case IODINE_ROUTE_RESPONSE: {
+    h->status = route->status;
+    fiobj_each1(route->headers, 0, iodine_router_set_header_task, h);
+    fio_str_info_s body = fiobj_obj2cstr(route->data);
+    if (fiobj_obj2cstr(h->method).len == 4 &&
+        !memcmp(fiobj_obj2cstr(h->method).data, "HEAD", 4)) {
+      http_set_header(h, HTTP_HEADER_CONTENT_LENGTH, fiobj_num_new(body.len));
+      http_finish(h);
+    } else {
+      http_send_body(h, body.data, body.len);
+    }
+    return Qnil;
+  }
+  case IODINE_ROUTE_REDIRECT:
+    h->status = route->status;
+    http_set_header2(h, (fio_str_info_s){.data = (char *)"location", .len = 8},
+                     fiobj_obj2cstr(route->data));
+    http_finish(h);
+    return Qnil;
+  case IODINE_ROUTE_NOT_FOUND:
+    break;
+  }
+  http_send_error(h, 404);
+  return Qnil;
+}
+
+/** Returns true if the object is an Iodine::Router. */
+int iodine_router_is(VALUE obj) {
+  return rb_typeddata_is_kind_of(obj, &iodine_router_type);
+}
+
+/**
+ * Marks the router as attached to a listening socket.
+ *
+ * Attached routers are matched without holding the GVL, so their routes can't
+ * be changed anymore.
+ */
+void iodine_router_attach(VALUE router) {
+  iodine_router_get(router)->attached = 1;
+}
+
+/* *****************************************************************************
+Initialization
+***************************************************************************** */
+
+/** Initializes the Iodine::Router class. */
+void iodine_router_init(void) {
+  method_sym_id = rb_intern("method");
+  status_sym_id = rb_intern("status");
+  IodineBinaryEncoding = rb_enc_find("binary");
+
+#define IODINE_ROUTER_STR(name, value)                                         \
+  name = rb_str_new_cstr(value);                                               \
+  rb_obj_freeze(name);                                                         \
+  rb_global_variable(&name);
+  IODINE_ROUTER_STR(request_method_str, "REQUEST_METHOD");
+  IODINE_ROUTER_STR(path_info_str, "PATH_INFO");
+  IODINE_ROUTER_STR(content_type_str, "content-type");
+  IODINE_ROUTER_STR(location_str, "location");
+#undef IODINE_ROUTER_STR
+  file_class = rb_cFile;
+
+  RouterClass = rb_define_class_under(IodineModule, "Router", rb_cObject);
+  rb_define_alloc_func(RouterClass, iodine_router_alloc);
+  rb_define_method(RouterClass, "initialize", iodine_router_initialize, -1);
+  rb_define_method(RouterClass, "app", iodine_router_app_get, 0);
+  rb_define_method(RouterClass, "app=", iodine_router_app_set, 1);
+  rb_define_method(RouterClass, "route", iodine_router_route_app, -1);
+  rb_define_method(RouterClass, "static", iodine_router_static, 2);
+  rb_define_method(RouterClass, "respond", iodine_router_respond, -1);
+  rb_define_method(RouterClass, "redirect", iodine_router_redirect, -1);
+  rb_define_method(RouterClass, "not_found", iodine_router_not_found, -1);
+  rb_define_method(RouterClass, "call", iodine_router_call, 1);
+}
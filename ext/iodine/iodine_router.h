@@ -0,0 +1,36 @@
+#ifndef H_IODINE_ROUTER_H
+#define H_IODINE_ROUTER_H
+/*
+Copyright: Boaz segev, 2016-2018
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+#include "iodine.h"
+
+#include "http.h"
+
+/** Initializes the Iodine::Router class. */
+void iodine_router_init(void);
+
+/** Returns true if the object is an Iodine::Router. */
+int iodine_router_is(VALUE obj);
+
+/**
+ * Marks the router as attached to a listening socket.
+ *
+ * Attached routers are matched without holding the GVL, so their routes can't
+ * be changed anymore.
+ */
+void iodine_router_attach(VALUE router);
+
+/**
+ * Routes a request - performed WITHOUT holding the GVL.
+ *
+ * Static files, fixed responses, redirects and 404 errors are handled
+ * natively, in which case Qnil is returned. Otherwise the Rack application
+ * that should handle the request is returned.
+ */
+VALUE iodine_router_route(VALUE router, http_s *h);
+
+#endif
@@ -45,6 +45,24 @@ static VALUE storage_remove(VALUE obj) {
   fio_unlock(&iodine_storage_lock);
   return obj;
 }
+/** Releases a String pinned by `iodine_store_write_str` (a `dealloc`). */
+void iodine_store_str_release(void *str) { storage_remove((VALUE)str); }
+
+/**
+ * Writes (a part of) a frozen String to the connection without copying it.
+ *
+ * The String is pinned (protected from the GC) until it was written.
+ */
+ssize_t iodine_store_write_str(intptr_t uuid, VALUE str, size_t offset,
+                               size_t length) {
+  storage_add(str);
+  /* the packet's buffer is the String object, so `dealloc` can release it */
+  return fio_write2(uuid, .data.buffer = (void *)str,
+                    .offset = (uintptr_t)RSTRING_PTR(str) - (uintptr_t)str +
+                              offset,
+                    .length = length, .after.dealloc = iodine_store_str_release);
+}
+
 /** Should be called after forking to reset locks */
 static void storage_after_fork(void) { iodine_storage_lock = FIO_LOCK_INIT; }
 
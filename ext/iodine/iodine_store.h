@@ -14,6 +14,29 @@ extern struct IodineStorage_s {
   void (*print)(void);
 } IodineStore;
 
+#ifndef IODINE_ZERO_COPY_MIN
+/**
+ * Frozen Strings (at least) this long are written without being copied (they
+ * are pinned until written). Shorter Strings are cheaper to copy.
+ */
+#define IODINE_ZERO_COPY_MIN 16384
+#endif
+
+/** Returns true if the String should be written without being copied. */
+#define IODINE_ZERO_COPY(str)                                                  \
+  (RB_OBJ_FROZEN((str)) && RSTRING_LEN((str)) >= IODINE_ZERO_COPY_MIN)
+
+/** Releases a String pinned by `iodine_store_write_str` (a `dealloc`). */
+void iodine_store_str_release(void *str);
+
+/**
+ * Writes (a part of) a frozen String to the connection without copying it.
+ *
+ * The String is pinned (protected from the GC) until it was written.
+ */
+ssize_t iodine_store_write_str(intptr_t uuid, VALUE str, size_t offset,
+                               size_t length);
+
 /** Initializes the storage unit for first use. */
 void iodine_storage_init(void);
 
@@ -164,6 +164,12 @@ static VALUE iodine_scheduler_write(VALUE self, VALUE r_fd, VALUE r_buffer, VALU
   Check_Type(r_offset, T_FIXNUM);
   int offset = FIX2INT(r_offset);
 
+  if (IODINE_ZERO_COPY(r_buffer) && offset >= 0 && length >= 0 &&
+      (long)offset + length <= RSTRING_LEN(r_buffer)) {
+    iodine_store_write_str(fio_fd2uuid(fd), r_buffer, offset, length);
+    return r_length;
+  }
+
   void *cpy = fio_malloc(length);
   memcpy(cpy, buffer, length);
   fio_write2(fio_fd2uuid(fd), .data.buffer = cpy, .length = length, .offset = offset, .after.dealloc = fio_free);
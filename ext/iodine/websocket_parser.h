@@ -143,8 +143,21 @@ inline static void websocket_xmask(void *msg, uint64_t len, uint32_t mask);
 /* *****************************************************************************
 Message masking
 ***************************************************************************** */
-/** used internally to mask and unmask client messages. */
+/**
+ * used internally to mask and unmask client messages.
+ *
+ * Define `WEBSOCKET_XMASK_BULK(msg, len, mask)` to process the leading bytes
+ * using a faster (i.e., vectorized) implementation. It must return the number
+ * of bytes processed, a multiple of 4 (so the mask's phase is unchanged).
+ */
 void websocket_xmask(void *msg, uint64_t len, uint32_t mask) {
+#ifdef WEBSOCKET_XMASK_BULK
+  if (len >= 32) {
+    const size_t bulk = WEBSOCKET_XMASK_BULK(msg, len, mask);
+    msg = (void *)((uintptr_t)msg + bulk);
+    len -= bulk;
+  }
+#endif
   if (len > 7) {
     { /* XOR any unaligned memory (4 byte alignment) */
       const uintptr_t offset = 4 - ((uintptr_t)msg & 3);
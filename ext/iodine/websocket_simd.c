@@ -0,0 +1,342 @@
+/*
+Copyright: Boaz Segev, 2016-2019
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+#include <websocket_simd.h>
+
+#include <string.h>
+
+#if WEBSOCKET_SIMD
+#include <immintrin.h>
+#endif
+
+/* *****************************************************************************
+Portable implementation
+***************************************************************************** */
+
+static size_t websocket_xmask_portable(void *msg, size_t len, uint32_t mask) {
+  return 0; /* the parser's 64 bit loop handles the data */
+  (void)msg;
+  (void)len;
+  (void)mask;
+}
+
+static uint8_t websocket_utf8_portable(const uint8_t *s, size_t len) {
+  size_t i = 0;
+  while (i < len) {
+    if (i + 8 <= len) {
+      /* ASCII fast path */
+      uint64_t word;
+      memcpy(&word, s + i, 8);
+      if (!(word & 0x8080808080808080ULL)) {
+        i += 8;
+        continue;
+      }
+    }
+    const uint8_t c = s[i];
+    if (c < 0x80) {
+      ++i;
+      continue;
+    }
+    size_t n;
+    if (c >= 0xC2 && c <= 0xDF)
+      n = 1;
+    else if ((c & 0xF0) == 0xE0)
+      n = 2;
+    else if (c >= 0xF0 && c <= 0xF4)
+      n = 3;
+    else
+      return 0;
+    if (i + n >= len)
+      return 0;
+    for (size_t k = 1; k <= n; ++k) {
+      if ((s[i + k] & 0xC0) != 0x80)
+        return 0;
+    }
+    /* overlong encodings, surrogates and code points above U+10FFFF */
+    if ((c == 0xE0 && s[i + 1] < 0xA0) || (c == 0xED && s[i + 1] > 0x9F) ||
+        (c == 0xF0 && s[i + 1] < 0x90) || (c == 0xF4 && s[i + 1] > 0x8F))
+      return 0;
+    i += n + 1;
+  }
+  return 1;
+}
+
+#if WEBSOCKET_SIMD
+/* *****************************************************************************
+Unmasking kernels (the mask's phase is kept, as blocks are multiples of 4)
+***************************************************************************** */
+
+__attribute__((target("sse2"))) static size_t
+websocket_xmask_sse2(void *msg, size_t len, uint32_t mask) {
+  uint8_t *pos = msg;
+  const __m128i m = _mm_set1_epi32((int)mask);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((__m128i *)(pos + i));
+    _mm_storeu_si128((__m128i *)(pos + i), _mm_xor_si128(v, m));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) static size_t
+websocket_xmask_avx2(void *msg, size_t len, uint32_t mask) {
+  uint8_t *pos = msg;
+  const __m256i m = _mm256_set1_epi32((int)mask);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((__m256i *)(pos + i));
+    _mm256_storeu_si256((__m256i *)(pos + i), _mm256_xor_si256(v, m));
+  }
+  return i + websocket_xmask_sse2(pos + i, len - i, mask);
+}
+
+__attribute__((target("avx512f"))) static size_t
+websocket_xmask_avx512(void *msg, size_t len, uint32_t mask) {
+  uint8_t *pos = msg;
+  const __m512i m = _mm512_set1_epi32((int)mask);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    __m512i v = _mm512_loadu_si512((void *)(pos + i));
+    _mm512_storeu_si512((void *)(pos + i), _mm512_xor_si512(v, m));
+  }
+  return i + websocket_xmask_avx2(pos + i, len - i, mask);
+}
+
+/* *****************************************************************************
+UTF-8 validation kernels
+
+The lookup algorithm (Keiser & Lemire, "Validating UTF-8 In Less Than One
+Instruction Per Byte"): every byte is classified by its high nibble, and the
+previous byte's nibbles, and the three tables' intersection marks errors.
+***************************************************************************** */
+
+/* 11______ 0_______ or 11______ 11______ */
+#define U8_TOO_SHORT (1 << 0)
+/* 0_______ 10______ */
+#define U8_TOO_LONG (1 << 1)
+/* 11100000 100_____ */
+#define U8_OVERLONG_3 (1 << 2)
+/* 11110100 1001____ and above U+10FFFF */
+#define U8_TOO_LARGE (1 << 3)
+/* 11101101 101_____ */
+#define U8_SURROGATE (1 << 4)
+/* 1100000_ 10______ */
+#define U8_OVERLONG_2 (1 << 5)
+/* 11110101 1000____ and above, or 11110000 1000____ (overlong) */
+#define U8_TOO_LARGE_1000 (1 << 6)
+#define U8_OVERLONG_4 (1 << 6)
+/* 10______ 10______ */
+#define U8_TWO_CONTS (1 << 7)
+/* the errors that apply regardless of the first byte's low nibble */
+#define U8_CARRY (U8_TOO_SHORT | U8_TOO_LONG | U8_TWO_CONTS)
+
+#define U8_TABLE_BYTE_1_HIGH                                                   \
+  U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,             \
+      U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, (char)U8_TWO_CONTS,               \
+      (char)U8_TWO_CONTS, (char)U8_TWO_CONTS, (char)U8_TWO_CONTS,              \
+      U8_TOO_SHORT | U8_OVERLONG_2, U8_TOO_SHORT,                              \
+      U8_TOO_SHORT | U8_OVERLONG_3 | U8_SURROGATE,                             \
+      U8_TOO_SHORT | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_OVERLONG_4
+
+#define U8_TABLE_BYTE_1_LOW                                                    \
+  (char)(U8_CARRY | U8_OVERLONG_3 | U8_OVERLONG_2 | U8_OVERLONG_4),            \
+      (char)(U8_CARRY | U8_OVERLONG_2), (char)U8_CARRY, (char)U8_CARRY,        \
+      (char)(U8_CARRY | U8_TOO_LARGE),                                         \
+      (char)(U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000),                     \
+      (char)(U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000),                     \
+      (char)(U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000),                     \
+      (char)(U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000),                     \
+      (char)(U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000),                     \
+      (char)(U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000),                     \
+      (char)(U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000),                     \
+      (char)(U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000),                     \
+      (char)(U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_SURROGATE),      \
+      (char)(U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000),                     \
+      (char)(U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000)
+
+#define U8_TABLE_BYTE_2_HIGH                                                   \
+  U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,        \
+      U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,                                \
+      (char)(U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 |      \
+             U8_TOO_LARGE_1000 | U8_OVERLONG_4),                               \
+      (char)(U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 |      \
+             U8_TOO_LARGE),                                                    \
+      (char)(U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE |       \
+             U8_TOO_LARGE),                                                    \
+      (char)(U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE |       \
+             U8_TOO_LARGE),                                                    \
+      U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT
+
+/* the last 3 bytes of a block can't start a 4, 3 or 2 byte sequence */
+#define U8_TABLE_INCOMPLETE (char)0xEF, (char)0xDF, (char)0xBF
+
+__attribute__((target("ssse3"))) static uint8_t
+websocket_utf8_ssse3(const uint8_t *s, size_t len) {
+  const __m128i byte_1_high = _mm_setr_epi8(U8_TABLE_BYTE_1_HIGH);
+  const __m128i byte_1_low = _mm_setr_epi8(U8_TABLE_BYTE_1_LOW);
+  const __m128i byte_2_high = _mm_setr_epi8(U8_TABLE_BYTE_2_HIGH);
+  const __m128i incomplete_max =
+      _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                    U8_TABLE_INCOMPLETE);
+  const __m128i nibble = _mm_set1_epi8(0x0F);
+  const __m128i third = _mm_set1_epi8((char)(0xE0 - 0x80));
+  const __m128i fourth = _mm_set1_epi8((char)(0xF0 - 0x80));
+  const __m128i high_bit = _mm_set1_epi8((char)0x80);
+  __m128i prev = _mm_setzero_si128();
+  __m128i incomplete = _mm_setzero_si128();
+  __m128i error = _mm_setzero_si128();
+  uint8_t tail[16];
+  for (size_t i = 0; i < len; i += 16) {
+    __m128i in;
+    if (len - i >= 16) {
+      in = _mm_loadu_si128((const __m128i *)(s + i));
+    } else {
+      /* zero padding is ASCII, so a truncated sequence is an error */
+      memset(tail, 0, sizeof(tail));
+      memcpy(tail, s + i, len - i);
+      in = _mm_loadu_si128((const __m128i *)tail);
+    }
+    if (!_mm_movemask_epi8(in)) {
+      error = _mm_or_si128(error, incomplete);
+      incomplete = _mm_setzero_si128();
+      prev = in;
+      continue;
+    }
+    __m128i prev1 = _mm_alignr_epi8(in, prev, 15);
+    __m128i special = _mm_and_si128(
+        _mm_and_si128(
+            _mm_shuffle_epi8(byte_1_high,
+                             _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+            _mm_shuffle_epi8(byte_1_low, _mm_and_si128(prev1, nibble))),
+        _mm_shuffle_epi8(byte_2_high,
+                         _mm_and_si128(_mm_srli_epi16(in, 4), nibble)));
+    __m128i must_continue = _mm_and_si128(
+        _mm_or_si128(
+            _mm_subs_epu8(_mm_alignr_epi8(in, prev, 14), third),
+            _mm_subs_epu8(_mm_alignr_epi8(in, prev, 13), fourth)),
+        high_bit);
+    error = _mm_or_si128(error, _mm_xor_si128(must_continue, special));
+    incomplete = _mm_subs_epu8(in, incomplete_max);
+    prev = in;
+  }
+  error = _mm_or_si128(error, incomplete);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) ==
+         0xFFFF;
+}
+
+/* shifts the previous block's last bytes in (the AVX2 `alignr` is per lane) */
+#define U8_AVX2_PREV(in, prev, n)                                              \
+  _mm256_alignr_epi8((in), _mm256_permute2x128_si256((prev), (in), 0x21),     \
+                     16 - (n))
+
+__attribute__((target("avx2"))) static uint8_t
+websocket_utf8_avx2(const uint8_t *s, size_t len) {
+  const __m256i byte_1_high =
+      _mm256_broadcastsi128_si256(_mm_setr_epi8(U8_TABLE_BYTE_1_HIGH));
+  const __m256i byte_1_low =
+      _mm256_broadcastsi128_si256(_mm_setr_epi8(U8_TABLE_BYTE_1_LOW));
+  const __m256i byte_2_high =
+      _mm256_broadcastsi128_si256(_mm_setr_epi8(U8_TABLE_BYTE_2_HIGH));
+  const __m256i incomplete_max = _mm256_setr_epi8(
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, U8_TABLE_INCOMPLETE);
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+  const __m256i third = _mm256_set1_epi8((char)(0xE0 - 0x80));
+  const __m256i fourth = _mm256_set1_epi8((char)(0xF0 - 0x80));
+  const __m256i high_bit = _mm256_set1_epi8((char)0x80);
+  __m256i prev = _mm256_setzero_si256();
+  __m256i incomplete = _mm256_setzero_si256();
+  __m256i error = _mm256_setzero_si256();
+  uint8_t tail[32];
+  for (size_t i = 0; i < len; i += 32) {
+    __m256i in;
+    if (len - i >= 32) {
+      in = _mm256_loadu_si256((const __m256i *)(s + i));
+    } else {
+      /* zero padding is ASCII, so a truncated sequence is an error */
+      memset(tail, 0, sizeof(tail));
+      memcpy(tail, s + i, len - i);
+      in = _mm256_loadu_si256((const __m256i *)tail);
+    }
+    if (!_mm256_movemask_epi8(in)) {
+      error = _mm256_or_si256(error, incomplete);
+      incomplete = _mm256_setzero_si256();
+      prev = in;
+      continue;
+    }
+    __m256i prev1 = U8_AVX2_PREV(in, prev, 1);
+    __m256i special = _mm256_and_si256(
+        _mm256_and_si256(
+            _mm256_shuffle_epi8(
+                byte_1_high,
+                _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+            _mm256_shuffle_epi8(byte_1_low, _mm256_and_si256(prev1, nibble))),
+        _mm256_shuffle_epi8(byte_2_high,
+                            _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble)));
+    __m256i must_continue = _mm256_and_si256(
+        _mm256_or_si256(
+            _mm256_subs_epu8(U8_AVX2_PREV(in, prev, 2), third),
+            _mm256_subs_epu8(U8_AVX2_PREV(in, prev, 3), fourth)),
+        high_bit);
+    error = _mm256_or_si256(error, _mm256_xor_si256(must_continue, special));
+    incomplete = _mm256_subs_epu8(in, incomplete_max);
+    prev = in;
+  }
+  error = _mm256_or_si256(error, incomplete);
+  return _mm256_testz_si256(error, error);
+}
+
+#undef U8_AVX2_PREV
+#endif /* WEBSOCKET_SIMD */
+
+/* *****************************************************************************
+Runtime dispatch
+***************************************************************************** */
+
+static size_t (*websocket_xmask_kernel)(void *, size_t,
+                                        uint32_t) = websocket_xmask_portable;
+static uint8_t (*websocket_utf8_kernel)(const uint8_t *,
+                                        size_t) = websocket_utf8_portable;
+
+static __attribute__((constructor)) void websocket_simd_constructor(void) {
+#if WEBSOCKET_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    websocket_xmask_kernel = websocket_xmask_avx512;
+  } else if (__builtin_cpu_supports("avx2")) {
+    websocket_xmask_kernel = websocket_xmask_avx2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    websocket_xmask_kernel = websocket_xmask_sse2;
+  }
+  /* UTF-8 validation shuffles bytes across lanes, AVX2 is the widest used */
+  if (__builtin_cpu_supports("avx2"))
+    websocket_utf8_kernel = websocket_utf8_avx2;
+  else if (__builtin_cpu_supports("ssse3"))
+    websocket_utf8_kernel = websocket_utf8_ssse3;
+#endif
+}
+
+/* *****************************************************************************
+API
+***************************************************************************** */
+
+/**
+ * XORs the leading 16 byte blocks of `msg` with the (repeated) `mask`.
+ *
+ * Returns the number of bytes processed (a multiple of 16, possibly 0), the
+ * rest of the data is left for the caller.
+ */
+size_t websocket_simd_xmask(void *msg, size_t len, uint32_t mask) {
+  return websocket_xmask_kernel(msg, len, mask);
+}
+
+/** Returns 1 if the data is valid UTF-8 (i.e., a valid text frame). */
+uint8_t websocket_utf8_valid(const void *data, size_t len) {
+  /* short messages aren't worth the vector setup */
+  if (len < 16)
+    return websocket_utf8_portable(data, len);
+  return websocket_utf8_kernel(data, len);
+}
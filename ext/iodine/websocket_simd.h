@@ -0,0 +1,40 @@
+/*
+Copyright: Boaz Segev, 2016-2019
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+#ifndef H_WEBSOCKET_SIMD_H
+#define H_WEBSOCKET_SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Vectorized WebSocket payload kernels (unmasking and UTF-8 validation).
+ *
+ * On x86_64 the widest supported instruction set (AVX-512, AVX2 or SSE) is
+ * selected at runtime, other platforms use the portable implementation.
+ *
+ * Define `WEBSOCKET_SIMD` as 0 to use the portable implementation everywhere.
+ */
+#ifndef WEBSOCKET_SIMD
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define WEBSOCKET_SIMD 1
+#else
+#define WEBSOCKET_SIMD 0
+#endif
+#endif
+
+/**
+ * XORs the leading 16 byte blocks of `msg` with the (repeated) `mask`.
+ *
+ * Returns the number of bytes processed (a multiple of 16, possibly 0), the
+ * rest of the data is left for the caller.
+ */
+size_t websocket_simd_xmask(void *msg, size_t len, uint32_t mask);
+
+/** Returns 1 if the data is valid UTF-8 (i.e., a valid text frame). */
+uint8_t websocket_utf8_valid(const void *data, size_t len);
+
+#endif
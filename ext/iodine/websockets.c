@@ -26,8 +26,15 @@ Feel free to copy, use and enjoy according to the license provided.
 #include <string.h>
 #include <strings.h>
 
+#include <websocket_simd.h>
+#define WEBSOCKET_XMASK_BULK(msg, len, mask)                                   \
+  websocket_simd_xmask((msg), (len), (mask))
 #include <websocket_parser.h>
 
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #if !defined(__BIG_ENDIAN__) && !defined(__LITTLE_ENDIAN__) &&                 \
     !defined(__MINGW32__)
 #include <endian.h>
@@ -60,20 +67,48 @@ void free_ws_buffer(ws_s *owner, struct buffer_s);
 /** Sets the initial buffer size. (4Kb)*/
 #define WS_INITIAL_BUFFER_SIZE 4096UL
 
+#ifndef WS_BUFFER_POOL_LIMIT
+/** The number of released (initial sized) buffers kept for reuse. */
+#define WS_BUFFER_POOL_LIMIT 1024
+#endif
+
+#ifndef WS_BUFFER_IDLE_TIME
+/**
+ * The number of milliseconds a drained connection is quiet before its buffer
+ * is released (it's reacquired on the next readable event). 0 disables.
+ */
+#define WS_BUFFER_IDLE_TIME 250
+#endif
+
 /*******************************************************************************
 Buffer management - simple implementation...
-Since Websocket connections have a long life expectancy, optimizing this part of
-the code probably wouldn't offer a high performance boost.
+Initial sized buffers are kept in a (process wide) pool, since idle connections
+release their buffer and reacquire it once they become readable.
 */
 
 // buffer increments by 4,096 Bytes (4Kb)
 #define round_up_buffer_size(size) (((size) >> 12) + 1) << 12
 
+static struct {
+  fio_lock_i lock;
+  size_t count;
+  /* released buffers, linked using their first bytes */
+  void *head;
+} ws_buffer_pool = {.lock = FIO_LOCK_INIT};
+
 struct buffer_s create_ws_buffer(ws_s *owner) {
   (void)(owner);
   struct buffer_s buff;
   buff.size = WS_INITIAL_BUFFER_SIZE;
-  buff.data = malloc(buff.size);
+  fio_lock(&ws_buffer_pool.lock);
+  buff.data = ws_buffer_pool.head;
+  if (buff.data) {
+    ws_buffer_pool.head = *(void **)buff.data;
+    --ws_buffer_pool.count;
+  }
+  fio_unlock(&ws_buffer_pool.lock);
+  if (!buff.data)
+    buff.data = malloc(buff.size);
   FIO_ASSERT_ALLOC(buff.data);
   return buff;
 }
@@ -90,6 +125,18 @@ struct buffer_s resize_ws_buffer(ws_s *owner, struct buffer_s buff) {
 }
 void free_ws_buffer(ws_s *owner, struct buffer_s buff) {
   (void)(owner);
+  if (!buff.data)
+    return;
+  if (buff.size == WS_INITIAL_BUFFER_SIZE) {
+    fio_lock(&ws_buffer_pool.lock);
+    if (ws_buffer_pool.count < WS_BUFFER_POOL_LIMIT) {
+      *(void **)buff.data = ws_buffer_pool.head;
+      ws_buffer_pool.head = buff.data;
+      ++ws_buffer_pool.count;
+      buff.data = NULL;
+    }
+    fio_unlock(&ws_buffer_pool.lock);
+  }
   free(buff.data);
 }
 
@@ -116,6 +163,8 @@ struct ws_s {
   void (*on_ready)(ws_s *ws);
   void (*on_open)(ws_s *ws);
   void (*on_close)(intptr_t uuid, void *udata);
+  void (*on_message_chunk)(ws_s *ws, fio_str_info_s data, uint8_t is_text,
+                           uint8_t first, uint8_t last);
   /** Opaque user data. */
   void *udata;
   /** The maximum websocket message size */
@@ -135,6 +184,28 @@ struct ws_s {
   uint8_t is_text;
   /** websocket connection type. */
   uint8_t is_client;
+  /** the message being received is compressed (permessage-deflate). */
+  uint8_t is_compressed;
+  /** the streamed frame starts a message (see `on_message_chunk`). */
+  uint8_t stream_first;
+  /** the streamed frame ends a message. */
+  uint8_t stream_fin;
+  /** the streamed frame's mask, rotated to the next byte's position. */
+  uint32_t stream_mask;
+  /** the streamed frame's payload that wasn't read yet. */
+  uint64_t stream_left;
+  /** the negotiated permessage-deflate parameters (if any). */
+  websocket_deflate_s deflate;
+  /** the connection is listed as idle (protected by the task lock). */
+  uint8_t idle_listed;
+  /** the time (in milliseconds) the connection was last drained. */
+  uint64_t idle_since;
+  /** the idle connections list node (see `websocket_idle_mark`). */
+  fio_ls_embd_s idle_node;
+#ifdef HAVE_ZLIB
+  /** the (incoming) message inflater, allocated on demand. */
+  z_stream *inflater;
+#endif
 };
 
 /* *****************************************************************************
@@ -153,13 +224,30 @@ static inline void clear_subscriptions(ws_s *ws) {
 Callbacks - Required functions for websocket_parser.h
 ***************************************************************************** */
 
+static int websocket_inflate(ws_s *ws, void *data, size_t len);
+
 static void websocket_on_unwrapped(void *ws_p, void *msg, uint64_t len,
                                    char first, char last, char text,
                                    unsigned char rsv) {
   ws_s *ws = ws_p;
   if (!ws)
     return;
-  if (last && first) {
+  if (first) {
+    /* RSV1 marks compressed messages, other bits are never negotiated */
+    if (rsv & (ws->deflate.mem_level ? 3 : 7))
+      goto protocol_error;
+    ws->is_compressed = (rsv >> 2) & 1;
+  } else if (rsv) {
+    goto protocol_error;
+  }
+  if (ws->on_message_chunk && !ws->is_compressed) {
+    if (first)
+      ws->is_text = (uint8_t)text;
+    ws->on_message_chunk(ws, (fio_str_info_s){.data = msg, .len = len},
+                         ws->is_text, (uint8_t)first, (uint8_t)last);
+    return;
+  }
+  if (last && first && !ws->is_compressed) {
     ws->on_message(ws, (fio_str_info_s){.data = msg, .len = len},
                    (uint8_t)text);
     return;
@@ -172,12 +260,22 @@ static void websocket_on_unwrapped(void *ws_p, void *msg, uint64_t len,
   }
   fiobj_str_write(ws->msg, msg, len);
   if (last) {
-    ws->on_message(ws, fiobj_obj2cstr(ws->msg), ws->is_text);
+    if (ws->is_compressed) {
+      fio_str_info_s compressed = fiobj_obj2cstr(ws->msg);
+      if (websocket_inflate(ws, compressed.data, compressed.len))
+        goto protocol_error;
+    }
+    if (ws->on_message_chunk)
+      ws->on_message_chunk(ws, fiobj_obj2cstr(ws->msg), ws->is_text, 1, 1);
+    else
+      ws->on_message(ws, fiobj_obj2cstr(ws->msg), ws->is_text);
     fiobj_str_resize(ws->msg, 0);
     ws->total_length = 0;
   }
+  return;
 
-  (void)rsv;
+protocol_error:
+  websocket_close(ws);
 }
 static void websocket_on_protocol_ping(void *ws_p, void *msg_, uint64_t len) {
   ws_s *ws = ws_p;
@@ -216,6 +314,294 @@ static void websocket_on_protocol_error(void *ws_p) {
   fio_close(ws->fd);
 }
 
+/* *****************************************************************************
+Compression (permessage-deflate, RFC 7692)
+***************************************************************************** */
+
+#ifdef HAVE_ZLIB
+/* the tail removed from (and restored to) every compressed message */
+static const uint8_t websocket_deflate_tail[4] = {0, 0, 0xFF, 0xFF};
+
+/* per-thread deflaters, by window bits (9..15) and memory level (1..9) */
+static __thread z_stream *websocket_deflaters[7][9];
+
+/**
+ * Compresses a message (the server never reuses its LZ77 window).
+ *
+ * Returns FIOBJ_INVALID if the data isn't worth compressing.
+ */
+static FIOBJ websocket_deflate(fio_str_info_s msg, uint8_t wbits,
+                               uint8_t mem_level) {
+  if (msg.len < WEBSOCKET_DEFLATE_MIN || wbits < 9 || wbits > 15 ||
+      !mem_level || mem_level > 9)
+    return FIOBJ_INVALID;
+  z_stream **pz = &websocket_deflaters[wbits - 9][mem_level - 1];
+  if (!*pz) {
+    z_stream *z = calloc(1, sizeof(*z));
+    FIO_ASSERT_ALLOC(z);
+    if (deflateInit2(z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -(int)wbits,
+                     mem_level, Z_DEFAULT_STRATEGY) != Z_OK) {
+      free(z);
+      return FIOBJ_INVALID;
+    }
+    *pz = z;
+  } else {
+    deflateReset(*pz);
+  }
+  z_stream *z = *pz;
+  /* compressing is only worth it when the result is smaller */
+  FIOBJ out = fiobj_str_buf(msg.len + 8);
+  fio_str_info_s dest = fiobj_obj2cstr(out);
+  z->next_in = (Bytef *)msg.data;
+  z->avail_in = (uInt)msg.len;
+  z->next_out = (Bytef *)dest.data;
+  z->avail_out = (uInt)msg.len + 4;
+  if (deflate(z, Z_SYNC_FLUSH) != Z_OK || z->avail_in ||
+      z->avail_out < 4 /* more data might be pending */) {
+    fiobj_free(out);
+    return FIOBJ_INVALID;
+  }
+  size_t len = (msg.len + 4) - z->avail_out;
+  if (len < 4 || memcmp(dest.data + len - 4, websocket_deflate_tail, 4) ||
+      len - 4 >= msg.len) {
+    fiobj_free(out);
+    return FIOBJ_INVALID;
+  }
+  fiobj_str_resize(out, len - 4);
+  return out;
+}
+
+/**
+ * Replaces the (compressed) message buffer with the inflated message.
+ *
+ * Returns -1 on error or if the message exceeds `max_msg_size`.
+ */
+static int websocket_inflate(ws_s *ws, void *data, size_t len) {
+  if (!ws->inflater) {
+    ws->inflater = calloc(1, sizeof(*ws->inflater));
+    FIO_ASSERT_ALLOC(ws->inflater);
+    /* a full window inflates streams compressed with any window size */
+    if (inflateInit2(ws->inflater, -15) != Z_OK) {
+      free(ws->inflater);
+      ws->inflater = NULL;
+      return -1;
+    }
+  }
+  z_stream *z = ws->inflater;
+  FIOBJ out = fiobj_str_buf(len << 1);
+  size_t total = 0;
+  int ret = 0;
+  uint8_t buf[16384];
+  for (int i = 0; i < 2 && !ret; ++i) {
+    z->next_in = (Bytef *)(i ? websocket_deflate_tail : data);
+    z->avail_in = (uInt)(i ? 4 : len);
+    do {
+      z->next_out = buf;
+      z->avail_out = sizeof(buf);
+      int r = inflate(z, Z_SYNC_FLUSH);
+      size_t produced = sizeof(buf) - z->avail_out;
+      total += produced;
+      if ((r != Z_OK && r != Z_BUF_ERROR && r != Z_STREAM_END) ||
+          total > ws->max_msg_size) {
+        ret = -1;
+        break;
+      }
+      fiobj_str_write(out, (char *)buf, produced);
+      if (r == Z_STREAM_END) {
+        /* the client finished the stream (BFINAL), start a new one */
+        inflateReset(z);
+        break;
+      }
+    } while (z->avail_in || !z->avail_out);
+  }
+  if (ret || ws->deflate.client_no_context)
+    inflateReset(z);
+  if (!ret) {
+    fiobj_free(ws->msg);
+    ws->msg = out;
+  } else {
+    fiobj_free(out);
+  }
+  return ret;
+}
+
+/** Parses a window bits value (8..15), returning -1 if it's invalid. */
+static int websocket_deflate_bits(fio_str_info_s value, uint8_t *bits) {
+  if (value.len && value.data[0] == '"' && value.len > 1 &&
+      value.data[value.len - 1] == '"') {
+    ++value.data;
+    value.len -= 2;
+  }
+  if (value.len < 1 || value.len > 2)
+    return -1;
+  char *pos = value.data;
+  uint64_t n = fio_atol(&pos);
+  if (pos != value.data + value.len || n < 8 || n > 15)
+    return -1;
+  *bits = (uint8_t)n;
+  return 0;
+}
+
+/**
+ * Reviews a single `permessage-deflate` offer (the parameters following the
+ * extension's name), returning -1 if it can't be accepted.
+ */
+static int websocket_deflate_offer(fio_str_info_s params,
+                                   websocket_deflate_s *d) {
+  uint8_t seen = 0;
+  while (params.len) {
+    /* split `name[=value]` */
+    char *end = memchr(params.data, ';', params.len);
+    size_t len = end ? (size_t)(end - params.data) : params.len;
+    fio_str_info_s name = {.data = params.data, .len = len};
+    fio_str_info_s value = {.len = 0};
+    params.data += len + (end ? 1 : 0);
+    params.len -= len + (end ? 1 : 0);
+    char *eq = memchr(name.data, '=', name.len);
+    if (eq) {
+      value = (fio_str_info_s){.data = eq + 1,
+                               .len = name.len - (size_t)(eq + 1 - name.data)};
+      name.len = (size_t)(eq - name.data);
+    }
+    while (name.len && (name.data[0] == ' ' || name.data[0] == '\t')) {
+      ++name.data;
+      --name.len;
+    }
+    while (name.len &&
+           (name.data[name.len - 1] == ' ' || name.data[name.len - 1] == '\t'))
+      --name.len;
+    while (value.len && (value.data[0] == ' ' || value.data[0] == '\t')) {
+      ++value.data;
+      --value.len;
+    }
+    while (value.len && (value.data[value.len - 1] == ' ' ||
+                         value.data[value.len - 1] == '\t'))
+      --value.len;
+    if (!name.len)
+      continue;
+#define WEBSOCKET_DEFLATE_PARAM(str)                                           \
+  (name.len == sizeof(str) - 1 && !strncasecmp(name.data, str, name.len))
+    uint8_t flag;
+    if (WEBSOCKET_DEFLATE_PARAM("server_no_context_takeover")) {
+      flag = 1;
+      if (eq)
+        return -1;
+    } else if (WEBSOCKET_DEFLATE_PARAM("client_no_context_takeover")) {
+      flag = 2;
+      if (eq)
+        return -1;
+      d->client_no_context = 1;
+    } else if (WEBSOCKET_DEFLATE_PARAM("server_max_window_bits")) {
+      flag = 4;
+      /* zlib can't compress using an 8 bit window */
+      if (websocket_deflate_bits(value, &d->server_wbits) ||
+          d->server_wbits < 9)
+        return -1;
+    } else if (WEBSOCKET_DEFLATE_PARAM("client_max_window_bits")) {
+      /* the client's window is never limited, so the value is a hint */
+      uint8_t ignr;
+      flag = 8;
+      if (eq && websocket_deflate_bits(value, &ignr))
+        return -1;
+    } else {
+      return -1;
+    }
+#undef WEBSOCKET_DEFLATE_PARAM
+    if (seen & flag)
+      return -1;
+    seen |= flag;
+  }
+  return 0;
+}
+#else
+static int websocket_inflate(ws_s *ws, void *data, size_t len) {
+  return -1;
+  (void)ws;
+  (void)data;
+  (void)len;
+}
+#endif
+
+/**
+ * used internally: negotiates `permessage-deflate` (RFC 7692) for a server
+ * upgrade request, setting the `Sec-WebSocket-Extensions` response header.
+ */
+websocket_deflate_s websocket_deflate_negotiate(http_s *h,
+                                                http_settings_s *settings) {
+  websocket_deflate_s d = {.mem_level = 0};
+#ifdef HAVE_ZLIB
+  static uint64_t extensions_hash = 0;
+  if (!extensions_hash)
+    extensions_hash = fiobj_hash_string("sec-websocket-extensions", 24);
+  if (!settings || !settings->ws_deflate)
+    return d;
+  FIOBJ header = fiobj_hash_get2(h->headers, extensions_hash);
+  if (!header)
+    return d;
+  size_t count = FIOBJ_TYPE_IS(header, FIOBJ_T_ARRAY) ? fiobj_ary_count(header)
+                                                       : 1;
+  for (size_t i = 0; i < count; ++i) {
+    fio_str_info_s offers = fiobj_obj2cstr(
+        FIOBJ_TYPE_IS(header, FIOBJ_T_ARRAY) ? fiobj_ary_index(header, i)
+                                             : header);
+    /* offers are comma separated (parameter values never contain commas) */
+    while (offers.len) {
+      char *end = memchr(offers.data, ',', offers.len);
+      size_t len = end ? (size_t)(end - offers.data) : offers.len;
+      fio_str_info_s offer = {.data = offers.data, .len = len};
+      offers.data += len + (end ? 1 : 0);
+      offers.len -= len + (end ? 1 : 0);
+      while (offer.len && (offer.data[0] == ' ' || offer.data[0] == '\t')) {
+        ++offer.data;
+        --offer.len;
+      }
+      if (offer.len < 18 || strncasecmp(offer.data, "permessage-deflate", 18) ||
+          (offer.len > 18 && offer.data[18] != ';' && offer.data[18] != ' ' &&
+           offer.data[18] != '\t'))
+        continue;
+      offer.data += 18;
+      offer.len -= 18;
+      while (offer.len && offer.data[0] != ';') {
+        if (offer.data[0] != ' ' && offer.data[0] != '\t')
+          break;
+        ++offer.data;
+        --offer.len;
+      }
+      if (offer.len && offer.data[0] != ';')
+        continue;
+      websocket_deflate_s tmp = {.server_wbits = 15};
+      if (offer.len) {
+        ++offer.data;
+        --offer.len;
+      }
+      if (websocket_deflate_offer(offer, &tmp))
+        continue;
+      tmp.mem_level = settings->ws_deflate > 9 ? 9 : settings->ws_deflate;
+      /* respond */
+      FIOBJ response = fiobj_str_buf(96);
+      fiobj_str_write(response,
+                      "permessage-deflate; server_no_context_takeover", 46);
+      if (tmp.client_no_context)
+        fiobj_str_write(response, "; client_no_context_takeover", 28);
+      if (tmp.server_wbits != 15) {
+        fiobj_str_write(response, "; server_max_window_bits=", 25);
+        fiobj_str_write_i(response, tmp.server_wbits);
+      }
+      http_set_header2(h,
+                       (fio_str_info_s){.data = (char *)"sec-websocket-extensions",
+                                        .len = 24},
+                       fiobj_obj2cstr(response));
+      fiobj_free(response);
+      return tmp;
+    }
+  }
+#else
+  (void)h;
+  (void)settings;
+#endif
+  return d;
+}
+
 /*******************************************************************************
 The Websocket Protocol implementation
 */
@@ -259,10 +645,213 @@ static uint8_t on_shutdown(intptr_t fd, fio_protocol_s *ws) {
   return 0;
 }
 
+/* *****************************************************************************
+Streamed frames (see `on_message_chunk`)
+***************************************************************************** */
+
+/** Returns true if the frame starting the buffer can be streamed. */
+static inline uint8_t websocket_stream_allowed(ws_s *ws) {
+  if (!ws->on_message_chunk || !ws->length)
+    return 0;
+  const uint8_t *head = ws->buffer.data;
+  const uint8_t opcode = head[0] & 15;
+  /* compressed messages (and protocol errors) are left for the parser */
+  return opcode <= 2 && !(head[0] & 0x70) && (opcode || !ws->is_compressed);
+}
+
+/**
+ * Passes the streamed frame's payload in the buffer to `on_message_chunk`.
+ *
+ * Returns the data remaining in the buffer (following the frame).
+ */
+static size_t websocket_stream_payload(ws_s *ws, size_t len) {
+  size_t n = len < ws->stream_left ? len : (size_t)ws->stream_left;
+  uint8_t last = ws->stream_fin && n == ws->stream_left;
+  if (!n && !last)
+    return len;
+  if (ws->stream_mask) {
+    uint32_t mask = ws->stream_mask;
+    websocket_xmask(ws->buffer.data, n, mask);
+    /* the next byte is unmasked using the mask's (n % 4) byte */
+    for (size_t i = 0; i < 4; ++i)
+      ((uint8_t *)&ws->stream_mask)[i] = ((uint8_t *)&mask)[(i + n) & 3];
+  }
+  ws->stream_left -= n;
+  uint8_t first = ws->stream_first;
+  ws->stream_first = 0;
+  ws->on_message_chunk(ws, (fio_str_info_s){.data = ws->buffer.data, .len = n},
+                       ws->is_text, first, last);
+  memmove(ws->buffer.data, (uint8_t *)ws->buffer.data + n, len - n);
+  return len - n;
+}
+
+/**
+ * Starts streaming a (partially read) data frame that doesn't fit the buffer.
+ *
+ * Returns the data remaining in the buffer (the frame's header is removed) or
+ * `len` if the frame isn't streamed.
+ */
+static size_t websocket_stream_start(ws_s *ws, size_t len) {
+  uint8_t *head = ws->buffer.data;
+  struct websocket_packet_info_s info = websocket_buffer_peek(head, len);
+  if (!info.head_length || info.head_length > len ||
+      info.head_length + info.packet_length <= ws->buffer.size)
+    return len;
+  const uint8_t opcode = head[0] & 15;
+  if (!info.masked && !ws->is_client) {
+    websocket_close(ws);
+    return 0;
+  }
+  if (opcode) {
+    ws->is_text = (opcode == 1);
+    ws->is_compressed = 0;
+  }
+  ws->stream_first = (opcode != 0);
+  ws->stream_fin = (head[0] >> 7) & 1;
+  ws->stream_left = info.packet_length;
+  ws->stream_mask = 0;
+  if (info.masked)
+    memcpy(&ws->stream_mask, head + info.head_length - 4, 4);
+  len -= info.head_length;
+  memmove(head, head + info.head_length, len);
+  return len;
+}
+
+/** Consumes the buffer, streaming large frames when `on_message_chunk` is set */
+static size_t websocket_consume_buffer(ws_s *ws, size_t len) {
+  for (;;) {
+    if (ws->stream_left) {
+      len = websocket_stream_payload(ws, len);
+      if (ws->stream_left)
+        return len;
+    }
+    if (!len)
+      return 0;
+    ws->length = websocket_consume(ws->buffer.data, len, ws,
+                                   (~(ws->is_client) & 1));
+    len = ws->length;
+    if (!websocket_stream_allowed(ws))
+      return len;
+    size_t streamed = websocket_stream_start(ws, len);
+    if (streamed == len)
+      return len;
+    len = streamed;
+  }
+}
+
+/* *****************************************************************************
+Idle connections (releasing their buffer)
+***************************************************************************** */
+
+/*
+ * Drained connections are listed and a single (per process) timer releases the
+ * buffers of connections that stayed quiet, so idle connections don't cost a
+ * timer (or a reactor event) each.
+ */
+static struct {
+  fio_lock_i lock;
+  /* the sweeper timer is running in this process */
+  uint8_t running;
+  fio_ls_embd_s list;
+} ws_idle = {.lock = FIO_LOCK_INIT, .list = FIO_LS_INIT(ws_idle.list)};
+
+static inline uint64_t websocket_idle_now(void) {
+  struct timespec t = fio_last_tick();
+  return ((uint64_t)t.tv_sec * 1000) + (t.tv_nsec / 1000000);
+}
+
+/** Returns true if no data (or partial message) is held by the connection. */
+static inline uint8_t websocket_is_drained(ws_s *ws) {
+  return !ws->length && !ws->stream_left && !ws->total_length;
+}
+
+static void websocket_idle_sweep(void *ignr_) {
+  const uint64_t now = websocket_idle_now();
+  fio_lock(&ws_idle.lock);
+  fio_ls_embd_s *pos = ws_idle.list.next;
+  while (pos != &ws_idle.list) {
+    ws_s *ws = FIO_LS_EMBD_OBJ(ws_s, idle_node, pos);
+    pos = pos->next;
+    if (ws->idle_since + WS_BUFFER_IDLE_TIME > now)
+      continue;
+    /* closed connections are unlisted by `destroy_ws` (waiting for the lock) */
+    fio_protocol_s *pr = fio_protocol_try_lock(ws->fd, FIO_PR_LOCK_TASK);
+    if (!pr)
+      continue;
+    /* the connection might have been active before it was locked */
+    if (pr == &ws->protocol && ws->idle_since + WS_BUFFER_IDLE_TIME <= now) {
+      if (websocket_is_drained(ws)) {
+        free_ws_buffer(ws, ws->buffer);
+        ws->buffer = (struct buffer_s){.data = NULL};
+        fiobj_free(ws->msg);
+        ws->msg = FIOBJ_INVALID;
+      }
+      fio_ls_embd_remove(&ws->idle_node);
+      ws->idle_listed = 0;
+    }
+    fio_protocol_unlock(pr, FIO_PR_LOCK_TASK);
+  }
+  fio_unlock(&ws_idle.lock);
+  (void)ignr_;
+}
+
+static void websocket_idle_on_finish(void *ignr_) {
+  fio_lock(&ws_idle.lock);
+  ws_idle.running = 0;
+  fio_unlock(&ws_idle.lock);
+  (void)ignr_;
+}
+
+/** Lists a drained connection as idle. Call within the task lock. */
+static void websocket_idle_mark(ws_s *ws) {
+  if (!WS_BUFFER_IDLE_TIME || !ws->buffer.data || !websocket_is_drained(ws))
+    return;
+  ws->idle_since = websocket_idle_now();
+  if (ws->idle_listed)
+    return;
+  ws->idle_listed = 1;
+  fio_lock(&ws_idle.lock);
+  fio_ls_embd_push(&ws_idle.list, &ws->idle_node);
+  if (!ws_idle.running && fio_is_running()) {
+    ws_idle.running = 1;
+    if (fio_run_every(WS_BUFFER_IDLE_TIME, 0, websocket_idle_sweep, NULL,
+                      websocket_idle_on_finish) == -1)
+      ws_idle.running = 0;
+  }
+  fio_unlock(&ws_idle.lock);
+}
+
+/** Removes a (closed) connection from the idle list. */
+static void websocket_idle_unlist(ws_s *ws) {
+  if (!ws->idle_listed)
+    return;
+  fio_lock(&ws_idle.lock);
+  fio_ls_embd_remove(&ws->idle_node);
+  fio_unlock(&ws_idle.lock);
+  ws->idle_listed = 0;
+}
+
+static void websocket_idle_on_fork(void *ignr_) {
+  /* parent connections are closed (and unlisted) by the child */
+  ws_idle.lock = FIO_LOCK_INIT;
+  ws_buffer_pool.lock = FIO_LOCK_INIT;
+  (void)ignr_;
+}
+
+static __attribute__((constructor)) void websocket_idle_constructor(void) {
+  fio_state_callback_add(FIO_CALL_IN_CHILD, websocket_idle_on_fork, NULL);
+}
+
 static void on_data(intptr_t sockfd, fio_protocol_s *ws_) {
   ws_s *const ws = (ws_s *)ws_;
   if (ws == NULL)
     return;
+  if (!ws->buffer.data) {
+    /* the buffer was released while the connection was idle */
+    ws->buffer = create_ws_buffer(ws);
+  }
+  if (ws->stream_left || websocket_stream_allowed(ws))
+    goto read_data; /* the frame is streamed once its header is read */
   struct websocket_packet_info_s info =
       websocket_buffer_peek(ws->buffer.data, ws->length);
   const uint64_t raw_length = info.packet_length + info.head_length;
@@ -283,13 +872,14 @@ static void on_data(intptr_t sockfd, fio_protocol_s *ws_) {
     }
   }
 
+read_data:;
   const ssize_t len = fio_read(sockfd, (uint8_t *)ws->buffer.data + ws->length,
                                ws->buffer.size - ws->length);
   if (len <= 0) {
+    websocket_idle_mark(ws);
     return;
   }
-  ws->length = websocket_consume(ws->buffer.data, ws->length + len, ws,
-                                 (~(ws->is_client) & 1));
+  ws->length = websocket_consume_buffer(ws, ws->length + len);
 
   fio_force_event(sockfd, FIO_EVENT_ON_DATA);
 }
@@ -302,8 +892,7 @@ static void on_data_first(intptr_t sockfd, fio_protocol_s *ws_) {
   ws->protocol.on_ready = on_ready;
 
   if (ws->length) {
-    ws->length = websocket_consume(ws->buffer.data, ws->length, ws,
-                                   (~(ws->is_client) & 1));
+    ws->length = websocket_consume_buffer(ws, ws->length);
   }
   fio_force_event(sockfd, FIO_EVENT_ON_DATA);
   fio_force_event(sockfd, FIO_EVENT_ON_READY);
@@ -311,7 +900,9 @@ static void on_data_first(intptr_t sockfd, fio_protocol_s *ws_) {
 
 /* later */
 static void websocket_write_impl(intptr_t fd, void *data, size_t len, char text,
-                                 char first, char last, char client);
+                                 char first, char last, char client,
+                                 unsigned char rsv);
+static void websocket_deflate_count(int delta);
 
 /*******************************************************************************
 Create/Destroy the websocket object
@@ -334,24 +925,38 @@ static ws_s *new_websocket(intptr_t uuid) {
   return ws;
 }
 static void destroy_ws(ws_s *ws) {
+  websocket_idle_unlist(ws);
   if (ws->on_close)
     ws->on_close(ws->fd, ws->udata);
   if (ws->msg)
     fiobj_free(ws->msg);
   clear_subscriptions(ws);
   free_ws_buffer(ws, ws->buffer);
+#ifdef HAVE_ZLIB
+  if (ws->inflater) {
+    inflateEnd(ws->inflater);
+    free(ws->inflater);
+  }
+#endif
+  if (ws->deflate.mem_level)
+    websocket_deflate_count(-1);
   free(ws);
 }
 
 void websocket_attach(intptr_t uuid, http_settings_s *http_settings,
-                      websocket_settings_s *args, void *data, size_t length) {
+                      websocket_settings_s *args, void *data, size_t length,
+                      websocket_deflate_s deflate) {
   ws_s *ws = new_websocket(uuid);
+  ws->deflate = deflate;
+  if (ws->deflate.mem_level)
+    websocket_deflate_count(1);
   // we have an active websocket connection - prep the connection buffer
   ws->buffer = create_ws_buffer(ws);
   // Setup ws callbacks
   ws->on_open = args->on_open;
   ws->on_close = args->on_close;
   ws->on_message = args->on_message;
+  ws->on_message_chunk = args->on_message_chunk;
   ws->on_ready = args->on_ready;
   ws->on_shutdown = args->on_shutdown;
   // setup any user data
@@ -394,26 +999,31 @@ Writing to the Websocket
 #define WS_MAX_FRAME_SIZE                                                      \
   (FIO_MEMORY_BLOCK_ALLOC_LIMIT - 4096) // should be less then `unsigned short`
 
+/* `rsv` is only set for the message's first frame (i.e., 4 when compressed) */
 static void websocket_write_impl(intptr_t fd, void *data, size_t len, char text,
-                                 char first, char last, char client) {
+                                 char first, char last, char client,
+                                 unsigned char rsv) {
   if (len <= WS_MAX_FRAME_SIZE) {
     void *buff = fio_malloc(len + 16);
     FIO_ASSERT_ALLOC(buff);
+    if (!first)
+      rsv = 0;
     len = (client ? websocket_client_wrap(buff, data, len, (text ? 1 : 2),
-                                          first, last, 0)
+                                          first, last, rsv)
                   : websocket_server_wrap(buff, data, len, (text ? 1 : 2),
-                                          first, last, 0));
+                                          first, last, rsv));
     fio_write2(fd, .data.buffer = buff, .length = len,
                .after.dealloc = fio_free);
   } else {
     /* frame fragmentation is better for large data then large frames */
     while (len > WS_MAX_FRAME_SIZE) {
-      websocket_write_impl(fd, data, WS_MAX_FRAME_SIZE, text, first, 0, client);
+      websocket_write_impl(fd, data, WS_MAX_FRAME_SIZE, text, first, 0, client,
+                           rsv);
       data = ((uint8_t *)data) + WS_MAX_FRAME_SIZE;
       first = 0;
       len -= WS_MAX_FRAME_SIZE;
     }
-    websocket_write_impl(fd, data, len, text, first, 1, client);
+    websocket_write_impl(fd, data, len, text, first, 1, client, rsv);
   }
   return;
 }
@@ -439,15 +1049,32 @@ static inline fio_msg_metadata_s websocket_optimize(fio_str_info_s msg,
   };
   return ret;
 }
+
+/* compresses the message once, for all the permessage-deflate clients */
+static inline fio_msg_metadata_s
+websocket_optimize_deflate(fio_str_info_s msg, unsigned char opcode) {
+#ifdef HAVE_ZLIB
+  FIOBJ deflated = websocket_deflate(msg, 15, WEBSOCKET_DEFLATE_MEM_LEVEL);
+  if (deflated) {
+    fio_str_info_s d = fiobj_obj2cstr(deflated);
+    FIOBJ out = fiobj_str_buf(d.len + 10);
+    fiobj_str_resize(out,
+                     websocket_server_wrap(fiobj_obj2cstr(out).data, d.data,
+                                           d.len, opcode, 1, 1, 4));
+    fiobj_free(deflated);
+    fio_msg_metadata_s ret = {
+        .on_finish = websocket_optimize_free,
+        .metadata = (void *)out,
+    };
+    return ret;
+  }
+#endif
+  return websocket_optimize(msg, opcode);
+}
 static fio_msg_metadata_s websocket_optimize_generic(fio_str_info_s ch,
                                                      fio_str_info_s msg,
                                                      uint8_t is_json) {
-  fio_str_s tmp = FIO_STR_INIT_EXISTING(ch.data, ch.len, 0); // don't free
-  tmp.dealloc = NULL;
-  unsigned char opcode = 2;
-  if (tmp.len <= (2 << 19) && fio_str_utf8_valid(&tmp)) {
-    opcode = 1;
-  }
+  unsigned char opcode = websocket_utf8_valid(msg.data, msg.len) ? 1 : 2;
   fio_msg_metadata_s ret = websocket_optimize(msg, opcode);
   ret.type_id = WEBSOCKET_OPTIMIZE_PUBSUB;
   return ret;
@@ -475,6 +1102,77 @@ static fio_msg_metadata_s websocket_optimize_binary(fio_str_info_s ch,
   (void)is_json;
 }
 
+static fio_msg_metadata_s websocket_optimize_deflate_generic(fio_str_info_s ch,
+                                                             fio_str_info_s msg,
+                                                             uint8_t is_json) {
+  unsigned char opcode = websocket_utf8_valid(msg.data, msg.len) ? 1 : 2;
+  fio_msg_metadata_s ret = websocket_optimize_deflate(msg, opcode);
+  ret.type_id = WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE;
+  return ret;
+  (void)ch;
+  (void)is_json;
+}
+
+static fio_msg_metadata_s websocket_optimize_deflate_text(fio_str_info_s ch,
+                                                          fio_str_info_s msg,
+                                                          uint8_t is_json) {
+  fio_msg_metadata_s ret = websocket_optimize_deflate(msg, 1);
+  ret.type_id = WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE_TEXT;
+  return ret;
+  (void)ch;
+  (void)is_json;
+}
+
+static fio_msg_metadata_s
+websocket_optimize_deflate_binary(fio_str_info_s ch, fio_str_info_s msg,
+                                  uint8_t is_json) {
+  fio_msg_metadata_s ret = websocket_optimize_deflate(msg, 2);
+  ret.type_id = WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE_BINARY;
+  return ret;
+  (void)ch;
+  (void)is_json;
+}
+
+/* the broadcast optimizations' state (see `websocket_optimize4broadcasts`) */
+static struct {
+  fio_lock_i lock;
+  /* enabled types: generic, text, binary */
+  intptr_t counters[3];
+  /* open permessage-deflate connections */
+  intptr_t deflate_connections;
+  /* the compressed variants currently registered */
+  uint8_t deflate_registered[3];
+} websocket_broadcasts;
+
+/**
+ * Registers the compressed variants of the enabled optimizations while
+ * permessage-deflate connections are open. Call within the lock.
+ */
+static void websocket_optimize_deflate_update_unsafe(void) {
+  static fio_msg_metadata_s (*const callbacks[3])(
+      fio_str_info_s, fio_str_info_s, uint8_t) = {
+      websocket_optimize_deflate_generic,
+      websocket_optimize_deflate_text,
+      websocket_optimize_deflate_binary,
+  };
+  for (size_t i = 0; i < 3; ++i) {
+    uint8_t required = websocket_broadcasts.counters[i] > 0 &&
+                       websocket_broadcasts.deflate_connections > 0;
+    if (required == websocket_broadcasts.deflate_registered[i])
+      continue;
+    websocket_broadcasts.deflate_registered[i] = required;
+    fio_message_metadata_callback_set(callbacks[i], required);
+  }
+}
+
+/** Counts permessage-deflate connections (see `websocket_optimize_deflate`). */
+static void websocket_deflate_count(int delta) {
+  fio_lock(&websocket_broadcasts.lock);
+  websocket_broadcasts.deflate_connections += delta;
+  websocket_optimize_deflate_update_unsafe();
+  fio_unlock(&websocket_broadcasts.lock);
+}
+
 /**
  * Enables (or disables) broadcast optimizations.
  *
@@ -502,36 +1200,63 @@ static fio_msg_metadata_s websocket_optimize_binary(fio_str_info_s ch,
  * are merged, but reference counted (disabled when reference is zero).
  */
 void websocket_optimize4broadcasts(intptr_t type, int enable) {
-  static intptr_t generic = 0;
-  static intptr_t text = 0;
-  static intptr_t binary = 0;
   fio_msg_metadata_s (*callback)(fio_str_info_s, fio_str_info_s, uint8_t);
   intptr_t *counter;
   switch ((0 - type)) {
   case (0 - WEBSOCKET_OPTIMIZE_PUBSUB):
-    counter = &generic;
+    counter = websocket_broadcasts.counters;
     callback = websocket_optimize_generic;
     break;
   case (0 - WEBSOCKET_OPTIMIZE_PUBSUB_TEXT):
-    counter = &text;
+    counter = websocket_broadcasts.counters + 1;
     callback = websocket_optimize_text;
     break;
   case (0 - WEBSOCKET_OPTIMIZE_PUBSUB_BINARY):
-    counter = &binary;
+    counter = websocket_broadcasts.counters + 2;
     callback = websocket_optimize_binary;
     break;
   default:
     return;
   }
+  fio_lock(&websocket_broadcasts.lock);
   if (enable) {
-    if (fio_atomic_add(counter, 1) == 1) {
+    if (++(*counter) == 1) {
       fio_message_metadata_callback_set(callback, 1);
     }
   } else {
-    if (fio_atomic_sub(counter, 1) == 0) {
+    if (--(*counter) == 0) {
       fio_message_metadata_callback_set(callback, 0);
     }
   }
+  websocket_optimize_deflate_update_unsafe();
+  fio_unlock(&websocket_broadcasts.lock);
+}
+
+/**
+ * Writes a pub/sub message to the WebSocket, using the pre-wrapped (and
+ * pre-compressed) broadcast frames when available.
+ */
+void websocket_write_broadcast(ws_s *ws, fio_msg_s *msg, intptr_t type) {
+  FIOBJ pre_wrapped = FIOBJ_INVALID;
+  if (!ws->is_client) {
+    /* pre-wrapping is only for client data */
+    if (ws->deflate.mem_level && ws->deflate.server_wbits == 15)
+      pre_wrapped = (FIOBJ)fio_message_metadata(
+          msg, type + (WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE -
+                       WEBSOCKET_OPTIMIZE_PUBSUB));
+    if (!pre_wrapped)
+      pre_wrapped = (FIOBJ)fio_message_metadata(msg, type);
+    if (pre_wrapped) {
+      fiobj_send_free(ws->fd, fiobj_dup(pre_wrapped));
+      return;
+    }
+  }
+  uint8_t txt = (type == WEBSOCKET_OPTIMIZE_PUBSUB_TEXT);
+  if (type == WEBSOCKET_OPTIMIZE_PUBSUB) {
+    /* unknown text state */
+    txt = websocket_utf8_valid(msg->msg.data, msg->msg.len);
+  }
+  websocket_write(ws, msg->msg, txt);
 }
 
 /* *****************************************************************************
@@ -555,41 +1280,10 @@ static inline void websocket_on_pubsub_message_direct_internal(fio_msg_s *msg,
     fio_message_defer(msg);
     return;
   }
-  FIOBJ message = FIOBJ_INVALID;
-  FIOBJ pre_wrapped = FIOBJ_INVALID;
-  if (!((ws_s *)pr)->is_client) {
-    /* pre-wrapping is only for client data */
-    switch (txt) {
-    case 0:
-      pre_wrapped =
-          (FIOBJ)fio_message_metadata(msg, WEBSOCKET_OPTIMIZE_PUBSUB_BINARY);
-      break;
-    case 1:
-      pre_wrapped =
-          (FIOBJ)fio_message_metadata(msg, WEBSOCKET_OPTIMIZE_PUBSUB_TEXT);
-      break;
-    case 2:
-      pre_wrapped = (FIOBJ)fio_message_metadata(msg, WEBSOCKET_OPTIMIZE_PUBSUB);
-      break;
-    default:
-      break;
-    }
-    if (pre_wrapped) {
-      // FIO_LOG_DEBUG(
-      //     "pub/sub WebSocket optimization route for pre-wrapped message.");
-      fiobj_send_free((intptr_t)msg->udata1, fiobj_dup(pre_wrapped));
-      goto finish;
-    }
-  }
-  if (txt == 2) {
-    /* unknown text state */
-    fio_str_s tmp =
-        FIO_STR_INIT_STATIC2(msg->msg.data, msg->msg.len); // don't free
-    txt = (tmp.len >= (2 << 14) ? 0 : fio_str_utf8_valid(&tmp));
-  }
-  websocket_write((ws_s *)pr, msg->msg, txt & 1);
-  fiobj_free(message);
-finish:
+  static const intptr_t types[] = {WEBSOCKET_OPTIMIZE_PUBSUB_BINARY,
+                                   WEBSOCKET_OPTIMIZE_PUBSUB_TEXT,
+                                   WEBSOCKET_OPTIMIZE_PUBSUB};
+  websocket_write_broadcast((ws_s *)pr, msg, types[txt]);
   fio_protocol_unlock(pr, FIO_PR_LOCK_WRITE);
 }
 
@@ -732,12 +1426,63 @@ uint8_t websocket_is_client(ws_s *ws) { return ws->is_client; }
 /** Writes data to the websocket. Returns -1 on failure (0 on success). */
 int websocket_write(ws_s *ws, fio_str_info_s msg, uint8_t is_text) {
   if (fio_is_valid(ws->fd)) {
+#ifdef HAVE_ZLIB
+    if (ws->deflate.mem_level && msg.len >= WEBSOCKET_DEFLATE_MIN) {
+      FIOBJ deflated =
+          websocket_deflate(msg, ws->deflate.server_wbits, ws->deflate.mem_level);
+      if (deflated) {
+        fio_str_info_s d = fiobj_obj2cstr(deflated);
+        websocket_write_impl(ws->fd, d.data, d.len, is_text, 1, 1,
+                             ws->is_client, 4);
+        fiobj_free(deflated);
+        return 0;
+      }
+    }
+#endif
     websocket_write_impl(ws->fd, msg.data, msg.len, is_text, 1, 1,
-                         ws->is_client);
+                         ws->is_client, 0);
     return 0;
   }
   return -1;
 }
+/* appends a single (complete) frame to a FIOBJ String */
+static void websocket_wrap2str(FIOBJ dest, void *data, size_t len, char text,
+                               char client, unsigned char rsv) {
+  fiobj_str_capa_assert(dest, fiobj_obj2cstr(dest).len + len + 14);
+  fio_str_info_s s = fiobj_obj2cstr(dest);
+  len = (client ? websocket_client_wrap(s.data + s.len, data, len,
+                                        (text ? 1 : 2), 1, 1, rsv)
+                : websocket_server_wrap(s.data + s.len, data, len,
+                                        (text ? 1 : 2), 1, 1, rsv));
+  fiobj_str_resize(dest, s.len + len);
+}
+
+/**
+ * Appends the message (as a WebSocket frame) to the `dest` String instead of
+ * writing it, so many messages can be sent using a single write.
+ *
+ * Returns -1 on failure (0 on success).
+ */
+int websocket_write2str(ws_s *ws, FIOBJ dest, fio_str_info_s msg,
+                        uint8_t is_text) {
+  if (!FIOBJ_TYPE_IS(dest, FIOBJ_T_STRING))
+    return -1;
+#ifdef HAVE_ZLIB
+  if (ws->deflate.mem_level && msg.len >= WEBSOCKET_DEFLATE_MIN) {
+    FIOBJ deflated =
+        websocket_deflate(msg, ws->deflate.server_wbits, ws->deflate.mem_level);
+    if (deflated) {
+      fio_str_info_s d = fiobj_obj2cstr(deflated);
+      websocket_wrap2str(dest, d.data, d.len, is_text, ws->is_client, 4);
+      fiobj_free(deflated);
+      return 0;
+    }
+  }
+#endif
+  websocket_wrap2str(dest, msg.data, msg.len, is_text, ws->is_client, 0);
+  return 0;
+}
+
 /** Closes a websocket connection. */
 void websocket_close(ws_s *ws) {
   if (ws->is_client) {
@@ -750,3 +1495,29 @@ void websocket_close(ws_s *ws) {
   fio_close(ws->fd);
   return;
 }
+
+/**
+ * Closes a websocket connection with a status `code` (i.e., 1008).
+ *
+ * The close frame is sent after any data that's already queued.
+ */
+void websocket_close_code(ws_s *ws, uint16_t code) {
+  uint8_t *frame = fio_malloc(8);
+  FIO_ASSERT_ALLOC(frame);
+  size_t len = 4;
+  frame[0] = 0x88;
+  frame[1] = 2;
+  frame[2] = (uint8_t)(code >> 8);
+  frame[3] = (uint8_t)(code & 0xFF);
+  if (ws->is_client) {
+    /* masked using "MASK" */
+    frame[1] |= 128;
+    memcpy(frame + 2, "MASK", 4);
+    frame[6] = (uint8_t)(code >> 8) ^ 'M';
+    frame[7] = (uint8_t)(code & 0xFF) ^ 'A';
+    len = 8;
+  }
+  fio_write2(ws->fd, .data.buffer = frame, .length = len,
+             .after.dealloc = fio_free);
+  fio_close(ws->fd);
+}
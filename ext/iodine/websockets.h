@@ -14,9 +14,40 @@ Feel free to copy, use and enjoy according to the license provided.
 extern "C" {
 #endif
 
+#ifndef WEBSOCKET_DEFLATE_MIN
+/** Outgoing messages shorter than this aren't compressed (permessage-deflate). */
+#define WEBSOCKET_DEFLATE_MIN 64
+#endif
+
+#ifndef WEBSOCKET_DEFLATE_MEM_LEVEL
+/** zlib's memory level for broadcast messages, compressed once for everyone. */
+#define WEBSOCKET_DEFLATE_MEM_LEVEL 8
+#endif
+
+/** used internally: the negotiated `permessage-deflate` parameters. */
+typedef struct {
+  /** zlib's memory level (1..9) for outgoing messages, 0 if not negotiated. */
+  uint8_t mem_level;
+  /** the server's (outgoing) LZ77 window bits (9..15). */
+  uint8_t server_wbits;
+  /** the client doesn't reuse its LZ77 window between messages. */
+  uint8_t client_no_context;
+} websocket_deflate_s;
+
+/**
+ * used internally: negotiates `permessage-deflate` (RFC 7692) for a server
+ * upgrade request, setting the `Sec-WebSocket-Extensions` response header.
+ *
+ * The server never reuses its LZ77 window (`server_no_context_takeover`), so
+ * broadcasts can be compressed once for all the clients.
+ */
+websocket_deflate_s websocket_deflate_negotiate(http_s *h,
+                                                http_settings_s *settings);
+
 /** used internally: attaches the Websocket protocol to the socket. */
 void websocket_attach(intptr_t uuid, http_settings_s *http_settings,
-                      websocket_settings_s *args, void *data, size_t length);
+                      websocket_settings_s *args, void *data, size_t length,
+                      websocket_deflate_s deflate);
 
 /* *****************************************************************************
 Websocket information
@@ -53,8 +84,22 @@ Websocket Connection Management (write / close)
 
 /** Writes data to the websocket. Returns -1 on failure (0 on success). */
 int websocket_write(ws_s *ws, fio_str_info_s msg, uint8_t is_text);
+/**
+ * Appends the message (as a WebSocket frame) to the `dest` String instead of
+ * writing it, so many messages can be sent using a single write.
+ *
+ * Returns -1 on failure (0 on success).
+ */
+int websocket_write2str(ws_s *ws, FIOBJ dest, fio_str_info_s msg,
+                        uint8_t is_text);
 /** Closes a websocket connection. */
 void websocket_close(ws_s *ws);
+/**
+ * Closes a websocket connection with a status `code` (i.e., 1008).
+ *
+ * The close frame is sent after any data that's already queued.
+ */
+void websocket_close_code(ws_s *ws, uint16_t code);
 
 /* *****************************************************************************
 Websocket Pub/Sub
@@ -149,6 +194,13 @@ void websocket_unsubscribe(ws_s *ws, uintptr_t subscription_id);
 /** Optimize binary broadcasts, for use in websocket_optimize4broadcasts. */
 #define WEBSOCKET_OPTIMIZE_PUBSUB_BINARY (-34)
 
+/** The compressed variant of WEBSOCKET_OPTIMIZE_PUBSUB (permessage-deflate). */
+#define WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE (-35)
+/** The compressed variant of WEBSOCKET_OPTIMIZE_PUBSUB_TEXT. */
+#define WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE_TEXT (-36)
+/** The compressed variant of WEBSOCKET_OPTIMIZE_PUBSUB_BINARY. */
+#define WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE_BINARY (-37)
+
 /**
  * Enables (or disables) broadcast optimizations.
  *
@@ -175,9 +227,24 @@ void websocket_unsubscribe(ws_s *ws, uintptr_t subscription_id);
  *     FIOBJ pre_wrapped = (FIOBJ)fio_message_metadata(msg,
  *                               WEBSOCKET_OPTIMIZE_PUBSUB);
  *     fiobj_send_free((intptr_t)msg->udata1, fiobj_dup(pre_wrapped));
+ *
+ * Note3: while `permessage-deflate` connections are open, each enabled type
+ * also enables its compressed variant (i.e.,
+ * `WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE`), so broadcasts are compressed once per
+ * message rather than once per client (see `websocket_write_broadcast`).
  */
 void websocket_optimize4broadcasts(intptr_t type, int enable);
 
+/**
+ * Writes a pub/sub message to the WebSocket, using the pre-wrapped (and
+ * pre-compressed) broadcast frames when available.
+ *
+ * `type` is the optimization type used when subscribing (i.e.,
+ * `WEBSOCKET_OPTIMIZE_PUBSUB_TEXT`). If the frame wasn't prepared, the message
+ * is written using `websocket_write`.
+ */
+void websocket_write_broadcast(ws_s *ws, fio_msg_s *msg, intptr_t type);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
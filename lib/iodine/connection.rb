@@ -28,6 +28,14 @@ module Iodine
   #          client.is_a?(Iodine::Connection) # => true
   #       end
   #
+  #       # (optional) when defined, WebSocket messages are passed in pieces as
+  #       # they arrive (instead of calling `on_message`), so large messages
+  #       # aren't buffered. `first` and `last` mark the message's boundaries.
+  #       # Text pieces might end in the middle of a UTF-8 character.
+  #       def on_message_chunk client, data, first, last
+  #          client.is_a?(Iodine::Connection) # => true
+  #       end
+  #
   #       # called when the server is shutting down, before closing the client
   #       # (it's still possible to send messages to the client)
   #       def on_shutdown client
@@ -0,0 +1,16 @@
+require 'http'
+require 'json'
+require 'tmpdir'
+
+RSpec.describe 'Access log', with_app: :access_log do
+  let(:access_log) { File.join(Dir.tmpdir, "iodine_access_log_spec.log") }
+
+  it 'writes JSON lines to the log target' do
+    expect(http_get("/logged?a=1").body.to_s).to eql('0')
+    sleep 0.2
+
+    line = File.readlines(access_log).map { |l| JSON.parse(l) }.find { |l| l['path'] == '/logged' }
+    expect(line).to include('method' => 'GET', 'status' => 200, 'version' => 'HTTP/1.1')
+    expect(line['timings'].keys).to include('headers', 'body', 'gvl', 'app', 'written', 'flushed')
+  end
+end
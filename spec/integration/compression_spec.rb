@@ -0,0 +1,54 @@
+require 'http'
+require 'zlib'
+
+RSpec.describe 'Dynamic response compression', with_app: :compress do
+  def get_with_encoding(path, accept_encoding)
+    http_client.headers('Accept-Encoding' => accept_encoding).get("http://localhost:#{server_port}#{path}")
+  end
+
+  it 'compresses textual responses' do
+    response = get_with_encoding('/json', 'gzip')
+    body = response.body.to_s
+
+    expect(response.headers['Content-Encoding']).to eql('gzip')
+    expect(response.headers['Vary']).to eql('accept-encoding')
+    expect(response.headers['Content-Length']).to eql(body.bytesize.to_s)
+    expect(Zlib.gunzip(body)).to start_with('{"items":[{"id":1,')
+  end
+
+  it 'does not compress when the client does not accept it' do
+    response = get_with_encoding('/json', 'identity')
+
+    expect(response.headers['Content-Encoding']).to be_nil
+    expect(response.headers['Vary']).to eql('accept-encoding')
+    expect(response.body.to_s).to start_with('{"items":[{"id":1,')
+  end
+
+  it 'does not compress small responses' do
+    response = get_with_encoding('/small', 'gzip')
+
+    expect(response.headers['Content-Encoding']).to be_nil
+    expect(response.body.to_s).to eql('small')
+  end
+
+  it 'does not compress non textual responses' do
+    response = get_with_encoding('/binary', 'gzip')
+
+    expect(response.headers['Content-Encoding']).to be_nil
+  end
+
+  it 'does not compress WebAssembly by default' do
+    response = get_with_encoding('/wasm', 'gzip')
+
+    expect(response.headers['Content-Encoding']).to be_nil
+  end
+
+  it 'compresses streamed responses' do
+    response = get_with_encoding('/stream', 'gzip')
+    expected = 100.times.map { |i| "line #{i}: #{'x' * 1000}\n" }.join
+
+    expect(response.headers['Content-Encoding']).to eql('gzip')
+    expect(response.headers['Vary']).to eql('accept-encoding')
+    expect(Zlib.gunzip(response.body.to_s)).to eql(expected)
+  end
+end
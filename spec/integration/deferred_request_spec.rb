@@ -0,0 +1,31 @@
+require 'http'
+
+RSpec.describe 'Deferred requests', with_app: :deferred do
+  it 'resumes a paused request' do
+    response = http_get("/delayed")
+
+    expect(response.code).to eql(200)
+    expect(response.body.to_s).to eql("resumed /delayed")
+  end
+
+  it 'resumes a request that is resumed right away' do
+    response = http_get("/immediate")
+
+    expect(response.code).to eql(200)
+    expect(response.body.to_s).to eql("resumed /immediate")
+  end
+
+  it 'resumes a request when its fiber ID is published to' do
+    response = http_get("/published")
+
+    expect(response.code).to eql(200)
+    expect(response.body.to_s).to eql("resumed /published")
+  end
+
+  it 'resumes concurrent requests' do
+    responses = 20.times.map { |i| Thread.new { http_get("/delayed?#{i}") } }.map(&:value)
+
+    expect(responses.map(&:code).uniq).to eql([200])
+    expect(responses.map { |r| r.body.to_s }.uniq).to eql(["resumed /delayed"])
+  end
+end
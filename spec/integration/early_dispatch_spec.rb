@@ -0,0 +1,40 @@
+require 'http'
+require 'digest'
+
+RSpec.describe 'Early dispatch', with_app: :early_dispatch do
+  let(:body) { Random.new(42).bytes(300_000) }
+
+  it 'streams the whole body' do
+    response = http_post("/size", body: body)
+
+    expect(response.code).to eql(200)
+    expect(response.body.to_s).to eql("#{body.bytesize} #{Digest::MD5.hexdigest(body)}")
+  end
+
+  it 'streams the body in chunks' do
+    response = http_post("/chunks", body: body)
+
+    expect(response.body.to_s).to eql(body.bytesize.to_s)
+  end
+
+  it 'streams the body line by line' do
+    lines = (1..20_000).map { |i| "line #{i}\n" }.join
+
+    response = http_post("/lines", body: lines)
+
+    expect(response.body.to_s).to eql("20000")
+  end
+
+  it 'responds before the body was read' do
+    response = http_post("/reject", body: body)
+
+    expect(response.code).to eql(413)
+    expect(response.body.to_s).to eql("too large")
+  end
+
+  it 'handles small bodies as usual' do
+    response = http_post("/size", body: "hello")
+
+    expect(response.body.to_s).to eql("5 #{Digest::MD5.hexdigest("hello")}")
+  end
+end
@@ -0,0 +1,22 @@
+require 'socket'
+
+RSpec.describe 'Frozen response bodies', with_app: :frozen_body do
+  it 'sends the whole body' do
+    response = http_get('/')
+
+    expect(response.body.to_s).to eql('0123456789abcdef' * 8192)
+    expect(response.headers['Content-Length']).to eql((16 * 8192).to_s)
+  end
+
+  it 'keeps the body until it was sent' do
+    socket = TCPSocket.new('localhost', server_port)
+    socket.write("GET /large?1 HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n")
+    # the body is still draining (the client isn't reading) while the GC runs
+    sleep 0.5
+    expect(http_get('/gc').code).to eql(200)
+
+    response = socket.read
+    socket.close
+    expect(response.split("\r\n\r\n", 2).last).to eql("1:#{'x' * 32_000_000}")
+  end
+end
@@ -0,0 +1,36 @@
+require 'http'
+require 'socket'
+
+RSpec.describe 'Large request bodies', with_app: :echo do
+  let(:body) { Random.new(7).bytes(3_000_000) }
+
+  it 'receives the whole body' do
+    response = http_post("/", body: body)
+
+    expect(response.body.to_s.b).to eql(body)
+  end
+
+  it 'handles pipelined requests after the body' do
+    socket = TCPSocket.new('localhost', server_port)
+    socket.write("POST /a HTTP/1.1\r\nHost: localhost\r\nContent-Length: #{body.bytesize}\r\n\r\n")
+    socket.write(body)
+    socket.write("POST /b HTTP/1.1\r\nHost: localhost\r\nContent-Length: 5\r\nConnection: close\r\n\r\nhello")
+
+    response = socket.read.b
+
+    expect(response.scan("HTTP/1.1 200").length).to eql(2)
+    expect(response).to end_with("hello")
+  ensure
+    socket&.close
+  end
+
+  it 'receives the whole multipart body' do
+    file = Random.new(8).bytes(300_000)
+    multipart = "--xYzZy\r\nContent-Disposition: form-data; name=\"a\"\r\n\r\n1\r\n" \
+      "--xYzZy\r\nContent-Disposition: form-data; name=\"f\"; filename=\"f.bin\"\r\n\r\n".b +
+      file + "\r\n--xYzZy--\r\n"
+    response = http_post("/", body: multipart, headers: { "content-type" => "multipart/form-data; boundary=xYzZy" })
+
+    expect(response.body.to_s.b).to eql(multipart)
+  end
+end
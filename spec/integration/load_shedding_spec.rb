@@ -0,0 +1,38 @@
+require 'http'
+require 'socket'
+
+RSpec.describe 'Load shedding', with_app: :load_shedding do
+  it 'reports the queue time' do
+    response = http_get("/queue_time")
+
+    expect(response.body.to_s).to eql('Float')
+  end
+
+  it 'responds with 503 once requests queue up behind a busy request' do
+    responses = 4.times.map do
+      thread = Thread.new { HTTP.timeout(5).get("http://localhost:#{server_port}/busy?500") }
+      sleep 0.05
+      thread
+    end.map(&:value)
+
+    shed = responses.select { |response| response.code == 503 }
+    expect(shed).not_to be_empty
+    expect(shed.first.headers['Retry-After']).to eql('1')
+    expect(responses.first.code).to eql(200)
+  end
+
+  it "doesn't count the upload time as queue time" do
+    socket = TCPSocket.new('localhost', server_port)
+    socket.write("POST /queue_time HTTP/1.1\r\nHost: localhost\r\nContent-Length: 4\r\n\r\nab")
+    sleep 0.3
+    socket.write("cd")
+
+    expect(socket.readpartial(4096)).to start_with("HTTP/1.1 200")
+  ensure
+    socket&.close
+  end
+
+  it 'admits requests once the queue drained' do
+    expect(http_get("/busy?1").code).to eql(200)
+  end
+end
@@ -651,5 +651,28 @@ RSpec.describe Iodine::Rack::Utils do
         expect(response.parse["parameter"]).to eq(string)
       end
     end
+
+    context "with a large file followed by params" do
+      let(:file) do
+        Tempfile.new.tap do |f|
+          f.write "1" * 300_000
+          f.rewind
+        end
+      end
+
+      it "works correctly" do
+        response = http_post("/", form: {
+          before: "a",
+          f: HTTP::FormData::File.new(file.path),
+          "after[]" => "b"
+        })
+
+        expect(response.status.to_i).to eq(200)
+        parsed = response.parse
+        expect(parsed["f_digest"]).to eq("4bc18f32f2f14a84890b5680ffeb2cbb")
+        expect(parsed["before"]).to eq("a")
+        expect(parsed["after"]).to eq(["b"])
+      end
+    end
   end
 end
@@ -0,0 +1,36 @@
+RSpec.describe 'Pub/Sub pattern subscriptions', with_app: :pubsub_patterns do
+  let(:patterns) { 'tenant.1.*,tenant.?.events,tenant.[12].log,other' }
+
+  def received(socket)
+    messages = []
+    while (message = ws_read(socket)[1]) != 'done'
+      messages << message
+    end
+    messages.sort
+  end
+
+  it 'delivers messages to the matching patterns' do
+    socket, = ws_connect(nil, path: "/?#{patterns}")
+    expect(ws_read(socket)).to eql([0x81, 'ready'])
+
+    ws_send(socket, 'publish:tenant.1.events,tenant.2.events,tenant.1.,tenant.1,' \
+                    'tenant.12.events,tenant.2.log,tenant.3.log,other,others')
+
+    expect(received(socket)).to eql(%w[other tenant.1.events tenant.1.events tenant.2.events tenant.2.log])
+  ensure
+    socket&.close
+  end
+
+  it 'stops delivering messages once a pattern is unsubscribed' do
+    socket, = ws_connect(nil, path: "/?#{patterns}")
+    expect(ws_read(socket)).to eql([0x81, 'ready'])
+
+    ws_send(socket, 'unsubscribe:tenant.1.*')
+    expect(ws_read(socket)).to eql([0x81, 'unsubscribed'])
+    ws_send(socket, 'publish:tenant.1.events,tenant.1.x')
+
+    expect(received(socket)).to eql(%w[tenant.1.events])
+  ensure
+    socket&.close
+  end
+end
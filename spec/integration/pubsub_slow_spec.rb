@@ -0,0 +1,71 @@
+RSpec.describe 'Pub/Sub slow consumers', with_app: :pubsub_slow do
+  # reads the frames (without reassembling fragments) until the stream ends
+  def read_frames(socket)
+    frames = []
+    while socket.wait_readable(1) && (frame = ws_read(socket))
+      frames << frame
+      break if frame[0] == 0x88
+    end
+    frames
+  rescue EOFError, NoMethodError
+    frames
+  end
+
+  def slow_client(policy)
+    socket, = ws_connect(nil, path: "/?#{policy}")
+    expect(ws_read(socket)).to eql([0x81, 'ready'])
+    http_get('/publish')
+    sleep(0.5) # the client is slow (doesn't read)
+    socket
+  end
+
+  def counter(policy)
+    http_get('/stats').body.to_s.split(',').to_h { |kv| kv.split('=') }[policy].to_i
+  end
+
+  def numbers(frames)
+    frames.select { |f| f[0] == 0x81 }.map { |f| f[1].to_i }
+  end
+
+  it 'drops new messages with :drop_newest' do
+    socket = slow_client(:drop_newest)
+    received = numbers(read_frames(socket))
+
+    expect(received.size).to be < 1000
+    expect(received).to eql(received.sort)
+    expect(counter('drop_newest')).to eql(1000 - received.size)
+  ensure
+    socket&.close
+  end
+
+  it 'keeps the latest messages with :drop_oldest' do
+    socket = slow_client(:drop_oldest)
+    received = numbers(read_frames(socket))
+
+    expect(received.size).to be < 1000
+    expect(received.last).to eql(999)
+    expect(counter('drop_oldest')).to be > 0
+  ensure
+    socket&.close
+  end
+
+  it 'sends only the latest message with :conflate' do
+    socket = slow_client(:conflate)
+    received = numbers(read_frames(socket))
+
+    expect(received.last).to eql(999)
+    expect(counter('conflate')).to be > 0
+  ensure
+    socket&.close
+  end
+
+  it 'closes the connection with :close' do
+    socket = slow_client(:close)
+    frames = read_frames(socket)
+
+    expect(frames.last).to eql([0x88, [1008].pack('n')])
+    expect(counter('close')).to eql(1)
+  ensure
+    socket&.close
+  end
+end
@@ -0,0 +1,49 @@
+require 'http'
+require 'socket'
+require 'securerandom'
+
+RSpec.describe 'Per-client limits', with_app: :rate_limit do
+  let(:client) { SecureRandom.hex(8) }
+
+  def get_as(client)
+    http_client.headers('X-Client' => client).get("http://localhost:#{server_port}/")
+  end
+
+  it 'allows bursts up to the limit' do
+    codes = 5.times.map { get_as(client).code }
+
+    expect(codes).to all(eql(200))
+  end
+
+  it 'responds with 429 once the bucket is empty' do
+    5.times { get_as(client) }
+    response = get_as(client)
+
+    expect(response.code).to eql(429)
+    expect(response.headers['Retry-After']).to eql('1')
+  end
+
+  it 'refills the bucket over time' do
+    6.times { get_as(client) }
+    sleep 1.1
+
+    expect(get_as(client).code).to eql(200)
+  end
+
+  it 'keeps a bucket per client' do
+    6.times { get_as(client) }
+
+    expect(get_as("#{client}-other").code).to eql(200)
+  end
+
+  it 'caps concurrent connections per IP' do
+    sockets = 2.times.map { TCPSocket.new('localhost', server_port) }
+    sleep 0.2
+    extra = TCPSocket.new('localhost', server_port)
+
+    expect(extra.read).to start_with('HTTP/1.1 429')
+  ensure
+    extra&.close
+    sockets&.each(&:close)
+  end
+end
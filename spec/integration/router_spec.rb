@@ -0,0 +1,61 @@
+require 'http'
+
+RSpec.describe 'Iodine::Router', with_app: :router do
+  it 'responds with fixed responses' do
+    response = http_get("/health")
+
+    expect(response.code).to eql(200)
+    expect(response.headers['Content-Type']).to eql('text/plain')
+    expect(response.headers['X-Health']).to eql('ok')
+    expect(response.body.to_s).to eql('OK')
+  end
+
+  it 'answers HEAD requests without a body' do
+    response = http_client.head("http://localhost:#{server_port}/health")
+
+    expect(response.code).to eql(200)
+    expect(response.headers['Content-Length']).to eql('2')
+    expect(response.body.to_s).to be_empty
+  end
+
+  it 'redirects' do
+    response = http_get("/home")
+
+    expect(response.code).to eql(301)
+    expect(response.headers['Location']).to eql('/')
+  end
+
+  it 'responds with 404 errors' do
+    expect(http_get("/blocked").code).to eql(404)
+  end
+
+  it 'serves static files' do
+    response = http_get("/assets/style.css")
+
+    expect(response.code).to eql(200)
+    expect(response.headers['Content-Type']).to eql('text/css')
+    expect(response.body.to_s).to eql("body { color: red; }\n")
+  end
+
+  it "doesn't fall back for missing static files" do
+    expect(http_get("/assets/missing.css").code).to eql(404)
+  end
+
+  it 'routes to applications' do
+    expect(http_get("/users/42").body.to_s).to eql('user /users/42')
+  end
+
+  it 'prefers static segments over params' do
+    expect(http_get("/users/new").body.to_s).to eql('new user')
+  end
+
+  it 'matches wildcards and methods' do
+    expect(http_post("/api/v1/items").body.to_s).to eql('api POST /api/v1/items')
+    expect(http_get("/api/v1/items").body.to_s).to eql('fallback /api/v1/items')
+  end
+
+  it 'falls back to the application' do
+    expect(http_get("/users/42/posts").body.to_s).to eql('fallback /users/42/posts')
+    expect(http_get("/other").body.to_s).to eql('fallback /other')
+  end
+end
@@ -0,0 +1,45 @@
+require 'http'
+
+RSpec.describe 'Pre-compressed static file variants', with_app: :static do
+  def get_with_encoding(accept_encoding)
+    http_client.headers('Accept-Encoding' => accept_encoding).get("http://localhost:#{server_port}/style.css")
+  end
+
+  it 'prefers brotli when the client accepts it' do
+    response = get_with_encoding('gzip, deflate, br')
+
+    expect(response.headers['Content-Encoding']).to eql('br')
+    expect(response.headers['Content-Type']).to eql('text/css')
+    expect(response.headers['Vary']).to eql('accept-encoding')
+    expect(response.body.to_s).to eql('br-variant')
+  end
+
+  it 'honors q-values' do
+    response = get_with_encoding('br;q=0.5, gzip')
+
+    expect(response.headers['Content-Encoding']).to eql('gzip')
+    expect(response.body.to_s).to eql('gz-variant')
+  end
+
+  it 'sends the identity when variants are refused' do
+    response = get_with_encoding('br;q=0, gzip;q=0')
+
+    expect(response.headers['Content-Encoding']).to be_nil
+    expect(response.body.to_s).to eql("body { color: red; }\n")
+  end
+
+  it 'sends Vary when the request has no Accept-Encoding' do
+    response = http_get('/style.css')
+
+    expect(response.headers['Content-Encoding']).to be_nil
+    expect(response.headers['Vary']).to eql('accept-encoding')
+  end
+
+  it 'folds the variant into the ETag' do
+    identity = get_with_encoding('identity')
+    brotli = get_with_encoding('br')
+
+    expect(brotli.headers['ETag']).to end_with('-br')
+    expect(brotli.headers['ETag']).not_to eql(identity.headers['ETag'])
+  end
+end
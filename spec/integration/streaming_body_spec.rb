@@ -0,0 +1,40 @@
+require 'http'
+require 'socket'
+
+RSpec.describe 'Streaming response bodies', with_app: :streaming do
+  it 'streams large bodies using the chunked transfer encoding' do
+    response = http_get("/each")
+
+    expect(response.headers['Transfer-Encoding']).to eql("chunked")
+    expect(response.headers['Content-Length']).to be_nil
+    expect(response.body.to_s.bytesize).to eql(64 * 1024)
+    expect(response.body.to_s).to start_with("0000x")
+  end
+
+  it 'sends small bodies with a Content-Length' do
+    response = http_get("/small")
+
+    expect(response.headers['Content-Length']).to eql("3")
+    expect(response.body.to_s).to eql("abc")
+  end
+
+  it 'supports Rack 3 streaming bodies' do
+    response = http_get("/call")
+
+    expect(response.headers['Transfer-Encoding']).to eql("chunked")
+    expect(response.body.to_s).to eql("hello world")
+  end
+
+  it 'closes the connection without completing the body if it raises midway' do
+    socket = TCPSocket.new('localhost', server_port)
+    socket.write("GET /raise HTTP/1.1\r\nHost: localhost\r\n\r\n")
+
+    response = socket.read.b # keep-alive connections aren't closed
+
+    expect(response).to start_with("HTTP/1.1 200")
+    expect(response).to include("0000x")
+    expect(response).not_to end_with("0\r\n\r\n")
+  ensure
+    socket&.close
+  end
+end
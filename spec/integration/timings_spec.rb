@@ -0,0 +1,15 @@
+require 'http'
+
+RSpec.describe 'Request timings', with_app: :timings do
+  it 'reports the request phases in env' do
+    response = http_get("/")
+
+    expect(response.body.to_s).to eql('body,gvl,headers:Float')
+  end
+
+  it 'adds a Server-Timing header' do
+    response = http_post("/", body: "hello")
+
+    expect(response.headers['Server-Timing']).to match(/\Anetwork;dur=[\d.]+, queue;dur=[\d.]+, app;dur=[\d.]+\z/)
+  end
+end
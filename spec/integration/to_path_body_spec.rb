@@ -0,0 +1,28 @@
+require 'http'
+
+RSpec.describe 'Bodies that respond to to_path', with_app: :to_path do
+  let(:source) { File.binread('spec/support/apps/to_path.ru') }
+
+  it 'sends the whole file' do
+    response = http_get("/file")
+
+    expect(response.headers['Content-Length']).to eql(source.bytesize.to_s)
+    expect(response.body.to_s).to eql(source)
+  end
+
+  it 'sends a single byte range' do
+    response = http_get("/range")
+
+    expect(response.code).to eql(206)
+    expect(response.headers['Content-Length']).to eql("8")
+    expect(response.body.to_s).to eql(source[2..9])
+  end
+
+  it 'drops a chunked transfer-encoding header' do
+    response = http_get("/chunked")
+
+    expect(response.headers['Transfer-Encoding']).to be_nil
+    expect(response.headers['Content-Length']).to eql(source.bytesize.to_s)
+    expect(response.body.to_s).to eql(source)
+  end
+end
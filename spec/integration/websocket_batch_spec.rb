@@ -0,0 +1,23 @@
+RSpec.describe 'Batched WebSocket writes', with_app: :ws_batch do
+  it 'writes each String in the Array as a message' do
+    socket, = ws_connect
+    ws_send(socket, 'many:50')
+
+    frames = Array.new(50) { ws_read(socket) }
+
+    expect(frames).to eql(Array.new(50) { |i| [0x81, "many#{i}"] })
+  ensure
+    socket&.close
+  end
+
+  it 'writes the messages collected by (nested) cork blocks' do
+    socket, = ws_connect
+    ws_send(socket, 'cork:20')
+
+    frames = Array.new(20) { ws_read(socket) }
+
+    expect(frames).to eql(Array.new(20) { |i| [0x81, "cork#{i}"] })
+  ensure
+    socket&.close
+  end
+end
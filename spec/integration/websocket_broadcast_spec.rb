@@ -0,0 +1,38 @@
+RSpec.describe 'WebSocket broadcasts', with_app: :ws_broadcast do
+  it 'sends large UTF-8 messages as text frames' do
+    message = "été € " * 20_000
+    socket, = ws_connect
+    ws_send(socket, message)
+
+    frame = ws_read(socket)
+
+    expect(frame[0]).to eql(0x81)
+    expect(frame[1].force_encoding(Encoding::UTF_8)).to eql(message)
+  ensure
+    socket&.close
+  end
+
+  it 'sends binary messages as binary frames' do
+    message = ("\xff\xfe\x00\x01".b * 20_000)
+    socket, = ws_connect
+    ws_send(socket, message, opcode: 2)
+
+    frame = ws_read(socket)
+
+    expect(frame).to eql([0x82, message])
+  ensure
+    socket&.close
+  end
+
+  it 'delivers every message, in order, to many subscribers' do
+    sockets = Array.new(150) { ws_connect.first }
+    sleep(0.5) # all the clients subscribed
+    10.times { |i| ws_send(sockets.first, "message #{i}") }
+
+    received = sockets.map { |socket| Array.new(10) { ws_read(socket)[1] } }
+
+    expect(received.uniq).to eql([Array.new(10) { |i| "message #{i}" }])
+  ensure
+    sockets&.each(&:close)
+  end
+end
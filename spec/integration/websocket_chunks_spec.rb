@@ -0,0 +1,37 @@
+require 'digest/md5'
+
+RSpec.describe 'WebSocket on_message_chunk', with_app: :ws_chunks do
+  it 'passes small messages in a single piece' do
+    socket, = ws_connect
+    ws_send(socket, 'hello')
+
+    expect(ws_read(socket)).to eql([0x81, "1:5:#{Digest::MD5.hexdigest('hello')}"])
+  ensure
+    socket&.close
+  end
+
+  it 'streams large messages in pieces, ignoring the message size limit' do
+    message = Random.new(1).bytes(1_000_000)
+    socket, = ws_connect
+    ws_send(socket, message, opcode: 2)
+
+    pieces, bytes, digest = ws_read(socket)[1].split(':')
+
+    expect(pieces.to_i).to be > 1
+    expect(bytes.to_i).to eql(message.bytesize)
+    expect(digest).to eql(Digest::MD5.hexdigest(message))
+  ensure
+    socket&.close
+  end
+
+  it 'passes fragmented messages with their boundaries' do
+    socket, = ws_connect
+    mask = "\x00\x00\x00\x00".b
+    socket.write([0x01, 0x80 | 3].pack('CC') + mask + 'abc')
+    socket.write([0x80, 0x80 | 3].pack('CC') + mask + 'def')
+
+    expect(ws_read(socket)).to eql([0x81, "2:6:#{Digest::MD5.hexdigest('abcdef')}"])
+  ensure
+    socket&.close
+  end
+end
@@ -0,0 +1,59 @@
+require 'zlib'
+
+RSpec.describe 'WebSocket permessage-deflate', with_app: :ws_deflate do
+  let(:message) { ('compress me please, ' * 20).freeze }
+
+  def inflate(data)
+    Zlib::Inflate.new(-Zlib::MAX_WBITS).inflate(data + "\x00\x00\xff\xff".b)
+  end
+
+  def deflate(data)
+    z = Zlib::Deflate.new(Zlib::DEFAULT_COMPRESSION, -Zlib::MAX_WBITS)
+    z.deflate(data, Zlib::SYNC_FLUSH)[0...-4]
+  end
+
+  it 'negotiates the extension' do
+    socket, headers = ws_connect('permessage-deflate; client_max_window_bits')
+    expect(headers).to match(/^sec-websocket-extensions: permessage-deflate; server_no_context_takeover/i)
+  ensure
+    socket&.close
+  end
+
+  it 'compresses outgoing messages and broadcasts' do
+    socket, = ws_connect('permessage-deflate')
+    ws_send(socket, message)
+
+    echo = ws_read(socket)
+    broadcast = ws_read(socket)
+
+    expect(echo[0]).to eql(0xC1)
+    expect(inflate(echo[1])).to eql(message)
+    expect(broadcast[0]).to eql(0xC1)
+    expect(inflate(broadcast[1])).to eql("broadcast: #{message}")
+  ensure
+    socket&.close
+  end
+
+  it 'inflates incoming messages' do
+    socket, = ws_connect('permessage-deflate')
+    ws_send(socket, deflate(message), rsv1: true)
+
+    echo = ws_read(socket)
+
+    expect(inflate(echo[1])).to eql(message)
+  ensure
+    socket&.close
+  end
+
+  it 'sends uncompressed frames when the extension is not requested' do
+    socket, headers = ws_connect
+    ws_send(socket, message)
+
+    echo = ws_read(socket)
+
+    expect(headers).not_to match(/sec-websocket-extensions/i)
+    expect(echo).to eql([0x81, message])
+  ensure
+    socket&.close
+  end
+end
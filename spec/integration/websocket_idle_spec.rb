@@ -0,0 +1,27 @@
+RSpec.describe 'Idle WebSocket connections', with_app: :ws_broadcast do
+  it 'reads messages once the connection was idle' do
+    socket, = ws_connect
+    ws_send(socket, 'x' * 100_000, opcode: 2)
+    expect(ws_read(socket)).to eql([0x81, 'x' * 100_000])
+
+    sleep(0.5) # the connection's buffer is released
+
+    ws_send(socket, 'after')
+    expect(ws_read(socket)).to eql([0x81, 'after'])
+  ensure
+    socket&.close
+  end
+
+  it 'keeps fragmented messages across idle periods' do
+    socket, = ws_connect
+    mask = "\x00\x00\x00\x00".b
+    socket.write([0x01, 0x85].pack('CC') + mask + 'part1')
+
+    sleep(0.5)
+
+    socket.write([0x80, 0x85].pack('CC') + mask + 'part2')
+    expect(ws_read(socket)).to eql([0x81, 'part1part2'])
+  ensure
+    socket&.close
+  end
+end
@@ -0,0 +1,47 @@
+require 'socket'
+
+module Spec
+  module Support
+    # A minimal WebSocket client, for inspecting the frames the server sends.
+    module WebSocketClient
+      def ws_connect(extensions = nil, path: '/')
+        socket = TCPSocket.new('localhost', server_port)
+        request = "GET #{path} HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\n" \
+                  "Connection: Upgrade\r\nSec-WebSocket-Version: 13\r\n" \
+                  "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+        request << "Sec-WebSocket-Extensions: #{extensions}\r\n" if extensions
+        socket.write(request << "\r\n")
+        headers = ''
+        headers << socket.readpartial(1) until headers.end_with?("\r\n\r\n")
+        [socket, headers]
+      end
+
+      def ws_send(socket, data, opcode: 1, rsv1: false)
+        data = data.b
+        mask = "\x01\x02\x03\x04".b
+        frame = [0x80 | (rsv1 ? 0x40 : 0) | opcode].pack('C')
+        frame << if data.bytesize < 126
+                   [0x80 | data.bytesize].pack('C')
+                 elsif data.bytesize < 65_536
+                   [0xFE, data.bytesize].pack('Cn')
+                 else
+                   [0xFF, data.bytesize].pack('CQ>')
+                 end
+        frame << mask << data.bytes.each_with_index.map { |b, i| b ^ mask.getbyte(i & 3) }.pack('C*')
+        socket.write(frame)
+      end
+
+      # Returns the frame's first byte (FIN, RSV and opcode) and its payload.
+      def ws_read(socket)
+        first, len = socket.read(2).unpack('CC')
+        len = socket.read(2).unpack1('n') if len == 126
+        len = socket.read(8).unpack1('Q>') if len == 127
+        [first, socket.read(len)]
+      end
+    end
+  end
+end
+
+RSpec.configure do |config|
+  config.include(Spec::Support::WebSocketClient, type: :integration)
+end